@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 // TODO: this should be a proper struct w/o heap allocation!
@@ -165,6 +166,32 @@ struct message_t {
           nonce(nonce) {}
 };
 
+/// message as received from a peer, referring to the serialized batch
+/// (which must outlive it)
+struct message_view_t {
+    std::string_view pub_key;
+    std::string_view data;
+    std::string_view hash;
+    uint64_t ttl;
+    uint64_t timestamp;
+    std::string_view nonce;
+};
+
+/// Deletion requested by a client, replicated to the rest of the swarm
+struct tombstone_t {
+    std::string pub_key;
+    /// If true, all messages stored up to `timestamp` are deleted, otherwise
+    /// only those listed in `hashes`
+    bool all;
+    /// When the owner made the request
+    uint64_t timestamp;
+    std::vector<std::string> hashes;
+    /// The owner's ed25519 key (hex) and signature (base64) of the request,
+    /// which every node that applies the deletion checks
+    std::string pubkey_ed25519;
+    std::string signature;
+};
+
 } // namespace oxen
 
 namespace std {
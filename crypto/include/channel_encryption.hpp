@@ -1,15 +1,43 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <list>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+/// An x25519 key (public or private)
+using x25519_key_t = std::array<uint8_t, 32>;
+
+/// Decode a hex-encoded x25519 key; throws if `hex` isn't one
+x25519_key_t x25519_key_from_hex(std::string_view hex);
+
+/// State of the derived key cache of a ChannelEncryption
+struct channel_key_cache_stats_t {
+    size_t size = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+/// Keys derived from our private key and a peer's public key
+struct channel_keys_t {
+    /// X25519 shared secret, used as the key for AES-CBC
+    std::array<uint8_t, 32> shared_secret;
+    /// HMAC of the shared secret, used as the key for AES-GCM
+    std::array<uint8_t, 32> symmetric_key;
+};
+
 // Why is this even a template??
 template <typename T>
 class ChannelEncryption {
   public:
     ChannelEncryption(const std::vector<uint8_t>& private_key);
-    ~ChannelEncryption() = default;
+    ChannelEncryption(const x25519_key_t& private_key);
+    /// Wipes the cached keys
+    ~ChannelEncryption();
 
     T encrypt_cbc(const T& plainText, const std::string& pubKey) const;
 
@@ -19,6 +47,95 @@ class ChannelEncryption {
 
     T decrypt_gcm(const T& cipherText, const std::string& pubKey) const;
 
+    /// The functions below work on buffers owned by the caller, so that
+    /// onion requests and proxy replies don't need a copy of the data for
+    /// every step. Encrypted data is laid out as:
+    ///   GCM: nonce (12 bytes) || ciphertext || tag (16 bytes)
+    ///   CBC: iv (16 bytes) || ciphertext (padded to 16 bytes)
+    /// All of them throw on failure, after which the contents of the output
+    /// are unspecified.
+
+    static constexpr size_t GCM_NONCE_SIZE = 12;
+    static constexpr size_t GCM_TAG_SIZE = 16;
+    static constexpr size_t CBC_IV_SIZE = 16;
+    static constexpr size_t CBC_BLOCK_SIZE = 16;
+
+    static constexpr size_t gcm_encrypted_size(size_t plaintext_size) {
+        return GCM_NONCE_SIZE + plaintext_size + GCM_TAG_SIZE;
+    }
+
+    static constexpr size_t cbc_encrypted_size(size_t plaintext_size) {
+        return CBC_IV_SIZE +
+               (plaintext_size / CBC_BLOCK_SIZE + 1) * CBC_BLOCK_SIZE;
+    }
+
+    /// The plaintext is exactly this size (or decryption fails)
+    static constexpr size_t gcm_decrypted_size(size_t encrypted_size) {
+        return encrypted_size < GCM_NONCE_SIZE + GCM_TAG_SIZE
+                   ? 0
+                   : encrypted_size - GCM_NONCE_SIZE - GCM_TAG_SIZE;
+    }
+
+    /// The plaintext is at most this size (padding is only known after
+    /// decryption)
+    static constexpr size_t cbc_decrypted_max_size(size_t encrypted_size) {
+        return encrypted_size < CBC_IV_SIZE ? 0 : encrypted_size - CBC_IV_SIZE;
+    }
+
+    /// Encrypt `plaintext` for the owner of `pubkey` into `out`, which must
+    /// have room for `gcm_encrypted_size(plaintext.size())` bytes
+    void encrypt_gcm(std::string_view plaintext, const x25519_key_t& pubkey,
+                     char* out) const;
+
+    /// Same with AES-CBC, into `cbc_encrypted_size(plaintext.size())` bytes
+    void encrypt_cbc(std::string_view plaintext, const x25519_key_t& pubkey,
+                     char* out) const;
+
+    /// Decrypt `ciphertext` from the owner of `pubkey` into `out`, which
+    /// must have room for `gcm_decrypted_size(ciphertext.size())` bytes;
+    /// returns the size of the plaintext
+    size_t decrypt_gcm(std::string_view ciphertext, const x25519_key_t& pubkey,
+                       char* out) const;
+
+    /// Same with AES-CBC, into `cbc_decrypted_max_size(ciphertext.size())`
+    /// bytes
+    size_t decrypt_cbc(std::string_view ciphertext, const x25519_key_t& pubkey,
+                       char* out) const;
+
+    /// Decrypt the `size` bytes at `data` in place; returns the plaintext,
+    /// which is somewhere within `data`
+    std::string_view decrypt_gcm_in_place(char* data, size_t size,
+                                          const x25519_key_t& pubkey) const;
+
+    std::string_view decrypt_cbc_in_place(char* data, size_t size,
+                                          const x25519_key_t& pubkey) const;
+
+    /// Number of peers whose keys are kept around. Clients (and the hops of
+    /// onion requests) use the same key for a request and its response, so
+    /// even a small cache saves most of the key derivations.
+    static constexpr size_t KEY_CACHE_SIZE = 1024;
+
+    channel_key_cache_stats_t key_cache_stats() const;
+
   private:
-    const std::vector<uint8_t> private_key_;
+    /// Keys for `pubkey`, from the cache if we have used them recently;
+    /// throws if `pubkey` is not a valid key
+    channel_keys_t get_keys(const x25519_key_t& pubkey) const;
+
+    const x25519_key_t private_key_;
+
+    struct key_hash_t {
+        size_t operator()(const x25519_key_t& key) const;
+    };
+
+    using key_cache_t = std::list<std::pair<x25519_key_t, channel_keys_t>>;
+
+    /// Most recently used first
+    mutable key_cache_t key_cache_;
+    /// Entries of `key_cache_` by public key
+    mutable std::unordered_map<x25519_key_t, key_cache_t::iterator, key_hash_t>
+        key_cache_index_;
+    mutable uint64_t key_cache_hits_ = 0;
+    mutable uint64_t key_cache_misses_ = 0;
+    mutable std::mutex key_cache_mutex_;
 };
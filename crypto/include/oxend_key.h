@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cstdint>
+#include <optional>
 #include <string>
 
 namespace oxen {
@@ -29,4 +30,9 @@ public_key_t derive_pubkey_legacy(const private_key_t& private_key);
 public_key_t derive_pubkey_x25519(const private_key_t& private_key);
 public_key_t derive_pubkey_ed25519(const private_key_ed25519_t& private_key);
 
+// Convert an ed25519 public key to the corresponding x25519 one, returns
+// nullopt if `pubkey` is not a valid ed25519 key
+std::optional<public_key_t>
+pubkey_ed25519_to_x25519(const public_key_t& pubkey);
+
 } // namespace oxen
@@ -3,6 +3,8 @@
 #include "oxend_key.h"
 
 #include <array>
+#include <string>
+#include <string_view>
 
 namespace oxen {
 
@@ -26,4 +28,27 @@ bool check_signature(const std::string& signature, const hash& hash,
 bool check_signature(const signature& sig, const hash& prefix_hash,
                      const public_key_t& pub);
 
+// Check a (base64 encoded) detached ed25519 signature of `data`, as produced
+// by clients signing with their ed25519 key
+bool check_ed25519_signature(const std::string& signature_b64,
+                             const std::string& data,
+                             const public_key_t& pubkey_ed25519);
+
+enum class owner_signature_t {
+    OK,
+    // `pubkey_ed25519` is not a hex encoded ed25519 key
+    INVALID_KEY,
+    // The key is valid, but not the counterpart of the owner's key
+    NOT_OWNER,
+    INVALID_SIGNATURE,
+};
+
+// Check that `data` was signed by the owner of the messages stored under
+// `owner` (a hex encoded x25519 key, possibly with a network prefix), using
+// the ed25519 counterpart of that key (also hex encoded)
+owner_signature_t check_owner_signature(std::string_view owner,
+                                        std::string_view pubkey_ed25519,
+                                        const std::string& signature_b64,
+                                        const std::string& data);
+
 } // namespace oxen
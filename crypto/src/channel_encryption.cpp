@@ -7,49 +7,65 @@
 
 #include "utils.hpp"
 
+#include <cstring>
 #include <exception>
+#include <functional>
+#include <memory>
 #include <string>
 
 #include <iostream>
 
-std::vector<uint8_t> hexToBytes(const std::string& hex) {
-    std::vector<uint8_t> temp;
+x25519_key_t x25519_key_from_hex(std::string_view hex) {
+    x25519_key_t key;
     if (!sispopmq::is_hex(hex)) throw std::runtime_error{"input is not hex"};
-    temp.reserve(hex.size() / 2);
-    sispopmq::from_hex(hex.begin(), hex.end(), std::back_inserter(temp));
-    return temp;
+    if (hex.size() != 2 * key.size()) {
+        throw std::runtime_error("Bad pubKey size");
+    }
+    sispopmq::from_hex(hex.begin(), hex.end(), key.begin());
+    return key;
+}
+
+static x25519_key_t to_x25519_key(const std::vector<uint8_t>& bytes) {
+    x25519_key_t key;
+    if (bytes.size() != key.size()) {
+        throw std::runtime_error("Bad private key size");
+    }
+    std::copy(bytes.begin(), bytes.end(), key.begin());
+    return key;
 }
 
 template <typename T>
 ChannelEncryption<T>::ChannelEncryption(const std::vector<uint8_t>& private_key)
+    : private_key_(to_x25519_key(private_key)) {}
+
+template <typename T>
+ChannelEncryption<T>::ChannelEncryption(const x25519_key_t& private_key)
     : private_key_(private_key) {}
 
+template <typename T>
+ChannelEncryption<T>::~ChannelEncryption() {
+    for (auto& entry : key_cache_) {
+        sodium_memzero(&entry.second, sizeof(entry.second));
+    }
+}
+
 // Derive shared secret from our (ephemeral) `seckey` and the other party's
 // `pubkey`
-static std::vector<uint8_t>
-calculate_shared_secret(const std::vector<uint8_t>& seckey,
-                        const std::vector<uint8_t>& pubkey) {
+static void calculate_shared_secret(const x25519_key_t& seckey,
+                                    const x25519_key_t& pubkey,
+                                    std::array<uint8_t, 32>& secret) {
 
-    std::vector<uint8_t> secret(crypto_scalarmult_BYTES);
-    if (pubkey.size() != crypto_scalarmult_curve25519_BYTES) {
-        throw std::runtime_error("Bad pubKey size");
-    }
+    static_assert(sizeof(secret) == crypto_scalarmult_BYTES);
+    static_assert(sizeof(pubkey) == crypto_scalarmult_curve25519_BYTES);
 
     if (crypto_scalarmult(secret.data(), seckey.data(), pubkey.data()) != 0) {
         throw std::runtime_error(
             "Shared key derivation failed (crypto_scalarmult)");
     }
-    return secret;
 }
 
-static std::vector<uint8_t>
-derive_symmetric_key(const std::vector<uint8_t>& seckey,
-                     const std::vector<uint8_t>& pubkey) {
-
-    const std::vector<uint8_t> sharedKey =
-        calculate_shared_secret(seckey, pubkey);
-
-    std::vector<uint8_t> derived_key(32);
+static void derive_symmetric_key(const std::array<uint8_t, 32>& sharedKey,
+                                 std::array<uint8_t, 32>& derived_key) {
 
     const std::string salt_str = "SISPOP";
     const auto salt = reinterpret_cast<const unsigned char*>(salt_str.data());
@@ -59,184 +75,316 @@ derive_symmetric_key(const std::vector<uint8_t>& seckey,
     crypto_auth_hmacsha256_init(&state, salt, salt_str.size());
     crypto_auth_hmacsha256_update(&state, sharedKey.data(), sharedKey.size());
     crypto_auth_hmacsha256_final(&state, derived_key.data());
+}
 
-    return derived_key;
+template <typename T>
+size_t ChannelEncryption<T>::key_hash_t::
+operator()(const x25519_key_t& key) const {
+    return std::hash<std::string_view>{}(
+        {reinterpret_cast<const char*>(key.data()), key.size()});
 }
 
 template <typename T>
-T ChannelEncryption<T>::encrypt_cbc(const T& plaintext,
-                                    const std::string& pubKey) const {
-    const std::vector<uint8_t> pubKeyBytes = hexToBytes(pubKey);
-    const std::vector<uint8_t> sharedKey =
-        calculate_shared_secret(this->private_key_, pubKeyBytes);
+channel_keys_t
+ChannelEncryption<T>::get_keys(const x25519_key_t& pubkey) const {
+
+    {
+        std::lock_guard guard(key_cache_mutex_);
+        const auto it = key_cache_index_.find(pubkey);
+        if (it != key_cache_index_.end()) {
+            key_cache_hits_++;
+            key_cache_.splice(key_cache_.begin(), key_cache_, it->second);
+            return it->second->second;
+        }
+        key_cache_misses_++;
+    }
 
-    // Initialise cipher
-    const EVP_CIPHER* cipher = EVP_aes_256_cbc();
-    const int ivLength = EVP_CIPHER_iv_length(cipher);
+    // Derived without holding the lock, as this is the expensive part
+    channel_keys_t keys;
+    calculate_shared_secret(this->private_key_, pubkey, keys.shared_secret);
+    derive_symmetric_key(keys.shared_secret, keys.symmetric_key);
+
+    std::lock_guard guard(key_cache_mutex_);
+    if (key_cache_index_.count(pubkey) == 0) {
+        key_cache_.emplace_front(pubkey, keys);
+        key_cache_index_.emplace(pubkey, key_cache_.begin());
+        if (key_cache_.size() > KEY_CACHE_SIZE) {
+            auto& evicted = key_cache_.back();
+            key_cache_index_.erase(evicted.first);
+            // Don't leave the secrets behind in freed memory
+            sodium_memzero(&evicted.second, sizeof(evicted.second));
+            key_cache_.pop_back();
+        }
+    }
+    return keys;
+}
 
-    // Generate IV
-    unsigned char iv[ivLength];
-    if (RAND_bytes(iv, ivLength) != 1) {
-        throw std::runtime_error("Could not generate IV");
+template <typename T>
+channel_key_cache_stats_t ChannelEncryption<T>::key_cache_stats() const {
+    std::lock_guard guard(key_cache_mutex_);
+    channel_key_cache_stats_t stats;
+    stats.size = key_cache_.size();
+    stats.hits = key_cache_hits_;
+    stats.misses = key_cache_misses_;
+    return stats;
+}
+
+namespace {
+
+struct cipher_ctx_deleter_t {
+    void operator()(EVP_CIPHER_CTX* ctx) const { EVP_CIPHER_CTX_free(ctx); }
+};
+
+using cipher_ctx_ptr_t = std::unique_ptr<EVP_CIPHER_CTX, cipher_ctx_deleter_t>;
+
+} // namespace
+
+// Set up `ctx` (created on first use) for `cipher` with a new key and iv.
+// Contexts are kept per thread and reused: once a context has its cipher,
+// changing the key and iv doesn't allocate.
+static EVP_CIPHER_CTX* init_ctx(cipher_ctx_ptr_t& ctx, const EVP_CIPHER* cipher,
+                                const uint8_t* key, const uint8_t* iv,
+                                bool encrypt) {
+    if (!ctx) {
+        ctx.reset(EVP_CIPHER_CTX_new());
+        if (!ctx || EVP_CipherInit_ex(ctx.get(), cipher, NULL, NULL, NULL,
+                                      encrypt) <= 0) {
+            ctx.reset();
+            throw std::runtime_error("Could not create cipher context");
+        }
     }
 
-    // Initialise cipher context
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (EVP_EncryptInit_ex(ctx, cipher, NULL, sharedKey.data(), iv) <= 0) {
-        throw std::runtime_error("Could not initialise encryption context");
+    if (EVP_CipherInit_ex(ctx.get(), NULL, NULL, key, iv, encrypt) <= 0) {
+        throw std::runtime_error(
+            encrypt ? "Could not initialise encryption context"
+                    : "Could not initialise decryption context");
     }
+    return ctx.get();
+}
 
-    int len;
-    size_t ciphertext_len = 0;
-    auto p = reinterpret_cast<const unsigned char*>(plaintext.data());
-    const size_t plaintext_len = plaintext.size();
+static const unsigned char* as_bytes(const char* data) {
+    return reinterpret_cast<const unsigned char*>(data);
+}
 
-    // Add some padding of 'blockSize' as upper limit
-    const int blockSize = EVP_CIPHER_CTX_block_size(ctx);
-    T output;
-    output.resize(plaintext_len + blockSize);
-    auto o = reinterpret_cast<unsigned char*>(&output[0]);
+static unsigned char* as_bytes(char* data) {
+    return reinterpret_cast<unsigned char*>(data);
+}
 
-    // Encrypt every full blocks
-    if (EVP_EncryptUpdate(ctx, o, &len, p, plaintext_len) <= 0) {
-        throw std::runtime_error("Could not encrypt plaintext");
-    }
-    ciphertext_len += len;
+// Decrypt `size` bytes at `data` into `out`, which is either separate or the
+// encrypted part of `data` (right after the iv)
+static size_t cbc_decrypt(const std::array<uint8_t, 32>& key, const char* data,
+                          size_t size, char* out) {
 
-    // Encrypt any remaining partial blocks
-    if (EVP_EncryptFinal_ex(ctx, o + len, &len) <= 0) {
-        throw std::runtime_error("Could not finalise encryption");
-    }
-    ciphertext_len += len;
+    static thread_local cipher_ctx_ptr_t thread_ctx;
 
-    // Remove excess padding
-    output.resize(ciphertext_len);
+    constexpr size_t iv_size = ChannelEncryption<std::string>::CBC_IV_SIZE;
+    if (size < iv_size) {
+        throw std::runtime_error("Ciphertext is too short");
+    }
 
-    // Insert iv at the start
-    output.insert(output.begin(), iv, iv + ivLength);
+    EVP_CIPHER_CTX* ctx = init_ctx(thread_ctx, EVP_aes_256_cbc(), key.data(),
+                                   as_bytes(data), false);
 
-    EVP_CIPHER_CTX_free(ctx);
+    int len;
+    size_t plaintextLength = 0;
 
-    return output;
-}
+    // Decrypt every full blocks
+    if (EVP_DecryptUpdate(ctx, as_bytes(out), &len, as_bytes(data + iv_size),
+                          size - iv_size) <= 0) {
+        throw std::runtime_error("Could not decrypt block");
+    }
+    plaintextLength += len;
 
-template <typename T>
-T ChannelEncryption<T>::encrypt_gcm(const T& plaintext,
-                                    const std::string& pubKey) const {
-    const std::vector<uint8_t> pubKeyBytes = hexToBytes(pubKey);
-    const std::vector<uint8_t> derived_key =
-        derive_symmetric_key(this->private_key_, pubKeyBytes);
+    // Decrypt any remaining partial blocks
+    if (EVP_DecryptFinal_ex(ctx, as_bytes(out) + len, &len) <= 0) {
+        throw std::runtime_error("Could not finalise decryption");
+    }
+    plaintextLength += len;
 
-    T ciphertext;
-    // Ciphertext should always be the length of plaintext plus tag
-    ciphertext.resize(plaintext.size() + 16);
+    return plaintextLength;
+}
 
-    auto ciphertext_ptr = reinterpret_cast<unsigned char*>(&ciphertext[0]);
+// Same for AES-GCM, where `out` is either separate or the encrypted part of
+// `data` (right after the nonce)
+static size_t gcm_decrypt(const std::array<uint8_t, 32>& key, const char* data,
+                          size_t size, char* out) {
 
-    unsigned long long ciphertext_len;
+    static thread_local cipher_ctx_ptr_t thread_ctx;
 
-    const auto plaintext_ptr =
-        reinterpret_cast<const unsigned char*>(&plaintext[0]);
+    using channel_t = ChannelEncryption<std::string>;
+    constexpr size_t nonce_size = channel_t::GCM_NONCE_SIZE;
+    constexpr size_t tag_size = channel_t::GCM_TAG_SIZE;
+    if (size < nonce_size + tag_size) {
+        throw std::runtime_error("Ciphertext is too short");
+    }
 
-    unsigned char nonce[crypto_aead_aes256gcm_NPUBBYTES];
-    randombytes_buf(nonce, sizeof(nonce));
+    const size_t ciphertext_len = size - nonce_size - tag_size;
 
-    crypto_aead_aes256gcm_encrypt(ciphertext_ptr, &ciphertext_len,
-                                  plaintext_ptr, plaintext.size(), NULL, 0,
-                                  NULL, nonce, derived_key.data());
+    // Copied, as the ctrl interface doesn't take a const tag
+    unsigned char tag[tag_size];
+    std::memcpy(tag, data + nonce_size + ciphertext_len, tag_size);
 
-    ciphertext.resize(ciphertext_len);
+    EVP_CIPHER_CTX* ctx = init_ctx(thread_ctx, EVP_aes_256_gcm(), key.data(),
+                                   as_bytes(data), false);
 
-    ciphertext.insert(ciphertext.begin(), std::begin(nonce), std::end(nonce));
+    int len;
+    if (EVP_DecryptUpdate(ctx, as_bytes(out), &len,
+                          as_bytes(data + nonce_size), ciphertext_len) <= 0 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag_size, tag) <= 0 ||
+        EVP_DecryptFinal_ex(ctx, as_bytes(out) + len, &len) <= 0) {
+        throw std::runtime_error("Could not decrypt (AES-GCM)");
+    }
 
-    // nonce (12 bytes) || ciphertext || tag (16 bytes)
-    return ciphertext;
+    return ciphertext_len;
 }
 
 template <typename T>
-T ChannelEncryption<T>::decrypt_gcm(const T& iv_ciphertext_tag,
-                                    const std::string& pubKey) const {
-    const std::vector<uint8_t> pubKeyBytes = hexToBytes(pubKey);
-    const std::vector<uint8_t> derived_key =
-        derive_symmetric_key(this->private_key_, pubKeyBytes);
-
-    T output;
-
-    // Plaintext should be (16 + 12) bytes shorter
-    output.resize(iv_ciphertext_tag.size() - 28);
+void ChannelEncryption<T>::encrypt_cbc(std::string_view plaintext,
+                                       const x25519_key_t& pubkey,
+                                       char* out) const {
 
-    auto outPtr = reinterpret_cast<unsigned char*>(&output[0]);
+    static thread_local cipher_ctx_ptr_t thread_ctx;
 
-    unsigned long long decrypted_len;
+    const auto sharedKey = this->get_keys(pubkey).shared_secret;
 
-    constexpr auto NONCE_SIZE = 12;
-    const auto ciphertext = reinterpret_cast<const unsigned char*>(
-        &iv_ciphertext_tag[0] + NONCE_SIZE);
+    // Generate IV, at the start of the output
+    if (RAND_bytes(as_bytes(out), CBC_IV_SIZE) != 1) {
+        throw std::runtime_error("Could not generate IV");
+    }
 
-    const auto nonce =
-        reinterpret_cast<const unsigned char*>(&iv_ciphertext_tag[0]);
+    EVP_CIPHER_CTX* ctx = init_ctx(thread_ctx, EVP_aes_256_cbc(),
+                                   sharedKey.data(), as_bytes(out), true);
 
-    unsigned long long clen = iv_ciphertext_tag.size() - NONCE_SIZE;
+    int len;
+    auto o = as_bytes(out + CBC_IV_SIZE);
 
-    if (crypto_aead_aes256gcm_decrypt(
-            outPtr, &decrypted_len, NULL /* must be null */, ciphertext, clen,
-            NULL, 0, nonce, derived_key.data()) != 0) {
-        throw std::runtime_error("Could not decrypt (AES-GCM)");
+    // Encrypt every full blocks
+    if (EVP_EncryptUpdate(ctx, o, &len, as_bytes(plaintext.data()),
+                          plaintext.size()) <= 0) {
+        throw std::runtime_error("Could not encrypt plaintext");
     }
 
-    assert(output.size() == decrypted_len);
-
-    return output;
+    // Encrypt any remaining partial blocks
+    if (EVP_EncryptFinal_ex(ctx, o + len, &len) <= 0) {
+        throw std::runtime_error("Could not finalise encryption");
+    }
 }
 
 template <typename T>
-T ChannelEncryption<T>::decrypt_cbc(const T& ciphertextAndIV,
-                                    const std::string& pubKey) const {
-    const std::vector<uint8_t> pubKeyBytes = hexToBytes(pubKey);
-    const std::vector<uint8_t> sharedKey =
-        calculate_shared_secret(this->private_key_, pubKeyBytes);
+void ChannelEncryption<T>::encrypt_gcm(std::string_view plaintext,
+                                       const x25519_key_t& pubkey,
+                                       char* out) const {
 
-    // Initialise cipher
-    const EVP_CIPHER* cipher = EVP_aes_256_cbc();
-    const int ivLength = EVP_CIPHER_iv_length(cipher);
+    static thread_local cipher_ctx_ptr_t thread_ctx;
 
-    auto inPtr = reinterpret_cast<const unsigned char*>(&ciphertextAndIV[0]);
+    const auto derived_key = this->get_keys(pubkey).symmetric_key;
 
-    // Initialise cipher context
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (EVP_DecryptInit_ex(ctx, cipher, NULL, sharedKey.data(), inPtr) <= 0) {
-        throw std::runtime_error("Could not initialise decryption context");
-    }
+    // nonce (12 bytes) || ciphertext || tag (16 bytes)
+    randombytes_buf(out, GCM_NONCE_SIZE);
+
+    EVP_CIPHER_CTX* ctx = init_ctx(thread_ctx, EVP_aes_256_gcm(),
+                                   derived_key.data(), as_bytes(out), true);
 
     int len;
-    size_t plaintextLength = 0;
-    const size_t ciphertextLength = ciphertextAndIV.size() - ivLength;
+    auto o = as_bytes(out + GCM_NONCE_SIZE);
+    if (EVP_EncryptUpdate(ctx, o, &len, as_bytes(plaintext.data()),
+                          plaintext.size()) <= 0 ||
+        EVP_EncryptFinal_ex(ctx, o + len, &len) <= 0 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_SIZE,
+                            o + plaintext.size()) <= 0) {
+        throw std::runtime_error("Could not encrypt (AES-GCM)");
+    }
+}
 
-    // Add some padding of 'blockSize' as upper limit
-    const int blockSize = EVP_CIPHER_CTX_block_size(ctx);
-    T output;
-    output.resize(ciphertextLength + blockSize);
+template <typename T>
+size_t ChannelEncryption<T>::decrypt_cbc(std::string_view ciphertext,
+                                         const x25519_key_t& pubkey,
+                                         char* out) const {
+    return cbc_decrypt(this->get_keys(pubkey).shared_secret, ciphertext.data(),
+                       ciphertext.size(), out);
+}
 
-    auto outPtr = reinterpret_cast<unsigned char*>(&output[0]);
+template <typename T>
+size_t ChannelEncryption<T>::decrypt_gcm(std::string_view ciphertext,
+                                         const x25519_key_t& pubkey,
+                                         char* out) const {
+    return gcm_decrypt(this->get_keys(pubkey).symmetric_key, ciphertext.data(),
+                       ciphertext.size(), out);
+}
 
-    // Decrypt every full blocks
-    if (EVP_DecryptUpdate(ctx, outPtr, &len, inPtr + ivLength,
-                          ciphertextLength) <= 0) {
-        throw std::runtime_error("Could not decrypt block");
+template <typename T>
+std::string_view
+ChannelEncryption<T>::decrypt_cbc_in_place(char* data, size_t size,
+                                           const x25519_key_t& pubkey) const {
+    if (size < CBC_IV_SIZE) {
+        throw std::runtime_error("Ciphertext is too short");
     }
-    plaintextLength += len;
+    char* out = data + CBC_IV_SIZE;
+    return {out, cbc_decrypt(this->get_keys(pubkey).shared_secret, data, size,
+                             out)};
+}
 
-    // Decrypt any remaining partial blocks
-    if (EVP_DecryptFinal_ex(ctx, outPtr + len, &len) <= 0) {
-        throw std::runtime_error("Could not finalise decryption");
+template <typename T>
+std::string_view
+ChannelEncryption<T>::decrypt_gcm_in_place(char* data, size_t size,
+                                           const x25519_key_t& pubkey) const {
+    if (size < GCM_NONCE_SIZE) {
+        throw std::runtime_error("Ciphertext is too short");
     }
-    plaintextLength += len;
+    char* out = data + GCM_NONCE_SIZE;
+    return {out, gcm_decrypt(this->get_keys(pubkey).symmetric_key, data, size,
+                             out)};
+}
+
+template <typename T>
+static std::string_view as_view(const T& data) {
+    return {reinterpret_cast<const char*>(data.data()), data.size()};
+}
+
+template <typename T>
+static char* as_chars(T& data) {
+    return reinterpret_cast<char*>(data.data());
+}
+
+template <typename T>
+T ChannelEncryption<T>::encrypt_cbc(const T& plaintext,
+                                    const std::string& pubKey) const {
+    T output;
+    output.resize(cbc_encrypted_size(plaintext.size()));
+    this->encrypt_cbc(as_view(plaintext), x25519_key_from_hex(pubKey),
+                      as_chars(output));
+    return output;
+}
+
+template <typename T>
+T ChannelEncryption<T>::encrypt_gcm(const T& plaintext,
+                                    const std::string& pubKey) const {
+    T output;
+    output.resize(gcm_encrypted_size(plaintext.size()));
+    this->encrypt_gcm(as_view(plaintext), x25519_key_from_hex(pubKey),
+                      as_chars(output));
+    return output;
+}
 
-    // Remove excess bytes
-    output.resize(plaintextLength);
+template <typename T>
+T ChannelEncryption<T>::decrypt_gcm(const T& iv_ciphertext_tag,
+                                    const std::string& pubKey) const {
+    T output;
+    output.resize(gcm_decrypted_size(iv_ciphertext_tag.size()));
+    output.resize(this->decrypt_gcm(as_view(iv_ciphertext_tag),
+                                    x25519_key_from_hex(pubKey),
+                                    as_chars(output)));
+    return output;
+}
 
-    // Don't we need to call free even when we throw??
-    EVP_CIPHER_CTX_free(ctx);
+template <typename T>
+T ChannelEncryption<T>::decrypt_cbc(const T& ciphertextAndIV,
+                                    const std::string& pubKey) const {
+    T output;
+    output.resize(cbc_decrypted_max_size(ciphertextAndIV.size()));
+    output.resize(this->decrypt_cbc(as_view(ciphertextAndIV),
+                                    x25519_key_from_hex(pubKey),
+                                    as_chars(output)));
     return output;
 }
 
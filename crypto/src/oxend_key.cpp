@@ -61,6 +61,16 @@ public_key_t derive_pubkey_ed25519(const private_key_ed25519_t& seckey) {
     return pubkey;
 }
 
+std::optional<public_key_t>
+pubkey_ed25519_to_x25519(const public_key_t& pubkey) {
+
+    public_key_t res;
+    if (crypto_sign_ed25519_pk_to_curve25519(res.data(), pubkey.data()) != 0)
+        return std::nullopt;
+
+    return res;
+}
+
 std::string key_to_string(const std::array<uint8_t, oxen::KEY_LENGTH>& key) {
     auto pk = reinterpret_cast<const char*>(&key);
     return std::string{pk, oxen::KEY_LENGTH};
@@ -8,9 +8,11 @@ extern "C" {
 
 #include <sodium/crypto_generichash.h>
 #include <sodium/crypto_generichash_blake2b.h>
+#include <sodium/crypto_sign.h>
 #include <sodium/randombytes.h>
 #include <sispopmq/base32z.h>
 #include <sispopmq/base64.h>
+#include <sispopmq/hex.h>
 
 #include <algorithm>
 #include <cassert>
@@ -146,4 +148,57 @@ bool check_signature(const std::string& signature_b64, const hash& hash,
     return check_signature(sig, hash, public_key);
 }
 
+bool check_ed25519_signature(const std::string& signature_b64,
+                             const std::string& data,
+                             const public_key_t& pubkey_ed25519) {
+    if (!sispopmq::is_base64(signature_b64))
+        return false;
+
+    // 64 bytes bytes -> 86/88 base64 encoded bytes with/without padding
+    if (!(signature_b64.size() == 86 ||
+          (signature_b64.size() == 88 && signature_b64[86] == '=')))
+        return false;
+
+    std::array<uint8_t, crypto_sign_BYTES> sig;
+    sispopmq::from_base64(signature_b64.begin(), signature_b64.end(),
+                          sig.begin());
+
+    return crypto_sign_verify_detached(
+               sig.data(), reinterpret_cast<const unsigned char*>(data.data()),
+               data.size(), pubkey_ed25519.data()) == 0;
+}
+
+owner_signature_t check_owner_signature(std::string_view owner,
+                                        std::string_view pubkey_ed25519,
+                                        const std::string& signature_b64,
+                                        const std::string& data) {
+
+    if (pubkey_ed25519.size() != KEY_LENGTH * 2 ||
+        !sispopmq::is_hex(pubkey_ed25519)) {
+        return owner_signature_t::INVALID_KEY;
+    }
+
+    public_key_t ed25519;
+    sispopmq::from_hex(pubkey_ed25519.begin(), pubkey_ed25519.end(),
+                       ed25519.begin());
+
+    const auto x25519 = pubkey_ed25519_to_x25519(ed25519);
+    if (!x25519) {
+        return owner_signature_t::INVALID_KEY;
+    }
+
+    // Session pubkeys have an extra (05) prefix that is not part of the key
+    if (owner.size() < KEY_LENGTH * 2 ||
+        owner.substr(owner.size() - KEY_LENGTH * 2) !=
+            sispopmq::to_hex(x25519->begin(), x25519->end())) {
+        return owner_signature_t::NOT_OWNER;
+    }
+
+    if (!check_ed25519_signature(signature_b64, data, ed25519)) {
+        return owner_signature_t::INVALID_SIGNATURE;
+    }
+
+    return owner_signature_t::OK;
+}
+
 } // namespace oxen
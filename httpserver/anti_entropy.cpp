@@ -0,0 +1,90 @@
+#include "anti_entropy.h"
+
+#include <algorithm>
+
+namespace oxen {
+
+uint64_t hash_fingerprint(std::string_view hash) {
+
+    // FNV-1a
+    uint64_t res = 0xcbf29ce484222325;
+    for (const char c : hash) {
+        res ^= static_cast<uint8_t>(c);
+        res *= 0x100000001b3;
+    }
+    return res;
+}
+
+void digest_builder_t::add(std::string_view hash, uint64_t timestamp) {
+
+    const uint64_t start = digest_bucket(timestamp);
+    auto& bucket = buckets_.try_emplace(start, bucket_digest_t{start, 0, 0})
+                       .first->second;
+    bucket.count++;
+    bucket.digest ^= hash_fingerprint(hash);
+}
+
+std::vector<bucket_digest_t> digest_builder_t::digests() const {
+
+    std::vector<bucket_digest_t> res;
+    res.reserve(buckets_.size());
+    for (const auto& [start, bucket] : buckets_) {
+        res.push_back(bucket);
+    }
+    return res;
+}
+
+bucket_hashes_t::bucket_hashes_t(std::vector<uint64_t> buckets,
+                                 size_t max_hashes)
+    : buckets_(std::move(buckets)), max_hashes_(max_hashes) {}
+
+void bucket_hashes_t::add(std::string_view hash, uint64_t timestamp) {
+
+    const uint64_t bucket = digest_bucket(timestamp);
+    if (full_ ||
+        !std::binary_search(buckets_.begin(), buckets_.end(), bucket)) {
+        return;
+    }
+
+    hashes_.emplace(hash_fingerprint(hash), hash);
+    last_bucket_ = bucket;
+    full_ = hashes_.size() >= max_hashes_;
+}
+
+std::vector<uint64_t> bucket_hashes_t::buckets() const {
+
+    if (!full_) {
+        return buckets_;
+    }
+    return {buckets_.begin(),
+            std::upper_bound(buckets_.begin(), buckets_.end(), last_bucket_)};
+}
+
+std::vector<uint64_t>
+differing_buckets(const std::vector<bucket_digest_t>& ours,
+                  const std::vector<bucket_digest_t>& theirs) {
+
+    std::vector<uint64_t> res;
+
+    auto a = ours.begin();
+    auto b = theirs.begin();
+    while (a != ours.end() || b != theirs.end()) {
+        if (b == theirs.end() || (a != ours.end() && a->start < b->start)) {
+            res.push_back(a->start);
+            ++a;
+        } else if (a == ours.end() || b->start < a->start) {
+            res.push_back(b->start);
+            ++b;
+        } else {
+            if (a->count != b->count || a->digest != b->digest) {
+                res.push_back(a->start);
+            }
+            ++a;
+            ++b;
+        }
+    }
+
+    return res;
+}
+
+} // namespace oxen
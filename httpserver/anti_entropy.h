@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace oxen {
+
+/// Anti-entropy: swarm members periodically compare compact summaries
+/// (digests) of the messages they hold, bucketed by message timestamp, and
+/// only look at the individual messages of the buckets that differ.
+
+/// Width (in ms) of a digest bucket
+constexpr uint64_t DIGEST_BUCKET_MS = 10 * 60 * 1000;
+
+/// Messages considered by an anti-entropy round: those with a timestamp in
+/// [begin, end) that have not expired at `now` (so that both sides look at
+/// the same set regardless of when they run their expiry cleanup)
+struct digest_range_t {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t now;
+};
+
+/// Summary of the messages a node has in a bucket
+struct bucket_digest_t {
+    // Timestamp (in ms) the bucket starts at
+    uint64_t start;
+    uint64_t count;
+    // XOR of the fingerprints of the messages
+    uint64_t digest;
+};
+
+/// Stable (across nodes and versions) 64-bit fingerprint of a message hash
+uint64_t hash_fingerprint(std::string_view hash);
+
+inline uint64_t digest_bucket(uint64_t timestamp) {
+    return timestamp - timestamp % DIGEST_BUCKET_MS;
+}
+
+class digest_builder_t {
+
+    std::map<uint64_t, bucket_digest_t> buckets_;
+
+  public:
+    void add(std::string_view hash, uint64_t timestamp);
+
+    /// Digests of all non-empty buckets, ordered by their start
+    std::vector<bucket_digest_t> digests() const;
+};
+
+/// Collects the hashes (by fingerprint) of the messages in `buckets` (which
+/// must be sorted), with messages added in timestamp order. Once it has
+/// `max_hashes` of them the remaining buckets are dropped, so the last bucket
+/// kept may be incomplete.
+class bucket_hashes_t {
+
+    std::vector<uint64_t> buckets_;
+    const size_t max_hashes_;
+    std::unordered_map<uint64_t, std::string> hashes_;
+    bool full_ = false;
+    uint64_t last_bucket_ = 0;
+
+  public:
+    bucket_hashes_t(std::vector<uint64_t> buckets, size_t max_hashes);
+
+    void add(std::string_view hash, uint64_t timestamp);
+
+    /// The buckets whose hashes have been collected (all of them unless the
+    /// limit was reached)
+    std::vector<uint64_t> buckets() const;
+
+    std::unordered_map<uint64_t, std::string>& hashes() { return hashes_; }
+};
+
+/// Starts of the buckets that differ between `ours` and `theirs` (both
+/// ordered by start), including those that only one side has
+std::vector<uint64_t>
+differing_buckets(const std::vector<bucket_digest_t>& ours,
+                  const std::vector<bucket_digest_t>& theirs);
+
+} // namespace oxen
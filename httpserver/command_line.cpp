@@ -26,6 +26,15 @@ void command_line_parser::parse_args(int argc, char* argv[]) {
         ("lmq-port", po::value(&options_.lmq_port), "Port used by SispopMQ")
         ("testnet", po::bool_switch(&options_.testnet), "Start storage server in testnet mode")
         ("force-start", po::bool_switch(&options_.force_start), "Ignore the initialisation ready check")
+        ("db-clustered", po::bool_switch(&options_.db_clustered), "Store each user's messages next to each other in the database (an existing database keeps its layout unless --db-convert is given)")
+        ("db-convert", po::bool_switch(&options_.db_convert), "Convert an existing database to the layout selected by --db-clustered on startup (needs room for a second copy of the messages)")
+        ("db-mmap-size", po::value(&options_.db_mmap_size_mb), "Size (in MiB) of the memory map used for database reads (0 to disable)")
+        ("db-cache-size", po::value(&options_.db_cache_size_mb), "Size (in MiB) of the database page cache (0 for the sqlite default)")
+        ("db-warmup", po::bool_switch(&options_.db_warmup), "Read the database indexes in the background on startup")
+        ("reuse-port", po::bool_switch(&options_.reuse_port), "Share the https port with worker processes (switches the database to WAL mode)")
+        ("worker", po::bool_switch(&options_.worker), "Run as a worker process that serves client reads for the storage server using the same --data-dir, port and --internal-port (which must be started with --reuse-port)")
+        ("internal-port", po::value(&options_.internal_port), "Loopback port on which the storage server accepts the requests its workers can't serve (required with --worker)")
+        ("sign-relays", po::bool_switch(&options_.sign_relays), "Sign the message batches relayed to swarm members, and trust those they sign, so that only a sample of their PoW is checked")
         ("bind-ip", po::value(&options_.ip)->default_value("0.0.0.0"), "IP to which to bind the server")
         ("version,v", po::bool_switch(&options_.print_version), "Print the version of this binary")
         ("help", po::bool_switch(&options_.print_help),"Shows this help message")
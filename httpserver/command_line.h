@@ -14,6 +14,15 @@ struct command_line_options {
     bool print_version = false;
     bool print_help = false;
     bool testnet = false;
+    bool db_clustered = false;
+    bool db_convert = false;
+    uint64_t db_mmap_size_mb = 0;
+    uint64_t db_cache_size_mb = 0;
+    bool db_warmup = false;
+    bool reuse_port = false;
+    bool worker = false;
+    uint16_t internal_port = 0;
+    bool sign_relays = false;
     std::string ip;
     std::string log_level = "info";
     std::string data_dir;
@@ -0,0 +1,81 @@
+#include "compression.h"
+
+#include <zlib.h>
+
+namespace oxen {
+
+// Compressed payloads start with the size of the original data (as a 32-bit
+// little endian number), so that it can be decompressed in one go
+constexpr size_t SIZE_HEADER_LEN = 4;
+
+bool parse_compression(std::string_view str, compression_t& codec) {
+
+    if (str == "0") {
+        codec = compression_t::none;
+    } else if (str == "1") {
+        codec = compression_t::zlib;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string compression_to_string(compression_t codec) {
+    return std::to_string(static_cast<int>(codec));
+}
+
+bool compress(compression_t codec, std::string_view data, std::string& out) {
+
+    if (codec != compression_t::zlib || data.size() < COMPRESSION_MIN_SIZE ||
+        data.size() > DECOMPRESSED_MAX_SIZE) {
+        return false;
+    }
+
+    uLongf len = compressBound(data.size());
+    out.resize(SIZE_HEADER_LEN + len);
+
+    const uint32_t size = data.size();
+    for (size_t i = 0; i < SIZE_HEADER_LEN; ++i) {
+        out[i] = static_cast<char>((size >> (8 * i)) & 0xff);
+    }
+
+    // Favour speed: most of what we send is relayed as soon as it arrives
+    const int res = compress2(
+        reinterpret_cast<Bytef*>(&out[SIZE_HEADER_LEN]), &len,
+        reinterpret_cast<const Bytef*>(data.data()), data.size(),
+        Z_BEST_SPEED);
+
+    if (res != Z_OK || SIZE_HEADER_LEN + len >= data.size()) {
+        return false;
+    }
+
+    out.resize(SIZE_HEADER_LEN + len);
+    return true;
+}
+
+bool decompress(compression_t codec, std::string_view data, std::string& out) {
+
+    if (codec != compression_t::zlib || data.size() < SIZE_HEADER_LEN) {
+        return false;
+    }
+
+    uint32_t size = 0;
+    for (size_t i = 0; i < SIZE_HEADER_LEN; ++i) {
+        size |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+    }
+
+    if (size > DECOMPRESSED_MAX_SIZE) {
+        return false;
+    }
+
+    out.resize(size);
+    uLongf len = size;
+    const int res = uncompress(
+        reinterpret_cast<Bytef*>(out.data()), &len,
+        reinterpret_cast<const Bytef*>(data.data() + SIZE_HEADER_LEN),
+        data.size() - SIZE_HEADER_LEN);
+
+    return res == Z_OK && len == size;
+}
+
+} // namespace oxen
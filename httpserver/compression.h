@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace oxen {
+
+/// Codecs that payloads sent to swarm members can be compressed with. Nodes
+/// tell their peers which one they accept (as the number), and payloads are
+/// only compressed for peers that do.
+enum class compression_t : uint8_t {
+    none = 0,
+    zlib = 1,
+};
+
+/// Codec we compress with and accept
+constexpr compression_t PREFERRED_COMPRESSION = compression_t::zlib;
+
+/// Smaller payloads are sent as they are
+constexpr size_t COMPRESSION_MIN_SIZE = 1024;
+
+/// Limit on the size of a decompressed payload, so that a small payload
+/// can't make us allocate an arbitrary amount of memory
+constexpr size_t DECOMPRESSED_MAX_SIZE = 64 * 1024 * 1024;
+
+/// Parse a codec as sent over the wire, return false if it is not one we
+/// know about
+bool parse_compression(std::string_view str, compression_t& codec);
+
+std::string compression_to_string(compression_t codec);
+
+/// Compress `data` into `out`. Returns false if that is not worth it, i.e.
+/// `data` is smaller than COMPRESSION_MIN_SIZE or doesn't get any smaller.
+bool compress(compression_t codec, std::string_view data, std::string& out);
+
+/// Returns false if `data` is corrupted or would decompress to more than
+/// DECOMPRESSED_MAX_SIZE
+bool decompress(compression_t codec, std::string_view data, std::string& out);
+
+} // namespace oxen
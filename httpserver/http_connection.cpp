@@ -40,6 +40,7 @@ static constexpr auto OXEN_FILE_SERVER_TARGET_HEADER =
 static constexpr auto OXEN_FILE_SERVER_VERB_HEADER = "X-Oxen-File-Server-Verb";
 static constexpr auto OXEN_FILE_SERVER_HEADERS_HEADER =
     "X-Oxen-File-Server-Headers";
+static constexpr auto OXEN_FORWARDED_FOR_HEADER = "X-Forwarded-For";
 
 using oxen::storage::Item;
 
@@ -211,7 +212,8 @@ static void accept_connection(boost::asio::io_context& ioc,
                               boost::asio::ssl::context& ssl_ctx,
                               tcp::acceptor& acceptor, ServiceNode& sn,
                               RequestHandler& rh, RateLimiter& rate_limiter,
-                              const Security& security) {
+                              const Security& security, uint16_t primary_port,
+                              bool from_worker) {
 
     static boost::asio::steady_timer acceptor_timer(ioc);
     constexpr std::chrono::milliseconds ACCEPT_DELAY = 50ms;
@@ -221,11 +223,12 @@ static void accept_connection(boost::asio::io_context& ioc,
         if (!ec) {
 
             std::make_shared<connection_t>(ioc, ssl_ctx, std::move(socket), sn,
-                                           rh, rate_limiter, security)
+                                           rh, rate_limiter, security,
+                                           primary_port, from_worker)
                 ->start();
 
             accept_connection(ioc, ssl_ctx, acceptor, sn, rh, rate_limiter,
-                              security);
+                              security, primary_port, from_worker);
         } else {
 
             // TODO: remove this once we confirmed that there is
@@ -253,7 +256,7 @@ static void accept_connection(boost::asio::io_context& ioc,
                 }
 
                 accept_connection(ioc, ssl_ctx, acceptor, sn, rh, rate_limiter,
-                                  security);
+                                  security, primary_port, from_worker);
             });
         }
     });
@@ -261,14 +264,40 @@ static void accept_connection(boost::asio::io_context& ioc,
 
 void run(boost::asio::io_context& ioc, const std::string& ip, uint16_t port,
          const std::filesystem::path& base_path, ServiceNode& sn,
-         RequestHandler& rh, RateLimiter& rate_limiter, Security& security) {
+         RequestHandler& rh, RateLimiter& rate_limiter, Security& security,
+         bool reuse_port, uint16_t internal_port) {
 
     OXEN_LOG(trace, "http server run");
 
     const auto address =
         boost::asio::ip::make_address(ip); /// throws if incorrect
 
-    tcp::acceptor acceptor{ioc, {address, port}};
+    const tcp::endpoint endpoint{address, port};
+    tcp::acceptor acceptor{ioc};
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    if (reuse_port) {
+        // Lets the kernel distribute incoming connections between us and
+        // other (worker) processes listening on the same port
+        using reuse_port_t =
+            boost::asio::detail::socket_option::boolean<SOL_SOCKET,
+                                                        SO_REUSEPORT>;
+        acceptor.set_option(reuse_port_t(true));
+    }
+    acceptor.bind(endpoint);
+    acceptor.listen();
+
+    // Workers forward the requests they can't serve to the primary process
+    // over loopback, on a port that is not shared with them
+    tcp::acceptor internal_acceptor{ioc};
+    if (internal_port != 0 && !sn.is_worker()) {
+        const tcp::endpoint internal_endpoint{
+            boost::asio::ip::address_v4::loopback(), internal_port};
+        internal_acceptor.open(internal_endpoint.protocol());
+        internal_acceptor.set_option(tcp::acceptor::reuse_address(true));
+        internal_acceptor.bind(internal_endpoint);
+        internal_acceptor.listen();
+    }
 
     ssl::context ssl_ctx{ssl::context::tlsv12};
 
@@ -276,7 +305,17 @@ void run(boost::asio::io_context& ioc, const std::string& ip, uint16_t port,
 
     security.generate_cert_signature();
 
-    accept_connection(ioc, ssl_ctx, acceptor, sn, rh, rate_limiter, security);
+    if (sn.is_worker()) {
+        accept_connection(ioc, ssl_ctx, acceptor, sn, rh, rate_limiter,
+                          security, internal_port, false);
+    } else {
+        accept_connection(ioc, ssl_ctx, acceptor, sn, rh, rate_limiter,
+                          security, 0, false);
+        if (internal_acceptor.is_open()) {
+            accept_connection(ioc, ssl_ctx, internal_acceptor, sn, rh,
+                              rate_limiter, security, 0, true);
+        }
+    }
 
     ioc.run();
 }
@@ -286,10 +325,12 @@ void run(boost::asio::io_context& ioc, const std::string& ip, uint16_t port,
 connection_t::connection_t(boost::asio::io_context& ioc, ssl::context& ssl_ctx,
                            tcp::socket socket, ServiceNode& sn,
                            RequestHandler& rh, RateLimiter& rate_limiter,
-                           const Security& security)
+                           const Security& security, uint16_t primary_port,
+                           bool from_worker)
     : ioc_(ioc), ssl_ctx_(ssl_ctx), socket_(std::move(socket)),
       stream_(socket_, ssl_ctx_), service_node_(sn), request_handler_(rh),
-      rate_limiter_(rate_limiter), repeat_timer_(ioc),
+      rate_limiter_(rate_limiter), primary_port_(primary_port),
+      from_worker_(from_worker), repeat_timer_(ioc),
       deadline_(ioc, SESSION_TIME_LIMIT), notification_ctx_{std::nullopt},
       security_(security) {
 
@@ -990,6 +1031,12 @@ void connection_t::process_request() {
             this->process_swarm_req(target);
             break;
         }
+        // Workers only serve requests that read from the database (or ask
+        // Oxend), everything else is served by the primary process
+        if (service_node_.is_worker() && needs_primary(target)) {
+            this->forward_to_primary();
+            break;
+        }
         if (!service_node_.snode_ready(&reason)) {
             OXEN_LOG(debug,
                      "Ignoring post request; storage server not ready: {}",
@@ -1127,6 +1174,70 @@ bool connection_t::parse_header(const char* first, Args... args) {
     return parse_header(first) && parse_header(args...);
 }
 
+bool connection_t::needs_primary(std::string_view target) const {
+
+    if (target == "/swarms/storage_test/v1" ||
+        target == "/swarms/blockchain_test/v1") {
+        return false;
+    }
+
+    if (target == "/storage_rpc/v1") {
+        return RequestHandler::client_req_needs_primary(request_.get().body());
+    }
+
+    return true;
+}
+
+void connection_t::forward_to_primary() {
+
+    OXEN_LOG(debug, "Forwarding request to the primary process: {}",
+             request_.get().target().to_string());
+
+    delay_response_ = true;
+
+    auto req = std::make_shared<request_t>(request_.get());
+    req->set(OXEN_FORWARDED_FOR_HEADER,
+             socket_.remote_endpoint().address().to_string());
+
+    make_https_request(
+        ioc_, "127.0.0.1", primary_port_, std::nullopt, req,
+        [wself = std::weak_ptr<connection_t>{shared_from_this()}](
+            sn_response_t res) {
+            auto self = wself.lock();
+            if (!self) {
+                OXEN_LOG(debug,
+                         "Connection is no longer valid, dropping response "
+                         "from the primary process");
+                return;
+            }
+
+            if (res.raw_response) {
+                self->response_ = std::move(*res.raw_response);
+            } else {
+                OXEN_LOG(debug, "Could not reach the primary process: {}",
+                         error_string(res.error_code));
+                self->response_.result(http::status::service_unavailable);
+                self->body_stream_ << "Service node is busy, please retry\n";
+            }
+
+            self->write_response();
+        });
+}
+
+std::string connection_t::client_ip() const {
+
+    // Only workers can connect to the loopback port, so we can trust them
+    // with the address of their client
+    if (from_worker_) {
+        const auto it = request_.get().find(OXEN_FORWARDED_FOR_HEADER);
+        if (it != request_.get().end()) {
+            return it->value().to_string();
+        }
+    }
+
+    return socket_.remote_endpoint().address().to_string();
+}
+
 constexpr auto LONG_POLL_TIMEOUT = std::chrono::milliseconds(20000);
 
 /// Move this out of `connection_t` Process client request
@@ -1138,8 +1249,7 @@ void connection_t::process_client_req_rate_limited() {
 
     const request_t& req = this->request_.get();
     std::string plain_text = req.body();
-    const std::string client_ip =
-        socket_.remote_endpoint().address().to_string();
+    const std::string client_ip = this->client_ip();
     if (rate_limiter_.should_rate_limit_client(client_ip)) {
         this->body_stream_ << "too many requests\n";
         response_.result(http::status::too_many_requests);
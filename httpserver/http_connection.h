@@ -200,6 +200,14 @@ class connection_t : public std::enable_shared_from_this<connection_t> {
 
     RateLimiter& rate_limiter_;
 
+    // (Worker only) the loopback port on which the primary process accepts
+    // the requests we can't serve
+    uint16_t primary_port_;
+
+    // Whether the connection was accepted on the loopback port, i.e. comes
+    // from a worker that forwards requests on behalf of its clients
+    bool from_worker_;
+
     // The timer for repeating an action within one connection
     boost::asio::steady_timer repeat_timer_;
     int repetition_count_ = 0;
@@ -237,7 +245,8 @@ class connection_t : public std::enable_shared_from_this<connection_t> {
   public:
     connection_t(boost::asio::io_context& ioc, ssl::context& ssl_ctx,
                  tcp::socket socket, ServiceNode& sn, RequestHandler& rh,
-                 RateLimiter& rate_limiter, const Security& security);
+                 RateLimiter& rate_limiter, const Security& security,
+                 uint16_t primary_port = 0, bool from_worker = false);
 
     ~connection_t();
 
@@ -274,6 +283,17 @@ class connection_t : public std::enable_shared_from_this<connection_t> {
     /// Syncronously (?) process client store/load requests
     void process_client_req_rate_limited();
 
+    /// (Worker only) whether the request has to be served by the primary
+    bool needs_primary(std::string_view target) const;
+
+    /// (Worker only) relay the request to the primary process and respond
+    /// with whatever it responds
+    void forward_to_primary();
+
+    /// The IP of the client, as reported by the worker if the request was
+    /// forwarded
+    std::string client_ip() const;
+
     void process_swarm_req(std::string_view target);
 
     /// Process onion request from the client (json)
@@ -310,7 +330,8 @@ class connection_t : public std::enable_shared_from_this<connection_t> {
 
 void run(boost::asio::io_context& ioc, const std::string& ip, uint16_t port,
          const std::filesystem::path& base_path, ServiceNode& sn,
-         RequestHandler& rh, RateLimiter& rate_limiter, Security&);
+         RequestHandler& rh, RateLimiter& rate_limiter, Security&,
+         bool reuse_port = false, uint16_t internal_port = 0);
 
 } // namespace http_server
 
@@ -12,7 +12,7 @@ using error_code = boost::system::error_code;
 
 void make_https_request(boost::asio::io_context& ioc,
                         const std::string& sn_address, uint16_t port,
-                        const std::string& sn_pubkey_b32z,
+                        std::optional<std::string> sn_pubkey_b32z,
                         const std::shared_ptr<request_t>& req,
                         http_callback_t&& cb) {
 
@@ -46,7 +46,7 @@ void make_https_request(boost::asio::io_context& ioc,
 
     auto session = std::make_shared<HttpsClientSession>(
         ioc, ctx, std::move(resolve_results), req, std::move(cb),
-        sn_pubkey_b32z);
+        std::move(sn_pubkey_b32z));
 
     session->start();
 }
@@ -7,8 +7,11 @@
 namespace oxen {
 using http_callback_t = std::function<void(sn_response_t)>;
 
+/// Pass no `sn_pubkey_b32z` to skip checking the response signature (e.g. for
+/// our own primary process, that only signs swarm responses)
 void make_https_request(boost::asio::io_context& ioc, const std::string& ip,
-                        uint16_t port, const std::string& sn_pubkey_b32z,
+                        uint16_t port,
+                        std::optional<std::string> sn_pubkey_b32z,
                         const std::shared_ptr<request_t>& req,
                         http_callback_t&& cb);
 
@@ -1,10 +1,12 @@
 #include "lmq_server.h"
 
+#include "compression.h"
 #include "dev_sink.h"
 #include "oxen_common.h"
 #include "oxen_logger.h"
 #include "oxend_key.h"
 #include "request_handler.h"
+#include "serialization.h"
 #include "service_node.h"
 
 #include <sispopmq/hex.h>
@@ -37,6 +39,58 @@ void SispopmqServer::handle_sn_data(sispopmq::Message& message) {
     OXEN_LOG(debug, "[LMQ]   thread id: {}", std::this_thread::get_id());
     OXEN_LOG(debug, "[LMQ]   from: {}", sispopmq::to_hex(message.conn.pubkey()));
 
+    auto& reply_tag = message.reply_tag;
+    auto& origin_pk = message.conn.pubkey();
+
+    // Replies once the messages are verified and stored, which happens off
+    // this thread
+    auto on_done = [this, origin_pk, reply_tag](bool stored, size_t accepted) {
+        // Without a reply the sender tries again later
+        if (!stored) {
+            OXEN_LOG(error, "[LMQ] Could not store a batch, not replying");
+            return;
+        }
+
+        OXEN_LOG(debug, "[LMQ] send reply");
+
+        // Let the sender know which batch format it can use with us, how
+        // many of the messages we have accepted, whether it can sign its
+        // batches (only if we trust signatures ourselves) and which
+        // compression we accept
+        this->sispopmq_->send(
+            origin_pk, "REPLY", reply_tag,
+            std::to_string(static_cast<int>(LATEST_BATCH_FORMAT)),
+            std::to_string(accepted),
+            service_node_->signs_relays() ? SIGNED_BATCHES_TAG : "",
+            compression_to_string(PREFERRED_COMPRESSION));
+    };
+
+    // TODO: proces push batch should move to "Request handler"
+    // Compressed batches come as [batch, signature (or empty), codec] and
+    // signed ones as [batch, signature], which are only sent to nodes that
+    // have told the sender they accept them
+    if (message.data.size() == 3) {
+
+        compression_t compression;
+        if (!parse_compression(message.data[2], compression)) {
+            OXEN_LOG(warn, "[LMQ] Dropping a batch with an unknown codec");
+            on_done(true, 0);
+            return;
+        }
+
+        service_node_->process_compressed_push_batch(
+            std::string(origin_pk), std::string(message.data[0]),
+            std::string(message.data[1]), compression, std::move(on_done));
+        return;
+    }
+
+    if (message.data.size() == 2) {
+        service_node_->process_signed_push_batch(
+            std::string(origin_pk), std::string(message.data[0]),
+            std::string(message.data[1]), std::move(on_done));
+        return;
+    }
+
     std::stringstream ss;
 
     // We are only expecting a single part message, so consider removing this
@@ -44,15 +98,160 @@ void SispopmqServer::handle_sn_data(sispopmq::Message& message) {
         ss << part;
     }
 
-    // TODO: proces push batch should move to "Request handler"
-    service_node_->process_push_batch(ss.str());
+    service_node_->process_push_batch(ss.str(), std::move(on_done));
+};
 
-    OXEN_LOG(debug, "[LMQ] send reply");
+void SispopmqServer::handle_sn_snapshot(sispopmq::Message& message) {
 
-    // TODO: Investigate if the above could fail and whether we should report
-    // that to the sending SN
-    message.send_reply();
-};
+    OXEN_LOG(debug, "[LMQ] handle_sn_snapshot");
+
+    // Expected parts: snapshot id, chunk index (or "end"), checksum, payload
+    // and, if the payload is compressed or signed, the codec, then the
+    // signature if signed
+    if (message.data.size() < 4 || message.data.size() > 6) {
+        OXEN_LOG(debug, "[LMQ] Expected 4 to 6 message parts, got {}",
+                 message.data.size());
+        message.send_reply("INVALID_REQUEST");
+        return;
+    }
+
+    compression_t compression = compression_t::none;
+    if (message.data.size() >= 5 &&
+        !parse_compression(message.data[4], compression)) {
+        message.send_reply("INVALID_REQUEST");
+        return;
+    }
+
+    const std::string signature =
+        message.data.size() == 6 ? std::string(message.data[5]) : "";
+
+    auto& reply_tag = message.reply_tag;
+    auto& origin_pk = message.conn.pubkey();
+
+    // Replies once the chunk is verified and stored, which happens off this
+    // thread
+    auto on_done = [this, origin_pk, reply_tag](std::string status) {
+        this->sispopmq_->send(origin_pk, "REPLY", reply_tag, status);
+    };
+
+    service_node_->process_snapshot_part(
+        std::string(origin_pk), std::string(message.data[0]),
+        std::string(message.data[1]), std::string(message.data[2]),
+        std::string(message.data[3]), compression, signature,
+        std::move(on_done));
+}
+
+void SispopmqServer::handle_sn_delete(sispopmq::Message& message) {
+
+    OXEN_LOG(debug, "[LMQ] handle_sn_delete");
+
+    if (message.data.size() != 1) {
+        OXEN_LOG(debug, "[LMQ] Expected 1 message part, got {}",
+                 message.data.size());
+        message.send_reply("INVALID_REQUEST");
+        return;
+    }
+
+    const bool success = service_node_->process_tombstones(
+        std::string(message.conn.pubkey()), std::string(message.data[0]));
+
+    message.send_reply(success ? "OK" : "REJECTED");
+}
+
+void SispopmqServer::handle_sn_digests(sispopmq::Message& message) {
+
+    OXEN_LOG(debug, "[LMQ] handle_sn_digests");
+
+    // Expected parts: range, digests
+    if (message.data.size() != 2) {
+        OXEN_LOG(debug, "[LMQ] Expected 2 message parts, got {}",
+                 message.data.size());
+        message.send_reply("INVALID_REQUEST");
+        return;
+    }
+
+    auto& reply_tag = message.reply_tag;
+    auto& origin_pk = message.conn.pubkey();
+
+    // Replies once our messages have been read, which happens off this
+    // thread
+    auto on_done = [this, origin_pk,
+                    reply_tag](std::vector<std::string> reply) {
+        this->sispopmq_->send(
+            origin_pk, "REPLY", reply_tag,
+            sispopmq::send_option::data_parts(reply.begin(), reply.end()));
+    };
+
+    service_node_->process_digests(std::string(origin_pk), message.data[0],
+                                   message.data[1], std::move(on_done));
+}
+
+void SispopmqServer::handle_sn_fetch(sispopmq::Message& message) {
+
+    OXEN_LOG(debug, "[LMQ] handle_sn_fetch");
+
+    // Expected parts: range, fingerprints
+    if (message.data.size() != 2) {
+        OXEN_LOG(debug, "[LMQ] Expected 2 message parts, got {}",
+                 message.data.size());
+        message.send_reply("INVALID_REQUEST");
+        return;
+    }
+
+    auto& reply_tag = message.reply_tag;
+    auto& origin_pk = message.conn.pubkey();
+
+    // Replies once our messages have been read, which happens off this
+    // thread
+    auto on_done = [this, origin_pk,
+                    reply_tag](std::vector<std::string> reply) {
+        this->sispopmq_->send(
+            origin_pk, "REPLY", reply_tag,
+            sispopmq::send_option::data_parts(reply.begin(), reply.end()));
+    };
+
+    service_node_->process_fetch(std::string(origin_pk), message.data[0],
+                                   message.data[1], std::move(on_done));
+}
+
+void SispopmqServer::handle_sn_log(sispopmq::Message& message) {
+
+    OXEN_LOG(debug, "[LMQ] handle_sn_log");
+
+    // Expected parts: position to read after, number of entries
+    if (message.data.size() != 2) {
+        OXEN_LOG(debug, "[LMQ] Expected 2 message parts, got {}",
+                 message.data.size());
+        message.send_reply("INVALID_REQUEST");
+        return;
+    }
+
+    const auto reply = service_node_->process_log_request(
+        std::string(message.conn.pubkey()), std::string(message.data[0]),
+        std::string(message.data[1]));
+
+    message.send_reply(
+        sispopmq::send_option::data_parts(reply.begin(), reply.end()));
+}
+
+void SispopmqServer::handle_sn_messages(sispopmq::Message& message) {
+
+    OXEN_LOG(debug, "[LMQ] handle_sn_messages");
+
+    // Expected parts: hashes
+    if (message.data.size() != 1) {
+        OXEN_LOG(debug, "[LMQ] Expected 1 message part, got {}",
+                 message.data.size());
+        message.send_reply("INVALID_REQUEST");
+        return;
+    }
+
+    const auto reply = service_node_->process_messages_request(
+        std::string(message.conn.pubkey()), message.data[0]);
+
+    message.send_reply(
+        sispopmq::send_option::data_parts(reply.begin(), reply.end()));
+}
 
 void SispopmqServer::handle_sn_proxy_exit(sispopmq::Message& message) {
 
@@ -210,6 +409,12 @@ void SispopmqServer::init(ServiceNode* sn, RequestHandler* rh,
     // clang-format off
     sispopmq_->add_category("sn", sispopmq::Access{sispopmq::AuthLevel::none, true, false})
         .add_request_command("data", [this](auto& m) { this->handle_sn_data(m); })
+        .add_request_command("snapshot", [this](auto& m) { this->handle_sn_snapshot(m); })
+        .add_request_command("delete", [this](auto& m) { this->handle_sn_delete(m); })
+        .add_request_command("digests", [this](auto& m) { this->handle_sn_digests(m); })
+        .add_request_command("fetch", [this](auto& m) { this->handle_sn_fetch(m); })
+        .add_request_command("log", [this](auto& m) { this->handle_sn_log(m); })
+        .add_request_command("messages", [this](auto& m) { this->handle_sn_messages(m); })
         .add_request_command("proxy_exit", [this](auto& m) { this->handle_sn_proxy_exit(m); })
         .add_request_command("onion_req", [this](auto& m) { this->handle_onion_request(m, false); })
         .add_request_command("onion_req_v2", [this](auto& m) { this->handle_onion_request(m, true); })
@@ -35,6 +35,24 @@ class SispopmqServer {
     // Handle Session data coming from peer SN
     void handle_sn_data(sispopmq::Message& message);
 
+    // Handle a part of a bootstrap snapshot coming from a swarm member
+    void handle_sn_snapshot(sispopmq::Message& message);
+
+    // Handle client deletions relayed by a swarm member
+    void handle_sn_delete(sispopmq::Message& message);
+
+    // Handle digests sent by a swarm member for anti-entropy
+    void handle_sn_digests(sispopmq::Message& message);
+
+    // Handle a swarm member fetching messages it found missing
+    void handle_sn_fetch(sispopmq::Message& message);
+
+    // Handle a swarm member reading our replication log
+    void handle_sn_log(sispopmq::Message& message);
+
+    // Handle a swarm member fetching messages found in our replication log
+    void handle_sn_messages(sispopmq::Message& message);
+
     // Handle Session client requests arrived via proxy
     void handle_sn_proxy_exit(sispopmq::Message& message);
 
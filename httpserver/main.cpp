@@ -16,6 +16,7 @@
 #include <sodium.h>
 #include <sispopmq/hex.h>
 
+#include <chrono>
 #include <cstdlib>
 #include <filesystem>
 #include <iostream>
@@ -57,6 +58,25 @@ static void systemd_watchdog_tick(boost::asio::steady_timer& timer,
 
 constexpr int EXIT_INVALID_PORT = 2;
 
+/// Logs how long it took to get to each stage of the startup, so it is
+/// easy to see where the time went when startup is slow
+class startup_timeline_t {
+    using clock = std::chrono::steady_clock;
+    clock::time_point start_ = clock::now();
+    clock::time_point last_ = start_;
+
+  public:
+    void record(const char* stage) {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        const auto now = clock::now();
+        OXEN_LOG(info, "Startup: {} in {} ms (total: {} ms)", stage,
+                 duration_cast<milliseconds>(now - last_).count(),
+                 duration_cast<milliseconds>(now - start_).count());
+        last_ = now;
+    }
+};
+
 int main(int argc, char* argv[]) {
 
     oxen::command_line_parser parser;
@@ -105,6 +125,8 @@ int main(int argc, char* argv[]) {
 
     oxen::init_logging(options.data_dir, log_level);
 
+    startup_timeline_t startup_timeline;
+
     if (options.testnet) {
         oxen::set_testnet();
         OXEN_LOG(warn,
@@ -129,6 +151,29 @@ int main(int argc, char* argv[]) {
 
     OXEN_LOG(info, "Setting log level to {}", options.log_level);
     OXEN_LOG(info, "Setting database location to {}", options.data_dir);
+    if (options.db_clustered) {
+        OXEN_LOG(info, "Using the clustered (by owner) database layout");
+    }
+    if (options.db_mmap_size_mb > 0) {
+        OXEN_LOG(info, "Setting database mmap size to {} MiB",
+                 options.db_mmap_size_mb);
+    }
+    if (options.db_cache_size_mb > 0) {
+        OXEN_LOG(info, "Setting database cache size to {} MiB",
+                 options.db_cache_size_mb);
+    }
+    if (options.worker) {
+        if (options.internal_port == 0) {
+            OXEN_LOG(critical, "Workers need the --internal-port of the "
+                               "storage server they serve requests for");
+            return EXIT_FAILURE;
+        }
+        OXEN_LOG(info, "Running as a read only worker process");
+    }
+    if (options.internal_port != 0) {
+        OXEN_LOG(info, "Workers forward requests over 127.0.0.1:{}",
+                 options.internal_port);
+    }
     OXEN_LOG(info, "Setting Oxend RPC to {}:{}", options.oxend_rpc_ip,
              options.oxend_rpc_port);
     OXEN_LOG(info, "Https server is listening at {}:{}", options.ip,
@@ -185,14 +230,13 @@ int main(int argc, char* argv[]) {
         OXEN_LOG(info, "ed25519 SECRET KEY: {}", options.oxend_ed25519_key);
 #endif
 
+        startup_timeline.record("obtained keys");
+
         const auto public_key = oxen::derive_pubkey_legacy(private_key);
         OXEN_LOG(info, "Retrieved keys from Sispopd; our SN pubkey is: {}",
                  sispopmq::to_hex(public_key.begin(), public_key.end()));
 
-        // TODO: avoid conversion to vector
-        const std::vector<uint8_t> priv(private_key_x25519.begin(),
-                                        private_key_x25519.end());
-        ChannelEncryption<std::string> channel_encryption(priv);
+        ChannelEncryption<std::string> channel_encryption(private_key_x25519);
 
         oxen::oxend_key_pair_t oxend_key_pair{private_key, public_key};
 
@@ -222,17 +266,36 @@ int main(int argc, char* argv[]) {
         // the rest of lmq server before we have a reference to ServiceNode
         oxen::SispopmqServer sispopmq_server(options.lmq_port);
 
+        oxen::db_options_t db_options;
+        db_options.clustered_by_owner = options.db_clustered;
+        db_options.convert_layout = options.db_convert;
+        db_options.mmap_size = options.db_mmap_size_mb * 1024 * 1024;
+        db_options.cache_size_kb = options.db_cache_size_mb * 1024;
+        db_options.warmup = options.db_warmup;
+        db_options.wal = options.reuse_port;
+        db_options.read_only = options.worker;
+
         // TODO: SN doesn't need sispopmq_server, just the lmq components
         oxen::ServiceNode service_node(ioc, worker_ioc, options.port,
                                        sispopmq_server, oxend_key_pair,
                                        pubkey_ed25519_hex, options.data_dir,
-                                       oxend_client, options.force_start);
+                                       db_options, oxend_client,
+                                       options.force_start, options.worker,
+                                       options.sign_relays);
+
+        startup_timeline.record("opened the database");
 
         oxen::RequestHandler request_handler(ioc, service_node, oxend_client,
                                              channel_encryption);
 
-        sispopmq_server.init(&service_node, &request_handler,
-                           oxend_key_pair_x25519, options.stats_access_keys);
+        // Other nodes only talk to the primary process over SispopMQ
+        if (!options.worker) {
+            sispopmq_server.init(&service_node, &request_handler,
+                                 oxend_key_pair_x25519,
+                                 options.stats_access_keys);
+
+            startup_timeline.record("started SispopMQ");
+        }
 
         RateLimiter rate_limiter;
 
@@ -244,9 +307,12 @@ int main(int argc, char* argv[]) {
         systemd_watchdog_tick(systemd_watchdog_timer, service_node);
 #endif
 
+        startup_timeline.record("ready to serve");
+
         oxen::http_server::run(ioc, options.ip, options.port, options.data_dir,
                                service_node, request_handler, rate_limiter,
-                               security);
+                               security, options.reuse_port || options.worker,
+                               options.internal_port);
     } catch (const std::exception& e) {
         // It seems possible for logging to throw its own exception,
         // in which case it will be propagated to libc...
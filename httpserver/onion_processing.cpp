@@ -55,14 +55,18 @@ process_ciphertext_v1(const ChannelEncryption<std::string>& decryptor,
                       const std::string& ciphertext,
                       const std::string& ephem_key) -> ParsedInfo {
 
-    std::string plaintext;
+    // Decrypted in place, so `plaintext` points into `buffer`
+    std::string buffer;
+    std::string_view plaintext;
 
     try {
         if (!sispopmq::is_base64(ciphertext))
             throw std::runtime_error{"cipher text is not base64 encoded"};
-        const std::string ciphertext_bin = sispopmq::from_base64(ciphertext);
+        const auto key = x25519_key_from_hex(ephem_key);
+        buffer = sispopmq::from_base64(ciphertext);
 
-        plaintext = decryptor.decrypt_gcm(ciphertext_bin, ephem_key);
+        plaintext =
+            decryptor.decrypt_gcm_in_place(buffer.data(), buffer.size(), key);
     } catch (const std::exception& e) {
         OXEN_LOG(debug, "Error decrypting an onion request: {}", e.what());
         return ProcessCiphertextError::INVALID_CIPHERTEXT;
@@ -72,7 +76,8 @@ process_ciphertext_v1(const ChannelEncryption<std::string>& decryptor,
 
     try {
 
-        const json inner_json = json::parse(plaintext, nullptr, true);
+        const json inner_json =
+            json::parse(plaintext.begin(), plaintext.end(), nullptr, true);
 
         if (inner_json.find("body") != inner_json.end()) {
 
@@ -86,7 +91,7 @@ process_ciphertext_v1(const ChannelEncryption<std::string>& decryptor,
                 inner_json.at("host").get_ref<const std::string&>();
             const auto& target =
                 inner_json.at("target").get_ref<const std::string&>();
-            return RelayToServerInfo{plaintext, host, target};
+            return RelayToServerInfo{std::string(plaintext), host, target};
 
         } else {
             // We fall back to forwarding a request to the next node
@@ -114,7 +119,11 @@ process_ciphertext_v2(const ChannelEncryption<std::string>& decryptor,
     std::string plaintext;
 
     try {
-        plaintext = decryptor.decrypt_gcm(ciphertext, ephem_key);
+        using channel_t = ChannelEncryption<std::string>;
+        const auto key = x25519_key_from_hex(ephem_key);
+        plaintext.resize(channel_t::gcm_decrypted_size(ciphertext.size()));
+        plaintext.resize(
+            decryptor.decrypt_gcm(ciphertext, key, plaintext.data()));
     } catch (const std::exception& e) {
         OXEN_LOG(debug, "Error decrypting an onion request: {}", e.what());
         return ProcessCiphertextError::INVALID_CIPHERTEXT;
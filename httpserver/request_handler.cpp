@@ -2,12 +2,15 @@
 #include "channel_encryption.hpp"
 #include "http_connection.h"
 #include "oxen_logger.h"
+#include "serialization.h"
 #include "service_node.h"
+#include "signature.h"
 #include "utils.hpp"
 
 #include "https_client.h"
 
 #include <sispopmq/base64.h>
+#include <sispopmq/hex.h>
 #include <nlohmann/json.hpp>
 
 using nlohmann::json;
@@ -16,6 +19,11 @@ namespace oxen {
 
 constexpr size_t MAX_MESSAGE_BODY = 102400; // 100 KB limit
 
+// Signed delete requests are only accepted for this long after being made
+constexpr uint64_t DELETE_REQUEST_WINDOW_MS = 60 * 1000;
+// Limit on the number of hashes in a single `delete` request
+constexpr size_t MAX_DELETE_HASHES = 1000;
+
 std::string to_string(const Response& res) {
 
     std::stringstream ss;
@@ -137,11 +145,12 @@ Response RequestHandler::process_store(const json& params) {
     }
 
     // Do not store message if the PoW provided is invalid
-    std::string messageHash;
-
-    const bool valid_pow =
-        checkPoW(nonce, timestamp, ttl, pk.str(), data, messageHash,
-                 service_node_.get_curr_pow_difficulty());
+    message_hash_t hash{};
+    const bool valid_pow = verify_pow(
+        pow_message_t{nonce, timestamp, ttl, pk.str(), data,
+                      service_node_.get_curr_pow_difficulty()},
+        hash);
+    const std::string messageHash(hash.data(), hash.size());
 #ifndef DISABLE_POW
     if (!valid_pow) {
         OXEN_LOG(debug, "Forbidden. Invalid PoW nonce: {}", nonce);
@@ -306,6 +315,132 @@ Response RequestHandler::process_retrieve(const json& params) {
     return Response{Status::OK, res_body.dump(), ContentType::json};
 }
 
+Response RequestHandler::process_delete(const json& params, bool all) {
+
+    // What is signed: "delete_all" followed by the timestamp for `delete_all`
+    // or "delete" followed by the timestamp and all the hashes for `delete`
+    std::vector<const char*> fields = {"pubKey", "pubkey_ed25519", "signature",
+                                       "timestamp"};
+    if (!all) {
+        fields.push_back("messages");
+    }
+
+    for (const auto& field : fields) {
+        if (!params.contains(field)) {
+            auto msg = fmt::format("invalid json: no `{}` field", field);
+            OXEN_LOG(debug, "{}", msg);
+            return Response{Status::BAD_REQUEST, std::move(msg)};
+        }
+    }
+
+    bool success;
+    const auto pk =
+        user_pubkey_t::create(params["pubKey"].get<std::string>(), success);
+
+    if (!success) {
+
+        auto msg = fmt::format("Pubkey must be {} characters long\n",
+                               get_user_pubkey_size());
+        OXEN_LOG(debug, "{}", msg);
+        return Response{Status::BAD_REQUEST, std::move(msg)};
+    }
+
+    if (!service_node_.is_pubkey_for_us(pk)) {
+        return this->handle_wrong_swarm(pk);
+    }
+
+    tombstone_t tombstone{pk.str(), all, 0, {}};
+
+    // Both kinds of requests expire, so that they can't be replayed later
+    // (e.g. to delete messages stored after the original request). Other
+    // nodes check the signature again, against the timestamp as we print
+    // it, so it has to be in that form.
+    const auto& ts = params.at("timestamp").get_ref<const std::string&>();
+    if (!util::parseTimestamp(ts, DELETE_REQUEST_WINDOW_MS,
+                              tombstone.timestamp) ||
+        std::to_string(tombstone.timestamp) != ts) {
+        OXEN_LOG(debug, "Forbidden. Invalid Timestamp: {}", ts);
+        return Response{Status::NOT_ACCEPTABLE,
+                        "Timestamp error: check your clock\n"};
+    }
+
+    if (!all) {
+        const auto& messages = params.at("messages");
+        if (!messages.is_array() || messages.empty() ||
+            messages.size() > MAX_DELETE_HASHES) {
+            return Response{Status::BAD_REQUEST,
+                            fmt::format("`messages` must be a list of 1 to {} "
+                                        "message hashes\n",
+                                        MAX_DELETE_HASHES)};
+        }
+        for (const auto& hash : messages) {
+            if (!hash.is_string()) {
+                return Response{Status::BAD_REQUEST,
+                                "`messages` must be a list of message hashes\n"};
+            }
+            tombstone.hashes.push_back(hash.get<std::string>());
+        }
+    }
+
+    tombstone.pubkey_ed25519 =
+        params.at("pubkey_ed25519").get_ref<const std::string&>();
+    tombstone.signature = params.at("signature").get_ref<const std::string&>();
+
+    // The request must be signed with the ed25519 counterpart of the
+    // (x25519) key the messages are stored under
+    switch (check_owner_signature(pk.str(), tombstone.pubkey_ed25519,
+                                  tombstone.signature,
+                                  tombstone_signed_data(tombstone))) {
+    case owner_signature_t::OK:
+        break;
+    case owner_signature_t::INVALID_KEY:
+        return Response{Status::BAD_REQUEST, "invalid `pubkey_ed25519`\n"};
+    case owner_signature_t::NOT_OWNER:
+        OXEN_LOG(debug, "Forbidden. Delete key does not match the owner");
+        return Response{Status::FORBIDDEN,
+                        "`pubkey_ed25519` does not match `pubKey`\n"};
+    case owner_signature_t::INVALID_SIGNATURE:
+        OXEN_LOG(debug, "Forbidden. Invalid delete signature");
+        return Response{Status::FORBIDDEN, "invalid signature\n"};
+    }
+
+    uint64_t deleted = 0;
+    if (!service_node_.delete_messages(tombstone, deleted)) {
+        auto msg = fmt::format(
+            "Internal Server Error. Could not delete messages for {}",
+            obfuscate_pubkey(pk.str()));
+        OXEN_LOG(critical, "{}", msg);
+        return Response{Status::INTERNAL_SERVER_ERROR, std::move(msg)};
+    }
+
+    json res_body;
+    res_body["deleted"] = deleted;
+
+    return Response{Status::OK, res_body.dump(), ContentType::json};
+}
+
+static bool is_read_only_method(const std::string& method_name) {
+    return method_name == "retrieve" ||
+           method_name == "get_snodes_for_pubkey" ||
+           method_name == "get_lns_mapping";
+}
+
+bool RequestHandler::client_req_needs_primary(const std::string& req_json) {
+
+    const json body = json::parse(req_json, nullptr, false);
+    if (body == nlohmann::detail::value_t::discarded) {
+        // Rejected just as well by us
+        return false;
+    }
+
+    const auto method_it = body.find("method");
+    if (method_it == body.end() || !method_it->is_string()) {
+        return false;
+    }
+
+    return !is_read_only_method(method_it->get_ref<const std::string&>());
+}
+
 void RequestHandler::process_client_req(
     const std::string& req_json, std::function<void(oxen::Response)> cb) {
 
@@ -335,6 +470,16 @@ void RequestHandler::process_client_req(
         cb(Response{Status::BAD_REQUEST, "invalid json: no `params` field\n"});
     }
 
+    // Workers can't write to the database, and hand such requests to the
+    // primary process before they get here
+    if (service_node_.is_worker() && !is_read_only_method(method_name)) {
+        OXEN_LOG(debug, "Worker can't process client request: {}",
+                 method_name);
+        cb(Response{Status::SERVICE_UNAVAILABLE,
+                    "Service node is busy, please retry\n"});
+        return;
+    }
+
     if (method_name == "store") {
         OXEN_LOG(debug, "Process client request: store");
         cb(this->process_store(*params_it));
@@ -345,6 +490,10 @@ void RequestHandler::process_client_req(
         // TODO: maybe we should check if (some old) clients requests
         // long-polling and then wait before responding to prevent spam
 
+    } else if (method_name == "delete_all" || method_name == "delete") {
+        OXEN_LOG(debug, "Process client request: {}", method_name);
+        cb(this->process_delete(*params_it, method_name == "delete_all"));
+
     } else if (method_name == "get_snodes_for_pubkey") {
         OXEN_LOG(debug, "Process client request: snodes for pubkey");
         cb(this->process_snodes_by_pk(*params_it));
@@ -375,18 +524,22 @@ Response RequestHandler::wrap_proxy_response(const Response& res,
 
     const std::string res_body = json_res.dump();
 
+    using channel_t = ChannelEncryption<std::string>;
+    const auto key = x25519_key_from_hex(client_key);
+
     std::string ciphertext;
 
     if (use_gcm) {
-        ciphertext = sispopmq::to_base64(
-            channel_cipher_.encrypt_gcm(res_body, client_key));
+        ciphertext.resize(channel_t::gcm_encrypted_size(res_body.size()));
+        channel_cipher_.encrypt_gcm(res_body, key, ciphertext.data());
     } else {
-        ciphertext = sispopmq::to_base64(
-            channel_cipher_.encrypt_cbc(res_body, client_key));
+        ciphertext.resize(channel_t::cbc_encrypted_size(res_body.size()));
+        channel_cipher_.encrypt_cbc(res_body, key, ciphertext.data());
     }
 
     // why does this have to be json???
-    return Response{Status::OK, std::move(ciphertext), ContentType::json};
+    return Response{Status::OK, sispopmq::to_base64(ciphertext),
+                    ContentType::json};
 }
 
 void RequestHandler::process_lns_request(
@@ -458,7 +611,11 @@ void RequestHandler::process_proxy_exit(
     std::string plaintext;
 
     try {
-        plaintext = channel_cipher_.decrypt_cbc(payload, client_key);
+        const auto key = x25519_key_from_hex(client_key);
+        plaintext.resize(ChannelEncryption<std::string>::cbc_decrypted_max_size(
+            payload.size()));
+        plaintext.resize(
+            channel_cipher_.decrypt_cbc(payload, key, plaintext.data()));
     } catch (const std::exception& e) {
         auto msg = fmt::format("Invalid ciphertext: {}", e.what());
         OXEN_LOG(debug, "{}", msg);
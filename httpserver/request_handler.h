@@ -98,6 +98,10 @@ class RequestHandler {
     // Query the database and return requested messages
     Response process_retrieve(const nlohmann::json& params);
 
+    // Delete all (`all` = true) or some of the owner's messages, the request
+    // must be signed with the owner's ed25519 key
+    Response process_delete(const nlohmann::json& params, bool all);
+
     void process_onion_exit(const std::string& eph_key,
                             const std::string& payload,
                             std::function<void(oxen::Response)> cb);
@@ -116,6 +120,10 @@ class RequestHandler {
     void process_client_req(const std::string& req_json,
                             std::function<void(oxen::Response)> cb);
 
+    // Whether a client request writes to the database, so that a (read only)
+    // worker has to hand it to the primary process
+    static bool client_req_needs_primary(const std::string& req_json);
+
     // Test only: retrieve all db entires
     Response process_retrieve_all();
 
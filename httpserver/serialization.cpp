@@ -2,22 +2,29 @@
 
 /// TODO: should only be aware of messages
 #include "Item.hpp"
+#include "anti_entropy.h"
 #include "oxen_logger.h"
 #include "service_node.h"
 
+#include <boost/crc.hpp>
 #include <boost/endian/conversion.hpp>
 #include <boost/format.hpp>
+#include <sispopmq/hex.h>
+
+#include <algorithm>
+#include <cstring>
 
 using oxen::storage::Item;
 
 namespace oxen {
 
 template <typename T>
-static T deserialize_integer(std::string::const_iterator& it) {
+static T deserialize_integer(std::string_view& slice) {
 
-    const auto b1 = reinterpret_cast<const T&>(*it);
-    it += sizeof(T);
-    return boost::endian::little_to_native(b1);
+    T res;
+    std::memcpy(&res, slice.data(), sizeof(T));
+    slice.remove_prefix(sizeof(T));
+    return boost::endian::little_to_native(res);
 }
 
 template <typename T>
@@ -27,9 +34,8 @@ static void serialize_integer(std::string& buf, T a) {
     buf.insert(buf.size(), p, sizeof(T));
 }
 
-static void serialize(std::string& buf, const std::string& str) {
+static void serialize(std::string& buf, std::string_view str) {
 
-    buf.reserve(buf.size() + str.size() + 4);
     serialize_integer(buf, str.size());
     buf += str;
 }
@@ -52,89 +58,374 @@ template void serialize_message(std::string& res, const message_t& msg);
 template void serialize_message(std::string& res, const Item& msg);
 
 template <typename T>
-std::vector<std::string> serialize_messages(const std::vector<T>& msgs) {
+static size_t serialized_size(const T& msg) {
+    return msg.pub_key.size() + msg.hash.size() + msg.data.size() +
+           msg.nonce.size() + 3 * sizeof(size_t) + 2 * sizeof(uint64_t);
+}
 
-    std::vector<std::string> res;
+/// v2 batches are: the version byte, records (each prefixed with its varint
+/// length, so that a record we can't make sense of can be skipped) and the
+/// crc32 of everything before it. A record is:
+///   flags, pubkey, hash, ttl, timestamp, nonce, data
+/// where integers are varints, strings are prefixed with their varint
+/// length, and pubkey/hash are sent in binary if they are lowercase hex (as
+/// indicated by the flags).
+
+constexpr uint8_t V2_PUBKEY_BINARY = 1 << 0;
+constexpr uint8_t V2_HASH_BINARY = 1 << 1;
+constexpr uint8_t V2_KNOWN_FLAGS = V2_PUBKEY_BINARY | V2_HASH_BINARY;
+constexpr size_t V2_CHECKSUM_SIZE = sizeof(uint32_t);
+
+static void serialize_varint(std::string& buf, uint64_t a) {
+    while (a >= 0x80) {
+        buf += static_cast<char>((a & 0x7f) | 0x80);
+        a >>= 7;
+    }
+    buf += static_cast<char>(a);
+}
+
+static size_t varint_size(uint64_t a) {
+    size_t res = 1;
+    while (a >= 0x80) {
+        a >>= 7;
+        ++res;
+    }
+    return res;
+}
 
-    std::string buf;
+static void serialize_varstring(std::string& buf, std::string_view str) {
+    serialize_varint(buf, str.size());
+    buf += str;
+}
 
-    constexpr size_t BATCH_SIZE = 500000;
+static size_t varstring_size(size_t len) { return varint_size(len) + len; }
 
-    for (const auto& msg : msgs) {
-        serialize_message(buf, msg);
-        if (buf.size() > BATCH_SIZE) {
-            res.push_back(std::move(buf));
-            buf.clear();
-        }
+static bool is_lowercase_hex(std::string_view str) {
+    return str.size() % 2 == 0 &&
+           std::all_of(str.begin(), str.end(), [](char c) {
+               return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+           });
+}
+
+/// Write `str` in binary if `binary` is set (in which case it must be hex)
+static void serialize_hex_field(std::string& buf, std::string_view str,
+                                bool binary) {
+    if (binary) {
+        serialize_varint(buf, str.size() / 2);
+        sispopmq::from_hex(str.begin(), str.end(), std::back_inserter(buf));
+    } else {
+        serialize_varstring(buf, str);
     }
+}
+
+static uint32_t batch_checksum(std::string_view data) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data.data(), data.size());
+    return crc.checksum();
+}
+
+template <typename T>
+static uint8_t record_flags_v2(const T& msg) {
+    return (is_lowercase_hex(msg.pub_key) ? V2_PUBKEY_BINARY : 0) |
+           (is_lowercase_hex(msg.hash) ? V2_HASH_BINARY : 0);
+}
+
+/// Size of the record, excluding its length prefix
+template <typename T>
+static size_t record_size_v2(const T& msg, uint8_t flags) {
+    const size_t pk_size = (flags & V2_PUBKEY_BINARY) ? msg.pub_key.size() / 2
+                                                      : msg.pub_key.size();
+    const size_t hash_size =
+        (flags & V2_HASH_BINARY) ? msg.hash.size() / 2 : msg.hash.size();
+    return 1 + varstring_size(pk_size) + varstring_size(hash_size) +
+           varint_size(msg.ttl) + varint_size(msg.timestamp) +
+           varstring_size(msg.nonce.size()) + varstring_size(msg.data.size());
+}
+
+template <typename T>
+static void serialize_message_v2(std::string& res, const T& msg,
+                                 uint8_t flags, size_t record_size) {
+
+    serialize_varint(res, record_size);
+    res += static_cast<char>(flags);
+    serialize_hex_field(res, msg.pub_key, flags & V2_PUBKEY_BINARY);
+    serialize_hex_field(res, msg.hash, flags & V2_HASH_BINARY);
+    serialize_varint(res, msg.ttl);
+    serialize_varint(res, msg.timestamp);
+    serialize_varstring(res, msg.nonce);
+    serialize_varstring(res, msg.data);
+}
+
+std::string batch_buffer_pool_t::take(size_t size) {
 
-    if (!buf.empty()) {
-        res.push_back(std::move(buf));
+    auto it = std::find_if(buffers_.begin(), buffers_.end(),
+                           [size](const std::string& buf) {
+                               return buf.capacity() >= size;
+                           });
+    if (it == buffers_.end() && !buffers_.empty()) {
+        it = std::prev(buffers_.end());
     }
 
+    std::string res;
+    if (it != buffers_.end()) {
+        res = std::move(*it);
+        buffers_.erase(it);
+    }
+
+    res.clear();
+    res.reserve(size);
     return res;
 }
 
-template std::vector<std::string>
-serialize_messages(const std::vector<message_t>& msgs);
+void batch_buffer_pool_t::give_back(std::string&& buffer) {
+    if (buffers_.size() < MAX_POOLED_BUFFERS) {
+        buffers_.push_back(std::move(buffer));
+    }
+}
 
-template std::vector<std::string>
-serialize_messages(const std::vector<Item>& msgs);
+batch_encoder_t::batch_encoder_t(batch_format_t format,
+                                 batch_buffer_pool_t& pool)
+    : format_(format), pool_(pool) {}
 
-struct string_view {
+batch_encoder_t::~batch_encoder_t() {
+    for (auto& batch : batches_) {
+        pool_.give_back(std::move(batch));
+    }
+}
 
-    std::string::const_iterator it;
-    const std::string::const_iterator it_end;
+std::vector<std::string> batch_encoder_t::take_batches() {
+    std::vector<std::string> res;
+    res.swap(batches_);
+    message_counts_.clear();
+    return res;
+}
 
-    string_view(const std::string& data)
-        : it(data.begin()), it_end(data.end()) {}
+std::string& batch_encoder_t::next_buffer(size_t size) {
+    return batches_.emplace_back(pool_.take(size));
+}
 
-    size_t size() { return it_end - it; }
+template <typename T>
+void batch_encoder_t::encode(const std::vector<T>& msgs) {
 
-    bool empty() { return it_end <= it; }
-};
+    const bool v2 = format_ == batch_format_t::v2;
 
-static std::optional<std::string> deserialize_string(string_view& slice,
-                                                     size_t len) {
+    // Work out the size of every message (the record size for v2) first,
+    // so that each batch can be written into a buffer of the right size
+    sizes_.clear();
+    flags_.clear();
+    sizes_.reserve(msgs.size());
+    for (const auto& msg : msgs) {
+        if (v2) {
+            flags_.push_back(record_flags_v2(msg));
+            sizes_.push_back(record_size_v2(msg, flags_.back()));
+        } else {
+            sizes_.push_back(serialized_size(msg));
+        }
+    }
+
+    size_t begin = 0;
+    while (begin < msgs.size()) {
+
+        // A batch ends with the message that takes it over BATCH_SIZE
+        size_t size = v2 ? 1 : 0;
+        size_t end = begin;
+        do {
+            size += sizes_[end] + (v2 ? varint_size(sizes_[end]) : 0);
+            ++end;
+        } while (end < msgs.size() && size <= BATCH_SIZE);
+
+        auto& buf = next_buffer(size + (v2 ? V2_CHECKSUM_SIZE : 0));
+
+        if (v2) {
+            buf += static_cast<char>(batch_format_t::v2);
+            for (size_t i = begin; i < end; ++i) {
+                serialize_message_v2(buf, msgs[i], flags_[i], sizes_[i]);
+            }
+            serialize_integer(buf, batch_checksum(buf));
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                serialize_message(buf, msgs[i]);
+            }
+        }
+
+        message_counts_.push_back(end - begin);
+        begin = end;
+    }
+}
+
+template void batch_encoder_t::encode(const std::vector<message_t>& msgs);
+template void batch_encoder_t::encode(const std::vector<Item>& msgs);
+
+template <typename T>
+std::vector<std::string> serialize_messages(const std::vector<T>& msgs,
+                                            batch_format_t format) {
+
+    batch_buffer_pool_t pool;
+    batch_encoder_t encoder(format, pool);
+    encoder.encode(msgs);
+    return encoder.take_batches();
+}
+
+template std::vector<std::string>
+serialize_messages(const std::vector<message_t>& msgs, batch_format_t format);
+
+template std::vector<std::string>
+serialize_messages(const std::vector<Item>& msgs, batch_format_t format);
+
+/// The deserialize_* functions below consume the value from the front of
+/// `slice`; the strings returned refer to the underlying buffer
+
+static std::optional<std::string_view>
+deserialize_string(std::string_view& slice, size_t len) {
 
     if (slice.size() < len) {
         return std::nullopt;
     }
 
-    const auto res = std::string(slice.it, slice.it + len);
-    slice.it += len;
+    const auto res = slice.substr(0, len);
+    slice.remove_prefix(len);
 
     return res;
 }
 
-static std::optional<std::string> deserialize_string(string_view& slice) {
+static std::optional<std::string_view>
+deserialize_string(std::string_view& slice) {
 
     if (slice.size() < sizeof(size_t))
         return std::nullopt;
 
-    const auto len =
-        deserialize_integer<size_t>(slice.it); // already increments `it`!
+    const auto len = deserialize_integer<size_t>(slice);
 
     return deserialize_string(slice, len);
 }
 
-static std::optional<uint64_t> deserialize_uint64(string_view& slice) {
+static std::optional<uint64_t> deserialize_uint64(std::string_view& slice) {
 
     if (slice.size() < sizeof(uint64_t))
         return std::nullopt;
 
-    const auto res = deserialize_integer<uint64_t>(slice.it);
+    return deserialize_integer<uint64_t>(slice);
+}
 
-    return res;
+static std::optional<uint64_t> deserialize_varint(std::string_view& slice) {
+
+    uint64_t res = 0;
+    for (int shift = 0; shift < 64 && !slice.empty(); shift += 7) {
+        const auto byte = static_cast<uint8_t>(slice.front());
+        slice.remove_prefix(1);
+        res |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return res;
+        }
+    }
+
+    return std::nullopt;
 }
 
-std::vector<message_t> deserialize_messages(const std::string& blob) {
+static std::optional<std::string_view>
+deserialize_varstring(std::string_view& slice) {
 
-    OXEN_LOG(trace, "=== Deserializing ===");
+    const auto len = deserialize_varint(slice);
+    if (!len) {
+        return std::nullopt;
+    }
 
-    std::vector<message_t> result;
+    return deserialize_string(slice, *len);
+}
+
+/// Decode a single v2 record, storing the hex representation of binary
+/// fields in `decoded`
+static std::optional<message_view_t>
+deserialize_record_v2(std::string_view record,
+                      std::deque<std::string>& decoded) {
+
+    if (record.empty()) {
+        return std::nullopt;
+    }
+
+    const auto flags = static_cast<uint8_t>(record.front());
+    record.remove_prefix(1);
+
+    // Written by a newer version that uses features we don't know about
+    if (flags & ~V2_KNOWN_FLAGS) {
+        return std::nullopt;
+    }
+
+    auto pk = deserialize_varstring(record);
+    auto hash = pk ? deserialize_varstring(record) : std::nullopt;
+    auto ttl = hash ? deserialize_varint(record) : std::nullopt;
+    auto timestamp = ttl ? deserialize_varint(record) : std::nullopt;
+    auto nonce = timestamp ? deserialize_varstring(record) : std::nullopt;
+    auto data = nonce ? deserialize_varstring(record) : std::nullopt;
+
+    if (!data) {
+        return std::nullopt;
+    }
+
+    if (flags & V2_PUBKEY_BINARY) {
+        pk = decoded.emplace_back(sispopmq::to_hex(*pk));
+    }
+    if (flags & V2_HASH_BINARY) {
+        hash = decoded.emplace_back(sispopmq::to_hex(*hash));
+    }
+
+    if (pk->size() != oxen::get_user_pubkey_size()) {
+        return std::nullopt;
+    }
+
+    return message_view_t{*pk, *data, *hash, *ttl, *timestamp, *nonce};
+}
+
+static bool deserialize_messages_v2(std::string_view blob,
+                                    message_batch_t& batch) {
+
+    if (blob.size() < 1 + V2_CHECKSUM_SIZE) {
+        OXEN_LOG(debug, "Batch is too short");
+        return false;
+    }
+
+    std::string_view trailer = blob.substr(blob.size() - V2_CHECKSUM_SIZE);
+    blob.remove_suffix(V2_CHECKSUM_SIZE);
+
+    if (deserialize_integer<uint32_t>(trailer) != batch_checksum(blob)) {
+        OXEN_LOG(debug, "Batch checksum mismatch");
+        return false;
+    }
+
+    std::string_view slice = blob.substr(1);
+
+    while (!slice.empty()) {
+
+        const auto record = deserialize_varstring(slice);
+        if (!record) {
+            // Can't find where the next record starts
+            OXEN_LOG(debug, "Could not deserialize record length");
+            return false;
+        }
+
+        if (auto msg = deserialize_record_v2(*record, batch.decoded)) {
+            batch.messages.push_back(*msg);
+        } else {
+            batch.skipped++;
+        }
+    }
+
+    return true;
+}
+
+bool deserialize_messages(std::string_view blob, message_batch_t& batch) {
 
-    string_view slice{blob};
+    // Version 1 batches start with a hex pubkey
+    if (!blob.empty() &&
+        blob.front() == static_cast<char>(batch_format_t::v2)) {
+        return deserialize_messages_v2(blob, batch);
+    }
+
+    auto& messages = batch.messages;
+
+    OXEN_LOG(trace, "=== Deserializing ===");
+
+    std::string_view slice = blob;
 
     while (!slice.empty()) {
 
@@ -142,54 +433,279 @@ std::vector<message_t> deserialize_messages(const std::string& blob) {
         auto pk = deserialize_string(slice, oxen::get_user_pubkey_size());
         if (!pk) {
             OXEN_LOG(debug, "Could not deserialize pk");
-            return {};
+            return false;
         }
 
         /// Deserialize Hash
         auto hash = deserialize_string(slice);
         if (!hash) {
             OXEN_LOG(debug, "Could not deserialize hash");
-            return {};
+            return false;
         }
 
         /// Deserialize Data
         auto data = deserialize_string(slice);
         if (!data) {
             OXEN_LOG(debug, "Could not deserialize data");
-            return {};
+            return false;
         }
 
         /// Deserialize TTL
         auto ttl = deserialize_uint64(slice);
         if (!ttl) {
             OXEN_LOG(debug, "Could not deserialize ttl");
-            return {};
+            return false;
         }
 
         /// Deserialize Timestamp
         auto timestamp = deserialize_uint64(slice);
         if (!timestamp) {
             OXEN_LOG(debug, "Could not deserialize timestamp");
-            return {};
+            return false;
         }
 
         /// Deserialize Nonce
         auto nonce = deserialize_string(slice);
         if (!nonce) {
             OXEN_LOG(debug, "Could not deserialize nonce");
-            return {};
+            return false;
         }
 
-        OXEN_LOG(trace, "Deserialized data: {}", *data);
-
         OXEN_LOG(trace, "pk: {}, msg: {}", *pk, *data);
 
-        result.push_back({*pk, *data, *hash, *ttl, *timestamp, *nonce});
+        messages.push_back({*pk, *data, *hash, *ttl, *timestamp, *nonce});
     }
 
     OXEN_LOG(trace, "=== END ===");
 
+    return true;
+}
+
+std::vector<message_t> deserialize_messages(const std::string& blob) {
+
+    message_batch_t batch;
+    if (!deserialize_messages(blob, batch)) {
+        return {};
+    }
+
+    std::vector<message_t> result;
+    result.reserve(batch.messages.size());
+
+    for (const auto& m : batch.messages) {
+        result.emplace_back(std::string(m.pub_key), std::string(m.data),
+                            std::string(m.hash), m.ttl, m.timestamp,
+                            std::string(m.nonce));
+    }
+
     return result;
 }
 
+std::string serialize_snapshot_chunk(const std::vector<Item>& items) {
+
+    std::string res;
+
+    for (const auto& item : items) {
+        serialize(res, item.hash);
+        serialize(res, item.pub_key);
+        serialize_integer(res, item.ttl);
+        serialize_integer(res, item.timestamp);
+        serialize_integer(res, item.expiration_timestamp);
+        serialize(res, item.nonce);
+        serialize(res, item.data);
+    }
+
+    return res;
+}
+
+bool deserialize_snapshot_chunk(const std::string& blob,
+                                std::vector<Item>& items) {
+
+    std::string_view slice = blob;
+
+    while (!slice.empty()) {
+
+        auto hash = deserialize_string(slice);
+        auto pub_key = hash ? deserialize_string(slice) : std::nullopt;
+        auto ttl = pub_key ? deserialize_uint64(slice) : std::nullopt;
+        auto timestamp = ttl ? deserialize_uint64(slice) : std::nullopt;
+        auto expiration =
+            timestamp ? deserialize_uint64(slice) : std::nullopt;
+        auto nonce = expiration ? deserialize_string(slice) : std::nullopt;
+        auto data = nonce ? deserialize_string(slice) : std::nullopt;
+
+        if (!data) {
+            OXEN_LOG(debug, "Could not deserialize snapshot item");
+            return false;
+        }
+
+        items.emplace_back(std::string(*hash), std::string(*pub_key),
+                           *timestamp, *ttl, *expiration, std::string(*nonce),
+                           std::string(*data));
+    }
+
+    return true;
+}
+
+std::string serialize_tombstones(const std::vector<tombstone_t>& tombstones) {
+
+    std::string res;
+
+    for (const auto& tombstone : tombstones) {
+        serialize(res, tombstone.pub_key);
+        serialize_integer(res, static_cast<uint64_t>(tombstone.all));
+        serialize_integer(res, tombstone.timestamp);
+        serialize_integer(res, static_cast<uint64_t>(tombstone.hashes.size()));
+        for (const auto& hash : tombstone.hashes) {
+            serialize(res, hash);
+        }
+        serialize(res, tombstone.pubkey_ed25519);
+        serialize(res, tombstone.signature);
+    }
+
+    return res;
+}
+
+std::string tombstone_signed_data(const tombstone_t& tombstone) {
+
+    std::string res = tombstone.all ? "delete_all" : "delete";
+    res += std::to_string(tombstone.timestamp);
+    for (const auto& hash : tombstone.hashes) {
+        res += hash;
+    }
+
+    return res;
+}
+
+bool deserialize_tombstones(const std::string& blob,
+                            std::vector<tombstone_t>& tombstones) {
+
+    std::string_view slice = blob;
+
+    while (!slice.empty()) {
+
+        auto pub_key = deserialize_string(slice);
+        auto all = pub_key ? deserialize_uint64(slice) : std::nullopt;
+        auto timestamp = all ? deserialize_uint64(slice) : std::nullopt;
+        auto count = timestamp ? deserialize_uint64(slice) : std::nullopt;
+
+        if (!count) {
+            OXEN_LOG(debug, "Could not deserialize tombstone");
+            return false;
+        }
+
+        tombstone_t tombstone{std::string(*pub_key), *all != 0, *timestamp, {}};
+
+        for (uint64_t i = 0; i < *count; ++i) {
+            auto hash = deserialize_string(slice);
+            if (!hash) {
+                OXEN_LOG(debug, "Could not deserialize tombstone hash");
+                return false;
+            }
+            tombstone.hashes.emplace_back(*hash);
+        }
+
+        auto pubkey_ed25519 = deserialize_string(slice);
+        auto signature =
+            pubkey_ed25519 ? deserialize_string(slice) : std::nullopt;
+        if (!signature) {
+            OXEN_LOG(debug, "Could not deserialize tombstone signature");
+            return false;
+        }
+        tombstone.pubkey_ed25519 = *pubkey_ed25519;
+        tombstone.signature = *signature;
+
+        tombstones.push_back(std::move(tombstone));
+    }
+
+    return true;
+}
+
+std::string serialize_digests(const std::vector<bucket_digest_t>& digests) {
+
+    std::string res;
+    res.reserve(digests.size() * 3 * sizeof(uint64_t));
+
+    for (const auto& bucket : digests) {
+        serialize_integer(res, bucket.start);
+        serialize_integer(res, bucket.count);
+        serialize_integer(res, bucket.digest);
+    }
+
+    return res;
+}
+
+bool deserialize_digests(std::string_view blob,
+                         std::vector<bucket_digest_t>& digests) {
+
+    if (blob.size() % (3 * sizeof(uint64_t)) != 0) {
+        OXEN_LOG(debug, "Could not deserialize digests");
+        return false;
+    }
+
+    digests.reserve(digests.size() + blob.size() / (3 * sizeof(uint64_t)));
+    while (!blob.empty()) {
+        bucket_digest_t bucket;
+        bucket.start = deserialize_integer<uint64_t>(blob);
+        bucket.count = deserialize_integer<uint64_t>(blob);
+        bucket.digest = deserialize_integer<uint64_t>(blob);
+        digests.push_back(bucket);
+    }
+
+    return true;
+}
+
+std::string serialize_integers(const std::vector<uint64_t>& values) {
+
+    std::string res;
+    res.reserve(values.size() * sizeof(uint64_t));
+
+    for (const auto value : values) {
+        serialize_integer(res, value);
+    }
+
+    return res;
+}
+
+bool deserialize_integers(std::string_view blob,
+                          std::vector<uint64_t>& values) {
+
+    if (blob.size() % sizeof(uint64_t) != 0) {
+        OXEN_LOG(debug, "Could not deserialize integers");
+        return false;
+    }
+
+    values.reserve(values.size() + blob.size() / sizeof(uint64_t));
+    while (!blob.empty()) {
+        values.push_back(deserialize_integer<uint64_t>(blob));
+    }
+
+    return true;
+}
+
+std::string serialize_hashes(const std::vector<std::string>& hashes) {
+
+    std::string res;
+
+    for (const auto& hash : hashes) {
+        serialize(res, hash);
+    }
+
+    return res;
+}
+
+bool deserialize_hashes(std::string_view blob,
+                        std::vector<std::string>& hashes) {
+
+    while (!blob.empty()) {
+        auto hash = deserialize_string(blob);
+        if (!hash) {
+            OXEN_LOG(debug, "Could not deserialize hash");
+            return false;
+        }
+        hashes.emplace_back(*hash);
+    }
+
+    return true;
+}
+
 } // namespace oxen
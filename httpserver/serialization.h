@@ -1,22 +1,156 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "oxen_common.h"
+
 namespace oxen {
 
 namespace storage {
 struct Item;
 }
 
-struct message_t;
+struct bucket_digest_t;
+
+/// Formats of message batches relayed to swarm members. Peers start with v1
+/// and switch to v2 once they have seen the recipient accept it.
+enum class batch_format_t : uint8_t {
+    v1 = 1,
+    // Binary fields, varints and a checksum
+    v2 = 2,
+};
+
+constexpr batch_format_t LATEST_BATCH_FORMAT = batch_format_t::v2;
+
+/// Included in the reply to a relayed batch by nodes that accept batches
+/// signed by the sender (sent as a second part of the request)
+constexpr std::string_view SIGNED_BATCHES_TAG = "signed";
+
+/// Messages of a relayed batch. The views refer either to the batch itself
+/// or to `decoded` (fields that are sent in binary), so the batch must
+/// outlive this.
+struct message_batch_t {
+    std::vector<message_view_t> messages;
+    std::deque<std::string> decoded;
+    // Number of (v2) records that were dropped as malformed
+    size_t skipped = 0;
+};
 
 template <typename T>
 void serialize_message(std::string& buf, const T& msg);
 
+/// Buffers kept around (up to a limit) to serialize batches into. Not thread
+/// safe.
+class batch_buffer_pool_t {
+
+    static constexpr size_t MAX_POOLED_BUFFERS = 8;
+
+    std::vector<std::string> buffers_;
+
+  public:
+    /// Get an empty buffer, preferably one that can already hold `size`
+    /// bytes
+    std::string take(size_t size);
+
+    void give_back(std::string&& buffer);
+
+    size_t size() const { return buffers_.size(); }
+};
+
+/// Serializes messages into batches, writing each one straight into a buffer
+/// of the right size. The buffers are taken from (and, unless the batches
+/// are taken, given back to) `pool`.
+class batch_encoder_t {
+
+    // Batches are cut after the message that takes them over this size
+    static constexpr size_t BATCH_SIZE = 500000;
+
+    const batch_format_t format_;
+    batch_buffer_pool_t& pool_;
+    std::vector<std::string> batches_;
+    // Number of messages in each of `batches_`
+    std::vector<size_t> message_counts_;
+    // Per message scratch space, reused between calls to `encode`
+    std::vector<size_t> sizes_;
+    std::vector<uint8_t> flags_;
+
+    std::string& next_buffer(size_t size);
+
+  public:
+    batch_encoder_t(batch_format_t format, batch_buffer_pool_t& pool);
+    ~batch_encoder_t();
+
+    batch_encoder_t(const batch_encoder_t&) = delete;
+    batch_encoder_t& operator=(const batch_encoder_t&) = delete;
+
+    /// Append batches for `msgs`
+    template <typename T>
+    void encode(const std::vector<T>& msgs);
+
+    const std::vector<std::string>& batches() const { return batches_; }
+
+    const std::vector<size_t>& message_counts() const {
+        return message_counts_;
+    }
+
+    std::vector<std::string> take_batches();
+};
+
 template <typename T>
-std::vector<std::string> serialize_messages(const std::vector<T>& msgs);
+std::vector<std::string>
+serialize_messages(const std::vector<T>& msgs,
+                   batch_format_t format = batch_format_t::v1);
 
 std::vector<message_t> deserialize_messages(const std::string& blob);
 
+/// Same as above, but supports all batch formats and avoids copying the
+/// messages out of `blob`. Return false if the batch as a whole is
+/// malformed; malformed v2 records are skipped.
+bool deserialize_messages(std::string_view blob, message_batch_t& batch);
+
+std::string serialize_tombstones(const std::vector<tombstone_t>& tombstones);
+
+/// What the owner signs to request a deletion: "delete_all" followed by the
+/// timestamp, or "delete" followed by the timestamp and all the hashes
+std::string tombstone_signed_data(const tombstone_t& tombstone);
+
+/// Return false (leaving `tombstones` in unspecified state) if `blob` is
+/// malformed
+bool deserialize_tombstones(const std::string& blob,
+                            std::vector<tombstone_t>& tombstones);
+
+std::string serialize_digests(const std::vector<bucket_digest_t>& digests);
+
+/// Return false (leaving `digests` in unspecified state) if `blob` is
+/// malformed
+bool deserialize_digests(std::string_view blob,
+                         std::vector<bucket_digest_t>& digests);
+
+/// Lists of integers, such as bucket starts or message fingerprints
+std::string serialize_integers(const std::vector<uint64_t>& values);
+
+/// Return false (leaving `values` in unspecified state) if `blob` is
+/// malformed
+bool deserialize_integers(std::string_view blob,
+                          std::vector<uint64_t>& values);
+
+std::string serialize_hashes(const std::vector<std::string>& hashes);
+
+/// Return false (leaving `hashes` in unspecified state) if `blob` is
+/// malformed
+bool deserialize_hashes(std::string_view blob,
+                        std::vector<std::string>& hashes);
+
+/// Serialize items exactly as they are stored in the database (including
+/// their expiration), as used for bootstrap snapshots
+std::string serialize_snapshot_chunk(const std::vector<storage::Item>& items);
+
+/// Return false (leaving `items` in unspecified state) if `blob` is malformed
+bool deserialize_snapshot_chunk(const std::string& blob,
+                                std::vector<storage::Item>& items);
+
 } // namespace oxen
@@ -24,14 +24,23 @@
 #include "dns_text_records.h"
 
 #include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <unordered_set>
 #include <string_view>
 
 #include <boost/bind/bind.hpp>
 
 using json = nlohmann::json;
 using oxen::storage::Item;
+using oxen::storage::ItemView;
+using oxen::storage::OutboxItem;
+using oxen::storage::OutboxKind;
+using oxen::storage::OutboxLag;
 using std::string_view;
 using namespace std::chrono_literals;
 
@@ -41,7 +50,72 @@ using http_server::connection_t;
 constexpr std::array<std::chrono::seconds, 8> RETRY_INTERVALS = {
     1s, 5s, 10s, 20s, 40s, 80s, 160s, 320s};
 
-constexpr std::chrono::milliseconds RELAY_INTERVAL = 350ms;
+// Buffered messages are relayed once they add up to RELAY_FLUSH_BYTES, or
+// when the oldest of them has waited for RELAY_MAX_DELAY
+constexpr size_t RELAY_FLUSH_BYTES = 256 * 1024;
+constexpr std::chrono::milliseconds RELAY_MAX_DELAY = 100ms;
+// Includes the first attempt (for batches that are not in the outbox)
+constexpr int RELAY_MAX_ATTEMPTS = 3;
+constexpr std::chrono::seconds OUTBOX_CHECK_INTERVAL = 1s;
+// Limits how much is read from the outbox at once
+constexpr int OUTBOX_MAX_RESENDS = 64;
+// Beyond these, a peer is left to catch up through our log and anti-entropy
+// rather than the outbox
+constexpr std::chrono::milliseconds OUTBOX_MAX_AGE = 1h;
+constexpr uint64_t OUTBOX_MAX_PEER_BYTES = 64 * 1024 * 1024;
+// Outcomes of sending outbox batches are written once a second, or once there
+// are this many of them
+constexpr size_t OUTBOX_MAX_PENDING_RESULTS = 256;
+// The maximum TTL: no message lives for longer than this after its timestamp
+constexpr std::chrono::milliseconds MAX_MESSAGE_TTL = 14 * 24h;
+// Deletions are resent for as long as the messages they delete may live
+constexpr std::chrono::milliseconds TOMBSTONE_RELAY_TIME = MAX_MESSAGE_TTL;
+
+constexpr std::chrono::seconds ANTI_ENTROPY_INTERVAL = 5min;
+// Recent messages are left out, as they may still be on their way
+constexpr std::chrono::milliseconds ANTI_ENTROPY_SETTLE_TIME = 5min;
+// Limit on the messages sent (and fetched) by a single round
+constexpr size_t ANTI_ENTROPY_MAX_MESSAGES = 1000;
+// Limit on the fingerprints in a digests reply (and on those we compare them
+// with); differing buckets past it are left for later rounds
+constexpr size_t ANTI_ENTROPY_MAX_FINGERPRINTS = 20000;
+// Limit on the message data in a fetch reply
+constexpr size_t ANTI_ENTROPY_MAX_FETCH_BYTES = 8 * 1024 * 1024;
+
+// Threads for CPU-heavy work such as verifying the messages of incoming
+// batches
+static const size_t CPU_POOL_THREADS =
+    std::max(1u, std::thread::hardware_concurrency());
+// Smallest number of messages worth verifying as a separate task
+constexpr size_t POW_VERIFY_MIN_TASK_SIZE = 64;
+// One in this many messages of a batch signed by a swarm member is still hashed
+// and has its PoW checked
+constexpr uint64_t SIGNED_BATCH_AUDIT_RATE = 100;
+// How long the signatures of a swarm member that failed an audit are ignored
+constexpr std::chrono::minutes SIGNER_DISTRUST_TIME = 1h;
+
+constexpr std::chrono::seconds LOG_SYNC_INTERVAL = 30s;
+// Number of log entries read (and messages fetched) at a time
+constexpr int LOG_PAGE_SIZE = 1000;
+// A member that is further behind the log of a peer than this skips ahead,
+// leaving older messages to bootstrapping and anti-entropy
+constexpr uint64_t LOG_MAX_BEHIND = 100000;
+// Batches for a peer are held back while this much is waiting for the peer's
+// reply, and the oldest of them are dropped once this much is held back
+constexpr size_t RELAY_MAX_INFLIGHT_BYTES = 4 * 1024 * 1024;
+constexpr size_t RELAY_MAX_BACKLOG_BYTES = 32 * 1024 * 1024;
+
+// Bootstrapping other swarms reads our messages in pages of this much message
+// data, and checks this often whether the peers have taken the previous ones
+constexpr size_t BOOTSTRAP_PAGE_BYTES = 16 * 1024 * 1024;
+constexpr std::chrono::milliseconds BOOTSTRAP_DRAIN_INTERVAL = 100ms;
+// Smallest number of messages worth mapping to their swarms as a separate task
+constexpr size_t PARTITION_MIN_TASK_SIZE = 1024;
+
+// Snapshot chunks are limited by the size of message data they carry
+constexpr size_t SNAPSHOT_CHUNK_SIZE = 4 * 1024 * 1024;
+constexpr int SNAPSHOT_MAX_ATTEMPTS = 3;
+constexpr std::chrono::seconds SNAPSHOT_REQUEST_TIMEOUT = 60s;
 
 static void make_sn_request(boost::asio::io_context& ioc, const sn_record_t& sn,
                             const std::shared_ptr<request_t>& req,
@@ -116,9 +190,9 @@ static std::shared_ptr<request_t> make_push_all_request(std::string&& data) {
     return build_post_request("/swarms/push_batch/v1", std::move(data));
 }
 
-static bool verify_message(const message_t& msg,
-                           const std::vector<pow_difficulty_t> history,
-                           const char** error_message = nullptr) {
+/// The checks of `verify_messages` that don't involve PoW
+static bool verify_expiry(const message_view_t& msg,
+                          const char** error_message = nullptr) {
     if (!util::validateTTL(msg.ttl)) {
         if (error_message)
             *error_message = "Provided TTL is not valid";
@@ -129,24 +203,71 @@ static bool verify_message(const message_t& msg,
             *error_message = "Provided timestamp is not valid";
         return false;
     }
-    std::string hash;
-#ifndef DISABLE_POW
-    const int difficulty =
-        get_valid_difficulty(std::to_string(msg.timestamp), history);
-    if (!checkPoW(msg.nonce, std::to_string(msg.timestamp),
-                  std::to_string(msg.ttl), msg.pub_key, msg.data, hash,
-                  difficulty)) {
-        if (error_message)
-            *error_message = "Provided PoW nonce is not valid";
-        return false;
+    return true;
+}
+
+/// Decimal timestamp and ttl of a message, which its PoW covers
+struct pow_fields_t {
+    char timestamp[20];
+    char ttl[20];
+};
+
+static pow_message_t to_pow_message(const message_view_t& msg,
+                                    const pow_difficulty_timeline_t& timeline,
+                                    pow_fields_t& fields) {
+    const auto timestamp_end =
+        std::to_chars(std::begin(fields.timestamp),
+                      std::end(fields.timestamp), msg.timestamp)
+            .ptr;
+    const auto ttl_end =
+        std::to_chars(std::begin(fields.ttl), std::end(fields.ttl), msg.ttl)
+            .ptr;
+
+    pow_message_t pow_msg;
+    pow_msg.nonce = msg.nonce;
+    pow_msg.timestamp =
+        std::string_view(fields.timestamp, timestamp_end - fields.timestamp);
+    pow_msg.ttl = std::string_view(fields.ttl, ttl_end - fields.ttl);
+    pow_msg.recipient = msg.pub_key;
+    pow_msg.data = msg.data;
+    pow_msg.difficulty = timeline.difficulty_at(msg.timestamp);
+    return pow_msg;
+}
+
+/// Fully verify the messages of `push` listed in its `to_verify[begin, end)`
+/// (their hash and PoW), checked as a batch
+static void verify_messages(pending_push_t& push, size_t begin, size_t end) {
+
+    std::vector<pow_fields_t> fields(end - begin);
+    std::vector<pow_message_t> pow_msgs;
+    std::vector<size_t> indices;
+    pow_msgs.reserve(end - begin);
+    indices.reserve(end - begin);
+
+    for (size_t j = begin; j < end; ++j) {
+        const size_t i = push.to_verify[j];
+        const auto& msg = *push.messages[i];
+        if (!verify_expiry(msg)) {
+            push.valid[i] = false;
+            continue;
+        }
+        pow_msgs.push_back(
+            to_pow_message(msg, *push.pow_timeline, fields[j - begin]));
+        indices.push_back(i);
     }
-#endif
-    if (hash != msg.hash) {
-        if (error_message)
-            *error_message = "Incorrect hash provided";
-        return false;
+
+    std::vector<message_hash_t> hashes;
+    std::vector<char> valid;
+    verify_batch(pow_msgs, hashes, valid);
+
+    for (size_t k = 0; k < indices.size(); ++k) {
+        const size_t i = indices[k];
+        const std::string_view hash(hashes[k].data(), hashes[k].size());
+        push.valid[i] = valid[k] && push.messages[i]->hash == hash;
+        if (!push.valid[i]) {
+            push.forged++;
+        }
     }
-    return true;
 }
 
 ServiceNode::ServiceNode(boost::asio::io_context& ioc,
@@ -155,15 +276,18 @@ ServiceNode::ServiceNode(boost::asio::io_context& ioc,
                          const oxend_key_pair_t& oxend_key_pair,
                          const std::string& ed25519hex,
                          const std::string& db_location,
-                         OxendClient& oxend_client, const bool force_start)
-    : ioc_(ioc), worker_ioc_(worker_ioc),
-      db_(std::make_unique<Database>(ioc, db_location)),
+                         const db_options_t& db_options,
+                         OxendClient& oxend_client, const bool force_start,
+                         const bool worker, const bool sign_relays)
+    : ioc_(ioc), worker_ioc_(worker_ioc), cpu_pool_(CPU_POOL_THREADS),
+      db_(std::make_unique<Database>(ioc, db_location, db_options)),
       swarm_update_timer_(ioc), oxend_ping_timer_(ioc),
       stats_cleanup_timer_(ioc), pow_update_timer_(worker_ioc),
       check_version_timer_(worker_ioc), peer_ping_timer_(ioc),
-      relay_timer_(ioc), oxend_key_pair_(oxend_key_pair),
+      relay_timer_(ioc), outbox_timer_(ioc), anti_entropy_timer_(ioc),
+      log_sync_timer_(ioc), oxend_key_pair_(oxend_key_pair),
       lmq_server_(lmq_server), oxend_client_(oxend_client),
-      force_start_(force_start) {
+      force_start_(force_start), worker_(worker), sign_relays_(sign_relays) {
 
     const auto addr = sispopmq::to_base32z(
             oxend_key_pair_.public_key.begin(),
@@ -189,10 +313,14 @@ ServiceNode::ServiceNode(boost::asio::io_context& ioc,
 #endif
 
     swarm_timer_tick();
-    oxend_ping_timer_tick();
     cleanup_timer_tick();
 
-    ping_peers_tick();
+    // Workers only serve reads, the primary process is the one that other
+    // nodes (and Oxend) talk to
+    if (!worker_) {
+        oxend_ping_timer_tick();
+        ping_peers_tick();
+    }
 
     worker_thread_ = std::thread([this]() { worker_ioc_.run(); });
     boost::asio::post(worker_ioc_, [this]() {
@@ -435,8 +563,10 @@ bool ServiceNode::snode_ready(std::string* reason) {
 }
 
 ServiceNode::~ServiceNode() {
+    this->flush_outbox_results();
     worker_ioc_.stop();
     worker_thread_.join();
+    cpu_pool_.join();
 };
 
 void ServiceNode::send_onion_to_sn_v1(const sn_record_t& sn,
@@ -502,21 +632,299 @@ void ServiceNode::send_to_sn(const sn_record_t& sn, ss_client::ReqMethod method,
     }
 }
 
-void ServiceNode::relay_data_reliable(const std::string& blob,
-                                      const sn_record_t& sn) const {
+shared_batch_t ServiceNode::share_batch(std::string&& batch) const {
+
+    return std::shared_ptr<std::string>(
+        new std::string(std::move(batch)), [this](std::string* buf) {
+            std::lock_guard guard(sn_mutex_);
+            batch_buffers_.give_back(std::move(*buf));
+            delete buf;
+        });
+}
+
+static std::string signature_to_base64(const signature& sig) {
+
+    std::string raw_sig;
+    raw_sig.reserve(sig.c.size() + sig.r.size());
+    raw_sig.insert(raw_sig.begin(), sig.c.begin(), sig.c.end());
+    raw_sig.insert(raw_sig.end(), sig.r.begin(), sig.r.end());
+
+    return sispopmq::to_base64(raw_sig);
+}
+
+std::string ServiceNode::sign_batch(const std::string& batch) const {
+
+    if (!sign_relays_)
+        return "";
+
+    return signature_to_base64(
+        generate_signature(hash_data(batch), oxend_key_pair_));
+}
+
+/// Compressed copy of a relayed batch, or null if it doesn't compress well
+static shared_batch_t compress_batch(const std::string& batch) {
+
+    std::string compressed;
+    if (!compress(PREFERRED_COMPRESSION, batch, compressed)) {
+        return nullptr;
+    }
+    return std::make_shared<const std::string>(std::move(compressed));
+}
+
+/// Parse the whole of `str` as a decimal number
+template <typename T>
+static bool parse_number(std::string_view str, T& value) {
+    const auto res =
+        std::from_chars(str.data(), str.data() + str.size(), value);
+    return res.ec == std::errc() && res.ptr == str.data() + str.size();
+}
+
+/// Time (in ms) of the next attempt to send an outbox batch that failed
+/// `attempts` times
+static uint64_t next_outbox_attempt(uint32_t attempts) {
+    const auto delay =
+        RETRY_INTERVALS[std::min<size_t>(attempts, RETRY_INTERVALS.size() - 1)];
+    return util::get_time_ms() +
+           std::chrono::duration_cast<std::chrono::milliseconds>(delay).count();
+}
+
+void ServiceNode::relay_data_reliable(relay_batch_t batch,
+                                      const sn_record_t& sn,
+                                      int attempt) const {
 
-    auto reply_callback = [](bool success, std::vector<std::string> data) {
+    if (batch.kind == OutboxKind::TOMBSTONES) {
+        this->relay_tombstones_reliable(std::move(batch), sn);
+        return;
+    }
+
+    auto reply_callback = [this, batch, sn, attempt](
+                              bool success, std::vector<std::string> data) {
         if (!success) {
-            OXEN_LOG(error, "Failed to send batch data: time-out");
+            std::lock_guard guard(sn_mutex_);
+            all_stats_.record_request_failed(sn);
+            if (batch.outbox_id != 0) {
+                OXEN_LOG(debug, "Failed to send batch data to {}, will retry "
+                                "from the outbox",
+                         sn);
+                this->record_outbox_result(sn, batch, false,
+                                           batch.attempts + 1);
+                this->on_batch_relayed(sn, batch);
+            } else if (attempt < RELAY_MAX_ATTEMPTS) {
+                // Backing off, as retrying right away is likely to fail the
+                // same way (and keeps the peer busy if it is overloaded)
+                const auto delay = RETRY_INTERVALS[std::min<size_t>(
+                    attempt - 1, RETRY_INTERVALS.size() - 1)];
+                OXEN_LOG(debug,
+                         "Failed to send batch data to {}, retrying in {} secs",
+                         sn, delay.count());
+                auto timer = std::make_shared<boost::asio::steady_timer>(ioc_);
+                timer->expires_after(delay);
+                timer->async_wait([this, timer, batch, sn, attempt](
+                                      const boost::system::error_code& ec) {
+                    if (!ec) {
+                        this->relay_data_reliable(batch, sn, attempt + 1);
+                    }
+                });
+            } else {
+                OXEN_LOG(error, "Failed to send batch data: time-out");
+                all_stats_.record_push_failed(sn);
+                this->on_batch_relayed(sn, batch);
+            }
+            return;
+        }
+
+        // Nodes that support newer formats reply with the latest one, the
+        // number of messages they accepted, whether they accept signed
+        // batches and the compression they accept; older ones (including a
+        // peer that got downgraded) reply with nothing
+        auto format = batch_format_t::v1;
+        if (!data.empty() &&
+            data[0] == std::to_string(static_cast<int>(batch_format_t::v2))) {
+            format = batch_format_t::v2;
+        }
+
+        std::optional<uint64_t> accepted;
+        uint64_t count;
+        if (data.size() >= 2 && parse_number(data[1], count)) {
+            accepted = count;
+        }
+
+        std::lock_guard guard(sn_mutex_);
+        peer_batch_formats_[sn.pubkey_x25519_bin()] = format;
+        if (data.size() >= 3 && data[2] == SIGNED_BATCHES_TAG) {
+            peers_accepting_signatures_.insert(sn.pubkey_x25519_bin());
+        } else {
+            peers_accepting_signatures_.erase(sn.pubkey_x25519_bin());
         }
+        compression_t compression;
+        if (data.size() >= 4 && parse_compression(data[3], compression)) {
+            peer_compression_[sn.pubkey_x25519_bin()] = compression;
+        } else {
+            peer_compression_.erase(sn.pubkey_x25519_bin());
+        }
+        if (batch.outbox_id != 0) {
+            this->record_outbox_result(sn, batch, true);
+        }
+        all_stats_.record_batch_acked(sn, batch.messages, accepted,
+                                      batch.data->size());
+        this->on_batch_relayed(sn, batch);
     };
 
     OXEN_LOG(debug, "Relaying data to: {}", sn);
 
-    auto req = ss_client::Request{blob, {}};
+    bool signed_batch = false;
+    if (!batch.signature.empty()) {
+        std::lock_guard guard(sn_mutex_);
+        // Older nodes would take the signature for part of the batch
+        signed_batch =
+            peers_accepting_signatures_.count(sn.pubkey_x25519_bin()) > 0;
+    }
+
+    const bool compressed =
+        batch.compressed && this->peer_accepts_compression(sn);
+
+    {
+        std::lock_guard guard(sn_mutex_);
+        relay_bytes_uncompressed_ += batch.data->size();
+        relay_bytes_sent_ +=
+            compressed ? batch.compressed->size() : batch.data->size();
+    }
+
+    // Sent directly (rather than through `send_to_sn`) to avoid making a
+    // copy of the batch for every peer
+    if (compressed) {
+        // Compressed batches come as [batch, signature (or empty), codec]
+        lmq_server_->request(
+            sn.pubkey_x25519_bin(), "sn.data", std::move(reply_callback),
+            *batch.compressed, signed_batch ? batch.signature : "",
+            compression_to_string(PREFERRED_COMPRESSION));
+    } else if (signed_batch) {
+        lmq_server_->request(sn.pubkey_x25519_bin(), "sn.data",
+                             std::move(reply_callback), *batch.data,
+                             batch.signature);
+    } else {
+        lmq_server_->request(sn.pubkey_x25519_bin(), "sn.data",
+                             std::move(reply_callback), *batch.data);
+    }
+}
+
+void ServiceNode::relay_tombstones_reliable(relay_batch_t batch,
+                                            const sn_record_t& sn) const {
+
+    auto reply_callback = [this, batch, sn](bool success,
+                                            std::vector<std::string> data) {
+        std::lock_guard guard(sn_mutex_);
+        if (success && !data.empty() && data[0] == "OK") {
+            if (batch.outbox_id != 0) {
+                this->record_outbox_result(sn, batch, true);
+            }
+        } else {
+            if (!success) {
+                all_stats_.record_request_failed(sn);
+            }
+            if (batch.outbox_id != 0) {
+                OXEN_LOG(debug, "Failed to relay deletions to {}, will retry "
+                                "from the outbox",
+                         sn);
+                this->record_outbox_result(sn, batch, false,
+                                           batch.attempts + 1);
+            } else {
+                OXEN_LOG(warn, "Failed to relay deletions to {}", sn);
+            }
+        }
+        this->on_batch_relayed(sn, batch);
+    };
+
+    OXEN_LOG(debug, "Relaying deletions to: {}", sn);
+
+    lmq_server_->request(sn.pubkey_x25519_bin(), "sn.delete",
+                         std::move(reply_callback), *batch.data);
+}
+
+void ServiceNode::queue_batch(const sn_record_t& sn,
+                              relay_batch_t batch) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    auto& peer = relay_peers_[sn.pubkey_x25519_bin()];
+    batch.queued_at = std::chrono::steady_clock::now();
+    if (batch.outbox_id == 0) {
+        peer.transient_messages += batch.messages;
+        peer.transient_since.insert(batch.queued_at);
+    }
+    peer.backlog_bytes += batch.data->size();
+    peer.backlog.push_back(std::move(batch));
+
+    // The oldest batches go first: those in the outbox are resent from
+    // there, the others are left to anti-entropy and our log
+    size_t shed = 0;
+    while (peer.backlog_bytes > RELAY_MAX_BACKLOG_BYTES &&
+           peer.backlog.size() > 1) {
+        auto& oldest = peer.backlog.front();
+        if (oldest.outbox_id != 0) {
+            this->record_outbox_result(sn, oldest, false, oldest.attempts);
+        } else {
+            peer.transient_messages -=
+                std::min<uint64_t>(peer.transient_messages, oldest.messages);
+            const auto since = peer.transient_since.find(oldest.queued_at);
+            if (since != peer.transient_since.end()) {
+                peer.transient_since.erase(since);
+            }
+        }
+        peer.backlog_bytes -= oldest.data->size();
+        peer.backlog.pop_front();
+        shed++;
+    }
+
+    if (shed > 0) {
+        relay_batches_shed_ += shed;
+        OXEN_LOG(warn, "{} is falling behind, dropped {} queued batches", sn,
+                 shed);
+    }
+
+    this->send_queued_batches(sn);
+}
+
+void ServiceNode::send_queued_batches(const sn_record_t& sn) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    auto& peer = relay_peers_[sn.pubkey_x25519_bin()];
+
+    while (!peer.backlog.empty() &&
+           peer.inflight_bytes < RELAY_MAX_INFLIGHT_BYTES) {
+        auto batch = std::move(peer.backlog.front());
+        peer.backlog.pop_front();
+        peer.backlog_bytes -= batch.data->size();
+        peer.inflight_bytes += batch.data->size();
+        this->relay_data_reliable(std::move(batch), sn);
+    }
+}
+
+void ServiceNode::on_batch_relayed(const sn_record_t& sn,
+                                   const relay_batch_t& batch) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    const auto it = relay_peers_.find(sn.pubkey_x25519_bin());
+    if (it == relay_peers_.end())
+        return;
+
+    auto& peer = it->second;
+    peer.inflight_bytes -= std::min(peer.inflight_bytes, batch.data->size());
+    if (batch.outbox_id == 0) {
+        peer.transient_messages -=
+            std::min<uint64_t>(peer.transient_messages, batch.messages);
+        const auto since = peer.transient_since.find(batch.queued_at);
+        if (since != peer.transient_since.end()) {
+            peer.transient_since.erase(since);
+        }
+    }
+    this->send_queued_batches(sn);
 
-    this->send_to_sn(sn, ss_client::ReqMethod::DATA, std::move(req),
-                     reply_callback);
+    if (peer.inflight_bytes == 0 && peer.backlog.empty()) {
+        relay_peers_.erase(it);
+    }
 }
 
 void ServiceNode::record_proxy_request() { all_stats_.bump_proxy_requests(); }
@@ -541,8 +949,17 @@ bool ServiceNode::process_store(const message_t& msg) {
     this->save_if_new(msg);
 
     // Instead of sending the messages immediatly, store them in a buffer
-    // and periodically send all messages from there as batches
+    // and send them as batches once there is enough of them (or the oldest
+    // one has waited long enough)
     this->relay_buffer_.push_back(msg);
+    relay_buffer_bytes_ += msg.pub_key.size() + msg.hash.size() +
+                           msg.data.size() + msg.nonce.size();
+
+    if (relay_buffer_bytes_ >= RELAY_FLUSH_BYTES) {
+        this->relay_buffered_messages();
+    } else {
+        this->schedule_relay();
+    }
 
     return true;
 }
@@ -557,16 +974,31 @@ void ServiceNode::save_if_new(const message_t& msg) {
     }
 }
 
-void ServiceNode::save_bulk(const std::vector<Item>& items) {
+bool ServiceNode::save_bulk(const std::vector<ItemView>& items,
+                            uint64_t& stored) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!db_->bulk_store(items, stored)) {
+        OXEN_LOG(error, "failed to save batch to the database");
+        return false;
+    }
+
+    OXEN_LOG(trace, "saved messages count: {}", items.size());
+    return true;
+}
+
+bool ServiceNode::save_bulk(const std::vector<Item>& items) {
 
     std::lock_guard guard(sn_mutex_);
 
     if (!db_->bulk_store(items)) {
         OXEN_LOG(error, "failed to save batch to the database");
-        return;
+        return false;
     }
 
     OXEN_LOG(trace, "saved messages count: {}", items.size());
+    return true;
 }
 
 void ServiceNode::on_bootstrap_update(block_update_t&& bu) {
@@ -696,9 +1128,18 @@ void ServiceNode::on_swarm_update(block_update_t&& bu) {
             // again
             OXEN_LOG(info, "Storage server is now active!");
 
-            relay_timer_.expires_after(RELAY_INTERVAL);
-            relay_timer_.async_wait(
-                boost::bind(&ServiceNode::relay_buffered_messages, this));
+            if (!worker_) {
+                relaying_ = true;
+                this->relay_buffered_messages();
+                this->outbox_timer_tick();
+
+                anti_entropy_timer_.expires_after(ANTI_ENTROPY_INTERVAL);
+                anti_entropy_timer_.async_wait(std::bind(
+                    &ServiceNode::anti_entropy_timer_tick, this));
+
+                // Replays whatever we missed while we were down
+                this->log_sync_timer_tick();
+            }
 
             active = true;
         }
@@ -706,6 +1147,21 @@ void ServiceNode::on_swarm_update(block_update_t&& bu) {
 
     swarm_->update_state(bu.swarms, bu.decommissioned_nodes, events, true);
 
+    // Nodes are trusted again if they come back to our swarm later
+    for (auto it = distrusted_signers_.begin();
+         it != distrusted_signers_.end();) {
+        if (this->is_swarm_peer(it->first)) {
+            ++it;
+        } else {
+            it = distrusted_signers_.erase(it);
+        }
+    }
+
+    // Workers only need to know the swarm structure, distributing data and
+    // testing peers is done by the primary process
+    if (worker_)
+        return;
+
     if (!events.new_snodes.empty()) {
         this->bootstrap_peers(events.new_snodes);
     }
@@ -724,14 +1180,35 @@ void ServiceNode::on_swarm_update(block_update_t&& bu) {
 #endif
 }
 
+void ServiceNode::schedule_relay() {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!relaying_ || relay_scheduled_)
+        return;
+
+    relay_scheduled_ = true;
+    relay_timer_.expires_after(RELAY_MAX_DELAY);
+    relay_timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (ec != boost::asio::error::operation_aborted) {
+            this->relay_buffered_messages();
+        }
+    });
+}
+
 void ServiceNode::relay_buffered_messages() {
 
     std::lock_guard guard(sn_mutex_);
 
-    // Should we wait for the response first?
-    relay_timer_.expires_after(RELAY_INTERVAL);
-    relay_timer_.async_wait(
-        boost::bind(&ServiceNode::relay_buffered_messages, this));
+    if (!relaying_)
+        return;
+
+    if (relay_scheduled_) {
+        relay_timer_.cancel();
+        relay_scheduled_ = false;
+    }
+
+    this->relay_tombstones();
 
     if (relay_buffer_.empty())
         return;
@@ -739,127 +1216,890 @@ void ServiceNode::relay_buffered_messages() {
     OXEN_LOG(debug, "Relaying {} messages from buffer to {} nodes",
              relay_buffer_.size(), swarm_->other_nodes().size());
 
-    this->relay_messages(relay_buffer_, swarm_->other_nodes());
+    // Kept in the outbox until each peer has them, so that peers that are
+    // temporarily unreachable catch up once they are back
+    this->relay_messages(relay_buffer_, swarm_->other_nodes(), true);
     relay_buffer_.clear();
+    relay_buffer_bytes_ = 0;
 }
 
-void ServiceNode::check_version_timer_tick() {
-
-    check_version_timer_.expires_after(VERSION_CHECK_INTERVAL);
-    check_version_timer_.async_wait(
-        std::bind(&ServiceNode::check_version_timer_tick, this));
-
-    dns::check_latest_version();
-}
-
-void ServiceNode::pow_difficulty_timer_tick(const pow_dns_callback_t cb) {
-    std::error_code ec;
-    std::vector<pow_difficulty_t> new_history = dns::query_pow_difficulty(ec);
-    if (!ec) {
-        boost::asio::post(ioc_, std::bind(cb, new_history));
-    }
-    pow_update_timer_.expires_after(POW_DIFFICULTY_UPDATE_INTERVAL);
-    pow_update_timer_.async_wait(
-        boost::bind(&ServiceNode::pow_difficulty_timer_tick, this, cb));
-}
-
-void ServiceNode::swarm_timer_tick() {
+void ServiceNode::outbox_timer_tick() {
 
     std::lock_guard guard(sn_mutex_);
 
-    OXEN_LOG(trace, "Swarm timer tick");
+    outbox_timer_.expires_after(OUTBOX_CHECK_INTERVAL);
+    outbox_timer_.async_wait(std::bind(&ServiceNode::outbox_timer_tick, this));
 
-    json params;
-    json fields;
+    this->flush_outbox_results();
 
-    fields["service_node_pubkey"] = true;
-    fields["swarm_id"] = true;
-    fields["storage_port"] = true;
-    fields["public_ip"] = true;
-    fields["height"] = true;
-    fields["block_hash"] = true;
-    fields["hardfork"] = true;
-    fields["funded"] = true;
-    fields["pubkey_x25519"] = true;
-    fields["pubkey_ed25519"] = true;
-    fields["storage_lmq_port"] = true;
+    const auto now = util::get_time_ms();
 
-    params["fields"] = fields;
-    params["poll_block_hash"] = block_hash_;
+    uint64_t dropped = 0;
+    if (!db_->outbox_trim(now - OUTBOX_MAX_AGE.count(), OUTBOX_MAX_PEER_BYTES,
+                          dropped)) {
+        OXEN_LOG(error, "Failed to trim the outbox");
+    } else if (dropped > 0) {
+        outbox_entries_dropped_ += dropped;
+        OXEN_LOG(warn, "Dropped {} outbox entries of peers that are too far "
+                       "behind",
+                 dropped);
+    }
 
-    params["active_only"] = false;
+    // Also removes the batches that were trimmed for all peers
+    if (!db_->outbox_prune(now)) {
+        OXEN_LOG(error, "Failed to prune the outbox");
+    }
 
-    static bool got_first_response = false;
+    std::vector<OutboxItem> items;
+    if (!db_->outbox_take_due(now, OUTBOX_MAX_RESENDS, items)) {
+        OXEN_LOG(error, "Failed to read the outbox");
+        return;
+    }
 
-    oxend_client_.make_oxend_request(
-        "get_n_service_nodes", params, [this](const sn_response_t&& res) {
-            if (res.error_code == SNodeError::NO_ERROR) {
-                try {
+    const auto& peers = swarm_->other_nodes();
 
-                    if (!got_first_response) {
-                        OXEN_LOG(
-                            info,
-                            "Got initial swarm information from local Oxend");
-                        got_first_response = true;
-#ifndef INTEGRATION_TEST
-                        // Only bootstrap (apply ips) once we have at least
-                        // some entries for snodes from oxend
-                        this->bootstrap_data();
-#endif
-                    }
+    for (auto& item : items) {
+        const auto it = std::find_if(
+            peers.begin(), peers.end(), [&](const sn_record_t& sn) {
+                return sn.pubkey_x25519_bin() == item.peer;
+            });
+        if (it == peers.end()) {
+            // No longer in our swarm (it will be bootstrapped if it comes
+            // back)
+            db_->outbox_drop_peer(item.peer);
+            continue;
+        }
 
-                    block_update_t bu = parse_swarm_update(res.body);
-                    if (!bu.unchanged)
-                        on_swarm_update(std::move(bu));
-                } catch (const std::exception& e) {
-                    OXEN_LOG(error, "Exception caught on swarm update: {}",
-                             e.what());
-                }
-            } else {
-                OXEN_LOG(critical, "Failed to contact local Oxend");
+        OXEN_LOG(debug, "Resending batch {} to {} (failed attempts: {})",
+                 item.batch_id, *it, item.attempts);
+
+        relay_batch_t batch;
+        batch.data = this->share_batch(std::move(item.data));
+        batch.outbox_id = item.batch_id;
+        batch.attempts = item.attempts;
+        batch.messages = item.messages;
+        batch.kind = item.kind;
+        if (batch.kind == OutboxKind::MESSAGES) {
+            batch.signature = this->sign_batch(*batch.data);
+            if (this->peer_accepts_compression(*it)) {
+                batch.compressed = compress_batch(*batch.data);
             }
-
-            // It would make more sense to wait the difference between the time
-            // elapsed and SWARM_UPDATE_INTERVAL, but this is good enough:
-            swarm_update_timer_.expires_after(SWARM_UPDATE_INTERVAL);
-            swarm_update_timer_.async_wait(
-                boost::bind(&ServiceNode::swarm_timer_tick, this));
-        });
+        }
+        this->queue_batch(*it, std::move(batch));
+    }
 }
 
-void ServiceNode::cleanup_timer_tick() {
+void ServiceNode::record_outbox_result(const sn_record_t& sn,
+                                       const relay_batch_t& batch, bool acked,
+                                       uint32_t attempts) const {
 
     std::lock_guard guard(sn_mutex_);
 
-    all_stats_.cleanup();
+    outbox_results_.push_back(
+        {batch.outbox_id, sn.pubkey_x25519_bin(), acked, attempts,
+         acked ? 0 : next_outbox_attempt(batch.attempts)});
 
-    stats_cleanup_timer_.expires_after(STATS_CLEANUP_INTERVAL);
-    stats_cleanup_timer_.async_wait(
-        boost::bind(&ServiceNode::cleanup_timer_tick, this));
+    if (outbox_results_.size() >= OUTBOX_MAX_PENDING_RESULTS) {
+        this->flush_outbox_results();
+    }
 }
 
-void ServiceNode::update_last_ping(ReachType type) {
+void ServiceNode::flush_outbox_results() const {
 
-    switch (type) {
-    case ReachType::HTTP: {
-        reach_records_.latest_incoming_http_ = std::chrono::steady_clock::now();
-        break;
-    }
-    case ReachType::ZMQ: {
-        reach_records_.latest_incoming_lmq_ = std::chrono::steady_clock::now();
-        break;
-    }
-    default:
-        OXEN_LOG(error, "Connection type not supported");
-        assert(false);
-        break;
+    std::lock_guard guard(sn_mutex_);
+
+    // Lost on failure, which only means that batches are sent again (or
+    // later than they could be)
+    if (!db_->outbox_record(outbox_results_)) {
+        OXEN_LOG(error, "Failed to update {} outbox entries",
+                 outbox_results_.size());
     }
+    outbox_results_.clear();
 }
 
-void ServiceNode::ping_peers_tick() {
+/// Range of an anti-entropy round, sent as [begin, end, now]
+static bool deserialize_range(std::string_view blob, digest_range_t& range) {
 
-    // Used as a callback to needs a mutex even if it is private
-    std::lock_guard guard(sn_mutex_);
+    std::vector<uint64_t> values;
+    if (!deserialize_integers(blob, values) || values.size() != 3) {
+        return false;
+    }
+
+    range = {values[0], values[1], values[2]};
+    // Older nodes start their ranges at 0, but nothing older than the maximum
+    // TTL can still be around
+    range.begin = std::max(
+        range.begin,
+        range.now - std::min<uint64_t>(range.now, MAX_MESSAGE_TTL.count()));
+    return true;
+}
+
+void ServiceNode::anti_entropy_timer_tick() {
+
+    std::lock_guard guard(sn_mutex_);
+
+    anti_entropy_timer_.expires_after(ANTI_ENTROPY_INTERVAL);
+    anti_entropy_timer_.async_wait(
+        std::bind(&ServiceNode::anti_entropy_timer_tick, this));
+
+    const auto& peers = swarm_->other_nodes();
+    if (peers.empty()) {
+        return;
+    }
+
+    const auto& peer =
+        peers[util::uniform_distribution_portable(util::rng(), peers.size())];
+
+    const uint64_t now = util::get_time_ms();
+    const digest_range_t range{now - MAX_MESSAGE_TTL.count(),
+                               now - ANTI_ENTROPY_SETTLE_TIME.count(), now};
+
+    // Reading the hashes of all our messages takes a while, so it is done
+    // on the CPU pool rather than holding up this thread
+    boost::asio::post(cpu_pool_, [this, peer, range]() {
+        std::vector<bucket_digest_t> digests;
+        if (!this->get_digests(range, digests)) {
+            OXEN_LOG(error, "Could not compute message digests");
+            return;
+        }
+
+        OXEN_LOG(debug, "Sending digests of {} buckets to {}",
+                 digests.size(), peer);
+
+        lmq_server_->request(
+            peer.pubkey_x25519_bin(), "sn.digests",
+            [this, peer, range](bool success, std::vector<std::string> data) {
+                this->on_digests_reply(peer, range, success, std::move(data));
+            },
+            serialize_integers({range.begin, range.end, range.now}),
+            serialize_digests(digests));
+    });
+}
+
+bool ServiceNode::get_digests(const digest_range_t& range,
+                              std::vector<bucket_digest_t>& digests) const {
+
+    digest_builder_t builder;
+    if (!db_->for_each_hash(range.begin, range.end, range.now,
+                            [&](std::string_view hash, uint64_t timestamp) {
+                                builder.add(hash, timestamp);
+                            })) {
+        return false;
+    }
+
+    digests = builder.digests();
+    return true;
+}
+
+bool ServiceNode::get_bucket_hashes(
+    const digest_range_t& range, std::vector<uint64_t>& buckets,
+    size_t max_hashes,
+    std::unordered_map<uint64_t, std::string>& hashes) const {
+
+    if (buckets.empty()) {
+        return true;
+    }
+
+    // Only read the part of the range the buckets cover
+    const uint64_t begin = std::max(range.begin, buckets.front());
+    const uint64_t end =
+        std::min(range.end, buckets.back() + DIGEST_BUCKET_MS);
+
+    bucket_hashes_t collector(buckets, max_hashes);
+    if (!db_->for_each_hash(begin, end, range.now,
+                            [&](std::string_view hash, uint64_t timestamp) {
+                                collector.add(hash, timestamp);
+                            })) {
+        return false;
+    }
+
+    buckets = collector.buckets();
+    hashes = std::move(collector.hashes());
+    return true;
+}
+
+void ServiceNode::on_digests_reply(const sn_record_t& peer,
+                                   const digest_range_t& range, bool success,
+                                   std::vector<std::string> data) {
+
+    // Older peers don't know about digests and never reply
+    if (!success || data.empty() || data[0] != "OK") {
+        OXEN_LOG(debug, "No digests reply from {} ({})", peer,
+                 success && !data.empty() ? data[0] : "NO_REPLY");
+        return;
+    }
+
+    std::vector<uint64_t> buckets;
+    std::vector<uint64_t> theirs;
+    if (data.size() != 3 || !deserialize_integers(data[1], buckets) ||
+        !deserialize_integers(data[2], theirs) ||
+        !std::is_sorted(buckets.begin(), buckets.end()) ||
+        theirs.size() > ANTI_ENTROPY_MAX_FINGERPRINTS) {
+        OXEN_LOG(warn, "Invalid digests reply from {}", peer);
+        return;
+    }
+
+    if (buckets.empty()) {
+        OXEN_LOG(debug, "Messages are in sync with {}", peer);
+        return;
+    }
+
+    boost::asio::post(cpu_pool_, [this, peer, range,
+                                  buckets = std::move(buckets),
+                                  theirs = std::move(theirs)]() mutable {
+        std::unordered_map<uint64_t, std::string> ours;
+        if (!this->get_bucket_hashes(range, buckets,
+                                     ANTI_ENTROPY_MAX_FINGERPRINTS, ours)) {
+            OXEN_LOG(error, "Could not read message hashes");
+            return;
+        }
+
+        boost::asio::post(ioc_, [this, peer, range,
+                                 buckets = std::move(buckets),
+                                 theirs = std::move(theirs),
+                                 ours = std::move(ours)]() {
+            this->exchange_messages(peer, range, buckets, theirs, ours);
+        });
+    });
+}
+
+void ServiceNode::exchange_messages(
+    const sn_record_t& peer, const digest_range_t& range,
+    const std::vector<uint64_t>& buckets, const std::vector<uint64_t>& theirs,
+    const std::unordered_map<uint64_t, std::string>& ours) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    const std::unordered_set<uint64_t> their_set(theirs.begin(), theirs.end());
+
+    std::vector<Item> items;
+    for (const auto& [fingerprint, hash] : ours) {
+        if (items.size() >= ANTI_ENTROPY_MAX_MESSAGES) {
+            break;
+        }
+        Item item;
+        if (!their_set.count(fingerprint) &&
+            db_->retrieve_by_hash(hash, item)) {
+            items.push_back(std::move(item));
+        }
+    }
+
+    std::vector<uint64_t> missing;
+    for (const auto fingerprint : their_set) {
+        if (missing.size() >= ANTI_ENTROPY_MAX_MESSAGES) {
+            break;
+        }
+        if (!ours.count(fingerprint)) {
+            missing.push_back(fingerprint);
+        }
+    }
+
+    OXEN_LOG(info,
+             "{} buckets differ from {}: sending {} messages, fetching {}",
+             buckets.size(), peer, items.size(), missing.size());
+
+    if (!items.empty()) {
+        anti_entropy_sent_ += items.size();
+        this->relay_messages(items, {peer});
+    }
+
+    if (missing.empty()) {
+        return;
+    }
+
+    // Only the buckets we compared, so that the peer doesn't send messages
+    // from the others
+    const digest_range_t fetch_range{
+        std::max(range.begin, buckets.front()),
+        std::min(range.end, buckets.back() + DIGEST_BUCKET_MS), range.now};
+
+    lmq_server_->request(
+        peer.pubkey_x25519_bin(), "sn.fetch",
+        [this, peer](bool success, std::vector<std::string> data) {
+            if (!success || data.empty() || data[0] != "OK") {
+                OXEN_LOG(debug, "Could not fetch messages from {}", peer);
+                return;
+            }
+            data.erase(data.begin());
+            this->return_tombstones(peer, data);
+            // Whatever could not be stored is fetched again next round
+            this->process_push_batches(
+                std::move(data), [this](bool, size_t fetched) {
+                    std::lock_guard guard(sn_mutex_);
+                    anti_entropy_fetched_ += fetched;
+                });
+        },
+        serialize_integers(
+            {fetch_range.begin, fetch_range.end, fetch_range.now}),
+        serialize_integers(missing));
+}
+
+void ServiceNode::process_digests(
+    const sn_pub_key_t& sender_x25519_bin, std::string_view range_blob,
+    std::string_view digests_blob,
+    std::function<void(std::vector<std::string>)> on_done) {
+
+    if (!this->is_swarm_peer(sender_x25519_bin)) {
+        OXEN_LOG(debug, "Ignoring digests from a node outside of our swarm");
+        on_done({"NOT_A_PEER"});
+        return;
+    }
+
+    digest_range_t range;
+    std::vector<bucket_digest_t> theirs;
+    if (!deserialize_range(range_blob, range) ||
+        !deserialize_digests(digests_blob, theirs)) {
+        on_done({"INVALID_REQUEST"});
+        return;
+    }
+    std::sort(theirs.begin(), theirs.end(),
+              [](const bucket_digest_t& a, const bucket_digest_t& b) {
+                  return a.start < b.start;
+              });
+
+    boost::asio::post(cpu_pool_, [this, range, theirs = std::move(theirs),
+                                  on_done = std::move(on_done)]() {
+        std::vector<bucket_digest_t> ours;
+        std::unordered_map<uint64_t, std::string> hashes;
+        if (!this->get_digests(range, ours)) {
+            on_done({"ERROR"});
+            return;
+        }
+
+        auto buckets = differing_buckets(ours, theirs);
+        if (!this->get_bucket_hashes(range, buckets,
+                                     ANTI_ENTROPY_MAX_FINGERPRINTS, hashes)) {
+            on_done({"ERROR"});
+            return;
+        }
+
+        std::vector<uint64_t> fingerprints;
+        fingerprints.reserve(hashes.size());
+        for (const auto& kv : hashes) {
+            fingerprints.push_back(kv.first);
+        }
+
+        on_done({"OK", serialize_integers(buckets),
+                 serialize_integers(fingerprints)});
+    });
+}
+
+void ServiceNode::process_fetch(
+    const sn_pub_key_t& sender_x25519_bin, std::string_view range_blob,
+    std::string_view fingerprints_blob,
+    std::function<void(std::vector<std::string>)> on_done) {
+
+    if (!this->is_swarm_peer(sender_x25519_bin)) {
+        OXEN_LOG(debug, "Ignoring fetch from a node outside of our swarm");
+        on_done({"NOT_A_PEER"});
+        return;
+    }
+
+    digest_range_t range;
+    std::vector<uint64_t> fingerprints;
+    if (!deserialize_range(range_blob, range) ||
+        !deserialize_integers(fingerprints_blob, fingerprints) ||
+        fingerprints.size() > ANTI_ENTROPY_MAX_MESSAGES) {
+        on_done({"INVALID_REQUEST"});
+        return;
+    }
+
+    boost::asio::post(cpu_pool_, [this, range,
+                                  fingerprints = std::move(fingerprints),
+                                  on_done = std::move(on_done)]() {
+        const std::unordered_set<uint64_t> wanted(fingerprints.begin(),
+                                                  fingerprints.end());
+
+        std::vector<std::string> hashes;
+        if (!db_->for_each_hash(range.begin, range.end, range.now,
+                                [&](std::string_view hash, uint64_t) {
+                                    if (wanted.count(hash_fingerprint(hash))) {
+                                        hashes.emplace_back(hash);
+                                    }
+                                })) {
+            on_done({"ERROR"});
+            return;
+        }
+
+        boost::asio::post(ioc_, [this, hashes = std::move(hashes),
+                                 on_done = std::move(on_done)]() {
+            on_done(this->get_fetched_messages(hashes));
+        });
+    });
+}
+
+std::vector<std::string>
+ServiceNode::get_fetched_messages(const std::vector<std::string>& hashes) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // The rest is fetched by later rounds
+    std::vector<Item> items;
+    size_t total_bytes = 0;
+    for (const auto& hash : hashes) {
+        if (total_bytes >= ANTI_ENTROPY_MAX_FETCH_BYTES) {
+            break;
+        }
+        Item item;
+        if (db_->retrieve_by_hash(hash, item)) {
+            total_bytes += item.data.size();
+            items.push_back(std::move(item));
+        }
+    }
+
+    // Peers that fetch are recent enough to read the latest format
+    std::vector<std::string> reply{"OK"};
+    for (auto& batch : serialize_messages(items, LATEST_BATCH_FORMAT)) {
+        reply.push_back(std::move(batch));
+    }
+
+    return reply;
+}
+
+void ServiceNode::log_sync_timer_tick() {
+
+    std::lock_guard guard(sn_mutex_);
+
+    log_sync_timer_.expires_after(LOG_SYNC_INTERVAL);
+    log_sync_timer_.async_wait(
+        std::bind(&ServiceNode::log_sync_timer_tick, this));
+
+    for (const auto& peer : swarm_->other_nodes()) {
+
+        // Still reading it from the previous tick
+        if (!log_syncing_.insert(peer.pubkey_x25519_bin()).second) {
+            continue;
+        }
+
+        std::optional<uint64_t> cursor;
+        if (!db_->get_log_cursor(peer.pubkey_x25519_bin(), cursor)) {
+            OXEN_LOG(error, "Could not read the log cursor of {}", peer);
+            log_syncing_.erase(peer.pubkey_x25519_bin());
+            continue;
+        }
+
+        this->read_log(peer, cursor);
+    }
+}
+
+void ServiceNode::read_log(const sn_record_t& peer,
+                           std::optional<uint64_t> after) {
+
+    // Messages from before we started following a peer are covered by
+    // bootstrapping, so the first request only gets its position
+    const int limit = after ? LOG_PAGE_SIZE : 0;
+
+    lmq_server_->request(
+        peer.pubkey_x25519_bin(), "sn.log",
+        [this, peer, after](bool success, std::vector<std::string> data) {
+            this->on_log_reply(peer, after, success, std::move(data));
+        },
+        std::to_string(after.value_or(0)), std::to_string(limit));
+}
+
+void ServiceNode::on_log_reply(const sn_record_t& peer,
+                               std::optional<uint64_t> after, bool success,
+                               std::vector<std::string> data) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    uint64_t head;
+    uint64_t last;
+    std::vector<std::string> hashes;
+
+    // Older peers don't have a log and never reply
+    if (!success || data.size() != 4 || data[0] != "OK" ||
+        !parse_number(data[1], head) || !parse_number(data[2], last) ||
+        !deserialize_hashes(data[3], hashes)) {
+        OXEN_LOG(debug, "Could not read the log of {}", peer);
+        log_syncing_.erase(peer.pubkey_x25519_bin());
+        return;
+    }
+
+    if (!after) {
+        this->advance_log(peer, head, head);
+        return;
+    }
+
+    // Positions never go back, so the peer lost its database and started
+    // its log over: read it again from the start, unless that's too much
+    if (head < *after) {
+        const uint64_t from = head > LOG_MAX_BEHIND ? head : 0;
+        OXEN_LOG(warn, "The log of {} restarted, reading it from {} (was at "
+                       "{})",
+                 peer, from, *after);
+        this->advance_log(peer, from, head);
+        return;
+    }
+
+    if (head - *after > LOG_MAX_BEHIND) {
+        OXEN_LOG(warn, "Skipping to position {} of the log of {} (from {})",
+                 head, peer, *after);
+        this->advance_log(peer, head, head);
+        return;
+    }
+
+    // Looked up on the CPU pool rather than under the node mutex
+    boost::asio::post(cpu_pool_, [this, peer, last, head,
+                                  hashes = std::move(hashes)]() {
+        this->fetch_log_messages(peer, hashes, last, head);
+    });
+}
+
+void ServiceNode::fetch_log_messages(const sn_record_t& peer,
+                                     const std::vector<std::string>& hashes,
+                                     uint64_t last, uint64_t head) {
+
+    std::vector<std::string> missing;
+    if (!db_->get_missing_hashes(hashes, missing)) {
+        std::lock_guard guard(sn_mutex_);
+        log_syncing_.erase(peer.pubkey_x25519_bin());
+        return;
+    }
+
+    if (missing.empty()) {
+        this->advance_log(peer, last, head);
+        return;
+    }
+
+    OXEN_LOG(debug, "Fetching {} messages from the log of {}", missing.size(),
+             peer);
+
+    lmq_server_->request(
+        peer.pubkey_x25519_bin(), "sn.messages",
+        [this, peer, last, head](bool success, std::vector<std::string> data) {
+            if (!success || data.empty() || data[0] != "OK") {
+                OXEN_LOG(debug, "Could not fetch messages from {}", peer);
+                std::lock_guard guard(sn_mutex_);
+                log_syncing_.erase(peer.pubkey_x25519_bin());
+                return;
+            }
+            // The cursor only moves once the messages are stored; messages
+            // the peer no longer has or that are invalid are passed over
+            data.erase(data.begin());
+            this->process_push_batches(
+                std::move(data),
+                [this, peer, last, head](bool stored, size_t fetched) {
+                    std::lock_guard guard(sn_mutex_);
+                    log_messages_fetched_ += fetched;
+                    if (!stored) {
+                        OXEN_LOG(error, "Could not store messages from the "
+                                        "log of {}, will read them again",
+                                 peer);
+                        log_syncing_.erase(peer.pubkey_x25519_bin());
+                        return;
+                    }
+                    this->advance_log(peer, last, head);
+                });
+        },
+        serialize_hashes(missing));
+}
+
+void ServiceNode::advance_log(const sn_record_t& peer, uint64_t position,
+                              uint64_t head) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!db_->set_log_cursor(peer.pubkey_x25519_bin(), position)) {
+        OXEN_LOG(error, "Could not save the log cursor of {}", peer);
+        log_syncing_.erase(peer.pubkey_x25519_bin());
+        return;
+    }
+
+    if (position < head) {
+        this->read_log(peer, position);
+    } else {
+        log_syncing_.erase(peer.pubkey_x25519_bin());
+    }
+}
+
+std::vector<std::string>
+ServiceNode::process_log_request(const sn_pub_key_t& sender_x25519_bin,
+                                 const std::string& after_str,
+                                 const std::string& limit_str) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!this->is_swarm_peer(sender_x25519_bin)) {
+        OXEN_LOG(debug, "Ignoring log request from a node outside of our "
+                        "swarm");
+        return {"NOT_A_PEER"};
+    }
+
+    uint64_t after;
+    int limit;
+    if (!parse_number(after_str, after) ||
+        !parse_number(limit_str, limit) || limit < 0 ||
+        limit > LOG_PAGE_SIZE) {
+        return {"INVALID_REQUEST"};
+    }
+
+    uint64_t head;
+    if (!db_->get_last_position(head)) {
+        return {"ERROR"};
+    }
+
+    std::vector<std::pair<std::string, std::string>> entries;
+    uint64_t last = after;
+    if (limit > 0 && !db_->get_hashes_after(after, limit, entries, last)) {
+        return {"ERROR"};
+    }
+
+    // Leave out messages that are no longer ours (these are not relayed
+    // either)
+    std::unordered_map<std::string, bool> pk_cache;
+    std::vector<std::string> hashes;
+    for (auto& [hash, owner] : entries) {
+        auto it = pk_cache.find(owner);
+        if (it == pk_cache.end()) {
+            bool success;
+            const auto pk = user_pubkey_t::create(owner, success);
+            const bool ours = success && swarm_->is_pubkey_for_us(pk);
+            it = pk_cache.emplace(owner, ours).first;
+        }
+        if (it->second) {
+            hashes.push_back(std::move(hash));
+        }
+    }
+
+    return {"OK", std::to_string(head), std::to_string(last),
+            serialize_hashes(hashes)};
+}
+
+std::vector<std::string>
+ServiceNode::process_messages_request(const sn_pub_key_t& sender_x25519_bin,
+                                      std::string_view hashes_blob) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!this->is_swarm_peer(sender_x25519_bin)) {
+        OXEN_LOG(debug, "Ignoring messages request from a node outside of "
+                        "our swarm");
+        return {"NOT_A_PEER"};
+    }
+
+    std::vector<std::string> hashes;
+    if (!deserialize_hashes(hashes_blob, hashes) ||
+        hashes.size() > LOG_PAGE_SIZE) {
+        return {"INVALID_REQUEST"};
+    }
+
+    std::vector<Item> items;
+    for (const auto& hash : hashes) {
+        Item item;
+        if (db_->retrieve_by_hash(hash, item)) {
+            items.push_back(std::move(item));
+        }
+    }
+
+    // Peers that read our log are recent enough to read the latest format
+    std::vector<std::string> reply{"OK"};
+    for (auto& batch : serialize_messages(items, LATEST_BATCH_FORMAT)) {
+        reply.push_back(std::move(batch));
+    }
+
+    return reply;
+}
+
+void ServiceNode::relay_tombstones() {
+
+    if (tombstone_buffer_.empty())
+        return;
+
+    OXEN_LOG(debug, "Relaying {} deletions to {} nodes",
+             tombstone_buffer_.size(), swarm_->other_nodes().size());
+
+    this->send_tombstones(tombstone_buffer_, swarm_->other_nodes());
+    tombstone_buffer_.clear();
+}
+
+void ServiceNode::send_tombstones(
+    const std::vector<tombstone_t>& tombstones,
+    const std::vector<sn_record_t>& snodes) const {
+
+    if (snodes.empty())
+        return;
+
+    std::vector<std::string> pubkeys;
+    for (const sn_record_t& sn : snodes) {
+        pubkeys.push_back(sn.pubkey_x25519_bin());
+    }
+
+    std::string blob = serialize_tombstones(tombstones);
+
+    // Kept in the outbox (like relayed messages) so that members that are
+    // unreachable for a while still get them
+    const uint64_t expiration =
+        util::get_time_ms() + TOMBSTONE_RELAY_TIME.count();
+
+    relay_batch_t batch;
+    batch.kind = OutboxKind::TOMBSTONES;
+    if (!db_->outbox_add(blob, 0, expiration, pubkeys, batch.outbox_id,
+                         OutboxKind::TOMBSTONES)) {
+        OXEN_LOG(error, "Failed to add deletions to the outbox");
+        batch.outbox_id = 0;
+    }
+    batch.data = this->share_batch(std::move(blob));
+
+    for (const sn_record_t& sn : snodes) {
+        this->queue_batch(sn, batch);
+    }
+}
+
+void ServiceNode::return_tombstones(const sn_record_t& peer,
+                                    const std::vector<std::string>& blobs) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // The owners' original (signed) requests, as the peer checks them
+    std::set<std::string> requests;
+    for (const auto& blob : blobs) {
+        message_batch_t batch;
+        if (!deserialize_messages(blob, batch)) {
+            continue;
+        }
+        for (const auto& msg : batch.messages) {
+            bool is_deleted = false;
+            std::string request;
+            if (db_->is_deleted(msg.pub_key, msg.hash, msg.timestamp,
+                                is_deleted, &request) &&
+                is_deleted && !request.empty()) {
+                requests.insert(std::move(request));
+            }
+        }
+    }
+
+    std::vector<tombstone_t> tombstones;
+    for (const auto& request : requests) {
+        deserialize_tombstones(request, tombstones);
+    }
+
+    if (tombstones.empty())
+        return;
+
+    OXEN_LOG(debug, "{} still has messages deleted by {} requests", peer,
+             tombstones.size());
+
+    this->send_tombstones(tombstones, {peer});
+}
+
+void ServiceNode::check_version_timer_tick() {
+
+    check_version_timer_.expires_after(VERSION_CHECK_INTERVAL);
+    check_version_timer_.async_wait(
+        std::bind(&ServiceNode::check_version_timer_tick, this));
+
+    dns::check_latest_version();
+}
+
+void ServiceNode::pow_difficulty_timer_tick(const pow_dns_callback_t cb) {
+    std::error_code ec;
+    std::vector<pow_difficulty_t> new_history = dns::query_pow_difficulty(ec);
+    if (!ec) {
+        boost::asio::post(ioc_, std::bind(cb, new_history));
+    }
+    pow_update_timer_.expires_after(POW_DIFFICULTY_UPDATE_INTERVAL);
+    pow_update_timer_.async_wait(
+        boost::bind(&ServiceNode::pow_difficulty_timer_tick, this, cb));
+}
+
+void ServiceNode::swarm_timer_tick() {
+
+    std::lock_guard guard(sn_mutex_);
+
+    OXEN_LOG(trace, "Swarm timer tick");
+
+    json params;
+    json fields;
+
+    fields["service_node_pubkey"] = true;
+    fields["swarm_id"] = true;
+    fields["storage_port"] = true;
+    fields["public_ip"] = true;
+    fields["height"] = true;
+    fields["block_hash"] = true;
+    fields["hardfork"] = true;
+    fields["funded"] = true;
+    fields["pubkey_x25519"] = true;
+    fields["pubkey_ed25519"] = true;
+    fields["storage_lmq_port"] = true;
+
+    params["fields"] = fields;
+    params["poll_block_hash"] = block_hash_;
+
+    params["active_only"] = false;
+
+    static bool got_first_response = false;
+
+    oxend_client_.make_oxend_request(
+        "get_n_service_nodes", params, [this](const sn_response_t&& res) {
+            if (res.error_code == SNodeError::NO_ERROR) {
+                try {
+
+                    if (!got_first_response) {
+                        OXEN_LOG(
+                            info,
+                            "Got initial swarm information from local Oxend");
+                        got_first_response = true;
+#ifndef INTEGRATION_TEST
+                        // Only bootstrap (apply ips) once we have at least
+                        // some entries for snodes from oxend
+                        this->bootstrap_data();
+#endif
+                    }
+
+                    block_update_t bu = parse_swarm_update(res.body);
+                    if (!bu.unchanged)
+                        on_swarm_update(std::move(bu));
+                } catch (const std::exception& e) {
+                    OXEN_LOG(error, "Exception caught on swarm update: {}",
+                             e.what());
+                }
+            } else {
+                OXEN_LOG(critical, "Failed to contact local Oxend");
+            }
+
+            // It would make more sense to wait the difference between the time
+            // elapsed and SWARM_UPDATE_INTERVAL, but this is good enough:
+            swarm_update_timer_.expires_after(SWARM_UPDATE_INTERVAL);
+            swarm_update_timer_.async_wait(
+                boost::bind(&ServiceNode::swarm_timer_tick, this));
+        });
+}
+
+void ServiceNode::cleanup_timer_tick() {
+
+    std::lock_guard guard(sn_mutex_);
+
+    all_stats_.cleanup();
+
+    stats_cleanup_timer_.expires_after(STATS_CLEANUP_INTERVAL);
+    stats_cleanup_timer_.async_wait(
+        boost::bind(&ServiceNode::cleanup_timer_tick, this));
+}
+
+void ServiceNode::update_last_ping(ReachType type) {
+
+    switch (type) {
+    case ReachType::HTTP: {
+        reach_records_.latest_incoming_http_ = std::chrono::steady_clock::now();
+        break;
+    }
+    case ReachType::ZMQ: {
+        reach_records_.latest_incoming_lmq_ = std::chrono::steady_clock::now();
+        break;
+    }
+    default:
+        OXEN_LOG(error, "Connection type not supported");
+        assert(false);
+        break;
+    }
+}
+
+void ServiceNode::ping_peers_tick() {
+
+    // Used as a callback to needs a mutex even if it is private
+    std::lock_guard guard(sn_mutex_);
 
     this->peer_ping_timer_.expires_after(PING_PEERS_INTERVAL);
     this->peer_ping_timer_.async_wait(
@@ -1070,13 +2310,7 @@ void ServiceNode::perform_blockchain_test(
 void ServiceNode::attach_signature(std::shared_ptr<request_t>& request,
                                    const signature& sig) const {
 
-    std::string raw_sig;
-    raw_sig.reserve(sig.c.size() + sig.r.size());
-    raw_sig.insert(raw_sig.begin(), sig.c.begin(), sig.c.end());
-    raw_sig.insert(raw_sig.end(), sig.r.begin(), sig.r.end());
-
-    const std::string sig_b64 = sispopmq::to_base64(raw_sig);
-    request->set(OXEN_SNODE_SIGNATURE_HEADER, sig_b64);
+    request->set(OXEN_SNODE_SIGNATURE_HEADER, signature_to_base64(sig));
 
     request->set(OXEN_SENDER_SNODE_PUBKEY_HEADER,
                  our_address_.pub_key_base32z());
@@ -1557,132 +2791,544 @@ void ServiceNode::initiate_peer_test() {
     }
 }
 
-void ServiceNode::bootstrap_peers(const std::vector<sn_record_t>& peers) const {
-
-    std::vector<Item> all_entries;
-    this->get_all_messages(all_entries);
+void ServiceNode::bootstrap_peers(const std::vector<sn_record_t>& peers) const {
+
+    for (const auto& peer : peers) {
+        this->send_snapshot(peer);
+    }
+}
+
+/// Progress of a snapshot being streamed to a single peer. Chunks are sent
+/// one at a time, the next one only after the peer has acknowledged (and
+/// stored) the previous one.
+struct snapshot_sender_t {
+    sn_record_t peer;
+    std::string id;
+    /// Position of the last message at the time the snapshot was started,
+    /// anything stored after that will reach the peer through normal relay
+    uint64_t up_to = 0;
+    /// Position of the last message acknowledged by the peer
+    uint64_t position = 0;
+    /// Position of the last message in the chunk currently in flight
+    uint64_t chunk_end = 0;
+    uint64_t chunk_idx = 0;
+    uint64_t chunk_items = 0;
+    uint64_t items_sent = 0;
+    int attempts = 0;
+    /// Whether the chunk in flight is the final "end" part
+    bool finished = false;
+    std::string payload;
+    /// Our signature of `payload`, for peers that trust it
+    std::string signature;
+    /// Compression of `payload`, and its size before that
+    compression_t compression = compression_t::none;
+    size_t uncompressed_size = 0;
+    std::string checksum;
+    /// Concatenated checksums of all acknowledged chunks
+    std::string checksums;
+    /// Whether a pubkey belongs to our swarm (cached as we go)
+    std::unordered_map<std::string, bool> pk_cache;
+};
+
+static std::string hash_to_string(const hash& h) {
+    return std::string(reinterpret_cast<const char*>(h.data()), h.size());
+}
+
+void ServiceNode::send_snapshot(const sn_record_t& peer) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    auto state = std::make_shared<snapshot_sender_t>();
+    state->peer = peer;
+
+    if (!db_->get_last_position(state->up_to)) {
+        OXEN_LOG(error, "Could not start a snapshot for {}, relaying instead",
+                 peer);
+        this->relay_all_messages(peer);
+        return;
+    }
+
+    if (state->up_to == 0) {
+        OXEN_LOG(debug, "No data to bootstrap {} with", peer);
+        return;
+    }
+
+    std::array<uint8_t, 8> id;
+    for (auto& b : id) {
+        b = static_cast<uint8_t>(util::uniform_distribution_portable(256));
+    }
+    state->id = sispopmq::to_hex(id.begin(), id.end());
+
+    OXEN_LOG(info, "Sending snapshot {} (up to position {}) to {}", state->id,
+             state->up_to, peer);
+
+    this->send_snapshot_chunk(std::move(state));
+}
+
+void ServiceNode::send_snapshot_chunk(
+    std::shared_ptr<snapshot_sender_t> state) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // Prepare the next chunk unless we are re-sending the current one
+    if (state->payload.empty() && !state->finished) {
+
+        std::vector<Item> items;
+        uint64_t last = state->position;
+
+        while (items.empty() && last < state->up_to) {
+
+            std::vector<Item> range;
+            if (!db_->retrieve_range(last, state->up_to, SNAPSHOT_CHUNK_SIZE,
+                                     range, last)) {
+                OXEN_LOG(error, "Could not read snapshot data for {}",
+                         state->peer);
+                break;
+            }
+
+            if (range.empty()) {
+                // Nothing left below `up_to`
+                last = state->up_to;
+                break;
+            }
+
+            for (auto& item : range) {
+                auto it = state->pk_cache.find(item.pub_key);
+                if (it == state->pk_cache.end()) {
+                    bool success;
+                    const auto pk =
+                        user_pubkey_t::create(item.pub_key, success);
+                    const bool ours = success && swarm_->is_pubkey_for_us(pk);
+                    it = state->pk_cache.emplace(item.pub_key, ours).first;
+                }
+                if (it->second) {
+                    items.push_back(std::move(item));
+                }
+            }
+        }
+
+        state->compression = compression_t::none;
+        state->signature.clear();
+
+        if (items.empty()) {
+            state->finished = true;
+            state->checksum = hash_to_string(hash_data(state->checksums));
+            state->payload = std::to_string(state->items_sent);
+            state->uncompressed_size = state->payload.size();
+        } else {
+            state->chunk_end = last;
+            state->chunk_items = items.size();
+            state->payload = serialize_snapshot_chunk(items);
+            state->uncompressed_size = state->payload.size();
+
+            std::string compressed;
+            if (this->peer_accepts_compression(state->peer) &&
+                compress(PREFERRED_COMPRESSION, state->payload, compressed)) {
+                state->payload = std::move(compressed);
+                state->compression = PREFERRED_COMPRESSION;
+            }
+
+            state->checksum = hash_to_string(hash_data(state->payload));
+
+            // So that only a sample of the messages is verified
+            if (peers_accepting_signatures_.count(
+                    state->peer.pubkey_x25519_bin())) {
+                state->signature = this->sign_batch(state->payload);
+            }
+        }
+    }
+
+    state->attempts++;
+
+    const std::string part =
+        state->finished ? "end" : std::to_string(state->chunk_idx);
+
+    OXEN_LOG(debug, "Sending snapshot {} part {} ({} bytes) to {}", state->id,
+             part, state->payload.size(), state->peer);
+
+    relay_bytes_sent_ += state->payload.size();
+    relay_bytes_uncompressed_ += state->uncompressed_size;
+
+    auto on_reply = [this, state](bool success,
+                                  std::vector<std::string> data) {
+        this->on_snapshot_reply(std::move(state), success, std::move(data));
+    };
+
+    // Compressed chunks carry the codec as an extra part, and signed ones
+    // the signature after it
+    if (!state->signature.empty()) {
+        lmq_server_->request(
+            state->peer.pubkey_x25519_bin(), "sn.snapshot",
+            std::move(on_reply),
+            sispopmq::send_option::request_timeout{SNAPSHOT_REQUEST_TIMEOUT},
+            state->id, part, state->checksum, state->payload,
+            compression_to_string(state->compression), state->signature);
+    } else if (state->compression != compression_t::none) {
+        lmq_server_->request(
+            state->peer.pubkey_x25519_bin(), "sn.snapshot",
+            std::move(on_reply),
+            sispopmq::send_option::request_timeout{SNAPSHOT_REQUEST_TIMEOUT},
+            state->id, part, state->checksum, state->payload,
+            compression_to_string(state->compression));
+    } else {
+        lmq_server_->request(
+            state->peer.pubkey_x25519_bin(), "sn.snapshot",
+            std::move(on_reply),
+            sispopmq::send_option::request_timeout{SNAPSHOT_REQUEST_TIMEOUT},
+            state->id, part, state->checksum, state->payload);
+    }
+}
+
+void ServiceNode::on_snapshot_reply(std::shared_ptr<snapshot_sender_t> state,
+                                    bool success,
+                                    std::vector<std::string> data) const {
+
+    const std::string status =
+        success && !data.empty() ? data[0] : "NO_REPLY";
+
+    if (status == "OK") {
+
+        if (state->finished) {
+            OXEN_LOG(info, "Snapshot {} with {} messages delivered to {}",
+                     state->id, state->items_sent, state->peer);
+            return;
+        }
+
+        state->position = state->chunk_end;
+        state->items_sent += state->chunk_items;
+        state->checksums += state->checksum;
+        state->chunk_idx++;
+        state->attempts = 0;
+        state->payload.clear();
+
+        this->send_snapshot_chunk(std::move(state));
+        return;
+    }
+
+    if (status == "BAD_CHECKSUM" && state->attempts < SNAPSHOT_MAX_ATTEMPTS) {
+        OXEN_LOG(warn, "Snapshot {} part was corrupted, re-sending to {}",
+                 state->id, state->peer);
+        this->send_snapshot_chunk(std::move(state));
+        return;
+    }
+
+    // Peers that don't know about snapshots never reply, so this also covers
+    // older nodes. Relaying is idempotent, so messages the peer already got
+    // as part of the snapshot are simply ignored on their side.
+    OXEN_LOG(warn,
+             "Snapshot {} to {} failed ({}) after {} messages, relaying "
+             "messages instead",
+             state->id, state->peer, status, state->items_sent);
+
+    this->relay_all_messages(state->peer);
+}
+
+template <typename T>
+std::string vec_to_string(const std::vector<T>& vec) {
+
+    std::stringstream ss;
+
+    ss << "[";
+
+    for (auto i = 0u; i < vec.size(); ++i) {
+        ss << vec[i];
+
+        if (i < vec.size() - 1) {
+            ss << " ";
+        }
+    }
+
+    ss << "]";
+
+    return ss.str();
+}
+
+/// Progress of relaying our messages to the swarms they belong to, a page
+/// at a time. The next page is only read once the peers have taken the
+/// batches of the previous ones, so that neither the pages nor the batches
+/// pile up in memory.
+struct bootstrap_sender_t {
+    /// The swarms at the time we started, which `lookup` maps pubkeys to
+    std::vector<SwarmInfo> swarms;
+    swarm_lookup_t lookup;
+    /// Whether the messages of each of `swarms` are relayed
+    std::vector<bool> wanted;
+    /// Position of the last message at the start, and of the last one read
+    uint64_t up_to = 0;
+    uint64_t last = 0;
+    /// Messages of each swarm, relayed whenever they make up a full batch
+    std::vector<std::vector<Item>> streams;
+    std::vector<size_t> stream_bytes;
+    uint64_t total = 0;
+    uint64_t invalid = 0;
+    /// The page being mapped, the index in `swarms` of the swarm of each of
+    /// its messages, and the mapping tasks still running
+    std::vector<Item> page;
+    std::vector<std::optional<size_t>> dest;
+    std::atomic<size_t> tasks_left = 0;
+    /// For waiting until the peers have taken what was relayed so far
+    boost::asio::steady_timer timer;
+
+    bootstrap_sender_t(boost::asio::io_context& ioc,
+                       std::vector<SwarmInfo> all_swarms)
+        : swarms(std::move(all_swarms)), lookup(swarms),
+          wanted(swarms.size(), false), streams(swarms.size()),
+          stream_bytes(swarms.size(), 0), timer(ioc) {}
+};
+
+void ServiceNode::bootstrap_swarms(
+    const std::vector<swarm_id_t>& swarms) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (swarms.empty()) {
+        OXEN_LOG(info, "Bootstrapping all swarms");
+    } else {
+        OXEN_LOG(info, "Bootstrapping swarms: {}", vec_to_string(swarms));
+    }
+
+    auto state =
+        std::make_shared<bootstrap_sender_t>(ioc_, swarm_->all_valid_swarms());
+    for (auto i = 0u; i < state->swarms.size(); ++i) {
+        const auto id = state->swarms[i].swarm_id;
+        state->wanted[i] = swarms.empty() ||
+                           std::find(swarms.begin(), swarms.end(), id) !=
+                               swarms.end();
+    }
+
+    this->start_bootstrap(std::move(state));
+}
+
+void ServiceNode::relay_all_messages(const sn_record_t& peer) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // Only the messages of our swarm, and only to `peer`
+    auto state =
+        std::make_shared<bootstrap_sender_t>(ioc_, swarm_->all_valid_swarms());
+    for (auto i = 0u; i < state->swarms.size(); ++i) {
+        if (state->swarms[i].swarm_id == swarm_->our_swarm_id()) {
+            state->swarms[i].snodes = {peer};
+            state->wanted[i] = true;
+        }
+    }
+
+    this->start_bootstrap(std::move(state));
+}
+
+void ServiceNode::start_bootstrap(
+    std::shared_ptr<bootstrap_sender_t> state) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!db_->get_last_position(state->up_to)) {
+        OXEN_LOG(error, "Could not retrieve entries from the database");
+        return;
+    }
+
+    // Not from within the swarm update that started it
+    boost::asio::post(ioc_, [this, state = std::move(state)]() {
+        this->bootstrap_next_page(state);
+    });
+}
+
+void ServiceNode::bootstrap_next_page(
+    std::shared_ptr<bootstrap_sender_t> state) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // Batches in flight are limited for each peer, so this only waits for
+    // those of the previous page to be sent
+    for (auto i = 0u; i < state->swarms.size(); ++i) {
+        if (!state->wanted[i])
+            continue;
+        for (const auto& sn : state->swarms[i].snodes) {
+            const auto it = relay_peers_.find(sn.pubkey_x25519_bin());
+            if (it != relay_peers_.end() && !it->second.backlog.empty()) {
+                state->timer.expires_after(BOOTSTRAP_DRAIN_INTERVAL);
+                state->timer.async_wait(
+                    [this, state](const boost::system::error_code& ec) {
+                        if (!ec) {
+                            this->bootstrap_next_page(state);
+                        }
+                    });
+                return;
+            }
+        }
+    }
+
+    auto& page = state->page;
+    page.clear();
+    if (state->last < state->up_to &&
+        !db_->retrieve_range(state->last, state->up_to, BOOTSTRAP_PAGE_BYTES,
+                             page, state->last)) {
+        OXEN_LOG(error, "Could not retrieve entries from the database");
+        page.clear();
+    }
+
+    if (page.empty()) {
+        // Whatever is left of each stream
+        for (auto idx = 0u; idx < state->streams.size(); ++idx) {
+            if (!state->streams[idx].empty()) {
+                this->relay_messages(state->streams[idx],
+                                     state->swarms[idx].snodes);
+            }
+        }
+
+        OXEN_LOG(debug, "We have {} messages", state->total);
+
+        if (state->invalid > 0) {
+            OXEN_LOG(error, "{} messages with an invalid pubkey while "
+                            "bootstrapping other nodes",
+                     state->invalid);
+        }
+        return;
+    }
+
+    state->total += page.size();
+
+    // Mapped to their swarms on the thread pool, split between its threads,
+    // then relayed from here
+    const size_t count = page.size();
+    const size_t per_task =
+        std::max(PARTITION_MIN_TASK_SIZE,
+                 (count + CPU_POOL_THREADS - 1) / CPU_POOL_THREADS);
+    state->dest.assign(count, std::nullopt);
+    state->tasks_left = (count + per_task - 1) / per_task;
+
+    for (size_t begin = 0; begin < count; begin += per_task) {
+        const size_t end = std::min(count, begin + per_task);
+        boost::asio::post(cpu_pool_, [this, state, begin, end]() {
+            for (size_t i = begin; i < end; ++i) {
+                bool success;
+                const auto pk =
+                    user_pubkey_t::create(state->page[i].pub_key, success);
+                if (success) {
+                    state->dest[i] = state->lookup.find(pk);
+                }
+            }
+
+            // The last task to finish hands the page back to the main thread
+            if (--state->tasks_left == 0) {
+                boost::asio::post(ioc_, [this, state]() {
+                    this->bootstrap_relay_page(*state, state->page,
+                                               state->dest);
+                    this->bootstrap_next_page(state);
+                });
+            }
+        });
+    }
+}
+
+void ServiceNode::bootstrap_relay_page(
+    bootstrap_sender_t& state, std::vector<Item>& page,
+    const std::vector<std::optional<size_t>>& dest) const {
 
-    this->relay_messages(all_entries, peers);
-}
+    std::lock_guard guard(sn_mutex_);
 
-template <typename T>
-std::string vec_to_string(const std::vector<T>& vec) {
+    for (size_t i = 0; i < page.size(); ++i) {
 
-    std::stringstream ss;
+        if (!dest[i]) {
+            state.invalid++;
+            continue;
+        }
 
-    ss << "[";
+        const size_t idx = *dest[i];
+        if (!state.wanted[idx])
+            continue;
 
-    for (auto i = 0u; i < vec.size(); ++i) {
-        ss << vec[i];
+        state.stream_bytes[idx] += page[i].data.size();
+        state.streams[idx].push_back(std::move(page[i]));
 
-        if (i < vec.size() - 1) {
-            ss << " ";
+        if (state.stream_bytes[idx] >= RELAY_FLUSH_BYTES) {
+            this->relay_messages(state.streams[idx], state.swarms[idx].snodes);
+            state.streams[idx].clear();
+            state.stream_bytes[idx] = 0;
         }
     }
-
-    ss << "]";
-
-    return ss.str();
 }
 
-void ServiceNode::bootstrap_swarms(
-    const std::vector<swarm_id_t>& swarms) const {
-
+template <typename Message>
+void ServiceNode::relay_messages(const std::vector<Message>& messages,
+                                 const std::vector<sn_record_t>& snodes,
+                                 bool durable) const {
+    // Protects the buffer pool
     std::lock_guard guard(sn_mutex_);
 
-    if (swarms.empty()) {
-        OXEN_LOG(info, "Bootstrapping all swarms");
-    } else {
-        OXEN_LOG(info, "Bootstrapping swarms: {}", vec_to_string(swarms));
+    OXEN_LOG(debug, "Relaying {} messages to Snodes:", messages.size());
+    for (auto sn : snodes) {
+        OXEN_LOG(debug, "    {}", sn);
     }
 
-    const auto& all_swarms = swarm_->all_valid_swarms();
-
-    std::vector<Item> all_entries;
-    if (!get_all_messages(all_entries)) {
-        OXEN_LOG(error, "Could not retrieve entries from the database");
-        return;
+    // Serialized once for each format our peers accept
+    std::map<batch_format_t, std::vector<const sn_record_t*>> recipients;
+    for (const sn_record_t& sn : snodes) {
+        recipients[this->peer_batch_format(sn)].push_back(&sn);
     }
 
-    std::unordered_map<swarm_id_t, size_t> swarm_id_to_idx;
-    for (auto i = 0u; i < all_swarms.size(); ++i) {
-        swarm_id_to_idx.insert({all_swarms[i].swarm_id, i});
+    // There is no point in delivering a batch once all of its messages have
+    // expired
+    uint64_t expiration = 0;
+    for (const auto& msg : messages) {
+        expiration = std::max(expiration, msg.timestamp + msg.ttl);
     }
 
-    /// See what pubkeys we have
-    std::unordered_map<std::string, swarm_id_t> cache;
-
-    OXEN_LOG(debug, "We have {} messages", all_entries.size());
-
-    std::unordered_map<swarm_id_t, std::vector<Item>> to_relay;
-
-    for (auto& entry : all_entries) {
-
-        swarm_id_t swarm_id;
-        const auto it = cache.find(entry.pub_key);
-        if (it == cache.end()) {
+    for (const auto& [format, peers] : recipients) {
+        const bool compress = std::any_of(
+            peers.begin(), peers.end(), [this](const sn_record_t* sn) {
+                return this->peer_accepts_compression(*sn);
+            });
 
-            bool success;
-            auto pk = user_pubkey_t::create(entry.pub_key, success);
+        batch_encoder_t encoder(format, batch_buffers_);
+        encoder.encode(messages);
 
-            if (!success) {
-                OXEN_LOG(error, "Invalid pubkey in a message while "
-                                "bootstrapping other nodes");
-                continue;
-            }
+        OXEN_LOG(debug, "Serialised batches (v{}): {}",
+                 static_cast<int>(format), encoder.batches().size());
 
-            swarm_id = get_swarm_by_pk(all_swarms, pk);
-            cache.insert({entry.pub_key, swarm_id});
-        } else {
-            swarm_id = it->second;
+        std::vector<std::string> pubkeys;
+        for (const sn_record_t* sn : peers) {
+            pubkeys.push_back(sn->pubkey_x25519_bin());
         }
 
-        bool relevant = false;
-        for (const auto swarm : swarms) {
-
-            if (swarm == swarm_id) {
-                relevant = true;
+        const auto counts = encoder.message_counts();
+        auto batches = encoder.take_batches();
+        for (size_t i = 0; i < batches.size(); ++i) {
+            auto& data = batches[i];
+            relay_batch_t batch;
+            batch.messages = counts[i];
+            if (durable && !db_->outbox_add(data, batch.messages, expiration,
+                                            pubkeys, batch.outbox_id)) {
+                OXEN_LOG(error, "Failed to add a batch to the outbox");
+                batch.outbox_id = 0;
+            }
+            batch.data = this->share_batch(std::move(data));
+            batch.signature = this->sign_batch(*batch.data);
+            if (compress) {
+                batch.compressed = compress_batch(*batch.data);
             }
-        }
-
-        if (relevant || swarms.empty()) {
 
-            to_relay[swarm_id].emplace_back(std::move(entry));
+            for (const sn_record_t* sn : peers) {
+                this->queue_batch(*sn, batch);
+            }
         }
     }
+}
 
-    OXEN_LOG(trace, "Bootstrapping {} swarms", to_relay.size());
+batch_format_t ServiceNode::peer_batch_format(const sn_record_t& sn) const {
 
-    for (const auto& kv : to_relay) {
-        const uint64_t swarm_id = kv.first;
-        /// what if not found?
-        const size_t idx = swarm_id_to_idx[swarm_id];
+    std::lock_guard guard(sn_mutex_);
 
-        relay_messages(kv.second, all_swarms[idx].snodes);
-    }
+    const auto it = peer_batch_formats_.find(sn.pubkey_x25519_bin());
+    return it != peer_batch_formats_.end() ? it->second : batch_format_t::v1;
 }
 
-template <typename Message>
-void ServiceNode::relay_messages(const std::vector<Message>& messages,
-                                 const std::vector<sn_record_t>& snodes) const {
-    std::vector<std::string> batches = serialize_messages(messages);
+bool ServiceNode::peer_accepts_compression(const sn_record_t& sn) const {
 
-    OXEN_LOG(debug, "Relayed messages:");
-    for (auto msg : batches) {
-        OXEN_LOG(debug, "    {}", msg);
-    }
-    OXEN_LOG(debug, "To Snodes:");
-    for (auto sn : snodes) {
-        OXEN_LOG(debug, "    {}", sn);
-    }
+    std::lock_guard guard(sn_mutex_);
 
-    OXEN_LOG(debug, "Serialised batches: {}", batches.size());
-    for (const sn_record_t& sn : snodes) {
-        for (auto& batch : batches) {
-            // TODO: I could probably avoid copying here
-            this->relay_data_reliable(batch, sn);
-        }
-    }
+    const auto it = peer_compression_.find(sn.pubkey_x25519_bin());
+    return it != peer_compression_.end() &&
+           it->second == PREFERRED_COMPRESSION;
 }
 
 void ServiceNode::salvage_data() const {
@@ -1708,8 +3354,8 @@ void ServiceNode::set_difficulty_history(
 
     std::lock_guard guard(sn_mutex_);
 
-    pow_history_ = new_history;
-    for (const auto& difficulty : pow_history_) {
+    pow_timeline_ = std::make_shared<pow_difficulty_timeline_t>(new_history);
+    for (const auto& difficulty : new_history) {
         if (curr_pow_difficulty_.timestamp < difficulty.timestamp) {
             curr_pow_difficulty_ = difficulty;
         }
@@ -1749,7 +3395,13 @@ static nlohmann::json to_json(const all_stats_t& stats) {
         const auto& pubkey = kv.first.pub_key_base32z();
 
         peers[pubkey]["requests_failed"] = kv.second.requests_failed;
-        peers[pubkey]["pushes_failed"] = kv.second.requests_failed;
+        peers[pubkey]["pushes_failed"] = kv.second.pushes_failed;
+        peers[pubkey]["batches_acked"] = kv.second.batches_acked;
+        peers[pubkey]["messages_acked"] = kv.second.messages_acked;
+        peers[pubkey]["messages_accepted"] = kv.second.messages_accepted;
+        peers[pubkey]["bytes_acked"] = kv.second.bytes_acked;
+        peers[pubkey]["throughput"] =
+            kv.second.current_throughput(std::chrono::steady_clock::now());
         peers[pubkey]["storage_tests"] = kv.second.storage_tests;
         peers[pubkey]["blockchain_tests"] = kv.second.blockchain_tests;
     }
@@ -1768,6 +3420,53 @@ std::string ServiceNode::get_stats_for_session_client() const {
     return res.dump(indent);
 }
 
+void ServiceNode::add_relay_stats(nlohmann::json& stats) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    std::vector<OutboxLag> outbox_lag;
+    if (!db_->outbox_get_lag(outbox_lag)) {
+        OXEN_LOG(error, "Could not get the outbox lag");
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const auto now_ms = util::get_time_ms();
+    for (const auto& sn : swarm_->other_nodes()) {
+        uint64_t lag_messages = 0;
+        double lag_seconds = 0;
+        size_t inflight_bytes = 0;
+        size_t backlog_bytes = 0;
+
+        const auto it = relay_peers_.find(sn.pubkey_x25519_bin());
+        if (it != relay_peers_.end()) {
+            const auto& peer = it->second;
+            lag_messages += peer.transient_messages;
+            if (!peer.transient_since.empty()) {
+                lag_seconds = std::chrono::duration<double>(
+                                  now - *peer.transient_since.begin())
+                                  .count();
+            }
+            inflight_bytes = peer.inflight_bytes;
+            backlog_bytes = peer.backlog_bytes;
+        }
+
+        for (const auto& entry : outbox_lag) {
+            if (entry.peer == sn.pubkey_x25519_bin()) {
+                lag_messages += entry.messages;
+                if (entry.oldest < now_ms) {
+                    lag_seconds =
+                        std::max(lag_seconds, (now_ms - entry.oldest) / 1000.0);
+                }
+            }
+        }
+
+        auto& peer_json = stats["peers"][sn.pub_key_base32z()];
+        peer_json["lag_messages"] = lag_messages;
+        peer_json["lag_seconds"] = lag_seconds;
+        peer_json["inflight_bytes"] = inflight_bytes;
+        peer_json["backlog_bytes"] = backlog_bytes;
+    }
+}
+
 std::string ServiceNode::get_stats() const {
 
     std::lock_guard guard(sn_mutex_);
@@ -1783,6 +3482,37 @@ std::string ServiceNode::get_stats() const {
         val["total_stored"] = total_stored;
     }
 
+    uint64_t cache_hits, cache_misses;
+    if (db_->get_cache_stats(cache_hits, cache_misses)) {
+        val["db_cache_hits"] = cache_hits;
+        val["db_cache_misses"] = cache_misses;
+    }
+
+    uint64_t db_memory;
+    if (db_->get_memory_used(db_memory)) {
+        val["db_memory"] = db_memory;
+    }
+
+    val["relay_batches_shed"] = relay_batches_shed_;
+    val["outbox_entries_dropped"] = outbox_entries_dropped_;
+    val["anti_entropy_sent"] = anti_entropy_sent_;
+    val["anti_entropy_fetched"] = anti_entropy_fetched_;
+    val["log_messages_fetched"] = log_messages_fetched_;
+    val["signed_batches_received"] = signed_batches_received_;
+    val["signed_batches_rejected"] = signed_batches_rejected_;
+    val["relay_bytes"] = relay_bytes_sent_;
+    val["relay_bytes_uncompressed"] = relay_bytes_uncompressed_;
+    if (relay_bytes_sent_ > 0) {
+        val["relay_compression_ratio"] =
+            static_cast<double>(relay_bytes_uncompressed_) / relay_bytes_sent_;
+    }
+
+    // Replication lag of current swarm members, combining the batches held in
+    // memory with the ones waiting in the outbox (workers don't relay)
+    if (swarm_ && !worker_) {
+        this->add_relay_stats(val);
+    }
+
     val["connections_in"] = get_net_stats().connections_in.load();
     val["http_connections_out"] = get_net_stats().http_connections_out.load();
     val["https_connections_out"] = get_net_stats().https_connections_out.load();
@@ -1846,48 +3576,530 @@ bool ServiceNode::get_all_messages(std::vector<Item>& all_entries) const {
     return db_->retrieve("", all_entries, "");
 }
 
-void ServiceNode::process_push_batch(const std::string& blob) {
+void ServiceNode::process_push_batch(
+    std::string blob, std::function<void(bool, size_t)> on_done) {
+    std::vector<std::string> blobs;
+    blobs.push_back(std::move(blob));
+    this->process_push_batches(std::move(blobs), std::move(on_done));
+}
+
+void ServiceNode::process_signed_push_batch(
+    const sn_pub_key_t& sender, std::string blob, const std::string& signature,
+    std::function<void(bool, size_t)> on_done) {
+
+    {
+        std::lock_guard guard(sn_mutex_);
+        signed_batches_received_++;
+    }
+
+    auto signer = this->trusted_signer(sender, signature, blob);
+
+    std::vector<std::string> blobs;
+    blobs.push_back(std::move(blob));
+    this->process_push_batches(std::move(blobs), std::move(on_done),
+                               std::move(signer));
+}
+
+void ServiceNode::process_compressed_push_batch(
+    const sn_pub_key_t& sender, std::string blob, std::string signature,
+    compression_t compression, std::function<void(bool, size_t)> on_done) {
+
+    // Batches decompress to up to 64 MiB, which would hold up the SispopMQ
+    // thread
+    boost::asio::post(cpu_pool_, [this, sender, blob = std::move(blob),
+                                  signature = std::move(signature),
+                                  compression,
+                                  on_done = std::move(on_done)]() mutable {
+        std::string batch;
+        if (!decompress(compression, blob, batch)) {
+            OXEN_LOG(warn, "Dropping a batch that could not be decompressed");
+            on_done(true, 0);
+            return;
+        }
+
+        if (signature.empty()) {
+            this->process_push_batch(std::move(batch), std::move(on_done));
+        } else {
+            this->process_signed_push_batch(sender, std::move(batch),
+                                            signature, std::move(on_done));
+        }
+    });
+}
+
+std::optional<sn_pub_key_t>
+ServiceNode::trusted_signer(const sn_pub_key_t& sender,
+                            const std::string& signature,
+                            const std::string& data) {
 
     std::lock_guard guard(sn_mutex_);
 
-    if (blob.empty())
-        return;
+    // Distrust wears off, as it may come from an honest disagreement (e.g.
+    // about the PoW difficulty at the time)
+    const auto distrusted = distrusted_signers_.find(sender);
+    if (distrusted != distrusted_signers_.end() &&
+        distrusted->second <= std::chrono::steady_clock::now()) {
+        distrusted_signers_.erase(distrusted);
+    }
+
+    // Only if we have opted in ourselves
+    const auto sn = this->find_node_by_x25519_bin(sender);
+    if (sign_relays_ && sn && this->is_swarm_peer(sender) &&
+        !distrusted_signers_.count(sender) &&
+        check_signature(signature, hash_data(data), sn->pub_key_base32z())) {
+        return sender;
+    }
 
-    std::vector<message_t> messages = deserialize_messages(blob);
+    OXEN_LOG(debug, "Not trusting the signature of a batch from {}",
+             sispopmq::to_hex(sender));
+    return std::nullopt;
+}
 
-    OXEN_LOG(trace, "Saving all: begin");
+void ServiceNode::process_push_batches(
+    std::vector<std::string> blobs, std::function<void(bool, size_t)> on_done,
+    std::optional<sn_pub_key_t> signer) {
+
+    auto push = std::make_shared<pending_push_t>();
+    push->blobs = std::move(blobs);
+    push->on_done = std::move(on_done);
+    push->signer = std::move(signer);
+
+    // Deserialized in place, as the messages refer to the blobs and to the
+    // batches
+    push->batches.reserve(push->blobs.size());
+    for (const auto& blob : push->blobs) {
+
+        if (blob.empty())
+            continue;
+
+        auto& batch = push->batches.emplace_back();
+        if (!deserialize_messages(blob, batch)) {
+            // Malformed batches are dropped entirely
+            OXEN_LOG(warn, "Dropping a malformed batch of size {}",
+                     blob.size());
+            push->batches.pop_back();
+            continue;
+        }
+        if (batch.skipped > 0) {
+            OXEN_LOG(warn, "Skipped {} malformed messages in a batch",
+                     batch.skipped);
+        }
+
+        OXEN_LOG(debug, "Got {} messages from peers, size: {}",
+                 batch.messages.size(), blob.size());
+
+        for (const auto& message : batch.messages) {
+            push->messages.push_back(&message);
+        }
+    }
+
+    this->verify_push(std::move(push));
+}
 
-    OXEN_LOG(debug, "Got {} messages from peers, size: {}", messages.size(),
-             blob.size());
+void ServiceNode::verify_push(std::shared_ptr<pending_push_t> push) {
+
+    push->valid.assign(push->messages.size(), true);
 
 #ifndef DISABLE_POW
-    const auto it = std::remove_if(
-        messages.begin(), messages.end(), [this](const message_t& message) {
-            return verify_message(message, pow_history_) == false;
-        });
-    messages.erase(it, messages.end());
-    if (it != messages.end()) {
-        OXEN_LOG(
-            warn,
-            "Some of the batch messages were removed due to incorrect PoW");
+    // A swarm member's signature vouches for the hashes and PoW of its
+    // messages, so only a random sample of them is hashed, which is enough
+    // to catch a signer that doesn't check them
+    auto& to_verify = push->to_verify;
+    if (push->signer) {
+        for (size_t i = 0; i < push->messages.size(); ++i) {
+            if (util::uniform_distribution_portable(SIGNED_BATCH_AUDIT_RATE) ==
+                0) {
+                to_verify.push_back(i);
+            } else {
+                push->valid[i] = verify_expiry(*push->messages[i]);
+            }
+        }
+    } else {
+        to_verify.resize(push->messages.size());
+        std::iota(to_verify.begin(), to_verify.end(), 0);
+    }
+
+    const size_t count = to_verify.size();
+    if (count > 0) {
+        {
+            std::lock_guard guard(sn_mutex_);
+            push->pow_timeline = pow_timeline_;
+        }
+
+        // Split evenly between the threads, but not into tasks so small
+        // that scheduling them costs more than the hashing
+        const size_t per_task = std::max(
+            POW_VERIFY_MIN_TASK_SIZE,
+            (count + CPU_POOL_THREADS - 1) / CPU_POOL_THREADS);
+        const size_t tasks = (count + per_task - 1) / per_task;
+        push->tasks_left = tasks;
+
+        for (size_t begin = 0; begin < count; begin += per_task) {
+            const size_t end = std::min(count, begin + per_task);
+            boost::asio::post(cpu_pool_, [this, push, begin, end]() {
+                verify_messages(*push, begin, end);
+                // The last task to finish hands the batch back to the main
+                // thread
+                if (--push->tasks_left == 0) {
+                    boost::asio::post(ioc_, [this, push]() {
+                        this->store_verified(*push);
+                    });
+                }
+            });
+        }
+        return;
     }
 #endif
 
-    std::vector<Item> items;
-    items.reserve(messages.size());
+    boost::asio::post(ioc_, [this, push]() { this->store_verified(*push); });
+}
+
+void ServiceNode::store_verified(pending_push_t& push) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // A peer that vouches for an invalid message can't be trusted to have
+    // checked the others either
+    if (push.signer && push.forged > 0) {
+        OXEN_LOG(warn, "Signed batch from {} failed the audit, not trusting "
+                       "its signatures for {} minutes",
+                 sispopmq::to_hex(*push.signer),
+                 std::chrono::duration_cast<std::chrono::minutes>(
+                     SIGNER_DISTRUST_TIME)
+                     .count());
+        signed_batches_rejected_++;
+        distrusted_signers_[*push.signer] =
+            std::chrono::steady_clock::now() + SIGNER_DISTRUST_TIME;
+        push.valid.assign(push.valid.size(), false);
+    }
+
+    std::vector<ItemView> items;
+    items.reserve(push.messages.size());
+
+    size_t not_ours = 0;
+    std::unordered_map<std::string_view, bool> pk_cache;
+
+    for (size_t i = 0; i < push.messages.size(); ++i) {
+        if (!push.valid[i])
+            continue;
+        const auto& m = *push.messages[i];
+        if (push.check_swarm) {
+            auto it = pk_cache.find(m.pub_key);
+            if (it == pk_cache.end()) {
+                bool success;
+                const auto pk =
+                    user_pubkey_t::create(std::string(m.pub_key), success);
+                const bool ours = success && swarm_->is_pubkey_for_us(pk);
+                it = pk_cache.emplace(m.pub_key, ours).first;
+            }
+            if (!it->second) {
+                not_ours++;
+                continue;
+            }
+        }
+        items.push_back(ItemView{m.hash, m.pub_key, m.timestamp, m.ttl,
+                                 m.timestamp + m.ttl, m.nonce, m.data});
+    }
 
-    // TODO: avoid copying m.data
-    // Promoting message_t to Item:
-    std::transform(messages.begin(), messages.end(), std::back_inserter(items),
-                   [](const message_t& m) {
-                       return Item{m.hash, m.pub_key,           m.timestamp,
-                                   m.ttl,  m.timestamp + m.ttl, m.nonce,
-                                   m.data};
-                   });
+    if (items.size() + not_ours < push.messages.size()) {
+        OXEN_LOG(warn, "{} of the batch messages were removed due to "
+                       "incorrect PoW",
+                 push.messages.size() - items.size() - not_ours);
+    }
+
+    if (not_ours > 0) {
+        OXEN_LOG(warn, "{} of the batch messages do not belong to our swarm",
+                 not_ours);
+    }
+
+    OXEN_LOG(trace, "Saving all: begin");
 
-    this->save_bulk(items);
+    // Only the messages we didn't have yet count as accepted
+    uint64_t accepted = 0;
+    const bool stored = items.empty() || this->save_bulk(items, accepted);
+    if (!stored) {
+        accepted = 0;
+    }
 
     OXEN_LOG(trace, "Saving all: end");
+
+    if (push.on_done) {
+        push.on_done(stored, accepted);
+    }
+}
+
+bool ServiceNode::is_swarm_peer(const sn_pub_key_t& x25519_bin) const {
+
+    std::lock_guard guard(sn_mutex_);
+
+    const auto& peers = swarm_->other_nodes();
+    return std::any_of(peers.begin(), peers.end(), [&](const sn_record_t& sn) {
+        return sn.pubkey_x25519_bin() == x25519_bin;
+    });
+}
+
+bool ServiceNode::apply_tombstone(const tombstone_t& tombstone,
+                                  uint64_t& deleted) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // Kept with the deletion, to hand it to peers that still have the
+    // messages later
+    const std::string request = serialize_tombstones({tombstone});
+
+    if (tombstone.all) {
+        return db_->delete_all(tombstone.pub_key, tombstone.timestamp,
+                               request, deleted);
+    } else {
+        return db_->delete_by_hash(tombstone.pub_key, tombstone.hashes,
+                                   request, deleted);
+    }
+}
+
+/// Whether a deletion relayed by another node was requested by the owner
+/// of the messages, recently enough to still matter
+static bool verify_tombstone(const tombstone_t& tombstone) {
+
+    // Same tolerance for the future as for client requests, but relayed
+    // deletions may have spent a while in an outbox
+    if (!util::validateTimestamp(tombstone.timestamp,
+                                 MAX_MESSAGE_TTL.count())) {
+        return false;
+    }
+
+    return check_owner_signature(tombstone.pub_key, tombstone.pubkey_ed25519,
+                                 tombstone.signature,
+                                 tombstone_signed_data(tombstone)) ==
+           owner_signature_t::OK;
+}
+
+bool ServiceNode::delete_messages(const tombstone_t& tombstone,
+                                  uint64_t& deleted) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!this->apply_tombstone(tombstone, deleted))
+        return false;
+
+    if (tombstone.all) {
+        OXEN_LOG(debug, "Deleted all {} messages for a client", deleted);
+    } else {
+        OXEN_LOG(debug, "Deleted {} of {} requested messages", deleted,
+                 tombstone.hashes.size());
+    }
+
+    tombstone_buffer_.push_back(tombstone);
+    this->schedule_relay();
+    return true;
+}
+
+bool ServiceNode::process_tombstones(const sn_pub_key_t& sender_x25519_bin,
+                                     const std::string& blob) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    // Deletions are only accepted from swarm members, and only if signed by
+    // the owner (the sender could be lying about that)
+    if (!this->is_swarm_peer(sender_x25519_bin)) {
+        OXEN_LOG(debug, "Ignoring deletions from a node outside of our swarm");
+        return false;
+    }
+
+    std::vector<tombstone_t> tombstones;
+    if (!deserialize_tombstones(blob, tombstones)) {
+        return false;
+    }
+
+    uint64_t total = 0;
+    size_t rejected = 0;
+    for (const auto& tombstone : tombstones) {
+        if (!verify_tombstone(tombstone)) {
+            rejected++;
+            continue;
+        }
+        uint64_t deleted = 0;
+        this->apply_tombstone(tombstone, deleted);
+        total += deleted;
+    }
+
+    if (rejected > 0) {
+        OXEN_LOG(warn, "Ignored {} deletions from a peer that the owner did "
+                       "not sign (or are out of date)",
+                 rejected);
+    }
+    OXEN_LOG(debug, "Applied {} deletions from a peer ({} messages)",
+             tombstones.size() - rejected, total);
+
+    return true;
+}
+
+void ServiceNode::process_snapshot_part(
+    const sn_pub_key_t& sender_x25519_bin, const std::string& snapshot_id,
+    const std::string& part, const std::string& checksum, std::string payload,
+    compression_t compression, const std::string& signature,
+    std::function<void(std::string)> on_done) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!this->is_swarm_peer(sender_x25519_bin)) {
+        OXEN_LOG(debug, "Ignoring snapshot from a node outside of our swarm");
+        on_done("NOT_A_PEER");
+        return;
+    }
+
+    auto it = incoming_snapshots_.find(sender_x25519_bin);
+
+    if (part == "end") {
+
+        if (it == incoming_snapshots_.end() || it->second.id != snapshot_id) {
+            on_done("UNKNOWN_SNAPSHOT");
+            return;
+        }
+
+        const auto& state = it->second;
+        const bool valid =
+            hash_to_string(hash_data(state.checksums)) == checksum &&
+            std::to_string(state.items_received) == payload;
+
+        if (!valid) {
+            OXEN_LOG(error, "Snapshot {} does not match what we received",
+                     snapshot_id);
+            incoming_snapshots_.erase(it);
+            on_done("BAD_CHECKSUM");
+            return;
+        }
+
+        OXEN_LOG(info, "Received snapshot {} with {} messages", snapshot_id,
+                 state.items_received);
+        incoming_snapshots_.erase(it);
+        on_done("OK");
+        return;
+    }
+
+    uint64_t chunk_idx;
+    const auto res = std::from_chars(part.data(), part.data() + part.size(),
+                                     chunk_idx);
+    if (res.ec != std::errc() || res.ptr != part.data() + part.size()) {
+        on_done("INVALID_REQUEST");
+        return;
+    }
+
+    if (chunk_idx == 0) {
+        // A (re)started snapshot replaces any previous one from this peer
+        it = incoming_snapshots_.insert_or_assign(sender_x25519_bin,
+                                                  snapshot_receiver_t{})
+                 .first;
+        it->second.id = snapshot_id;
+    } else if (it == incoming_snapshots_.end() ||
+               it->second.id != snapshot_id) {
+        on_done("UNKNOWN_SNAPSHOT");
+        return;
+    } else if (chunk_idx + 1 == it->second.next_chunk) {
+        // Our previous reply got lost, the chunk is already stored
+        on_done("OK");
+        return;
+    } else if (chunk_idx != it->second.next_chunk) {
+        on_done("OUT_OF_ORDER");
+        return;
+    }
+
+    // Checked, decompressed and deserialized on the CPU pool, chunks being
+    // up to 4 MiB (more once decompressed)
+    boost::asio::post(cpu_pool_, [this, sender_x25519_bin, snapshot_id,
+                                  chunk_idx, checksum,
+                                  payload = std::move(payload), compression,
+                                  signature, on_done = std::move(on_done)]() {
+        this->process_snapshot_chunk(sender_x25519_bin, snapshot_id, chunk_idx,
+                                     checksum, payload, compression,
+                                     signature, std::move(on_done));
+    });
+}
+
+void ServiceNode::process_snapshot_chunk(
+    const sn_pub_key_t& sender_x25519_bin, const std::string& snapshot_id,
+    uint64_t chunk_idx, const std::string& checksum,
+    const std::string& payload, compression_t compression,
+    const std::string& signature, std::function<void(std::string)> on_done) {
+
+    if (hash_to_string(hash_data(payload)) != checksum) {
+        OXEN_LOG(warn, "Snapshot {} chunk {} has invalid checksum",
+                 snapshot_id, chunk_idx);
+        on_done("BAD_CHECKSUM");
+        return;
+    }
+
+    std::string decompressed;
+    if (compression != compression_t::none &&
+        !decompress(compression, payload, decompressed)) {
+        on_done("BAD_CHECKSUM");
+        return;
+    }
+
+    auto push = std::make_shared<pending_push_t>();
+    if (!deserialize_snapshot_chunk(
+            compression != compression_t::none ? decompressed : payload,
+            push->items)) {
+        on_done("BAD_CHECKSUM");
+        return;
+    }
+
+    // Verified like relayed batches (a member of our swarm is not any more
+    // trustworthy when it bootstraps us), and also checked against our swarm
+    // as the sender picks the messages by its own view of it. A signer that
+    // fails the audit has the whole chunk dropped, which anti-entropy makes
+    // up for later.
+    if (!signature.empty()) {
+        push->signer =
+            this->trusted_signer(sender_x25519_bin, signature, payload);
+    }
+
+    auto& batch = push->batches.emplace_back();
+    batch.messages.reserve(push->items.size());
+    for (const auto& item : push->items) {
+        batch.messages.push_back(message_view_t{item.pub_key, item.data,
+                                                item.hash, item.ttl,
+                                                item.timestamp, item.nonce});
+    }
+    for (const auto& message : batch.messages) {
+        push->messages.push_back(&message);
+    }
+    push->check_swarm = true;
+
+    const size_t received = push->items.size();
+    push->on_done = [this, sender_x25519_bin, snapshot_id, chunk_idx, checksum,
+                     received,
+                     on_done = std::move(on_done)](bool stored,
+                                                   size_t accepted) {
+        std::lock_guard guard(sn_mutex_);
+
+        // The sender relays the messages instead
+        if (!stored) {
+            on_done("ERROR");
+            return;
+        }
+
+        const auto it = incoming_snapshots_.find(sender_x25519_bin);
+        if (it == incoming_snapshots_.end() || it->second.id != snapshot_id) {
+            // Restarted while this chunk was being verified
+            on_done("UNKNOWN_SNAPSHOT");
+            return;
+        }
+
+        auto& state = it->second;
+        // A chunk re-sent while the first copy was being verified is only
+        // counted once
+        if (state.next_chunk == chunk_idx) {
+            state.next_chunk++;
+            state.items_received += received;
+            state.checksums += checksum;
+        }
+
+        OXEN_LOG(debug, "Stored snapshot {} chunk {} ({} of {} messages)",
+                 snapshot_id, chunk_idx, accepted, received);
+
+        on_done("OK");
+    };
+
+    this->verify_push(std::move(push));
 }
 
 bool ServiceNode::is_pubkey_for_us(const user_pubkey_t& pk) const {
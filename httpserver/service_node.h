@@ -1,22 +1,31 @@
 #pragma once
 
 #include <Database.hpp>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <set>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <boost/asio.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/circular_buffer.hpp>
+#include <nlohmann/json_fwd.hpp>
 
+#include "anti_entropy.h"
+#include "compression.h"
 #include "oxen_common.h"
 #include "oxend_key.h"
 #include "pow.hpp"
 #include "reachability_testing.h"
+#include "serialization.h"
 #include "stats.h"
 #include "swarm.h"
 
@@ -38,6 +47,7 @@ namespace oxen {
 
 namespace storage {
 struct Item;
+struct ItemView;
 } // namespace storage
 
 struct sn_response_t;
@@ -97,6 +107,88 @@ class FailedRequestHandler
     void init_timer();
 };
 
+struct snapshot_sender_t;
+struct bootstrap_sender_t;
+
+/// State of a bootstrap snapshot being received from a swarm member
+struct snapshot_receiver_t {
+    std::string id;
+    uint64_t next_chunk = 0;
+    /// Messages in the chunks received so far, including those that failed
+    /// verification
+    uint64_t items_received = 0;
+    /// Concatenated checksums of all chunks received so far
+    std::string checksums;
+};
+
+/// Relayed batch, shared by the sends (and retries) to all peers
+using shared_batch_t = std::shared_ptr<const std::string>;
+
+/// Batch to be sent to a particular peer
+struct relay_batch_t {
+    shared_batch_t data;
+    /// Id in the replication outbox, or 0 if the batch is not kept there
+    uint64_t outbox_id = 0;
+    /// Number of failed attempts so far
+    uint32_t attempts = 0;
+    /// Number of messages in the batch
+    uint32_t messages = 0;
+    /// Messages are sent as "sn.data", deletions as "sn.delete"
+    storage::OutboxKind kind = storage::OutboxKind::MESSAGES;
+    /// When the batch was queued for the peer
+    time_point_t queued_at{};
+    /// Our signature of `data` (base64), or empty if we don't sign batches
+    std::string signature;
+    /// `data` compressed with PREFERRED_COMPRESSION for the peers that accept
+    /// it, or null if it doesn't compress well
+    shared_batch_t compressed;
+};
+
+/// Relay state of a swarm member, used to hold back batches while the peer
+/// is slow to process the ones already sent
+struct peer_relay_state_t {
+    /// Size of the batches sent but not yet acknowledged
+    size_t inflight_bytes = 0;
+    /// Batches waiting for the in-flight ones to complete
+    std::deque<relay_batch_t> backlog;
+    size_t backlog_bytes = 0;
+    /// Messages queued or in flight that are not in the outbox (the outbox
+    /// keeps track of its own), and when each of their batches was queued
+    uint64_t transient_messages = 0;
+    std::multiset<time_point_t> transient_since;
+};
+
+/// Batches received from swarm members, kept while their messages are being
+/// verified (the messages refer to `blobs`)
+struct pending_push_t {
+    std::vector<std::string> blobs;
+    std::vector<message_batch_t> batches;
+    std::vector<const message_view_t*> messages;
+    /// Verdict for each of `messages`
+    std::vector<char> valid;
+    std::shared_ptr<const pow_difficulty_timeline_t> pow_timeline;
+    /// Number of verification tasks still running
+    std::atomic<size_t> tasks_left{0};
+    /// Called with whether the messages could be stored and the number of
+    /// them that were new
+    std::function<void(bool, size_t)> on_done;
+    /// Swarm member that signed the batches, if we trust its signature
+    std::optional<sn_pub_key_t> signer;
+    /// Indices of the messages that are fully verified (only a sample of
+    /// them if the batches are signed)
+    std::vector<size_t> to_verify;
+    /// Number of those with a wrong hash or PoW (rather than only being
+    /// expired, which can happen on the way)
+    std::atomic<size_t> forged{0};
+    /// Messages of a bootstrap snapshot, which `messages` refer to instead of
+    /// `blobs`
+    std::vector<storage::Item> items;
+    /// Whether messages that don't belong to our swarm are dropped. Relayed
+    /// batches can arrive before we learn about a swarm change, but
+    /// snapshots only ever come from members of our own swarm.
+    bool check_swarm = false;
+};
+
 /// WRONG_REQ - request was ignored as not valid (e.g. incorrect tester)
 enum class MessageTestStatus { SUCCESS, RETRY, ERROR, WRONG_REQ };
 
@@ -110,13 +202,26 @@ class ServiceNode {
     boost::asio::io_context& ioc_;
     boost::asio::io_context& worker_ioc_;
     std::thread worker_thread_;
+    /// Used to verify the messages of incoming batches and to work out where
+    /// our messages belong when bootstrapping other swarms
+    mutable boost::asio::thread_pool cpu_pool_;
 
     // We set the default difficulty to some low value, so that we don't reject
     // clients unnecessarily before we get the DNS record
     pow_difficulty_t curr_pow_difficulty_{std::chrono::milliseconds(0), 1};
-    std::vector<pow_difficulty_t> pow_history_{curr_pow_difficulty_};
+    /// Difficulties that messages are verified against, rebuilt whenever
+    /// the history changes (and shared with the verification tasks)
+    std::shared_ptr<const pow_difficulty_timeline_t> pow_timeline_ =
+        std::make_shared<pow_difficulty_timeline_t>(
+            std::vector<pow_difficulty_t>{curr_pow_difficulty_});
 
     bool force_start_ = false;
+    /// Whether we are a (read only) worker process serving client requests
+    /// on behalf of the primary process of this node
+    bool worker_ = false;
+    /// Whether to sign the batches we relay, so that swarm members can skip
+    /// checking the PoW of their messages (and whether we skip it for theirs)
+    bool sign_relays_ = false;
     bool syncing_ = true;
     int hardfork_ = 0;
     uint64_t block_height_ = 0;
@@ -146,8 +251,29 @@ class ServiceNode {
 
     boost::asio::steady_timer peer_ping_timer_;
 
-    /// Used to periodially send messages from relay_buffer_
+    /// Used to send messages from relay_buffer_ once the oldest of them
+    /// has waited long enough
     boost::asio::steady_timer relay_timer_;
+    /// Whether relay_timer_ is set
+    bool relay_scheduled_ = false;
+    /// Set once we are active; messages are only buffered until then
+    bool relaying_ = false;
+
+    /// Used to periodically resend batches from the replication outbox
+    boost::asio::steady_timer outbox_timer_;
+
+    /// Used to periodically compare our messages with a swarm member's
+    boost::asio::steady_timer anti_entropy_timer_;
+    /// Messages sent to and fetched from peers by anti-entropy rounds
+    uint64_t anti_entropy_sent_ = 0;
+    uint64_t anti_entropy_fetched_ = 0;
+
+    /// Used to periodically read the replication logs of swarm members
+    boost::asio::steady_timer log_sync_timer_;
+    /// Swarm members whose log we are reading
+    std::unordered_set<sn_pub_key_t> log_syncing_;
+    /// Messages we were missing found in the logs of swarm members
+    uint64_t log_messages_fetched_ = 0;
 
     oxen::oxend_key_pair_t oxend_key_pair_;
 
@@ -161,15 +287,60 @@ class ServiceNode {
     /// Container for recently received messages directly from
     /// clients;
     std::vector<message_t> relay_buffer_;
+    size_t relay_buffer_bytes_ = 0;
+
+    /// Deletions requested by clients, relayed along with messages
+    std::vector<tombstone_t> tombstone_buffer_;
 
     mutable all_stats_t all_stats_;
 
+    /// Snapshots currently being received, by sender's x25519 key
+    std::unordered_map<sn_pub_key_t, snapshot_receiver_t> incoming_snapshots_;
+
+    /// Batch formats accepted by swarm members, by their x25519 key
+    mutable std::unordered_map<sn_pub_key_t, batch_format_t>
+        peer_batch_formats_;
+    /// Swarm members that accept signed batches, by their x25519 key
+    mutable std::unordered_set<sn_pub_key_t> peers_accepting_signatures_;
+    /// Compression accepted by swarm members, by their x25519 key
+    mutable std::unordered_map<sn_pub_key_t, compression_t> peer_compression_;
+
+    /// Size of the batches and snapshot chunks sent to swarm members, as
+    /// sent and before compression
+    mutable uint64_t relay_bytes_sent_ = 0;
+    mutable uint64_t relay_bytes_uncompressed_ = 0;
+
+    /// Swarm members whose signed batches contained invalid messages, and
+    /// until when their batches are fully verified
+    std::unordered_map<sn_pub_key_t, std::chrono::steady_clock::time_point>
+        distrusted_signers_;
+    /// Signed batches received, and those rejected by the PoW audit
+    uint64_t signed_batches_received_ = 0;
+    uint64_t signed_batches_rejected_ = 0;
+
+    /// Buffers reused for serializing relayed batches
+    mutable batch_buffer_pool_t batch_buffers_;
+
+    /// By x25519 key of the peer
+    mutable std::unordered_map<sn_pub_key_t, peer_relay_state_t> relay_peers_;
+    /// Batches dropped because a peer fell too far behind
+    mutable uint64_t relay_batches_shed_ = 0;
+    /// Outcomes of sending outbox batches, written to the outbox together
+    mutable std::vector<storage::OutboxResult> outbox_results_;
+    /// Outbox entries dropped for peers that fell too far behind, which are
+    /// left to catch up through our log and anti-entropy
+    uint64_t outbox_entries_dropped_ = 0;
+
     mutable std::recursive_mutex sn_mutex_;
 
     void save_if_new(const message_t& msg);
 
-    // Save items to the database, notifying listeners as necessary
-    void save_bulk(const std::vector<storage::Item>& items);
+    // Save items to the database, notifying listeners as necessary. Return
+    // false if they could not be saved.
+    bool save_bulk(const std::vector<storage::Item>& items);
+    // `stored` is set to the number of items we didn't have yet
+    bool save_bulk(const std::vector<storage::ItemView>& items,
+                   uint64_t& stored);
 
     void on_bootstrap_update(block_update_t&& bu);
 
@@ -180,8 +351,36 @@ class ServiceNode {
     void bootstrap_peers(
         const std::vector<sn_record_t>& peers) const; // mutex not needed
 
+    /// Stream a snapshot of our data to a new swarm member, falling back
+    /// to relaying individual messages if the peer does not support it
+    void send_snapshot(const sn_record_t& peer) const;
+
+    void send_snapshot_chunk(std::shared_ptr<snapshot_sender_t> state) const;
+
+    void on_snapshot_reply(std::shared_ptr<snapshot_sender_t> state,
+                           bool success, std::vector<std::string> data) const;
+
+    /// Relay our messages to the members of `swarms` (of all swarms if
+    /// empty), a page at a time
     void bootstrap_swarms(const std::vector<swarm_id_t>& swarms) const;
 
+    /// Same for the messages of our swarm, to `peer` only (when it can't
+    /// take a snapshot)
+    void relay_all_messages(const sn_record_t& peer) const;
+
+    void start_bootstrap(std::shared_ptr<bootstrap_sender_t> state) const;
+
+    /// Read and relay the next page of messages once the peers have taken
+    /// the previous ones, or finish
+    void
+    bootstrap_next_page(std::shared_ptr<bootstrap_sender_t> state) const;
+
+    /// Add the messages of `page` to the streams of the swarms (`dest`) they
+    /// belong to, relaying the streams that make up a full batch
+    void bootstrap_relay_page(
+        bootstrap_sender_t& state, std::vector<storage::Item>& page,
+        const std::vector<std::optional<size_t>>& dest) const;
+
     /// Distribute all our data to where it belongs
     /// (called when our old node got dissolved)
     void salvage_data() const; // mutex not needed
@@ -189,15 +388,47 @@ class ServiceNode {
     void attach_signature(std::shared_ptr<request_t>& request,
                           const signature& sig) const; // mutex not needed
 
-    /// Reliably push message/batch to a service node
-    void
-    relay_data_reliable(const std::string& blob,
-                        const sn_record_t& address) const; // mutex not needed
+    /// Wrap a serialized batch so that it can be shared by the sends to
+    /// all peers; the buffer goes back to the pool after the last of them
+    shared_batch_t share_batch(std::string&& batch) const;
+
+    /// Our signature of a relayed batch (if we sign them)
+    std::string sign_batch(const std::string& batch) const;
+
+    /// Reliably push message/batch to a service node. Failed attempts to
+    /// send a batch from the outbox are left for the outbox to retry, others
+    /// are retried here after the RETRY_INTERVALS delays.
+    void relay_data_reliable(relay_batch_t batch, const sn_record_t& address,
+                             int attempt = 1) const; // mutex not needed
+
+    /// Same for a batch of deletions, which is always in the outbox
+    void relay_tombstones_reliable(relay_batch_t batch,
+                                   const sn_record_t& sn) const;
+
+    /// Queue `batch` for `sn`, to be sent as soon as the peer has capacity.
+    /// If the peer falls too far behind, the oldest queued batches are
+    /// dropped (those in the outbox are left for the outbox to resend).
+    void queue_batch(const sn_record_t& sn, relay_batch_t batch) const;
+
+    /// Send queued batches to `sn` while it is below the in-flight limit
+    void send_queued_batches(const sn_record_t& sn) const;
+
+    /// Called when sending `batch` to `sn` has completed (successfully or
+    /// not)
+    void on_batch_relayed(const sn_record_t& sn,
+                          const relay_batch_t& batch) const;
 
+    /// Format to use for message batches sent to `sn`
+    batch_format_t peer_batch_format(const sn_record_t& sn) const;
+
+    /// Whether `sn` accepts payloads compressed with PREFERRED_COMPRESSION
+    bool peer_accepts_compression(const sn_record_t& sn) const;
+
+    /// Batches are kept in the outbox until acknowledged if `durable` is set
     template <typename Message>
-    void relay_messages(
-        const std::vector<Message>& messages,
-        const std::vector<sn_record_t>& snodes) const; // mutex not needed
+    void relay_messages(const std::vector<Message>& messages,
+                        const std::vector<sn_record_t>& snodes,
+                        bool durable = false) const;
 
     /// Request swarm structure from the deamon and reset the timer
     void swarm_timer_tick();
@@ -206,8 +437,107 @@ class ServiceNode {
 
     void ping_peers_tick();
 
+    /// Make sure the buffered messages are relayed within RELAY_MAX_DELAY
+    void schedule_relay();
+
     void relay_buffered_messages();
 
+    /// Resend batches from the outbox that are due for another attempt
+    void outbox_timer_tick();
+
+    /// Record that `sn` has acknowledged `batch` (if `acked`) or that it is
+    /// to be sent again later, after `attempts` failed attempts
+    void record_outbox_result(const sn_record_t& sn,
+                              const relay_batch_t& batch, bool acked,
+                              uint32_t attempts = 0) const;
+
+    /// Write the recorded outcomes to the outbox
+    void flush_outbox_results() const;
+
+    /// Add the replication lag and relay state of every swarm member to
+    /// `stats`
+    void add_relay_stats(nlohmann::json& stats) const;
+
+    /// Compare digests of our messages with those of a random swarm member
+    /// and exchange the messages either of us is missing
+    void anti_entropy_timer_tick();
+
+    /// Digests of our messages in `range`. Like `get_bucket_hashes`, this
+    /// reads a lot of the database, so it is meant to be called from the CPU
+    /// pool (and doesn't need the node mutex).
+    bool get_digests(const digest_range_t& range,
+                     std::vector<bucket_digest_t>& digests) const;
+
+    /// Hashes (by fingerprint) of our messages in `range` that fall into
+    /// `buckets` (which must be sorted). Stops once it has `max_hashes` of
+    /// them, removing the buckets it didn't get to from `buckets` (the last
+    /// one left may be incomplete).
+    bool
+    get_bucket_hashes(const digest_range_t& range,
+                      std::vector<uint64_t>& buckets, size_t max_hashes,
+                      std::unordered_map<uint64_t, std::string>& hashes) const;
+
+    void on_digests_reply(const sn_record_t& peer, const digest_range_t& range,
+                          bool success, std::vector<std::string> data);
+
+    /// Send `peer` the messages we have in the `buckets` that differ (our
+    /// hashes in them being `ours`) and fetch those it has that we don't
+    /// (`theirs`)
+    void exchange_messages(
+        const sn_record_t& peer, const digest_range_t& range,
+        const std::vector<uint64_t>& buckets,
+        const std::vector<uint64_t>& theirs,
+        const std::unordered_map<uint64_t, std::string>& ours);
+
+    /// The reply to a fetch for the messages with `hashes`: "OK" followed
+    /// by message batches (of a limited size, so possibly not all of them)
+    std::vector<std::string>
+    get_fetched_messages(const std::vector<std::string>& hashes);
+
+    /// Verify the messages of `push` on the PoW thread pool, then store the
+    /// valid ones
+    void verify_push(std::shared_ptr<pending_push_t> push);
+
+    /// Store the messages of `push` that passed verification
+    void store_verified(pending_push_t& push);
+
+    /// Catch up with the replication logs of all swarm members
+    void log_sync_timer_tick();
+
+    /// Read the replication log of `peer` after `after` (or only get its
+    /// position if we have never read it)
+    void read_log(const sn_record_t& peer, std::optional<uint64_t> after);
+
+    void on_log_reply(const sn_record_t& peer, std::optional<uint64_t> after,
+                      bool success, std::vector<std::string> data);
+
+    /// Fetch the messages with `hashes` (read from the log of `peer` up to
+    /// `last`) that we don't have, then advance our cursor in its log
+    void fetch_log_messages(const sn_record_t& peer,
+                            const std::vector<std::string>& hashes,
+                            uint64_t last, uint64_t head);
+
+    /// Record that we have the log of `peer` up to `position`, and continue
+    /// reading if that is not the `head` of it
+    void advance_log(const sn_record_t& peer, uint64_t position, uint64_t head);
+
+    /// Add the buffered deletions to the outbox and send them to our swarm
+    void relay_tombstones(); // mutex not needed
+
+    void send_tombstones(const std::vector<tombstone_t>& tombstones,
+                         const std::vector<sn_record_t>& snodes) const;
+
+    /// Send our deletions of any of the messages in `blobs` (fetched from
+    /// `peer`) back to it, so that it stops offering them
+    void return_tombstones(const sn_record_t& peer,
+                           const std::vector<std::string>& blobs);
+
+    /// Delete messages according to `tombstone` from the database
+    bool apply_tombstone(const tombstone_t& tombstone, uint64_t& deleted);
+
+    /// Whether `x25519_bin` is the key of one of our swarm members
+    bool is_swarm_peer(const sn_pub_key_t& x25519_bin) const;
+
     /// Check the latest version from DNS text record
     void check_version_timer_tick(); // mutex not needed
     /// Update PoW difficulty from DNS text record
@@ -263,13 +593,21 @@ class ServiceNode {
                 SispopmqServer& lmq_server,
                 const oxen::oxend_key_pair_t& key_pair,
                 const std::string& ed25519hex, const std::string& db_location,
-                OxendClient& oxend_client, const bool force_start);
+                const db_options_t& db_options, OxendClient& oxend_client,
+                const bool force_start, const bool worker = false,
+                const bool sign_relays = false);
 
     ~ServiceNode();
 
     // Return info about this node as it is advertised to other nodes
     const sn_record_t& own_address() { return our_address_; }
 
+    bool is_worker() const { return worker_; }
+
+    /// Whether we sign the batches we relay, and trust the signed batches of
+    /// swarm members
+    bool signs_relays() const { return sign_relays_; }
+
     // Record the time of our last being tested over lmq/http
     void update_last_ping(ReachType type);
 
@@ -300,8 +638,106 @@ class ServiceNode {
     /// Process message received from a client, return false if not in a swarm
     bool process_store(const message_t& msg);
 
-    /// Process incoming blob of messages: add to DB if new
-    void process_push_batch(const std::string& blob);
+    /// Process incoming blobs of messages: verify them on the PoW thread
+    /// pool, then add them to DB (if new) and call `on_done` with whether
+    /// they could be stored and the number of messages accepted. If `signer`
+    /// is set, the batches have been signed by that swarm member and only a
+    /// sample of the messages is checked.
+    void process_push_batches(
+        std::vector<std::string> blobs,
+        std::function<void(bool, size_t)> on_done = nullptr,
+        std::optional<sn_pub_key_t> signer = {});
+
+    void
+    process_push_batch(std::string blob,
+                       std::function<void(bool, size_t)> on_done = nullptr);
+
+    /// Process a batch that swarm member `sender` has signed. Messages from
+    /// peers have already been checked by the node that received them from
+    /// the client, so if the signature is valid (and we trust the sender)
+    /// only a random sample of them has its PoW checked.
+    void process_signed_push_batch(const sn_pub_key_t& sender,
+                                   std::string blob,
+                                   const std::string& signature,
+                                   std::function<void(bool, size_t)> on_done);
+
+    /// Decompress (on the CPU pool) a batch from swarm member `sender`, then
+    /// process it as signed if it comes with a `signature`
+    void process_compressed_push_batch(
+        const sn_pub_key_t& sender, std::string blob, std::string signature,
+        compression_t compression, std::function<void(bool, size_t)> on_done);
+
+    /// `sender` if its `signature` of `data` is valid and we trust its
+    /// signatures (it is a swarm member that hasn't failed an audit lately)
+    std::optional<sn_pub_key_t> trusted_signer(const sn_pub_key_t& sender,
+                                               const std::string& signature,
+                                               const std::string& data);
+
+    /// Delete messages as requested (and signed) by their owner, whose
+    /// signature has been checked, and replicate the deletion to the swarm
+    bool delete_messages(const tombstone_t& tombstone, uint64_t& deleted);
+
+    /// Apply deletions relayed by a swarm member (those that are not signed
+    /// by the owner, or too old or too far in the future are ignored),
+    /// return false if the sender is not one or the blob is malformed
+    bool process_tombstones(const sn_pub_key_t& sender_x25519_bin,
+                            const std::string& blob);
+
+    /// Process a part of a snapshot sent by a swarm member and call
+    /// `on_done` with the status to reply with ("OK" on success). Messages
+    /// get the same checks as relayed ones before they are stored, so only
+    /// a sample of them is checked if the chunk has a `signature` we trust.
+    /// The checksum and signature are of the payload as sent, which may be
+    /// compressed.
+    void process_snapshot_part(const sn_pub_key_t& sender_x25519_bin,
+                               const std::string& snapshot_id,
+                               const std::string& part,
+                               const std::string& checksum,
+                               std::string payload, compression_t compression,
+                               const std::string& signature,
+                               std::function<void(std::string)> on_done);
+
+    /// The part of `process_snapshot_part` that runs on the CPU pool, for a
+    /// chunk that is the next one expected from the sender
+    void process_snapshot_chunk(const sn_pub_key_t& sender_x25519_bin,
+                                const std::string& snapshot_id,
+                                uint64_t chunk_idx, const std::string& checksum,
+                                const std::string& payload,
+                                compression_t compression,
+                                const std::string& signature,
+                                std::function<void(std::string)> on_done);
+
+    /// Compare the `digests` of the messages in `range` sent by a swarm
+    /// member with ours, call `on_done` (possibly from another thread) with
+    /// the reply: a status ("OK" on success) followed by the buckets that
+    /// differ and the fingerprints of our messages in them (leaving out the
+    /// latest buckets if there are too many fingerprints)
+    void process_digests(const sn_pub_key_t& sender_x25519_bin,
+                         std::string_view range, std::string_view digests,
+                         std::function<void(std::vector<std::string>)> on_done);
+
+    /// Get the messages in `range` with the requested `fingerprints` for a
+    /// swarm member, call `on_done` (possibly from another thread) with the
+    /// reply: a status ("OK" on success) followed by message batches (of a
+    /// limited size, so possibly not all of them)
+    void process_fetch(const sn_pub_key_t& sender_x25519_bin,
+                       std::string_view range, std::string_view fingerprints,
+                       std::function<void(std::vector<std::string>)> on_done);
+
+    /// Read our replication log (the positions at which messages were
+    /// stored) for a swarm member, return the reply: a status ("OK" on
+    /// success) followed by our latest position, the position of the last
+    /// entry returned and the hashes of up to `limit` messages stored after
+    /// `after`
+    std::vector<std::string>
+    process_log_request(const sn_pub_key_t& sender_x25519_bin,
+                        const std::string& after, const std::string& limit);
+
+    /// Get messages with `hashes` for a swarm member, return the reply: a
+    /// status ("OK" on success) followed by message batches
+    std::vector<std::string>
+    process_messages_request(const sn_pub_key_t& sender_x25519_bin,
+                             std::string_view hashes);
 
     /// request blockchain test from a peer
     void perform_blockchain_test(
@@ -18,6 +18,47 @@ static void cleanup_old(std::deque<test_result_t>& tests, time_t cutoff_time) {
 }
 
 static constexpr std::chrono::seconds ROLLING_WINDOW_SIZE = 120min;
+static constexpr std::chrono::seconds THROUGHPUT_WINDOW_SIZE = 10s;
+
+double peer_stats_t::current_throughput(time_point_t now) const {
+    // The throughput is only updated on acknowledgements
+    if (now - throughput_window_start > 2 * THROUGHPUT_WINDOW_SIZE) {
+        return 0;
+    }
+    return throughput;
+}
+
+void all_stats_t::record_batch_acked(const sn_record_t& sn, uint64_t messages,
+                                     std::optional<uint64_t> accepted,
+                                     uint64_t bytes) {
+
+    auto& stats = peer_report_[sn];
+    stats.batches_acked++;
+    stats.messages_acked += messages;
+    stats.bytes_acked += bytes;
+    if (accepted) {
+        stats.messages_accepted += *accepted;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = now - stats.throughput_window_start;
+    if (elapsed > 2 * THROUGHPUT_WINDOW_SIZE) {
+        // Nothing was relayed for a while, so start over
+        stats.throughput = 0;
+        stats.throughput_window_start = now;
+        stats.throughput_window_bytes = bytes;
+    } else {
+        stats.throughput_window_bytes += bytes;
+        if (elapsed >= THROUGHPUT_WINDOW_SIZE) {
+            using seconds = std::chrono::duration<double>;
+            stats.throughput =
+                stats.throughput_window_bytes /
+                std::chrono::duration_cast<seconds>(elapsed).count();
+            stats.throughput_window_start = now;
+            stats.throughput_window_bytes = 0;
+        }
+    }
+}
 
 void all_stats_t::cleanup() {
 
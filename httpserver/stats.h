@@ -3,6 +3,7 @@
 #include "oxen_common.h"
 #include <atomic>
 #include <deque>
+#include <optional>
 #include <unordered_map>
 
 namespace oxen {
@@ -43,6 +44,22 @@ struct peer_stats_t {
     // causing this node to give up re-transmitting
     uint64_t pushes_failed = 0;
 
+    // relayed batches (and messages in them) acknowledged by the peer
+    uint64_t batches_acked = 0;
+    uint64_t messages_acked = 0;
+    uint64_t bytes_acked = 0;
+    // how many of the acknowledged messages the peer accepted (as reported
+    // by the peer; older versions don't report it)
+    uint64_t messages_accepted = 0;
+
+    // acknowledged bytes per second, measured over the latest window
+    double throughput = 0;
+    time_point_t throughput_window_start{};
+    uint64_t throughput_window_bytes = 0;
+
+    // throughput as of `now`, or 0 if nothing was acknowledged lately
+    double current_throughput(time_point_t now) const;
+
     std::deque<test_result_t> storage_tests;
 
     std::deque<test_result_t> blockchain_tests;
@@ -97,6 +114,9 @@ class all_stats_t {
         peer_report_[sn].pushes_failed++;
     }
 
+    void record_batch_acked(const sn_record_t& sn, uint64_t messages,
+                            std::optional<uint64_t> accepted, uint64_t bytes);
+
     void record_storage_test_result(const sn_record_t& sn, ResultType result) {
         test_result_t res = {std::time(nullptr), result};
         peer_report_[sn].storage_tests.push_back(res);
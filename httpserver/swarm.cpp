@@ -4,6 +4,7 @@
 
 #include "service_node.h"
 
+#include <algorithm>
 #include <ostream>
 #include <stdlib.h>
 #include <unordered_map>
@@ -383,6 +384,72 @@ swarm_id_t get_swarm_by_pk(const std::vector<SwarmInfo>& all_swarms,
     return cur_best;
 }
 
+swarm_lookup_t::swarm_lookup_t(const std::vector<SwarmInfo>& all_swarms) {
+
+    swarms_.reserve(all_swarms.size());
+    for (size_t i = 0; i < all_swarms.size(); ++i) {
+        if (all_swarms[i].swarm_id != INVALID_SWARM_ID) {
+            swarms_.push_back({all_swarms[i].swarm_id, i});
+        }
+    }
+
+    std::sort(swarms_.begin(), swarms_.end(),
+              [](const entry_t& a, const entry_t& b) {
+                  return a.swarm_id < b.swarm_id;
+              });
+}
+
+std::optional<size_t> swarm_lookup_t::find(const user_pubkey_t& pk) const {
+
+    if (swarms_.empty()) {
+        return std::nullopt;
+    }
+
+    const uint64_t res = hex_to_u64(pk);
+
+    /// Mirrors `get_swarm_by_pk`, including its choice of MAX_ID
+    constexpr swarm_id_t MAX_ID = INVALID_SWARM_ID - 1;
+
+    const entry_t& leftmost = swarms_.front();
+    const entry_t& rightmost = swarms_.back();
+
+    const auto above = std::lower_bound(
+        swarms_.begin(), swarms_.end(), res,
+        [](const entry_t& e, uint64_t value) { return e.swarm_id < value; });
+
+    // The closest swarm is either the first one at or above `res` or the one
+    // before it; ties go to the one that comes first in `all_swarms`
+    const entry_t* best = nullptr;
+    uint64_t min_dist = 0;
+    if (above != swarms_.end()) {
+        best = &*above;
+        min_dist = above->swarm_id - res;
+    }
+    if (above != swarms_.begin()) {
+        const auto& below = *std::prev(above);
+        const uint64_t dist = res - below.swarm_id;
+        if (!best || dist < min_dist ||
+            (dist == min_dist && below.idx < best->idx)) {
+            best = &below;
+            min_dist = dist;
+        }
+    }
+
+    if (res > rightmost.swarm_id) {
+        const uint64_t dist = (MAX_ID - res) + leftmost.swarm_id;
+        if (dist < min_dist) {
+            best = &leftmost;
+        }
+    } else if (res < leftmost.swarm_id) {
+        const uint64_t dist = res + (MAX_ID - rightmost.swarm_id);
+        if (dist < min_dist) {
+            best = &rightmost;
+        }
+    }
+
+    return best->idx;
+}
+
 const std::vector<sn_record_t>& Swarm::other_nodes() const {
     return swarm_peers_;
 }
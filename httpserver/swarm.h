@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <optional>
 #include <sispopmq/auth.h>
 #include <string>
 #include <vector>
@@ -39,6 +40,28 @@ void debug_print(std::ostream& os, const block_update_t& bu);
 swarm_id_t get_swarm_by_pk(const std::vector<SwarmInfo>& all_swarms,
                            const user_pubkey_t& pk);
 
+/// Maps public keys to swarms the same way as `get_swarm_by_pk`, but sorts
+/// the swarms once so that each lookup is a binary search rather than a scan
+/// of all swarms. Safe to use from multiple threads.
+class swarm_lookup_t {
+
+    struct entry_t {
+        swarm_id_t swarm_id;
+        /// Index in `all_swarms`, which breaks ties the same way as the scan
+        size_t idx;
+    };
+
+    /// Sorted by swarm id
+    std::vector<entry_t> swarms_;
+
+  public:
+    explicit swarm_lookup_t(const std::vector<SwarmInfo>& all_swarms);
+
+    /// Index in `all_swarms` of the swarm responsible for `pk`, or nullopt
+    /// if there are no valid swarms
+    std::optional<size_t> find(const user_pubkey_t& pk) const;
+};
+
 struct SwarmEvents {
 
     /// our (potentially new) swarm id
@@ -0,0 +1,127 @@
+// Compares the cost of checking the PoW of messages with `checkPoW`, with the
+// allocation-free `verify_pow` and with `verify_batch` (multi-buffer SHA-512).
+//
+// Usage: pow_bench [messages] [data size]
+
+#include "pow.hpp"
+#include "sha512_multi.hpp"
+
+#include <sispopmq/base64.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+struct message_t {
+    std::string nonce;
+    std::string timestamp;
+    std::string ttl;
+    std::string recipient;
+    std::string data;
+};
+
+static std::vector<message_t> make_messages(size_t count, size_t size) {
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef"
+                                       "ghijklmnopqrstuvwxyz0123456789+/";
+    std::mt19937_64 rng(1);
+    std::vector<message_t> msgs(count);
+    for (auto& msg : msgs) {
+        std::string nonce(8, '\0');
+        for (auto& c : nonce)
+            c = static_cast<char>(rng());
+        msg.nonce = sispopmq::to_base64(nonce);
+        msg.timestamp = std::to_string(1554859211000 + rng() % 1000000);
+        msg.ttl = "345600000";
+        msg.recipient = "05";
+        while (msg.recipient.size() < 66)
+            msg.recipient += "0123456789abcdef"[rng() % 16];
+        msg.data.resize(size);
+        for (auto& c : msg.data)
+            c = alphabet[rng() % 64];
+    }
+    return msgs;
+}
+
+static const char* impl_name(sha512_impl_t impl) {
+    switch (impl) {
+    case sha512_impl_t::avx512:
+        return "AVX-512";
+    case sha512_impl_t::avx2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+template <typename F>
+static double time_ns_per_message(size_t count, F&& f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+}
+
+int main(int argc, char* argv[]) {
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    const size_t size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 500;
+    constexpr int difficulty = 100;
+
+    const auto msgs = make_messages(count, size);
+
+    std::vector<std::string> old_hashes(count);
+    size_t old_valid = 0;
+    const double old_ns = time_ns_per_message(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            const auto& m = msgs[i];
+            old_valid += checkPoW(m.nonce, m.timestamp, m.ttl, m.recipient,
+                                  m.data, old_hashes[i], difficulty);
+        }
+    });
+
+    std::vector<message_hash_t> hashes(count);
+    size_t valid = 0;
+    const double new_ns = time_ns_per_message(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            const auto& m = msgs[i];
+            valid += verify_pow({m.nonce, m.timestamp, m.ttl, m.recipient,
+                                 m.data, difficulty},
+                                hashes[i]);
+        }
+    });
+
+    std::vector<pow_message_t> batch;
+    batch.reserve(count);
+    for (const auto& m : msgs) {
+        batch.push_back(
+            {m.nonce, m.timestamp, m.ttl, m.recipient, m.data, difficulty});
+    }
+    std::vector<message_hash_t> batch_hashes;
+    std::vector<char> batch_valid;
+    size_t batch_count = 0;
+    const double batch_ns = time_ns_per_message(count, [&] {
+        batch_count = verify_batch(batch, batch_hashes, batch_valid);
+    });
+
+    for (size_t i = 0; i < count; i++) {
+        if (old_hashes[i] != std::string(hashes[i].data(), hashes[i].size()) ||
+            hashes[i] != batch_hashes[i]) {
+            std::fprintf(stderr, "Hash mismatch for message %zu\n", i);
+            return 1;
+        }
+    }
+    if (old_valid != valid || valid != batch_count) {
+        std::fprintf(stderr, "Verdicts differ\n");
+        return 1;
+    }
+
+    std::printf("%zu messages of %zu bytes (%zu with valid PoW)\n", count,
+                size, valid);
+    std::printf("checkPoW:     %8.0f ns/message\n", old_ns);
+    std::printf("verify_pow:   %8.0f ns/message\n", new_ns);
+    std::printf("verify_batch: %8.0f ns/message (%s)\n", batch_ns,
+                impl_name(sha512_best_impl()));
+    return 0;
+}
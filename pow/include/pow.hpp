@@ -1,5 +1,9 @@
+#include <array>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <string_view>
 #include <vector>
 
 struct pow_difficulty_t {
@@ -10,7 +14,56 @@ struct pow_difficulty_t {
 int get_valid_difficulty(const std::string& timestamp,
                          const std::vector<pow_difficulty_t>& history);
 
-bool checkPoW(const std::string& nonce, const std::string& timestamp,
-              const std::string& ttl, const std::string& recipient,
-              const std::string& data, std::string& messageHash,
+/// Same difficulties as `get_valid_difficulty` gives for `history`, but
+/// worked out in advance for every interval of timestamps over which they
+/// stay the same, so that a lookup is a binary search
+class pow_difficulty_timeline_t {
+
+    struct interval_t {
+        /// First timestamp (in ms) of the interval, which lasts until the
+        /// start of the next one
+        int64_t start;
+        int difficulty;
+    };
+
+    /// Sorted by start; timestamps before the first interval have no valid
+    /// difficulty
+    std::vector<interval_t> intervals_;
+
+  public:
+    explicit pow_difficulty_timeline_t(
+        const std::vector<pow_difficulty_t>& history);
+
+    /// Difficulty for a message with `timestamp` (in ms)
+    int difficulty_at(uint64_t timestamp) const;
+};
+
+bool checkPoW(std::string_view nonce, const std::string& timestamp,
+              const std::string& ttl, std::string_view recipient,
+              std::string_view data, std::string& messageHash,
               const int difficulty);
+
+/// Size of a message hash: the final PoW digest in hex
+constexpr size_t MESSAGE_HASH_SIZE = 128;
+
+using message_hash_t = std::array<char, MESSAGE_HASH_SIZE>;
+
+/// Fields of a message covered by its PoW, exactly as sent by the client
+struct pow_message_t {
+    std::string_view nonce;
+    std::string_view timestamp;
+    std::string_view ttl;
+    std::string_view recipient;
+    std::string_view data;
+    int difficulty;
+};
+
+/// Same as `checkPoW`, but hashes the fields in place and writes the hash
+/// to a fixed buffer, so nothing is allocated
+bool verify_pow(const pow_message_t& msg, message_hash_t& hash);
+
+/// Verify each of `msgs`, setting the hash and verdict at the same index of
+/// `hashes` and `valid` (resized to match); return the number of valid ones
+size_t verify_batch(const std::vector<pow_message_t>& msgs,
+                    std::vector<message_hash_t>& hashes,
+                    std::vector<char>& valid);
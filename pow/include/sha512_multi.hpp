@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/// Multi-buffer SHA-512: hashes several messages at once, one message per
+/// lane of a SIMD register (4 lanes with AVX2, 8 with AVX-512), falling back
+/// to one message at a time on other CPUs. Only pays off for many messages,
+/// such as the PoW of a whole batch.
+
+/// Number of pieces a message can be given in (hashed one after another, as
+/// if they were concatenated)
+constexpr size_t SHA512_MAX_PARTS = 4;
+
+struct sha512_message_t {
+    std::array<std::string_view, SHA512_MAX_PARTS> parts;
+};
+
+using sha512_digest_t = std::array<uint8_t, 64>;
+
+enum class sha512_impl_t {
+    scalar,
+    avx2,
+    avx512,
+};
+
+/// Whether `impl` can run on this CPU
+bool sha512_impl_supported(sha512_impl_t impl);
+
+/// The fastest implementation supported by this CPU
+sha512_impl_t sha512_best_impl();
+
+/// Hash each of `msgs` into the digest at the same index of `digests`
+/// (resized to match)
+void sha512_multi(const std::vector<sha512_message_t>& msgs,
+                  std::vector<sha512_digest_t>& digests);
+
+/// Same as above, with a given implementation (which must be supported)
+void sha512_multi(const std::vector<sha512_message_t>& msgs,
+                  std::vector<sha512_digest_t>& digests, sha512_impl_t impl);
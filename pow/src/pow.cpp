@@ -1,7 +1,14 @@
+// The SHA512_* functions (deprecated by OpenSSL 3) hash with a context on the
+// stack, where EVP would allocate one for every message
+#define OPENSSL_SUPPRESS_DEPRECATED
+
 #include "pow.hpp"
+#include "sha512_multi.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <array>
+#include <charconv>
 #include <iomanip>
 #include <limits>
 #include <sispopmq/base64.h>
@@ -35,12 +42,12 @@ bool multWillOverflow(uint64_t left, uint64_t right) {
            (std::numeric_limits<std::uint64_t>::max() / left < right);
 }
 
-bool calcTarget(const std::string& payload, const uint64_t ttlInt,
+bool calcTarget(const size_t payloadSize, const uint64_t ttlInt,
                 const int difficulty, uint64Bytes& target) {
-    bool overflow = addWillOverflow(payload.size(), BYTE_LEN);
+    bool overflow = addWillOverflow(payloadSize, BYTE_LEN);
     if (overflow)
         return false;
-    uint64_t totalLen = payload.size() + BYTE_LEN;
+    uint64_t totalLen = payloadSize + BYTE_LEN;
     overflow = multWillOverflow(ttlInt, totalLen);
     if (overflow)
         return false;
@@ -60,26 +67,19 @@ bool calcTarget(const std::string& payload, const uint64_t ttlInt,
     return true;
 }
 
-int get_valid_difficulty(const std::string& timestamp,
-                         const std::vector<pow_difficulty_t>& history) {
-    uint64_t timestamp_long;
-    try {
-        timestamp_long = std::stoull(timestamp);
-    } catch (...) {
-        // Should never happen, checked previously
-        return false;
-    }
-    const auto msg_timestamp = std::chrono::milliseconds(timestamp_long);
-
+// Lowest of the difficulty in effect at `timestamp` and of those set within
+// TIMESTAMP_VARIANCE of it
+static int difficultyAt(std::chrono::milliseconds timestamp,
+                        const std::vector<pow_difficulty_t>& history) {
     int difficulty = std::numeric_limits<int>::max();
     int most_recent_difficulty = std::numeric_limits<int>::max();
     std::chrono::milliseconds most_recent(0);
-    const std::chrono::milliseconds lower = msg_timestamp - TIMESTAMP_VARIANCE;
-    const std::chrono::milliseconds upper = msg_timestamp + TIMESTAMP_VARIANCE;
+    const std::chrono::milliseconds lower = timestamp - TIMESTAMP_VARIANCE;
+    const std::chrono::milliseconds upper = timestamp + TIMESTAMP_VARIANCE;
 
     for (const auto& this_difficulty : history) {
         const std::chrono::milliseconds t = this_difficulty.timestamp;
-        if (t < msg_timestamp && t >= most_recent) {
+        if (t < timestamp && t >= most_recent) {
             most_recent = t;
             most_recent_difficulty = this_difficulty.difficulty;
         }
@@ -91,9 +91,58 @@ int get_valid_difficulty(const std::string& timestamp,
     return std::min(most_recent_difficulty, difficulty);
 }
 
-bool checkPoW(const std::string& nonce, const std::string& timestamp,
-              const std::string& ttl, const std::string& recipient,
-              const std::string& data, std::string& messageHash,
+pow_difficulty_timeline_t::pow_difficulty_timeline_t(
+    const std::vector<pow_difficulty_t>& history) {
+    // The difficulty can only change where an entry becomes the most recent
+    // one, or enters or leaves the window around the timestamp
+    const int64_t variance = TIMESTAMP_VARIANCE.count();
+    std::vector<int64_t> starts;
+    starts.reserve(3 * history.size());
+    for (const auto& entry : history) {
+        const int64_t t = entry.timestamp.count();
+        starts.push_back(t + 1);
+        starts.push_back(t - variance);
+        starts.push_back(t + variance + 1);
+    }
+    std::sort(starts.begin(), starts.end());
+    starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+    // Rebuilt rarely, from a short history, so each interval can simply be
+    // evaluated the same way as get_valid_difficulty does
+    for (const int64_t start : starts) {
+        const int difficulty =
+            difficultyAt(std::chrono::milliseconds(start), history);
+        if (intervals_.empty() || intervals_.back().difficulty != difficulty)
+            intervals_.push_back({start, difficulty});
+    }
+}
+
+int pow_difficulty_timeline_t::difficulty_at(uint64_t timestamp) const {
+    const auto it = std::upper_bound(
+        intervals_.begin(), intervals_.end(), static_cast<int64_t>(timestamp),
+        [](int64_t value, const interval_t& interval) {
+            return value < interval.start;
+        });
+    if (it == intervals_.begin())
+        return std::numeric_limits<int>::max();
+    return std::prev(it)->difficulty;
+}
+
+int get_valid_difficulty(const std::string& timestamp,
+                         const std::vector<pow_difficulty_t>& history) {
+    uint64_t timestamp_long;
+    try {
+        timestamp_long = std::stoull(timestamp);
+    } catch (...) {
+        // Should never happen, checked previously
+        return false;
+    }
+    return difficultyAt(std::chrono::milliseconds(timestamp_long), history);
+}
+
+bool checkPoW(std::string_view nonce, const std::string& timestamp,
+              const std::string& ttl, std::string_view recipient,
+              std::string_view data, std::string& messageHash,
               const int difficulty) {
     std::string payload;
     payload.reserve(timestamp.size() + ttl.size() + recipient.size() +
@@ -109,7 +158,7 @@ bool checkPoW(const std::string& nonce, const std::string& timestamp,
     // ttl is in milliseconds, but target calculation wants seconds
     ttlInt = ttlInt / 1000;
     uint64Bytes target;
-    calcTarget(payload, ttlInt, difficulty, target);
+    calcTarget(payload.size(), ttlInt, difficulty, target);
 
     uint8_t hashResult[SHA512_DIGEST_LENGTH];
     // Initial hash
@@ -135,3 +184,185 @@ bool checkPoW(const std::string& nonce, const std::string& timestamp,
 
     return memcmp(hashResult, target.data(), BYTE_LEN) < 0;
 }
+
+// Two hex digits for each byte value
+static constexpr auto HEX_PAIRS = [] {
+    constexpr char digits[] = "0123456789abcdef";
+    std::array<std::array<char, 2>, 256> pairs{};
+    for (int i = 0; i < 256; i++) {
+        pairs[i] = {digits[i >> 4], digits[i & 0xf]};
+    }
+    return pairs;
+}();
+
+static void toHex(const uint8_t* bytes, size_t size, char* out) {
+    for (size_t i = 0; i < size; i++) {
+        memcpy(out + 2 * i, HEX_PAIRS[bytes[i]].data(), 2);
+    }
+}
+
+// Value of each base64 character (both the standard and the URL-safe
+// alphabet, as accepted by sispopmq), or -1
+static constexpr auto BASE64_VALUES = [] {
+    std::array<int8_t, 256> values{};
+    for (auto& v : values)
+        v = -1;
+    for (int i = 0; i < 26; i++) {
+        values['A' + i] = i;
+        values['a' + i] = 26 + i;
+    }
+    for (int i = 0; i < 10; i++)
+        values['0' + i] = 52 + i;
+    values['+'] = values['-'] = 62;
+    values['/'] = values['_'] = 63;
+    return values;
+}();
+
+// Decode `nonce` (already checked to be valid base64), passing each byte to
+// `out`
+template <typename Output>
+static void decodeBase64(std::string_view nonce, Output&& out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for (const char c : nonce) {
+        if (c == '=')
+            break;
+        acc = (acc << 6) | BASE64_VALUES[static_cast<uint8_t>(c)];
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out(static_cast<uint8_t>(acc >> bits));
+        }
+    }
+}
+
+// Decode `nonce` straight into the hash, a small block at a time
+static void hashBase64(std::string_view nonce, SHA512_CTX& ctx) {
+    uint8_t block[64];
+    size_t used = 0;
+    decodeBase64(nonce, [&](uint8_t byte) {
+        block[used++] = byte;
+        if (used == sizeof(block)) {
+            SHA512_Update(&ctx, block, used);
+            used = 0;
+        }
+    });
+    SHA512_Update(&ctx, block, used);
+}
+
+// Same as util::parseTTL (which takes a std::string), without the copy
+static bool parseTTL(std::string_view ttl, uint64_t& result) {
+    // Leading whitespace and a plus sign are accepted by std::stoi
+    size_t start = 0;
+    while (start < ttl.size() && isspace(static_cast<uint8_t>(ttl[start])))
+        start++;
+    if (start < ttl.size() && ttl[start] == '+')
+        start++;
+    int ttlInt;
+    const auto end = ttl.data() + ttl.size();
+    if (std::from_chars(ttl.data() + start, end, ttlInt).ec != std::errc{})
+        return false;
+    if (!util::validateTTL(ttlInt))
+        return false;
+    result = static_cast<uint64_t>(ttlInt);
+    return true;
+}
+
+// Target for the hash of `msg` to be under, if its ttl and nonce are valid
+static bool prepareTarget(const pow_message_t& msg, uint64Bytes& target) {
+    uint64_t ttlInt;
+    if (!parseTTL(msg.ttl, ttlInt))
+        return false;
+    // ttl is in milliseconds, but target calculation wants seconds
+    ttlInt = ttlInt / 1000;
+    const size_t payloadSize = msg.timestamp.size() + msg.ttl.size() +
+                               msg.recipient.size() + msg.data.size();
+    if (!calcTarget(payloadSize, ttlInt, msg.difficulty, target))
+        return false;
+
+    return sispopmq::is_base64(msg.nonce);
+}
+
+bool verify_pow(const pow_message_t& msg, message_hash_t& hash) {
+    uint64Bytes target;
+    if (!prepareTarget(msg, target))
+        return false;
+
+    uint8_t hashResult[SHA512_DIGEST_LENGTH];
+    SHA512_CTX ctx;
+    // Initial hash, of the fields one after another
+    SHA512_Init(&ctx);
+    for (const auto field : {msg.timestamp, msg.ttl, msg.recipient, msg.data})
+        SHA512_Update(&ctx, field.data(), field.size());
+    SHA512_Final(hashResult, &ctx);
+    // Final hash, of the binary nonce followed by the initial hash
+    SHA512_Init(&ctx);
+    hashBase64(msg.nonce, ctx);
+    SHA512_Update(&ctx, hashResult, SHA512_DIGEST_LENGTH);
+    SHA512_Final(hashResult, &ctx);
+
+    toHex(hashResult, SHA512_DIGEST_LENGTH, hash.data());
+
+    return memcmp(hashResult, target.data(), BYTE_LEN) < 0;
+}
+
+size_t verify_batch(const std::vector<pow_message_t>& msgs,
+                    std::vector<message_hash_t>& hashes,
+                    std::vector<char>& valid) {
+    hashes.resize(msgs.size());
+    valid.assign(msgs.size(), false);
+    size_t count = 0;
+
+    // Without SIMD, hashing one message at a time with OpenSSL is faster
+    if (sha512_best_impl() == sha512_impl_t::scalar) {
+        for (size_t i = 0; i < msgs.size(); i++) {
+            valid[i] = verify_pow(msgs[i], hashes[i]);
+            count += valid[i];
+        }
+        return count;
+    }
+
+    // Messages that are rejected without hashing are left out
+    std::vector<uint64Bytes> targets(msgs.size());
+    std::vector<size_t> toHash;
+    toHash.reserve(msgs.size());
+    for (size_t i = 0; i < msgs.size(); i++) {
+        if (prepareTarget(msgs[i], targets[i]))
+            toHash.push_back(i);
+    }
+
+    // Initial hashes, of the fields one after another
+    std::vector<sha512_message_t> inputs(toHash.size());
+    for (size_t j = 0; j < toHash.size(); j++) {
+        const auto& msg = msgs[toHash[j]];
+        inputs[j].parts = {msg.timestamp, msg.ttl, msg.recipient, msg.data};
+    }
+    std::vector<sha512_digest_t> inner;
+    sha512_multi(inputs, inner);
+
+    // Final hashes, of the binary nonces followed by the initial hashes
+    std::string nonces;
+    std::vector<size_t> nonceEnds(toHash.size());
+    for (size_t j = 0; j < toHash.size(); j++) {
+        decodeBase64(msgs[toHash[j]].nonce,
+                     [&](uint8_t byte) { nonces.push_back(byte); });
+        nonceEnds[j] = nonces.size();
+    }
+    for (size_t j = 0; j < toHash.size(); j++) {
+        const size_t start = j == 0 ? 0 : nonceEnds[j - 1];
+        inputs[j].parts = {
+            std::string_view(nonces).substr(start, nonceEnds[j] - start),
+            std::string_view(reinterpret_cast<const char*>(inner[j].data()),
+                             inner[j].size())};
+    }
+    std::vector<sha512_digest_t> outer;
+    sha512_multi(inputs, outer);
+
+    for (size_t j = 0; j < toHash.size(); j++) {
+        const size_t i = toHash[j];
+        toHex(outer[j].data(), outer[j].size(), hashes[i].data());
+        valid[i] = memcmp(outer[j].data(), targets[i].data(), BYTE_LEN) < 0;
+        count += valid[i];
+    }
+    return count;
+}
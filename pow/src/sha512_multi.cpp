@@ -0,0 +1,442 @@
+#include "sha512_multi.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA512_MULTI_X86
+// GCC 12 warns about the AVX-512 intrinsics themselves (which start from an
+// undefined register); the warnings point into the header, so only its code
+// needs them off
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+namespace {
+
+constexpr size_t BLOCK_SIZE = 128;
+
+constexpr uint64_t K[80] = {
+    0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f,
+    0xe9b5dba58189dbbc, 0x3956c25bf348b538, 0x59f111f1b605d019,
+    0x923f82a4af194f9b, 0xab1c5ed5da6d8118, 0xd807aa98a3030242,
+    0x12835b0145706fbe, 0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2,
+    0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235,
+    0xc19bf174cf692694, 0xe49b69c19ef14ad2, 0xefbe4786384f25e3,
+    0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65, 0x2de92c6f592b0275,
+    0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5,
+    0x983e5152ee66dfab, 0xa831c66d2db43210, 0xb00327c898fb213f,
+    0xbf597fc7beef0ee4, 0xc6e00bf33da88fc2, 0xd5a79147930aa725,
+    0x06ca6351e003826f, 0x142929670a0e6e70, 0x27b70a8546d22ffc,
+    0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed, 0x53380d139d95b3df,
+    0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6,
+    0x92722c851482353b, 0xa2bfe8a14cf10364, 0xa81a664bbc423001,
+    0xc24b8b70d0f89791, 0xc76c51a30654be30, 0xd192e819d6ef5218,
+    0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8,
+    0x19a4c116b8d2d0c8, 0x1e376c085141ab53, 0x2748774cdf8eeb99,
+    0x34b0bcb5e19b48a8, 0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb,
+    0x5b9cca4f7763e373, 0x682e6ff3d6b2b8a3, 0x748f82ee5defb2fc,
+    0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
+    0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915,
+    0xc67178f2e372532b, 0xca273eceea26619c, 0xd186b8c721c0c207,
+    0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178, 0x06f067aa72176fba,
+    0x0a637dc5a2c898a6, 0x113f9804bef90dae, 0x1b710b35131c471b,
+    0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc,
+    0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a,
+    0x5fcb6fab3ad6faec, 0x6c44198c4a475817};
+
+constexpr uint64_t INITIAL_STATE[8] = {
+    0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b,
+    0xa54ff53a5f1d36f1, 0x510e527fade682d1, 0x9b05688c2b3e6c1f,
+    0x1f83d9abfb41bd6b, 0x5be0cd19137e2179};
+
+uint64_t load_be64(const uint8_t* p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+void store_be64(uint64_t value, uint8_t* p) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = static_cast<uint8_t>(value);
+        value >>= 8;
+    }
+}
+
+uint64_t message_size(const sha512_message_t& msg) {
+    uint64_t size = 0;
+    for (const auto& part : msg.parts)
+        size += part.size();
+    return size;
+}
+
+/// Number of blocks a message of `size` bytes takes once padded (with at
+/// least a 0x80 byte and the 16 byte length)
+size_t padded_blocks(uint64_t size) {
+    return (size + 17 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/// Write block `idx` (out of `blocks`) of the padded message to `out`
+void fill_block(const sha512_message_t& msg, uint64_t size, size_t idx,
+                size_t blocks, uint8_t* out) {
+
+    const uint64_t begin = idx * BLOCK_SIZE;
+    size_t filled = 0;
+
+    // Message bytes in [begin, begin + BLOCK_SIZE), from whichever parts
+    // they are in
+    uint64_t part_start = 0;
+    for (const auto& part : msg.parts) {
+        const uint64_t part_end = part_start + part.size();
+        if (part_end > begin + filled && filled < BLOCK_SIZE) {
+            const uint64_t from = begin + filled - part_start;
+            const size_t n = std::min<uint64_t>(part.size() - from,
+                                                BLOCK_SIZE - filled);
+            memcpy(out + filled, part.data() + from, n);
+            filled += n;
+        }
+        part_start = part_end;
+    }
+
+    memset(out + filled, 0, BLOCK_SIZE - filled);
+
+    if (size >= begin && size < begin + BLOCK_SIZE)
+        out[size - begin] = 0x80;
+
+    if (idx + 1 == blocks) {
+        // Length in bits, as a 128-bit big-endian number
+        store_be64(size >> 61, out + BLOCK_SIZE - 16);
+        store_be64(size << 3, out + BLOCK_SIZE - 8);
+    }
+}
+
+// The state of the messages being hashed is interleaved, so that each word
+// of it can be loaded into a SIMD register at once: word `i` of lane `l` is
+// at `state[i * LANES + l]`
+using compress_fn = void (*)(uint64_t* state, const uint8_t* const* blocks);
+
+uint64_t ror(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+void compress_scalar(uint64_t* state, const uint8_t* const* blocks) {
+
+    uint64_t w[80];
+    for (int t = 0; t < 16; t++)
+        w[t] = load_be64(blocks[0] + 8 * t);
+    for (int t = 16; t < 80; t++) {
+        const uint64_t s0 =
+            ror(w[t - 15], 1) ^ ror(w[t - 15], 8) ^ (w[t - 15] >> 7);
+        const uint64_t s1 =
+            ror(w[t - 2], 19) ^ ror(w[t - 2], 61) ^ (w[t - 2] >> 6);
+        w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+    }
+
+    uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int t = 0; t < 80; t++) {
+        const uint64_t s1 = ror(e, 14) ^ ror(e, 18) ^ ror(e, 41);
+        const uint64_t ch = (e & f) ^ (~e & g);
+        const uint64_t t1 = h + s1 + ch + K[t] + w[t];
+        const uint64_t s0 = ror(a, 28) ^ ror(a, 34) ^ ror(a, 39);
+        const uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+        const uint64_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+#ifdef SHA512_MULTI_X86
+
+#define SHA512_AVX2 __attribute__((target("avx2")))
+#define SHA512_AVX512 __attribute__((target("avx512f")))
+
+uint64_t load_be64_x86(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return __builtin_bswap64(value);
+}
+
+template <int N>
+SHA512_AVX2 inline __m256i ror_avx2(__m256i x) {
+    return _mm256_or_si256(_mm256_srli_epi64(x, N),
+                           _mm256_slli_epi64(x, 64 - N));
+}
+
+SHA512_AVX2 void compress_avx2(uint64_t* state, const uint8_t* const* blocks) {
+
+    __m256i w[16];
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm256_set_epi64x(load_be64_x86(blocks[3] + 8 * t),
+                                 load_be64_x86(blocks[2] + 8 * t),
+                                 load_be64_x86(blocks[1] + 8 * t),
+                                 load_be64_x86(blocks[0] + 8 * t));
+    }
+
+    __m256i s[8];
+    for (int i = 0; i < 8; i++) {
+        s[i] = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(state + 4 * i));
+    }
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+    __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int t = 0; t < 80; t++) {
+        // The schedule is kept to the last 16 words
+        if (t >= 16) {
+            const __m256i w15 = w[(t - 15) & 15];
+            const __m256i w2 = w[(t - 2) & 15];
+            const __m256i s0 = _mm256_xor_si256(
+                _mm256_xor_si256(ror_avx2<1>(w15), ror_avx2<8>(w15)),
+                _mm256_srli_epi64(w15, 7));
+            const __m256i s1 = _mm256_xor_si256(
+                _mm256_xor_si256(ror_avx2<19>(w2), ror_avx2<61>(w2)),
+                _mm256_srli_epi64(w2, 6));
+            w[t & 15] = _mm256_add_epi64(
+                _mm256_add_epi64(w[t & 15], s0),
+                _mm256_add_epi64(w[(t - 7) & 15], s1));
+        }
+
+        const __m256i s1 = _mm256_xor_si256(
+            _mm256_xor_si256(ror_avx2<14>(e), ror_avx2<18>(e)),
+            ror_avx2<41>(e));
+        const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                            _mm256_andnot_si256(e, g));
+        const __m256i t1 = _mm256_add_epi64(
+            _mm256_add_epi64(_mm256_add_epi64(h, s1), ch),
+            _mm256_add_epi64(_mm256_set1_epi64x(K[t]), w[t & 15]));
+        const __m256i s0 = _mm256_xor_si256(
+            _mm256_xor_si256(ror_avx2<28>(a), ror_avx2<34>(a)),
+            ror_avx2<39>(a));
+        const __m256i maj = _mm256_or_si256(
+            _mm256_and_si256(a, b),
+            _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        const __m256i t2 = _mm256_add_epi64(s0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi64(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi64(t1, t2);
+    }
+
+    const __m256i out[8] = {a, b, c, d, e, f, g, h};
+    for (int i = 0; i < 8; i++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state + 4 * i),
+                            _mm256_add_epi64(s[i], out[i]));
+    }
+}
+
+SHA512_AVX512 void compress_avx512(uint64_t* state,
+                                   const uint8_t* const* blocks) {
+
+    __m512i w[16];
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm512_set_epi64(load_be64_x86(blocks[7] + 8 * t),
+                                load_be64_x86(blocks[6] + 8 * t),
+                                load_be64_x86(blocks[5] + 8 * t),
+                                load_be64_x86(blocks[4] + 8 * t),
+                                load_be64_x86(blocks[3] + 8 * t),
+                                load_be64_x86(blocks[2] + 8 * t),
+                                load_be64_x86(blocks[1] + 8 * t),
+                                load_be64_x86(blocks[0] + 8 * t));
+    }
+
+    __m512i s[8];
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm512_loadu_si512(state + 8 * i);
+    __m512i a = s[0], b = s[1], c = s[2], d = s[3];
+    __m512i e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int t = 0; t < 80; t++) {
+        if (t >= 16) {
+            const __m512i w15 = w[(t - 15) & 15];
+            const __m512i w2 = w[(t - 2) & 15];
+            // 0x96 is a ^ b ^ c
+            const __m512i s0 = _mm512_ternarylogic_epi64(
+                _mm512_ror_epi64(w15, 1), _mm512_ror_epi64(w15, 8),
+                _mm512_srli_epi64(w15, 7), 0x96);
+            const __m512i s1 = _mm512_ternarylogic_epi64(
+                _mm512_ror_epi64(w2, 19), _mm512_ror_epi64(w2, 61),
+                _mm512_srli_epi64(w2, 6), 0x96);
+            w[t & 15] = _mm512_add_epi64(
+                _mm512_add_epi64(w[t & 15], s0),
+                _mm512_add_epi64(w[(t - 7) & 15], s1));
+        }
+
+        const __m512i s1 = _mm512_ternarylogic_epi64(
+            _mm512_ror_epi64(e, 14), _mm512_ror_epi64(e, 18),
+            _mm512_ror_epi64(e, 41), 0x96);
+        // 0xca is (e & f) | (~e & g), 0xe8 is the majority of a, b and c
+        const __m512i ch = _mm512_ternarylogic_epi64(e, f, g, 0xca);
+        const __m512i t1 = _mm512_add_epi64(
+            _mm512_add_epi64(_mm512_add_epi64(h, s1), ch),
+            _mm512_add_epi64(_mm512_set1_epi64(K[t]), w[t & 15]));
+        const __m512i s0 = _mm512_ternarylogic_epi64(
+            _mm512_ror_epi64(a, 28), _mm512_ror_epi64(a, 34),
+            _mm512_ror_epi64(a, 39), 0x96);
+        const __m512i maj = _mm512_ternarylogic_epi64(a, b, c, 0xe8);
+        const __m512i t2 = _mm512_add_epi64(s0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm512_add_epi64(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm512_add_epi64(t1, t2);
+    }
+
+    const __m512i out[8] = {a, b, c, d, e, f, g, h};
+    for (int i = 0; i < 8; i++)
+        _mm512_storeu_si512(state + 8 * i, _mm512_add_epi64(s[i], out[i]));
+}
+
+#endif // SHA512_MULTI_X86
+
+/// Hash `msgs` LANES at a time. As soon as a lane is done with its message,
+/// it moves on to the next one, so messages of different sizes keep all the
+/// lanes busy.
+template <size_t LANES>
+void hash_lanes(const std::vector<sha512_message_t>& msgs,
+                std::vector<sha512_digest_t>& digests, compress_fn compress) {
+
+    struct lane_t {
+        size_t msg = 0;
+        uint64_t size = 0;
+        size_t block = 0;
+        size_t blocks = 0;
+        bool active = false;
+    };
+
+    lane_t lanes[LANES];
+    alignas(64) uint8_t buffers[LANES][BLOCK_SIZE] = {};
+    const uint8_t* blocks[LANES];
+    alignas(64) uint64_t state[8 * LANES];
+
+    for (size_t l = 0; l < LANES; l++)
+        blocks[l] = buffers[l];
+
+    size_t next = 0;
+    const auto start = [&](size_t l) {
+        if (next == msgs.size()) {
+            lanes[l].active = false;
+            return;
+        }
+        const uint64_t size = message_size(msgs[next]);
+        lanes[l] = lane_t{next, size, 0, padded_blocks(size), true};
+        next++;
+        for (size_t i = 0; i < 8; i++)
+            state[i * LANES + l] = INITIAL_STATE[i];
+    };
+
+    for (size_t l = 0; l < LANES; l++)
+        start(l);
+
+    while (true) {
+        bool any_active = false;
+        for (size_t l = 0; l < LANES; l++) {
+            const auto& lane = lanes[l];
+            if (!lane.active)
+                continue;
+            any_active = true;
+            fill_block(msgs[lane.msg], lane.size, lane.block, lane.blocks,
+                       buffers[l]);
+        }
+
+        if (!any_active)
+            break;
+
+        // Idle lanes hash whatever is left in their buffers, which is
+        // simply ignored
+        compress(state, blocks);
+
+        for (size_t l = 0; l < LANES; l++) {
+            auto& lane = lanes[l];
+            if (!lane.active || ++lane.block < lane.blocks)
+                continue;
+            for (size_t i = 0; i < 8; i++) {
+                store_be64(state[i * LANES + l],
+                           digests[lane.msg].data() + 8 * i);
+            }
+            start(l);
+        }
+    }
+}
+
+} // namespace
+
+bool sha512_impl_supported(sha512_impl_t impl) {
+    switch (impl) {
+    case sha512_impl_t::scalar:
+        return true;
+#ifdef SHA512_MULTI_X86
+    case sha512_impl_t::avx2:
+        return __builtin_cpu_supports("avx2");
+    case sha512_impl_t::avx512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+sha512_impl_t sha512_best_impl() {
+    static const sha512_impl_t best = [] {
+        for (const auto impl : {sha512_impl_t::avx512, sha512_impl_t::avx2}) {
+            if (sha512_impl_supported(impl))
+                return impl;
+        }
+        return sha512_impl_t::scalar;
+    }();
+    return best;
+}
+
+void sha512_multi(const std::vector<sha512_message_t>& msgs,
+                  std::vector<sha512_digest_t>& digests) {
+    sha512_multi(msgs, digests, sha512_best_impl());
+}
+
+void sha512_multi(const std::vector<sha512_message_t>& msgs,
+                  std::vector<sha512_digest_t>& digests, sha512_impl_t impl) {
+
+    digests.resize(msgs.size());
+
+    switch (impl) {
+#ifdef SHA512_MULTI_X86
+    case sha512_impl_t::avx512:
+        hash_lanes<8>(msgs, digests, compress_avx512);
+        return;
+    case sha512_impl_t::avx2:
+        hash_lanes<4>(msgs, digests, compress_avx2);
+        return;
+#endif
+    default:
+        hash_lanes<1>(msgs, digests, compress_scalar);
+        return;
+    }
+}
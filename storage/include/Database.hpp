@@ -3,10 +3,15 @@
 #include "Item.hpp"
 #include "oxen_common.h"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/asio.hpp>
@@ -17,20 +22,52 @@ class Timer;
 
 namespace oxen {
 
+struct db_options_t {
+    // Store messages in a table clustered by owner (a WITHOUT ROWID table
+    // keyed on owner and sequence number) rather than in insertion order, so
+    // that all messages of an owner live on a few adjacent pages. An existing
+    // database keeps its layout unless `convert_layout` is set.
+    bool clustered_by_owner = false;
+    // Convert an existing database to the layout requested above when
+    // opening it (refused if there isn't room for a second copy)
+    bool convert_layout = false;
+    // Size (in bytes) of the memory map used for reads, 0 disables it
+    uint64_t mmap_size = 0;
+    // Size (in KiB) of the page cache, 0 keeps the sqlite default
+    uint64_t cache_size_kb = 0;
+    // Read through the owner and hash indexes in the background on start, so
+    // that the first polls after a restart don't hit cold storage
+    bool warmup = false;
+    // Use write-ahead logging so that other processes can read the database
+    // while we are writing to it
+    bool wal = false;
+    // Open an existing database (in WAL mode) for reading only, as done by
+    // worker processes. Expiry cleanup is left to the process that writes.
+    bool read_only = false;
+};
+
 class Database {
   public:
-    Database(boost::asio::io_context& ioc, const std::string& db_path);
+    Database(boost::asio::io_context& ioc, const std::string& db_path,
+             const db_options_t& options = {});
     ~Database();
 
     enum class DuplicateHandling { IGNORE, FAIL };
 
-    bool store(const std::string& hash, const std::string& pubKey,
-               const std::string& bytes, uint64_t ttl, uint64_t timestamp,
-               const std::string& nonce,
+    bool store(std::string_view hash, std::string_view pubKey,
+               std::string_view bytes, uint64_t ttl, uint64_t timestamp,
+               std::string_view nonce,
                DuplicateHandling behaviour = DuplicateHandling::FAIL);
 
     bool bulk_store(const std::vector<storage::Item>& items);
 
+    // Same as above, but without copying the items
+    bool bulk_store(const std::vector<storage::ItemView>& items);
+
+    // Same as above; `stored` is set to the number of items that were new
+    bool bulk_store(const std::vector<storage::ItemView>& items,
+                    uint64_t& stored);
+
     bool retrieve(const std::string& key, std::vector<storage::Item>& items,
                   const std::string& lastHash, int num_results = -1);
 
@@ -44,15 +81,152 @@ class Database {
     // Get message by `msg_hash`, return true if found
     bool retrieve_by_hash(const std::string& msg_hash, storage::Item& item);
 
+    // Return the position of the most recently stored message (0 if the
+    // database is empty). Positions only ever increase, even when the most
+    // recent messages are deleted; in read only mode this is only the
+    // highest position currently in the table.
+    bool get_last_position(uint64_t& position);
+
+    // Retrieve messages with positions in (`after`, `up_to`] in the order
+    // they were stored, stopping once `max_bytes` of message data have been
+    // read; `last` is set to the position of the last message returned
+    bool retrieve_range(uint64_t after, uint64_t up_to, size_t max_bytes,
+                        std::vector<storage::Item>& items, uint64_t& last);
+
+    // Delete all messages of `pubkey` stored with a timestamp up to (and
+    // including) `timestamp`; `deleted` is set to the number of messages
+    // removed. `request` is the owner's signed request, kept to prove the
+    // deletion to peers that still have the messages.
+    bool delete_all(const std::string& pubkey, uint64_t timestamp,
+                    std::string_view request, uint64_t& deleted);
+
+    // Delete messages of `pubkey` with the given hashes (others are ignored)
+    bool delete_by_hash(const std::string& pubkey,
+                        const std::vector<std::string>& hashes,
+                        std::string_view request, uint64_t& deleted);
+
+    // Both of the above leave a tombstone, which makes `bulk_store` skip the
+    // deleted messages until they would have expired anyway. Set `deleted`
+    // if the message with `hash` and `timestamp` is covered by one, and
+    // `request` (if given) to the request that deleted it.
+    bool is_deleted(std::string_view pubkey, std::string_view hash,
+                    uint64_t timestamp, bool& deleted,
+                    std::string* request = nullptr);
+
+    // Get the hashes and owners of up to `limit` messages with positions
+    // after `after`, in the order they were stored; `last` is set to the
+    // position of the last one returned
+    bool
+    get_hashes_after(uint64_t after, int limit,
+                     std::vector<std::pair<std::string, std::string>>& entries,
+                     uint64_t& last);
+
+    // Put the ones of `hashes` that we don't have in `missing`. Like
+    // `for_each_hash`, can be called from any thread.
+    bool get_missing_hashes(const std::vector<std::string>& hashes,
+                            std::vector<std::string>& missing);
+
+    // Position in the replication log of `peer` up to which we have its
+    // messages (nullopt if we have never read its log)
+    bool get_log_cursor(std::string_view peer,
+                        std::optional<uint64_t>& position);
+
+    bool set_log_cursor(std::string_view peer, uint64_t position);
+
+    // Call `f` with the hash and timestamp of every message with a timestamp
+    // in [`begin`, `end`) that has not expired at `now`, in timestamp order.
+    // Uses a separate connection, so (unlike the other methods) it can be
+    // called from any thread, including concurrently with the others.
+    bool for_each_hash(
+        uint64_t begin, uint64_t end, uint64_t now,
+        const std::function<void(std::string_view, uint64_t)>& f);
+
+    // The replication outbox keeps batches relayed to swarm members until
+    // each of them has acknowledged the batch (or its messages expire).
+    // Entries are either being sent (and not returned by
+    // `outbox_take_due`) or waiting for their next attempt.
+
+    // Add a batch of `messages` for `peers`, in the "being sent" state
+    bool outbox_add(std::string_view batch, uint32_t messages,
+                    uint64_t expiration, const std::vector<std::string>& peers,
+                    uint64_t& batch_id,
+                    storage::OutboxKind kind = storage::OutboxKind::MESSAGES);
+
+    // Remove the entry once `peer` has acknowledged the batch
+    bool outbox_ack(uint64_t batch_id, std::string_view peer);
+
+    // Record the number of failed `attempts` and schedule the next one at
+    // `next_attempt` (in ms)
+    bool outbox_defer(uint64_t batch_id, std::string_view peer,
+                      uint32_t attempts, uint64_t next_attempt);
+
+    // Record the outcome of several attempts at once, as `outbox_ack` or
+    // `outbox_defer` would, but in a single transaction
+    bool outbox_record(const std::vector<storage::OutboxResult>& results);
+
+    // Take up to `limit` entries due for another attempt at `now`, putting
+    // them in the "being sent" state
+    bool outbox_take_due(uint64_t now, int limit,
+                         std::vector<storage::OutboxItem>& items);
+
+    // Forget all entries for `peer`
+    bool outbox_drop_peer(std::string_view peer);
+
+    // Forget batches that expire before `now`
+    bool outbox_prune(uint64_t now);
+
+    // Forget the entries of each peer for batches added before
+    // `created_before` (in ms), and the oldest ones of those that take its
+    // unacknowledged batches over `max_peer_bytes`; `dropped` is set to the
+    // number of entries forgotten
+    bool outbox_trim(uint64_t created_before, uint64_t max_peer_bytes,
+                     uint64_t& dropped);
+
+    // Get the unacknowledged batches of every peer that has any
+    bool outbox_get_lag(std::vector<storage::OutboxLag>& lag);
+
+    // Return the number of page cache hits and misses since the database was
+    // opened
+    bool get_cache_stats(uint64_t& hits, uint64_t& misses);
+
+    // Return the heap memory used by the connection (page cache, schema and
+    // prepared statements)
+    bool get_memory_used(uint64_t& bytes);
+
+    // Return the number of index entries read by the warmup so far, and set
+    // `done` once it has finished (or was never started)
+    uint64_t get_warmup_progress(bool& done) const;
+
   private:
     sqlite3_stmt* prepare_statement(const std::string& query);
     void open_and_prepare(const std::string& db_path);
+    // Create the tables, in the configured layout unless the existing table
+    // uses the other one and conversion isn't requested
+    void create_table();
+    // Convert the existing table to the configured layout
+    void convert_table();
+    // Delete a batch of expired messages and schedule the next step
     void perform_cleanup();
+    void schedule_cleanup(std::chrono::milliseconds delay);
+    // Record the deletion of `hash` (of all messages up to `timestamp` if
+    // empty), within the caller's transaction
+    bool add_tombstone(const std::string& pubkey, std::string_view hash,
+                       uint64_t timestamp, uint64_t expiration,
+                       std::string_view request);
+    // Make sure that the next `count` positions have been reserved
+    bool reserve_positions(uint64_t count);
+    // Apply cache related pragmas from `options_` to connection `conn`
+    void configure_cache(sqlite3* conn);
+    // Read all index pages using a separate (read only) connection
+    void warm_up(const std::string& file_path);
 
   private:
     sqlite3* db;
+    // Read only connection for `for_each_hash`
+    sqlite3* scan_db = nullptr;
     sqlite3_stmt* save_stmt;
     sqlite3_stmt* save_or_ignore_stmt;
+    sqlite3_stmt* bulk_save_stmt;
     sqlite3_stmt* get_all_for_pk_stmt;
     sqlite3_stmt* get_all_stmt;
     sqlite3_stmt* get_stmt;
@@ -60,8 +234,52 @@ class Database {
     sqlite3_stmt* get_by_index_stmt;
     sqlite3_stmt* get_by_hash_stmt;
     sqlite3_stmt* delete_expired_stmt;
+    sqlite3_stmt* get_last_position_stmt;
+    sqlite3_stmt* reserve_positions_stmt;
+    sqlite3_stmt* get_range_stmt;
+    sqlite3_stmt* delete_all_stmt;
+    sqlite3_stmt* delete_by_hash_stmt;
+    sqlite3_stmt* add_tombstone_stmt;
+    sqlite3_stmt* is_deleted_stmt;
+    sqlite3_stmt* delete_expired_tombstones_stmt;
+    sqlite3_stmt* get_hashes_after_stmt;
+    sqlite3_stmt* get_log_cursor_stmt;
+    sqlite3_stmt* set_log_cursor_stmt;
+    sqlite3_stmt* outbox_add_batch_stmt;
+    sqlite3_stmt* outbox_add_peer_stmt;
+    sqlite3_stmt* outbox_ack_stmt;
+    sqlite3_stmt* outbox_delete_batch_stmt;
+    sqlite3_stmt* outbox_defer_stmt;
+    sqlite3_stmt* outbox_get_due_stmt;
+    sqlite3_stmt* outbox_drop_peer_stmt;
+    sqlite3_stmt* outbox_prune_stmt;
+    sqlite3_stmt* outbox_trim_stmt;
+    sqlite3_stmt* outbox_lag_stmt;
 
     boost::asio::steady_timer cleanup_timer_;
+
+    const db_options_t options_;
+    // Whether the table uses the clustered layout; unless converting it, this
+    // is whatever the existing table uses
+    bool clustered_;
+    // Position of the next stored message, and the last one reserved
+    uint64_t next_seq_ = 1;
+    uint64_t reserved_seq_ = 0;
+
+    // Accumulated here as sqlite only keeps (32 bit) counters; read from
+    // both the io and the LMQ threads
+    std::atomic<uint64_t> cache_hits_{0};
+    std::atomic<uint64_t> cache_misses_{0};
+
+    std::thread warmup_thread_;
+    std::atomic<bool> stop_warmup_{false};
+    std::atomic<uint64_t> warmup_entries_{0};
+    std::atomic<bool> warmup_done_{false};
+
+    std::chrono::steady_clock::time_point opened_at_;
+    bool initial_cleanup_done_ = false;
+    // Number of messages deleted in the current run of cleanup steps
+    uint64_t cleanup_backlog_deleted_ = 0;
 };
 
 } // namespace oxen
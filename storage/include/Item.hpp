@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 
 namespace oxen {
 namespace storage {
@@ -23,6 +24,57 @@ struct Item {
     std::string data;
 };
 
+/// What a batch in the replication outbox holds
+enum class OutboxKind : uint8_t {
+    MESSAGES = 0,
+    // Deletions requested by owners
+    TOMBSTONES = 1,
+};
+
+/// Batch waiting in the replication outbox to be (re)sent to a peer
+struct OutboxItem {
+    uint64_t batch_id;
+    std::string peer;
+    // Number of failed attempts so far
+    uint32_t attempts;
+    // Number of messages in the batch
+    uint32_t messages;
+    OutboxKind kind = OutboxKind::MESSAGES;
+    std::string data;
+};
+
+/// Outcome of an attempt to send an outbox batch to a peer
+struct OutboxResult {
+    uint64_t batch_id;
+    std::string peer;
+    // Acknowledged by the peer, or else to be tried again at `next_attempt`
+    bool acked;
+    // Number of failed attempts so far
+    uint32_t attempts = 0;
+    uint64_t next_attempt = 0;
+};
+
+/// Batches in the replication outbox that a peer has not acknowledged yet
+struct OutboxLag {
+    std::string peer;
+    uint64_t batches;
+    uint64_t messages;
+    // When the oldest of them was added (in ms)
+    uint64_t oldest;
+};
+
+/// Same as Item, but refers to strings owned by someone else (such as a
+/// batch received from a peer), so it is cheap to construct
+struct ItemView {
+    std::string_view hash;
+    std::string_view pub_key;
+    uint64_t timestamp;
+    uint64_t ttl;
+    uint64_t expiration_timestamp;
+    std::string_view nonce;
+    std::string_view data;
+};
+
 } // namespace storage
 
 } // namespace oxen
@@ -4,46 +4,164 @@
 
 #include "sqlite3.h"
 #include <cstdlib>
+#include <algorithm>
+#include <array>
 #include <exception>
+#include <filesystem>
+#include <optional>
+#include <unordered_set>
 
 namespace oxen {
 using namespace storage;
 
 constexpr auto CLEANUP_PERIOD = std::chrono::seconds(10);
 
+// Maximum number of expired rows removed in a single cleanup step. A large
+// expiry backlog (e.g. after a long downtime) is worked off in slices of this
+// size, yielding to the io context in between, so that it never blocks
+// request processing for long.
+constexpr int CLEANUP_BATCH_SIZE = 5000;
+
+// Number of index entries read per warmup step; each step is a separate read
+// transaction so that writers are never held up for long
+constexpr int WARMUP_BATCH_SIZE = 1000;
+
+// How long deletions are remembered, so that copies of deleted messages
+// still held (or relayed) by other nodes are not stored again. Longer than
+// the maximum TTL of 14 days, after which those copies have expired anyway.
+constexpr uint64_t TOMBSTONE_LIFETIME_MS = 15 * 24 * 60 * 60 * 1000ull;
+
+// Positions are reserved (and the reservation persisted) this many at a time,
+// so that they keep increasing across restarts even when the most recently
+// stored messages have been deleted in the meantime
+constexpr uint64_t POSITION_BLOCK_SIZE = 1000;
+
+// Width (in ms) of the timestamp slices `for_each_hash` reads at a time
+constexpr uint64_t HASH_SCAN_SLICE_MS = 60 * 60 * 1000;
+
+// Messages inserted by a single statement in `bulk_store` (8 parameters each,
+// within the 999 parameters older sqlite versions allow)
+constexpr size_t BULK_INSERT_ROWS = 100;
+
+// Hashes looked up by a single statement in `get_missing_hashes`
+constexpr size_t MISSING_HASHES_PER_QUERY = 500;
+
 Database::~Database() {
+    stop_warmup_ = true;
+    if (warmup_thread_.joinable()) {
+        warmup_thread_.join();
+    }
     sqlite3_finalize(save_stmt);
     sqlite3_finalize(save_or_ignore_stmt);
+    sqlite3_finalize(bulk_save_stmt);
     sqlite3_finalize(get_all_for_pk_stmt);
     sqlite3_finalize(get_all_stmt);
     sqlite3_finalize(get_stmt);
     sqlite3_finalize(delete_expired_stmt);
+    sqlite3_finalize(get_last_position_stmt);
+    sqlite3_finalize(reserve_positions_stmt);
+    sqlite3_finalize(outbox_trim_stmt);
+    sqlite3_finalize(get_range_stmt);
+    sqlite3_finalize(delete_all_stmt);
+    sqlite3_finalize(delete_by_hash_stmt);
+    sqlite3_finalize(add_tombstone_stmt);
+    sqlite3_finalize(is_deleted_stmt);
+    sqlite3_finalize(delete_expired_tombstones_stmt);
+    sqlite3_finalize(get_hashes_after_stmt);
+    sqlite3_finalize(get_log_cursor_stmt);
+    sqlite3_finalize(set_log_cursor_stmt);
+    sqlite3_finalize(outbox_add_batch_stmt);
+    sqlite3_finalize(outbox_add_peer_stmt);
+    sqlite3_finalize(outbox_ack_stmt);
+    sqlite3_finalize(outbox_delete_batch_stmt);
+    sqlite3_finalize(outbox_defer_stmt);
+    sqlite3_finalize(outbox_get_due_stmt);
+    sqlite3_finalize(outbox_drop_peer_stmt);
+    sqlite3_finalize(outbox_prune_stmt);
+    sqlite3_finalize(outbox_lag_stmt);
+    sqlite3_close(scan_db);
     sqlite3_close(db);
     std::cerr << "~Database\n";
 }
 
-Database::Database(boost::asio::io_context& ioc, const std::string& db_path)
-    : cleanup_timer_(ioc) {
+Database::Database(boost::asio::io_context& ioc, const std::string& db_path,
+                   const db_options_t& options)
+    : cleanup_timer_(ioc), options_(options),
+      clustered_(options.clustered_by_owner) {
     open_and_prepare(db_path);
 
-    perform_cleanup();
+    if (options_.warmup) {
+        warmup_thread_ = std::thread(&Database::warm_up, this,
+                                     db_path + "/storage.db");
+    } else {
+        warmup_done_ = true;
+    }
+
+    // Don't make the caller wait for the (potentially huge) initial cleanup,
+    // it is performed in batches from the io context instead
+    if (!options_.read_only) {
+        schedule_cleanup(std::chrono::seconds(0));
+    }
+}
+
+void Database::schedule_cleanup(std::chrono::milliseconds delay) {
+    cleanup_timer_.expires_after(delay);
+    cleanup_timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (ec != boost::asio::error::operation_aborted) {
+            this->perform_cleanup();
+        }
+    });
+}
+
+// Execute a DELETE/INSERT/UPDATE statement (with its parameters already
+// bound), adding the number of changed rows to `changed`
+static bool step_write(sqlite3* db, sqlite3_stmt* stmt, uint64_t& changed) {
+
+    bool success = false;
+    int rc;
+    while (true) {
+        rc = sqlite3_step(stmt);
+        if (rc == SQLITE_BUSY) {
+            continue;
+        } else if (rc == SQLITE_DONE) {
+            changed += sqlite3_changes(db);
+            success = true;
+            break;
+        } else {
+            OXEN_LOG(critical, "Could not execute `write` db statement, ec: {}",
+                     rc);
+            break;
+        }
+    }
+
+    rc = sqlite3_reset(stmt);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+        success = false;
+    }
+    return success;
 }
 
 void Database::perform_cleanup() {
     const auto now_ms = util::get_time_ms();
 
     sqlite3_bind_int64(delete_expired_stmt, 1, now_ms);
+    sqlite3_bind_int(delete_expired_stmt, 2, CLEANUP_BATCH_SIZE);
 
+    int deleted = 0;
     int rc;
     while (true) {
         rc = sqlite3_step(delete_expired_stmt);
         if (rc == SQLITE_BUSY) {
             continue;
         } else if (rc == SQLITE_DONE) {
+            deleted = sqlite3_changes(db);
             break;
         } else {
-            fprintf(stderr, "Can't delete expired messages: %s\n",
-                    sqlite3_errmsg(db));
+            OXEN_LOG(error, "Can't delete expired messages: {}",
+                     sqlite3_errmsg(db));
+            break;
         }
     }
     int reset_rc = sqlite3_reset(delete_expired_stmt);
@@ -51,11 +169,38 @@ void Database::perform_cleanup() {
     // indicated an error, then sqlite3_reset(S) returns an appropriate error
     // code.
     if (reset_rc != SQLITE_OK && reset_rc != rc) {
-        fprintf(stderr, "sql error: unexpected value from sqlite3_reset");
+        OXEN_LOG(error, "sql error: unexpected value from sqlite3_reset");
+    }
+
+    cleanup_backlog_deleted_ += deleted;
+
+    uint64_t tombstones = 0;
+    sqlite3_bind_int64(delete_expired_tombstones_stmt, 1, now_ms);
+    if (step_write(db, delete_expired_tombstones_stmt, tombstones) &&
+        tombstones > 0) {
+        OXEN_LOG(debug, "Forgot {} expired deletions", tombstones);
+    }
+
+    if (deleted == CLEANUP_BATCH_SIZE) {
+        // There are (likely) more expired messages, continue as soon as
+        // other pending work has had a chance to run
+        schedule_cleanup(std::chrono::seconds(0));
+        return;
+    }
+
+    if (!initial_cleanup_done_) {
+        initial_cleanup_done_ = true;
+        const auto elapsed = std::chrono::steady_clock::now() - opened_at_;
+        OXEN_LOG(info,
+                 "Initial cleanup done: removed {} expired messages, {} ms "
+                 "after opening the database",
+                 cleanup_backlog_deleted_,
+                 std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                     .count());
     }
+    cleanup_backlog_deleted_ = 0;
 
-    cleanup_timer_.expires_after(CLEANUP_PERIOD);
-    cleanup_timer_.async_wait(std::bind(&Database::perform_cleanup, this));
+    schedule_cleanup(CLEANUP_PERIOD);
 }
 
 sqlite3_stmt* Database::prepare_statement(const std::string& query) {
@@ -107,6 +252,26 @@ static void set_page_count(sqlite3* db) {
     }
 }
 
+// Value of an integer pragma (such as `page_count`)
+static bool get_pragma(sqlite3* db, const std::string& pragma,
+                       int64_t& value) {
+    std::optional<int64_t> result;
+    auto cb = [](void* result, int argc, char** argv, char**) -> int {
+        if (argc > 0 && argv[0]) {
+            *static_cast<std::optional<int64_t>*>(result) =
+                std::strtoll(argv[0], nullptr, 10);
+        }
+        return 0;
+    };
+    if (sqlite3_exec(db, ("PRAGMA " + pragma + ";").c_str(), cb, &result,
+                     nullptr) != SQLITE_OK ||
+        !result) {
+        return false;
+    }
+    value = *result;
+    return true;
+}
+
 static void check_page_size(sqlite3* db) {
 
     char* errMsg = nullptr;
@@ -141,12 +306,415 @@ static void check_page_size(sqlite3* db) {
     }
 }
 
+static int64_t ms_since(std::chrono::steady_clock::time_point& since) {
+    const auto now = std::chrono::steady_clock::now();
+    const auto res =
+        std::chrono::duration_cast<std::chrono::milliseconds>(now - since);
+    since = now;
+    return res.count();
+}
+
+static std::string create_table_query(const std::string& table,
+                                      bool clustered) {
+    // In the clustered layout `Seq` plays the role of rowid: it records the
+    // order in which messages were stored. It comes last so that `SELECT *`
+    // returns the same leading columns in both layouts.
+    return fmt::format("CREATE TABLE IF NOT EXISTS `{}`("
+                       "    `Hash` VARCHAR(128) NOT NULL,"
+                       "    `Owner` VARCHAR(256) NOT NULL,"
+                       "    `TTL` INTEGER NOT NULL,"
+                       "    `Timestamp` INTEGER NOT NULL,"
+                       "    `TimeExpires` INTEGER NOT NULL,"
+                       "    `Nonce` VARCHAR(128) NOT NULL,"
+                       "    `Data` BLOB{}"
+                       "){};",
+                       table,
+                       clustered ? ",    `Seq` INTEGER NOT NULL,"
+                                   "    PRIMARY KEY (`Owner`, `Seq`)"
+                                 : "",
+                       clustered ? " WITHOUT ROWID" : "");
+}
+
+// Column that orders messages by the time they were stored
+static const char* position_column(bool clustered) {
+    return clustered ? "`Seq`" : "rowid";
+}
+
+// Inserts `rows` messages (8 parameters each, as for a single one), skipping
+// duplicates and those deleted by their owner
+static std::string bulk_insert_query(bool clustered, size_t rows) {
+    std::string values;
+    for (size_t i = 0; i < rows; ++i) {
+        values += i == 0 ? "(?,?,?,?,?,?,?,?)" : ",(?,?,?,?,?,?,?,?)";
+    }
+    return fmt::format(
+        "INSERT OR IGNORE INTO Data (Hash, Owner, TTL, Timestamp, "
+        "TimeExpires, Nonce, Data, {}) SELECT * FROM (VALUES {}) AS v WHERE "
+        "NOT EXISTS (SELECT 1 FROM `Tombstone` WHERE `Owner` = v.column2 AND "
+        "(`Hash` = v.column1 OR (`Hash` = '' AND `Timestamp` >= v.column4)));",
+        position_column(clustered), values);
+}
+
+static bool exec(sqlite3* db, const std::string& query) {
+    char* errMsg = nullptr;
+    int rc = sqlite3_exec(db, query.c_str(), nullptr, nullptr, &errMsg);
+    if (rc) {
+        if (errMsg) {
+            OXEN_LOG(error, "Query error: {}", errMsg);
+            sqlite3_free(errMsg);
+        }
+        return false;
+    }
+    return true;
+}
+
+// Add the `columns` (name and definition) that `table` is missing because
+// it was created by an older version
+static bool add_missing_columns(
+    sqlite3* db, const std::string& table,
+    const std::vector<std::pair<std::string, std::string>>& columns) {
+
+    std::vector<std::string> existing;
+    // Rows are: cid, name, type, notnull, dflt_value, pk
+    auto cb = [](void* existing, int argc, char** argv, char**) -> int {
+        if (argc > 1 && argv[1]) {
+            static_cast<std::vector<std::string>*>(existing)->push_back(
+                argv[1]);
+        }
+        return 0;
+    };
+    if (sqlite3_exec(db,
+                     fmt::format("PRAGMA table_info(`{}`);", table).c_str(),
+                     cb, &existing, nullptr) != SQLITE_OK) {
+        return false;
+    }
+
+    for (const auto& [name, definition] : columns) {
+        if (std::find(existing.begin(), existing.end(), name) !=
+            existing.end()) {
+            continue;
+        }
+        OXEN_LOG(info, "Adding column {} to table {}", name, table);
+        if (!exec(db, fmt::format("ALTER TABLE `{}` ADD COLUMN `{}` {};", table,
+                                  name, definition))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Database::configure_cache(sqlite3* conn) {
+
+    if (options_.mmap_size > 0) {
+        // sqlite silently caps this at its compile time maximum, so we log
+        // the value that is actually in effect
+        auto cb = [](void*, int argc, char** argv, char**) -> int {
+            if (argc > 0 && argv[0]) {
+                OXEN_LOG(debug, "DB mmap size: {}", argv[0]);
+            }
+            return 0;
+        };
+        sqlite3_exec(
+            conn,
+            fmt::format("PRAGMA mmap_size = {};", options_.mmap_size).c_str(),
+            cb, nullptr, nullptr);
+    }
+
+    if (options_.cache_size_kb > 0) {
+        // Negative values are interpreted as KiB rather than pages
+        exec(conn,
+             fmt::format("PRAGMA cache_size = -{};", options_.cache_size_kb));
+    }
+}
+
+void Database::warm_up(const std::string& file_path) {
+
+    const auto started = std::chrono::steady_clock::now();
+
+    sqlite3* conn;
+    int rc = sqlite3_open_v2(file_path.c_str(), &conn,
+                             SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (rc) {
+        OXEN_LOG(error, "Can't open database for warmup: {}",
+                 sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        warmup_done_ = true;
+        return;
+    }
+
+    configure_cache(conn);
+
+    // Walk the indexes in key order, resuming after the last key seen. For
+    // the clustered layout the table itself is the owner index.
+    const std::array<const char*, 2> queries = {
+        clustered_
+            ? "SELECT `Owner`, `Seq` FROM `Data` WHERE (`Owner`, `Seq`) > "
+              "(?1, ?2) ORDER BY `Owner`, `Seq` LIMIT ?3;"
+            : "SELECT `Owner`, rowid FROM `Data` INDEXED BY `idx_data_owner` "
+              "WHERE (`Owner`, rowid) > (?1, ?2) ORDER BY `Owner`, rowid "
+              "LIMIT ?3;",
+        "SELECT `Hash`, 0 FROM `Data` INDEXED BY `idx_data_hash` WHERE `Hash` "
+        "> ?1 ORDER BY `Hash` LIMIT ?3;"};
+
+    uint64_t entries = 0;
+
+    for (const auto query : queries) {
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(conn, query, -1, &stmt, nullptr) != SQLITE_OK) {
+            OXEN_LOG(error, "Could not prepare warmup statement: {}",
+                     sqlite3_errmsg(conn));
+            break;
+        }
+
+        std::string last_key;
+        int64_t last_position = 0;
+
+        while (!stop_warmup_) {
+            sqlite3_bind_text(stmt, 1, last_key.data(), last_key.size(),
+                              SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt, 2, last_position);
+            sqlite3_bind_int(stmt, 3, WARMUP_BATCH_SIZE);
+
+            int count = 0;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                last_key.assign(
+                    reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                    sqlite3_column_bytes(stmt, 0));
+                last_position = sqlite3_column_int64(stmt, 1);
+                count++;
+            }
+            sqlite3_reset(stmt);
+
+            entries += count;
+            warmup_entries_ = entries;
+
+            if (rc == SQLITE_BUSY) {
+                // A write is in progress, let it finish
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            if (rc != SQLITE_DONE) {
+                OXEN_LOG(error, "Database warmup failed: {}",
+                         sqlite3_errmsg(conn));
+                break;
+            }
+            if (count < WARMUP_BATCH_SIZE) {
+                break;
+            }
+        }
+
+        sqlite3_finalize(stmt);
+    }
+
+    sqlite3_close(conn);
+    warmup_done_ = true;
+
+    if (!stop_warmup_) {
+        OXEN_LOG(info, "Database warmup done: read {} index entries in {} ms",
+                 entries,
+                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - started)
+                     .count());
+    }
+}
+
+void Database::convert_table() {
+
+    const bool clustered = clustered_;
+
+    // The converted copy is written (within a transaction, so alongside a
+    // rollback journal) before the old table is dropped, so this can take
+    // up to twice the space the database currently uses
+    int64_t page_count = 0, free_pages = 0;
+    if (!get_pragma(db, "page_count", page_count) ||
+        !get_pragma(db, "freelist_count", free_pages)) {
+        throw std::runtime_error("Can't get the size of the database");
+    }
+    const int64_t used = (page_count - free_pages) * DB_PAGE_SIZE;
+    if (page_count + (page_count - free_pages) > DB_PAGE_LIMIT) {
+        throw std::runtime_error(fmt::format(
+            "The database ({} MiB) is too large to be converted within the "
+            "{} MiB size limit, start without requesting its conversion",
+            used / (1024 * 1024), DB_SIZE_LIMIT / (1024 * 1024)));
+    }
+
+    const auto dir = std::filesystem::path(sqlite3_db_filename(db, "main"))
+                         .parent_path();
+    std::error_code ec;
+    const auto space = std::filesystem::space(dir, ec);
+    if (!ec && space.available < static_cast<uint64_t>(2 * used)) {
+        throw std::runtime_error(fmt::format(
+            "Not enough free disk space to convert the database ({} MiB "
+            "needed, {} MiB available)",
+            2 * used / (1024 * 1024), space.available / (1024 * 1024)));
+    }
+
+    OXEN_LOG(info, "Converting the database to the {} layout",
+             clustered ? "clustered" : "insertion ordered");
+
+    const auto started = std::chrono::steady_clock::now();
+
+    constexpr auto columns =
+        "`Hash`, `Owner`, `TTL`, `Timestamp`, `TimeExpires`, `Nonce`, "
+        "`Data`";
+
+    // Positions are carried over so that they keep increasing
+    const std::string query = fmt::format(
+        "BEGIN TRANSACTION;"
+        "DROP TABLE IF EXISTS `Data_new`;"
+        "{}"
+        "INSERT INTO `Data_new` ({}, {}) SELECT {}, {} FROM `Data`;"
+        "DROP TABLE `Data`;"
+        "ALTER TABLE `Data_new` RENAME TO `Data`;"
+        "COMMIT;",
+        create_table_query("Data_new", clustered), columns,
+        position_column(clustered), columns, position_column(!clustered));
+
+    if (!exec(db, query)) {
+        exec(db, "ROLLBACK;");
+        throw std::runtime_error("Can't convert table");
+    }
+
+    OXEN_LOG(info, "Database converted in {} ms",
+             std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - started)
+                 .count());
+}
+
+void Database::create_table() {
+
+    // Find out the layout of the existing table (if any)
+    std::optional<std::string> existing;
+    auto cb = [](void* existing, int argc, char** argv, char**) -> int {
+        if (argc > 0 && argv[0]) {
+            *static_cast<std::optional<std::string>*>(existing) = argv[0];
+        }
+        return 0;
+    };
+    sqlite3_exec(db,
+                 "SELECT sql FROM sqlite_master WHERE type = 'table' AND "
+                 "name = 'Data';",
+                 cb, &existing, nullptr);
+
+    if (options_.read_only) {
+        if (!existing) {
+            throw std::runtime_error("Database has not been created yet");
+        }
+        clustered_ = existing->find("WITHOUT ROWID") != std::string::npos;
+        return;
+    }
+
+    if (existing &&
+        (existing->find("WITHOUT ROWID") != std::string::npos) != clustered_) {
+        if (options_.convert_layout) {
+            convert_table();
+        } else {
+            clustered_ = !clustered_;
+            OXEN_LOG(warn,
+                     "Keeping the {} layout of the existing database, its "
+                     "conversion must be requested explicitly",
+                     clustered_ ? "clustered" : "insertion ordered");
+        }
+    }
+
+    const bool clustered = clustered_;
+
+    // Anti-entropy reads messages by timestamp
+    std::string query = create_table_query("Data", clustered) +
+                        "CREATE UNIQUE INDEX IF NOT EXISTS `idx_data_hash` ON "
+                        "`Data` (`Hash`);"
+                        "CREATE INDEX IF NOT EXISTS `idx_data_timestamp` ON "
+                        "`Data` (`Timestamp`);";
+    if (clustered) {
+        // Owner lookups use the primary key; ranges of positions (snapshots,
+        // expiry) need their own index
+        query += "CREATE UNIQUE INDEX IF NOT EXISTS `idx_data_seq` ON `Data` "
+                 "(`Seq`);";
+    } else {
+        query += "CREATE INDEX IF NOT EXISTS `idx_data_owner` on `Data` "
+                 "('Owner');";
+    }
+
+    // Entries that were being sent when we stopped are due right away (a
+    // `NextAttempt` of 0 means "being sent")
+    query += "CREATE TABLE IF NOT EXISTS `OutboxBatch` ("
+             "    `Id` INTEGER PRIMARY KEY,"
+             "    `Data` BLOB NOT NULL,"
+             "    `Messages` INTEGER NOT NULL DEFAULT 0,"
+             "    `TimeCreated` INTEGER NOT NULL DEFAULT 0,"
+             "    `TimeExpires` INTEGER NOT NULL,"
+             "    `Kind` INTEGER NOT NULL DEFAULT 0"
+             ");"
+             "CREATE TABLE IF NOT EXISTS `OutboxPeer` ("
+             "    `BatchId` INTEGER NOT NULL,"
+             "    `Peer` BLOB NOT NULL,"
+             "    `Attempts` INTEGER NOT NULL DEFAULT 0,"
+             "    `NextAttempt` INTEGER NOT NULL DEFAULT 0,"
+             "    PRIMARY KEY (`BatchId`, `Peer`)"
+             ") WITHOUT ROWID;"
+             "CREATE INDEX IF NOT EXISTS `idx_outbox_next` ON `OutboxPeer` "
+             "(`NextAttempt`);"
+             "UPDATE `OutboxPeer` SET `NextAttempt` = 1 WHERE "
+             "`NextAttempt` = 0;";
+
+    // Deletions requested by owners: an empty `Hash` stands for all
+    // messages with a timestamp up to `Timestamp`. `Request` is the owner's
+    // signed request (empty for those kept before we stored it).
+    query += "CREATE TABLE IF NOT EXISTS `Tombstone` ("
+             "    `Owner` VARCHAR(256) NOT NULL,"
+             "    `Hash` VARCHAR(128) NOT NULL,"
+             "    `Timestamp` INTEGER NOT NULL,"
+             "    `TimeExpires` INTEGER NOT NULL,"
+             "    `Request` BLOB NOT NULL DEFAULT '',"
+             "    PRIMARY KEY (`Owner`, `Hash`)"
+             ") WITHOUT ROWID;"
+             "CREATE INDEX IF NOT EXISTS `idx_tombstone_expires` ON "
+             "`Tombstone` (`TimeExpires`);";
+
+    // Positions up to `Reserved` may have been handed out already
+    query += "CREATE TABLE IF NOT EXISTS `PositionMark` ("
+             "    `Id` INTEGER PRIMARY KEY CHECK (`Id` = 0),"
+             "    `Reserved` INTEGER NOT NULL"
+             ");";
+
+    // How far we have read the replication log of each swarm member
+    query += "CREATE TABLE IF NOT EXISTS `LogCursor` ("
+             "    `Peer` BLOB PRIMARY KEY,"
+             "    `Position` INTEGER NOT NULL"
+             ") WITHOUT ROWID;";
+
+    if (!exec(db, query)) {
+        throw std::runtime_error("Can't create table");
+    }
+
+    // Outboxes created before we kept track of their contents
+    if (!add_missing_columns(
+            db, "OutboxBatch",
+            {{"Messages", "INTEGER NOT NULL DEFAULT 0"},
+             {"TimeCreated", "INTEGER NOT NULL DEFAULT 0"},
+             {"Kind", "INTEGER NOT NULL DEFAULT 0"}})) {
+        throw std::runtime_error("Can't upgrade the outbox table");
+    }
+
+    // Deletions recorded before we kept the owner's request
+    if (!add_missing_columns(db, "Tombstone",
+                             {{"Request", "BLOB NOT NULL DEFAULT ''"}})) {
+        throw std::runtime_error("Can't upgrade the tombstone table");
+    }
+}
+
 void Database::open_and_prepare(const std::string& db_path) {
+    auto checkpoint = std::chrono::steady_clock::now();
+    opened_at_ = checkpoint;
+
     const std::string file_path = db_path + "/storage.db";
+    const int flags =
+        options_.read_only ? SQLITE_OPEN_READONLY
+                           : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
     int rc = sqlite3_open_v2(file_path.c_str(), &db,
-                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
-                                 SQLITE_OPEN_FULLMUTEX,
-                             NULL);
+                             flags | SQLITE_OPEN_FULLMUTEX, NULL);
 
     if (rc) {
         fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
@@ -155,60 +723,86 @@ void Database::open_and_prepare(const std::string& db_path) {
         return;
     }
 
+    const auto open_ms = ms_since(checkpoint);
+
     check_page_size(db);
     set_page_count(db);
+    configure_cache(db);
 
-    const char* create_table_query =
-        "CREATE TABLE IF NOT EXISTS `Data`("
-        "    `Hash` VARCHAR(128) NOT NULL,"
-        "    `Owner` VARCHAR(256) NOT NULL,"
-        "    `TTL` INTEGER NOT NULL,"
-        "    `Timestamp` INTEGER NOT NULL,"
-        "    `TimeExpires` INTEGER NOT NULL,"
-        "    `Nonce` VARCHAR(128) NOT NULL,"
-        "    `Data` BLOB"
-        ");"
-        "CREATE UNIQUE INDEX IF NOT EXISTS `idx_data_hash` ON `Data` (`Hash`);"
-        "CREATE INDEX IF NOT EXISTS `idx_data_owner` on `Data` ('Owner');";
+    if (options_.wal && !options_.read_only) {
+        if (!exec(db, "PRAGMA journal_mode = WAL;")) {
+            throw std::runtime_error("Can't switch the database to WAL mode");
+        }
+    }
 
-    char* errMsg = nullptr;
-    rc = sqlite3_exec(db, create_table_query, nullptr, nullptr, &errMsg);
-    if (rc) {
-        if (errMsg) {
-            printf("%s\n", errMsg);
-            sqlite3_free(errMsg);
+    if (options_.read_only) {
+        // Readers in the rollback journal mode would block the writer
+        std::string journal_mode;
+        auto cb = [](void* mode, int argc, char** argv, char**) -> int {
+            if (argc > 0 && argv[0]) {
+                *static_cast<std::string*>(mode) = argv[0];
+            }
+            return 0;
+        };
+        sqlite3_exec(db, "PRAGMA journal_mode;", cb, &journal_mode, nullptr);
+        if (journal_mode != "wal") {
+            throw std::runtime_error(
+                "Database must be in WAL mode to be opened read only");
         }
-        throw std::runtime_error("Can't create table");
     }
 
-    save_stmt = prepare_statement(
-        "INSERT INTO Data "
-        "(Hash, Owner, TTL, Timestamp, TimeExpires, Nonce, Data)"
-        "VALUES (?,?,?,?,?,?,?);");
+    create_table();
+
+    // Long scans (for anti-entropy) get their own connection so that they
+    // can run on other threads than the one using `db`
+    rc = sqlite3_open_v2(file_path.c_str(), &scan_db,
+                         SQLITE_OPEN_READONLY | SQLITE_OPEN_FULLMUTEX, NULL);
+    if (rc) {
+        throw std::runtime_error(fmt::format(
+            "Can't open database for scans: {}", sqlite3_errmsg(scan_db)));
+    }
+    configure_cache(scan_db);
+
+    const auto schema_ms = ms_since(checkpoint);
+
+    const bool clustered = clustered_;
+    const auto pos = position_column(clustered);
+
+    // The position is assigned by us (as the 8th parameter) rather than by
+    // sqlite, which would reuse those of deleted messages
+    const auto insert_columns = fmt::format(
+        "(Hash, Owner, TTL, Timestamp, TimeExpires, Nonce, Data, {}) VALUES "
+        "(?,?,?,?,?,?,?,?)",
+        pos);
+
+    save_stmt =
+        prepare_statement(fmt::format("INSERT INTO Data {};", insert_columns));
     if (!save_stmt)
         throw std::runtime_error("could not prepare the save statement");
 
     save_or_ignore_stmt = prepare_statement(
-        "INSERT OR IGNORE INTO Data "
-        "(Hash, Owner, TTL, Timestamp, TimeExpires, Nonce, Data)"
-        "VALUES (?,?,?,?,?,?,?)");
-    if (!save_or_ignore_stmt)
+        fmt::format("INSERT OR IGNORE INTO Data {};", insert_columns));
+    bulk_save_stmt =
+        prepare_statement(bulk_insert_query(clustered, BULK_INSERT_ROWS));
+    if (!save_or_ignore_stmt || !bulk_save_stmt)
         throw std::runtime_error("could not prepare the bulk save statement");
 
-    get_all_for_pk_stmt = prepare_statement(
-        "SELECT * FROM Data WHERE `Owner` = ? ORDER BY rowid LIMIT ?;");
+    get_all_for_pk_stmt = prepare_statement(fmt::format(
+        "SELECT * FROM Data WHERE `Owner` = ? ORDER BY {} LIMIT ?;", pos));
     if (!get_all_for_pk_stmt)
         throw std::runtime_error(
             "could not prepare the get all for pk statement");
 
-    get_all_stmt = prepare_statement("SELECT * FROM Data ORDER BY rowid;");
+    get_all_stmt =
+        prepare_statement(fmt::format("SELECT * FROM Data ORDER BY {};", pos));
     if (!get_all_stmt)
         throw std::runtime_error("could not prepare the get all statement");
 
-    get_stmt =
-        prepare_statement("SELECT * FROM `Data` WHERE `Owner` == ? AND rowid >"
-                          "COALESCE((SELECT `rowid` FROM `Data` WHERE `Hash` = "
-                          "?), 0) ORDER BY rowid LIMIT ?;");
+    get_stmt = prepare_statement(
+        fmt::format("SELECT * FROM `Data` WHERE `Owner` == ? AND {0} >"
+                    "COALESCE((SELECT {0} FROM `Data` WHERE `Hash` = "
+                    "?), 0) ORDER BY {0} LIMIT ?;",
+                    pos));
     if (!get_stmt)
         throw std::runtime_error("could not prepare get statement");
 
@@ -225,11 +819,156 @@ void Database::open_and_prepare(const std::string& db_path) {
     if (!get_by_hash_stmt)
         throw std::runtime_error("could not prepare get by hash statement");
 
-    delete_expired_stmt =
-        prepare_statement("DELETE FROM `Data` WHERE `TimeExpires` <= ?");
+    delete_expired_stmt = prepare_statement(
+        fmt::format("DELETE FROM `Data` WHERE {0} IN (SELECT {0} FROM `Data` "
+                    "WHERE `TimeExpires` <= ? LIMIT ?);",
+                    pos));
     if (!delete_expired_stmt)
         throw std::runtime_error(
             "could not prepare 'delete expired' statement");
+
+    get_last_position_stmt = prepare_statement(
+        fmt::format("SELECT COALESCE(MAX({}), 0) FROM `Data`;", pos));
+    if (!get_last_position_stmt)
+        throw std::runtime_error(
+            "could not prepare 'get last position' statement");
+
+    get_range_stmt = prepare_statement(
+        fmt::format("SELECT `Hash`, `Owner`, `TTL`, `Timestamp`, "
+                    "`TimeExpires`, `Nonce`, `Data`, {0} FROM `Data` WHERE {0} "
+                    "> ? AND {0} <= ? ORDER BY {0};",
+                    pos));
+    if (!get_range_stmt)
+        throw std::runtime_error("could not prepare 'get range' statement");
+
+    // Both are range deletes on the owner index (or the primary key in the
+    // clustered layout)
+    delete_all_stmt = prepare_statement(
+        "DELETE FROM `Data` WHERE `Owner` = ? AND `Timestamp` <= ?;");
+    if (!delete_all_stmt)
+        throw std::runtime_error("could not prepare 'delete all' statement");
+
+    delete_by_hash_stmt = prepare_statement(
+        "DELETE FROM `Data` WHERE `Owner` = ? AND `Hash` = ?;");
+    if (!delete_by_hash_stmt)
+        throw std::runtime_error(
+            "could not prepare 'delete by hash' statement");
+
+    // A later deletion of all messages replaces an earlier one (along with
+    // the request that proves it)
+    add_tombstone_stmt = prepare_statement(
+        "INSERT OR REPLACE INTO `Tombstone` (`Owner`, `Hash`, `Timestamp`, "
+        "`TimeExpires`, `Request`) SELECT ?1, ?2, "
+        "MAX(?3, COALESCE(MAX(`Timestamp`), 0)), "
+        "MAX(?4, COALESCE(MAX(`TimeExpires`), 0)), "
+        "CASE WHEN ?3 >= COALESCE(MAX(`Timestamp`), 0) THEN ?5 "
+        "ELSE `Request` END FROM `Tombstone` WHERE `Owner` = ?1 AND "
+        "`Hash` = ?2;");
+    is_deleted_stmt = prepare_statement(
+        "SELECT `Request` FROM `Tombstone` WHERE `Owner` = ?1 AND "
+        "(`Hash` = ?2 OR (`Hash` = '' AND `Timestamp` >= ?3)) LIMIT 1;");
+    delete_expired_tombstones_stmt = prepare_statement(
+        "DELETE FROM `Tombstone` WHERE `TimeExpires` <= ?;");
+    if (!options_.read_only &&
+        (!add_tombstone_stmt || !is_deleted_stmt ||
+         !delete_expired_tombstones_stmt))
+        throw std::runtime_error("could not prepare tombstone statements");
+
+    get_hashes_after_stmt = prepare_statement(
+        fmt::format("SELECT `Hash`, `Owner`, {0} FROM `Data` WHERE {0} > ? "
+                    "ORDER BY {0} LIMIT ?;",
+                    pos));
+    if (!get_hashes_after_stmt)
+        throw std::runtime_error(
+            "could not prepare 'get hashes after' statement");
+
+    get_log_cursor_stmt = prepare_statement(
+        "SELECT `Position` FROM `LogCursor` WHERE `Peer` = ?;");
+    set_log_cursor_stmt = prepare_statement(
+        "INSERT OR REPLACE INTO `LogCursor` (`Peer`, `Position`) VALUES (?, "
+        "?);");
+    if (!options_.read_only && (!get_log_cursor_stmt || !set_log_cursor_stmt))
+        throw std::runtime_error("could not prepare log cursor statements");
+
+    outbox_add_batch_stmt = prepare_statement(
+        "INSERT INTO `OutboxBatch` (`Data`, `Messages`, `TimeCreated`, "
+        "`TimeExpires`, `Kind`) VALUES (?, ?, ?, ?, ?);");
+    outbox_add_peer_stmt =
+        prepare_statement("INSERT OR IGNORE INTO `OutboxPeer` (`BatchId`, "
+                          "`Peer`) VALUES (?, ?);");
+    outbox_ack_stmt = prepare_statement(
+        "DELETE FROM `OutboxPeer` WHERE `BatchId` = ? AND `Peer` = ?;");
+    outbox_delete_batch_stmt = prepare_statement(
+        "DELETE FROM `OutboxBatch` WHERE `Id` = ?1 AND NOT EXISTS (SELECT 1 "
+        "FROM `OutboxPeer` WHERE `BatchId` = ?1);");
+    outbox_defer_stmt = prepare_statement(
+        "UPDATE `OutboxPeer` SET `Attempts` = ?, `NextAttempt` = ? WHERE "
+        "`BatchId` = ? AND `Peer` = ?;");
+    outbox_get_due_stmt = prepare_statement(
+        "SELECT p.`BatchId`, p.`Peer`, p.`Attempts`, b.`Messages`, b.`Data`, "
+        "b.`Kind` FROM "
+        "`OutboxPeer` p JOIN `OutboxBatch` b ON b.`Id` = p.`BatchId` WHERE "
+        "p.`NextAttempt` > 0 AND p.`NextAttempt` <= ? LIMIT ?;");
+    outbox_drop_peer_stmt =
+        prepare_statement("DELETE FROM `OutboxPeer` WHERE `Peer` = ?;");
+    // Also used to get rid of batches nobody is waiting for
+    outbox_prune_stmt = prepare_statement(
+        "DELETE FROM `OutboxBatch` WHERE `TimeExpires` <= ? OR `Id` NOT IN "
+        "(SELECT `BatchId` FROM `OutboxPeer`);");
+    // Sizes add up from the most recent batch of each peer
+    outbox_trim_stmt = prepare_statement(
+        "DELETE FROM `OutboxPeer` WHERE (`BatchId`, `Peer`) IN (SELECT "
+        "`BatchId`, `Peer` FROM (SELECT p.`BatchId`, p.`Peer`, "
+        "b.`TimeCreated`, SUM(LENGTH(b.`Data`)) OVER (PARTITION BY p.`Peer` "
+        "ORDER BY p.`BatchId` DESC) AS `Total` FROM `OutboxPeer` p JOIN "
+        "`OutboxBatch` b ON b.`Id` = p.`BatchId`) WHERE `TimeCreated` < ? OR "
+        "`Total` > ?);");
+    outbox_lag_stmt = prepare_statement(
+        "SELECT p.`Peer`, COUNT(*), SUM(b.`Messages`), MIN(b.`TimeCreated`) "
+        "FROM `OutboxPeer` p JOIN `OutboxBatch` b ON b.`Id` = p.`BatchId` "
+        "GROUP BY p.`Peer`;");
+    if (!options_.read_only &&
+        (!outbox_add_batch_stmt || !outbox_add_peer_stmt || !outbox_ack_stmt ||
+         !outbox_delete_batch_stmt || !outbox_defer_stmt ||
+         !outbox_get_due_stmt || !outbox_drop_peer_stmt ||
+         !outbox_prune_stmt || !outbox_trim_stmt || !outbox_lag_stmt))
+        throw std::runtime_error("could not prepare outbox statements");
+
+    reserve_positions_stmt = prepare_statement(
+        "INSERT OR REPLACE INTO `PositionMark` (`Id`, `Reserved`) VALUES "
+        "(0, ?);");
+    if (!options_.read_only && !reserve_positions_stmt)
+        throw std::runtime_error(
+            "could not prepare 'reserve positions' statement");
+
+    if (!options_.read_only) {
+        // Anything up to the last reservation may have been handed out
+        // (and deleted since), so carry on past it
+        uint64_t last_position;
+        if (!get_last_position(last_position))
+            throw std::runtime_error("could not read the last position");
+
+        uint64_t reserved = 0;
+        auto cb = [](void* reserved, int argc, char** argv, char**) -> int {
+            if (argc > 0 && argv[0]) {
+                *static_cast<uint64_t*>(reserved) = std::stoull(argv[0]);
+            }
+            return 0;
+        };
+        if (sqlite3_exec(db, "SELECT `Reserved` FROM `PositionMark`;", cb,
+                         &reserved, nullptr) != SQLITE_OK)
+            throw std::runtime_error("could not read the reserved positions");
+        last_position = std::max(last_position, reserved);
+        next_seq_ = last_position + 1;
+        reserved_seq_ = last_position;
+    }
+
+    const auto prepare_ms = ms_since(checkpoint);
+
+    OXEN_LOG(info,
+             "Database ready in {} ms (open: {} ms, schema: {} ms, "
+             "statements: {} ms)",
+             open_ms + schema_ms + prepare_ms, open_ms, schema_ms, prepare_ms);
 }
 
 bool Database::get_message_count(uint64_t& count) {
@@ -349,77 +1088,818 @@ bool Database::retrieve_by_hash(const std::string& msg_hash, Item& item) {
     return success;
 }
 
-bool Database::store(const std::string& hash, const std::string& pubKey,
-                     const std::string& bytes, uint64_t ttl, uint64_t timestamp,
-                     const std::string& nonce,
-                     DuplicateHandling duplicateHandling) {
+bool Database::reserve_positions(uint64_t count) {
 
-    const auto exp_time = timestamp + ttl;
+    if (next_seq_ + count - 1 <= reserved_seq_)
+        return true;
 
-    sqlite3_stmt* stmt = duplicateHandling == DuplicateHandling::IGNORE
-                             ? save_or_ignore_stmt
-                             : save_stmt;
+    const uint64_t reserved = next_seq_ + count - 1 + POSITION_BLOCK_SIZE;
+    uint64_t changed = 0;
+    sqlite3_bind_int64(reserve_positions_stmt, 1, reserved);
+    if (!step_write(db, reserve_positions_stmt, changed))
+        return false;
 
-    // TODO: bind can return errors, handle them
-    sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, pubKey.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 3, ttl);
-    sqlite3_bind_int64(stmt, 4, timestamp);
-    sqlite3_bind_int64(stmt, 5, exp_time);
-    sqlite3_bind_blob(stmt, 6, nonce.data(), nonce.size(), SQLITE_STATIC);
-    sqlite3_bind_blob(stmt, 7, bytes.data(), bytes.size(), SQLITE_STATIC);
+    reserved_seq_ = reserved;
+    return true;
+}
 
-    // keep track of db full errorss so we don't print them on every store
-    static int db_full_counter = 0;
-    // print the error once so many errors
-    constexpr int DB_FULL_FREQUENCY = 100;
+bool Database::get_last_position(uint64_t& position) {
 
-    bool result = false;
+    bool success = false;
     int rc;
     while (true) {
-        rc = sqlite3_step(stmt);
+        rc = sqlite3_step(get_last_position_stmt);
         if (rc == SQLITE_BUSY) {
             continue;
-        } else if (rc == SQLITE_CONSTRAINT) {
+        } else if (rc == SQLITE_DONE) {
+            break;
+        } else if (rc == SQLITE_ROW) {
+            position = sqlite3_column_int64(get_last_position_stmt, 0);
+            success = true;
+        } else {
+            OXEN_LOG(critical,
+                     "Could not execute `get last position` db statement");
             break;
+        }
+    }
+
+    rc = sqlite3_reset(get_last_position_stmt);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+        success = false;
+    }
+
+    // The most recently stored messages may have been deleted; positions
+    // handed out since we started (or reserved before) are never reused
+    position = std::max(position, next_seq_ - 1);
+
+    return success;
+}
+
+bool Database::retrieve_range(uint64_t after, uint64_t up_to,
+                              size_t max_bytes, std::vector<Item>& items,
+                              uint64_t& last) {
+
+    sqlite3_bind_int64(get_range_stmt, 1, after);
+    sqlite3_bind_int64(get_range_stmt, 2, up_to);
+
+    last = after;
+    size_t total_bytes = 0;
+
+    bool success = false;
+    while (true) {
+        int rc = sqlite3_step(get_range_stmt);
+        if (rc == SQLITE_BUSY) {
+            continue;
         } else if (rc == SQLITE_DONE) {
-            result = true;
+            success = true;
             break;
-        } else if (rc == SQLITE_FULL) {
-            if (db_full_counter % DB_FULL_FREQUENCY == 0) {
-                OXEN_LOG(error, "Failed to store message: database is full");
-                ++db_full_counter;
+        } else if (rc == SQLITE_ROW) {
+            items.push_back(extract_item(get_range_stmt));
+            last = sqlite3_column_int64(get_range_stmt, 7);
+            total_bytes += items.back().data.size();
+            if (total_bytes >= max_bytes) {
+                success = true;
+                break;
             }
-            break;
         } else {
-            OXEN_LOG(critical, "Could not execute `store` db statement, ec: {}",
+            OXEN_LOG(critical,
+                     "Could not execute `retrieve range` db statement, ec: {}",
                      rc);
             break;
         }
     }
 
-    rc = sqlite3_reset(stmt);
-    if (rc != SQLITE_OK && rc != SQLITE_CONSTRAINT && rc != SQLITE_FULL) {
+    int rc = sqlite3_reset(get_range_stmt);
+    if (rc != SQLITE_OK) {
         OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
                  sqlite3_errmsg(db));
+        success = false;
     }
-    return result;
+    return success;
 }
 
-bool Database::bulk_store(const std::vector<Item>& items) {
+bool Database::add_tombstone(const std::string& pubkey, std::string_view hash,
+                             uint64_t timestamp, uint64_t expiration,
+                             std::string_view request) {
+
+    uint64_t changed = 0;
+    sqlite3_bind_text(add_tombstone_stmt, 1, pubkey.c_str(), -1,
+                      SQLITE_STATIC);
+    sqlite3_bind_text(add_tombstone_stmt, 2, hash.data(), hash.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(add_tombstone_stmt, 3, timestamp);
+    sqlite3_bind_int64(add_tombstone_stmt, 4, expiration);
+    sqlite3_bind_blob(add_tombstone_stmt, 5, request.data(), request.size(),
+                      SQLITE_STATIC);
+    return step_write(db, add_tombstone_stmt, changed);
+}
+
+bool Database::delete_all(const std::string& pubkey, uint64_t timestamp,
+                          std::string_view request, uint64_t& deleted) {
     char* errmsg = 0;
     if (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, &errmsg) !=
         SQLITE_OK) {
         return false;
     }
 
-    try {
-        for (const auto& item : items) {
-            store(item.hash, item.pub_key, item.data, item.ttl, item.timestamp,
-                  item.nonce, DuplicateHandling::IGNORE);
+    sqlite3_bind_text(delete_all_stmt, 1, pubkey.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(delete_all_stmt, 2, timestamp);
+
+    deleted = 0;
+    const bool success =
+        step_write(db, delete_all_stmt, deleted) &&
+        add_tombstone(pubkey, "", timestamp, timestamp + TOMBSTONE_LIFETIME_MS,
+                      request);
+
+    if (sqlite3_exec(db, success ? "END TRANSACTION;" : "ROLLBACK;", NULL,
+                     NULL, &errmsg) != SQLITE_OK)
+        return false;
+
+    return success;
+}
+
+bool Database::delete_by_hash(const std::string& pubkey,
+                              const std::vector<std::string>& hashes,
+                              std::string_view request, uint64_t& deleted) {
+    char* errmsg = 0;
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, &errmsg) !=
+        SQLITE_OK) {
+        return false;
+    }
+
+    const uint64_t now = util::get_time_ms();
+
+    deleted = 0;
+    bool success = true;
+    for (const auto& hash : hashes) {
+        sqlite3_bind_text(delete_by_hash_stmt, 1, pubkey.c_str(), -1,
+                          SQLITE_STATIC);
+        sqlite3_bind_text(delete_by_hash_stmt, 2, hash.c_str(), -1,
+                          SQLITE_STATIC);
+        // Messages we don't have (yet) are remembered as deleted too
+        if (!step_write(db, delete_by_hash_stmt, deleted) ||
+            !add_tombstone(pubkey, hash, now, now + TOMBSTONE_LIFETIME_MS,
+                           request)) {
+            success = false;
+            break;
+        }
+    }
+
+    if (sqlite3_exec(db, success ? "END TRANSACTION;" : "ROLLBACK;", NULL,
+                     NULL, &errmsg) != SQLITE_OK)
+        return false;
+
+    return success;
+}
+
+bool Database::is_deleted(std::string_view pubkey, std::string_view hash,
+                          uint64_t timestamp, bool& deleted,
+                          std::string* request) {
+
+    sqlite3_bind_text(is_deleted_stmt, 1, pubkey.data(), pubkey.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_text(is_deleted_stmt, 2, hash.data(), hash.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(is_deleted_stmt, 3, timestamp);
+
+    deleted = false;
+
+    int rc;
+    while ((rc = sqlite3_step(is_deleted_stmt)) == SQLITE_BUSY) {
+    }
+    bool success = true;
+    if (rc == SQLITE_ROW) {
+        deleted = true;
+        if (request) {
+            const auto data = static_cast<const char*>(
+                sqlite3_column_blob(is_deleted_stmt, 0));
+            const int size = sqlite3_column_bytes(is_deleted_stmt, 0);
+            request->assign(data ? data : "", size);
+        }
+    } else if (rc != SQLITE_DONE) {
+        OXEN_LOG(critical,
+                 "Could not execute `is deleted` db statement, ec: {}", rc);
+        success = false;
+    }
+
+    rc = sqlite3_reset(is_deleted_stmt);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+        success = false;
+    }
+
+    return success;
+}
+
+bool Database::get_hashes_after(
+    uint64_t after, int limit,
+    std::vector<std::pair<std::string, std::string>>& entries,
+    uint64_t& last) {
+
+    sqlite3_bind_int64(get_hashes_after_stmt, 1, after);
+    sqlite3_bind_int(get_hashes_after_stmt, 2, limit);
+
+    last = after;
+
+    bool success = false;
+    while (true) {
+        int rc = sqlite3_step(get_hashes_after_stmt);
+        if (rc == SQLITE_BUSY) {
+            continue;
+        } else if (rc == SQLITE_DONE) {
+            success = true;
+            break;
+        } else if (rc == SQLITE_ROW) {
+            entries.emplace_back(
+                reinterpret_cast<const char*>(
+                    sqlite3_column_text(get_hashes_after_stmt, 0)),
+                reinterpret_cast<const char*>(
+                    sqlite3_column_text(get_hashes_after_stmt, 1)));
+            last = sqlite3_column_int64(get_hashes_after_stmt, 2);
+        } else {
+            OXEN_LOG(critical,
+                     "Could not execute `get hashes after` db statement, ec: "
+                     "{}",
+                     rc);
+            break;
+        }
+    }
+
+    int rc = sqlite3_reset(get_hashes_after_stmt);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+        success = false;
+    }
+
+    return success;
+}
+
+bool Database::get_missing_hashes(const std::vector<std::string>& hashes,
+                                  std::vector<std::string>& missing) {
+
+    std::unordered_set<std::string> found;
+
+    for (size_t begin = 0; begin < hashes.size();
+         begin += MISSING_HASHES_PER_QUERY) {
+        const size_t count =
+            std::min(MISSING_HASHES_PER_QUERY, hashes.size() - begin);
+
+        std::string query = "SELECT `Hash` FROM `Data` WHERE `Hash` IN (?";
+        for (size_t i = 1; i < count; ++i) {
+            query += ",?";
+        }
+        query += ");";
+
+        // Like `for_each_hash`, on the scan connection
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(scan_db, query.c_str(), -1, &stmt, nullptr) !=
+            SQLITE_OK) {
+            OXEN_LOG(critical, "Could not prepare `has hashes` statement: {}",
+                     sqlite3_errmsg(scan_db));
+            return false;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const auto& hash = hashes[begin + i];
+            sqlite3_bind_text(stmt, i + 1, hash.data(), hash.size(),
+                              SQLITE_STATIC);
+        }
+
+        bool success = false;
+        while (true) {
+            const int rc = sqlite3_step(stmt);
+            if (rc == SQLITE_BUSY) {
+                continue;
+            } else if (rc == SQLITE_DONE) {
+                success = true;
+                break;
+            } else if (rc == SQLITE_ROW) {
+                found.emplace(reinterpret_cast<const char*>(
+                                  sqlite3_column_text(stmt, 0)),
+                              sqlite3_column_bytes(stmt, 0));
+            } else {
+                OXEN_LOG(critical,
+                         "Could not execute `has hashes` db statement, ec: {}",
+                         rc);
+                break;
+            }
+        }
+
+        sqlite3_finalize(stmt);
+        if (!success) {
+            return false;
+        }
+    }
+
+    for (const auto& hash : hashes) {
+        if (!found.count(hash)) {
+            missing.push_back(hash);
+        }
+    }
+
+    return true;
+}
+
+bool Database::get_log_cursor(std::string_view peer,
+                              std::optional<uint64_t>& position) {
+
+    sqlite3_bind_blob(get_log_cursor_stmt, 1, peer.data(), peer.size(),
+                      SQLITE_STATIC);
+
+    position = std::nullopt;
+
+    bool success = false;
+    while (true) {
+        int rc = sqlite3_step(get_log_cursor_stmt);
+        if (rc == SQLITE_BUSY) {
+            continue;
+        } else if (rc == SQLITE_DONE) {
+            success = true;
+            break;
+        } else if (rc == SQLITE_ROW) {
+            position = sqlite3_column_int64(get_log_cursor_stmt, 0);
+        } else {
+            OXEN_LOG(critical,
+                     "Could not execute `get log cursor` db statement, ec: {}",
+                     rc);
+            break;
+        }
+    }
+
+    int rc = sqlite3_reset(get_log_cursor_stmt);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+        success = false;
+    }
+
+    return success;
+}
+
+bool Database::set_log_cursor(std::string_view peer, uint64_t position) {
+
+    uint64_t changed = 0;
+    sqlite3_bind_blob(set_log_cursor_stmt, 1, peer.data(), peer.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(set_log_cursor_stmt, 2, position);
+    return step_write(db, set_log_cursor_stmt, changed);
+}
+
+bool Database::for_each_hash(
+    uint64_t begin, uint64_t end, uint64_t now,
+    const std::function<void(std::string_view, uint64_t)>& f) {
+
+    const char* query =
+        "SELECT `Hash`, `Timestamp` FROM `Data` WHERE `Timestamp` >= ? AND "
+        "`Timestamp` < ? AND `TimeExpires` > ? ORDER BY `Timestamp`;";
+
+    // Scans may run concurrently, so each has its own statement
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(scan_db, query, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "Could not prepare `get hashes` statement: {}",
+                 sqlite3_errmsg(scan_db));
+        return false;
+    }
+
+    // Read a slice at a time, the read lock being released in between so
+    // that writers don't wait for the whole scan
+    bool success = true;
+    uint64_t from = begin;
+    while (success && from < end) {
+        const uint64_t to = from + std::min(HASH_SCAN_SLICE_MS, end - from);
+        sqlite3_bind_int64(stmt, 1, from);
+        sqlite3_bind_int64(stmt, 2, to);
+        sqlite3_bind_int64(stmt, 3, now);
+        from = to;
+
+        success = false;
+        while (true) {
+            rc = sqlite3_step(stmt);
+            if (rc == SQLITE_BUSY) {
+                continue;
+            } else if (rc == SQLITE_DONE) {
+                success = true;
+                break;
+            } else if (rc == SQLITE_ROW) {
+                const std::string_view hash(
+                    reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                    sqlite3_column_bytes(stmt, 0));
+                f(hash, sqlite3_column_int64(stmt, 1));
+            } else {
+                OXEN_LOG(critical,
+                         "Could not execute `get hashes` db statement, ec: {}",
+                         rc);
+                break;
+            }
+        }
+
+        rc = sqlite3_reset(stmt);
+        if (rc != SQLITE_OK) {
+            OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                     sqlite3_errmsg(scan_db));
+            success = false;
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+bool Database::outbox_add(std::string_view batch, uint32_t messages,
+                          uint64_t expiration,
+                          const std::vector<std::string>& peers,
+                          uint64_t& batch_id, OutboxKind kind) {
+    char* errmsg = 0;
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, &errmsg) !=
+        SQLITE_OK) {
+        return false;
+    }
+
+    uint64_t changed = 0;
+    sqlite3_bind_blob(outbox_add_batch_stmt, 1, batch.data(), batch.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int(outbox_add_batch_stmt, 2, messages);
+    sqlite3_bind_int64(outbox_add_batch_stmt, 3, util::get_time_ms());
+    sqlite3_bind_int64(outbox_add_batch_stmt, 4, expiration);
+    sqlite3_bind_int(outbox_add_batch_stmt, 5, static_cast<int>(kind));
+    bool success = step_write(db, outbox_add_batch_stmt, changed);
+    batch_id = sqlite3_last_insert_rowid(db);
+
+    for (size_t i = 0; success && i < peers.size(); ++i) {
+        sqlite3_bind_int64(outbox_add_peer_stmt, 1, batch_id);
+        sqlite3_bind_blob(outbox_add_peer_stmt, 2, peers[i].data(),
+                          peers[i].size(), SQLITE_STATIC);
+        success = step_write(db, outbox_add_peer_stmt, changed);
+    }
+
+    if (sqlite3_exec(db, success ? "END TRANSACTION;" : "ROLLBACK;", NULL,
+                     NULL, &errmsg) != SQLITE_OK)
+        return false;
+
+    return success;
+}
+
+bool Database::outbox_ack(uint64_t batch_id, std::string_view peer) {
+
+    uint64_t changed = 0;
+    sqlite3_bind_int64(outbox_ack_stmt, 1, batch_id);
+    sqlite3_bind_blob(outbox_ack_stmt, 2, peer.data(), peer.size(),
+                      SQLITE_STATIC);
+    if (!step_write(db, outbox_ack_stmt, changed))
+        return false;
+
+    // Only deleted once acknowledged by all peers
+    sqlite3_bind_int64(outbox_delete_batch_stmt, 1, batch_id);
+    return step_write(db, outbox_delete_batch_stmt, changed);
+}
+
+bool Database::outbox_defer(uint64_t batch_id, std::string_view peer,
+                            uint32_t attempts, uint64_t next_attempt) {
+
+    uint64_t changed = 0;
+    sqlite3_bind_int(outbox_defer_stmt, 1, attempts);
+    sqlite3_bind_int64(outbox_defer_stmt, 2, next_attempt);
+    sqlite3_bind_int64(outbox_defer_stmt, 3, batch_id);
+    sqlite3_bind_blob(outbox_defer_stmt, 4, peer.data(), peer.size(),
+                      SQLITE_STATIC);
+    return step_write(db, outbox_defer_stmt, changed);
+}
+
+bool Database::outbox_record(const std::vector<OutboxResult>& results) {
+
+    if (results.empty())
+        return true;
+
+    char* errmsg = 0;
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, &errmsg) !=
+        SQLITE_OK) {
+        return false;
+    }
+
+    bool success = true;
+    for (size_t i = 0; success && i < results.size(); ++i) {
+        const auto& result = results[i];
+        success = result.acked
+                      ? outbox_ack(result.batch_id, result.peer)
+                      : outbox_defer(result.batch_id, result.peer,
+                                     result.attempts, result.next_attempt);
+    }
+
+    if (sqlite3_exec(db, success ? "END TRANSACTION;" : "ROLLBACK;", NULL,
+                     NULL, &errmsg) != SQLITE_OK)
+        return false;
+
+    return success;
+}
+
+bool Database::outbox_take_due(uint64_t now, int limit,
+                               std::vector<OutboxItem>& items) {
+
+    sqlite3_bind_int64(outbox_get_due_stmt, 1, now);
+    sqlite3_bind_int(outbox_get_due_stmt, 2, limit);
+
+    const size_t first = items.size();
+
+    bool success = false;
+    while (true) {
+        int rc = sqlite3_step(outbox_get_due_stmt);
+        if (rc == SQLITE_BUSY) {
+            continue;
+        } else if (rc == SQLITE_DONE) {
+            success = true;
+            break;
+        } else if (rc == SQLITE_ROW) {
+            OutboxItem item;
+            item.batch_id = sqlite3_column_int64(outbox_get_due_stmt, 0);
+            item.peer = std::string(
+                static_cast<const char*>(
+                    sqlite3_column_blob(outbox_get_due_stmt, 1)),
+                sqlite3_column_bytes(outbox_get_due_stmt, 1));
+            item.attempts = sqlite3_column_int(outbox_get_due_stmt, 2);
+            item.messages = sqlite3_column_int(outbox_get_due_stmt, 3);
+            item.data = std::string(
+                static_cast<const char*>(
+                    sqlite3_column_blob(outbox_get_due_stmt, 4)),
+                sqlite3_column_bytes(outbox_get_due_stmt, 4));
+            item.kind = static_cast<OutboxKind>(
+                sqlite3_column_int(outbox_get_due_stmt, 5));
+            items.push_back(std::move(item));
+        } else {
+            OXEN_LOG(critical,
+                     "Could not execute `outbox due` db statement, ec: {}", rc);
+            break;
+        }
+    }
+
+    int rc = sqlite3_reset(outbox_get_due_stmt);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+        success = false;
+    }
+
+    if (!success || items.size() == first)
+        return success;
+
+    // Mark them as being sent
+    std::vector<OutboxResult> sending;
+    sending.reserve(items.size() - first);
+    for (size_t i = first; i < items.size(); ++i) {
+        sending.push_back(
+            {items[i].batch_id, items[i].peer, false, items[i].attempts, 0});
+    }
+    return outbox_record(sending);
+}
+
+bool Database::outbox_drop_peer(std::string_view peer) {
+
+    uint64_t changed = 0;
+    sqlite3_bind_blob(outbox_drop_peer_stmt, 1, peer.data(), peer.size(),
+                      SQLITE_STATIC);
+    return step_write(db, outbox_drop_peer_stmt, changed) &&
+           outbox_prune(0);
+}
+
+bool Database::outbox_prune(uint64_t now) {
+
+    uint64_t changed = 0;
+    sqlite3_bind_int64(outbox_prune_stmt, 1, now);
+    if (!step_write(db, outbox_prune_stmt, changed))
+        return false;
+
+    if (changed > 0) {
+        OXEN_LOG(debug, "Pruned {} batches from the outbox", changed);
+    }
+
+    // Entries of the pruned batches
+    return exec(db, "DELETE FROM `OutboxPeer` WHERE `BatchId` NOT IN "
+                    "(SELECT `Id` FROM `OutboxBatch`);");
+}
+
+bool Database::outbox_trim(uint64_t created_before, uint64_t max_peer_bytes,
+                           uint64_t& dropped) {
+
+    dropped = 0;
+    sqlite3_bind_int64(outbox_trim_stmt, 1, created_before);
+    sqlite3_bind_int64(outbox_trim_stmt, 2, max_peer_bytes);
+    return step_write(db, outbox_trim_stmt, dropped);
+}
+
+bool Database::outbox_get_lag(std::vector<OutboxLag>& lag) {
+
+    bool success = false;
+    while (true) {
+        int rc = sqlite3_step(outbox_lag_stmt);
+        if (rc == SQLITE_BUSY) {
+            continue;
+        } else if (rc == SQLITE_DONE) {
+            success = true;
+            break;
+        } else if (rc == SQLITE_ROW) {
+            OutboxLag entry;
+            entry.peer = std::string(
+                static_cast<const char*>(sqlite3_column_blob(outbox_lag_stmt, 0)),
+                sqlite3_column_bytes(outbox_lag_stmt, 0));
+            entry.batches = sqlite3_column_int64(outbox_lag_stmt, 1);
+            entry.messages = sqlite3_column_int64(outbox_lag_stmt, 2);
+            entry.oldest = sqlite3_column_int64(outbox_lag_stmt, 3);
+            lag.push_back(std::move(entry));
+        } else {
+            OXEN_LOG(critical,
+                     "Could not execute `outbox lag` db statement, ec: {}", rc);
+            break;
+        }
+    }
+
+    int rc = sqlite3_reset(outbox_lag_stmt);
+    if (rc != SQLITE_OK) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+        success = false;
+    }
+
+    return success;
+}
+
+bool Database::get_cache_stats(uint64_t& hits, uint64_t& misses) {
+
+    int cur, highwater;
+
+    // Counters are reset on every read and accumulated on our side
+    if (sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &cur, &highwater,
+                          1) != SQLITE_OK) {
+        return false;
+    }
+    hits = cache_hits_ += cur;
+
+    if (sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &cur, &highwater,
+                          1) != SQLITE_OK) {
+        return false;
+    }
+    misses = cache_misses_ += cur;
+
+    return true;
+}
+
+bool Database::get_memory_used(uint64_t& bytes) {
+
+    bytes = 0;
+    for (const int op : {SQLITE_DBSTATUS_CACHE_USED,
+                         SQLITE_DBSTATUS_SCHEMA_USED,
+                         SQLITE_DBSTATUS_STMT_USED}) {
+        int cur, highwater;
+        if (sqlite3_db_status(db, op, &cur, &highwater, 0) != SQLITE_OK) {
+            return false;
+        }
+        bytes += cur;
+    }
+
+    return true;
+}
+
+uint64_t Database::get_warmup_progress(bool& done) const {
+    done = warmup_done_;
+    return warmup_entries_;
+}
+
+bool Database::store(std::string_view hash, std::string_view pubKey,
+                     std::string_view bytes, uint64_t ttl, uint64_t timestamp,
+                     std::string_view nonce,
+                     DuplicateHandling duplicateHandling) {
+
+    const auto exp_time = timestamp + ttl;
+
+    if (!reserve_positions(1))
+        return false;
+
+    sqlite3_stmt* stmt = duplicateHandling == DuplicateHandling::IGNORE
+                             ? save_or_ignore_stmt
+                             : save_stmt;
+
+    // TODO: bind can return errors, handle them
+    sqlite3_bind_text(stmt, 1, hash.data(), hash.size(), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, pubKey.data(), pubKey.size(), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, ttl);
+    sqlite3_bind_int64(stmt, 4, timestamp);
+    sqlite3_bind_int64(stmt, 5, exp_time);
+    sqlite3_bind_blob(stmt, 6, nonce.data(), nonce.size(), SQLITE_STATIC);
+    sqlite3_bind_blob(stmt, 7, bytes.data(), bytes.size(), SQLITE_STATIC);
+    // Gaps left by duplicates are fine, positions only need to increase
+    sqlite3_bind_int64(stmt, 8, next_seq_++);
+
+    // keep track of db full errorss so we don't print them on every store
+    static int db_full_counter = 0;
+    // print the error once so many errors
+    constexpr int DB_FULL_FREQUENCY = 100;
+
+    bool result = false;
+    int rc;
+    while (true) {
+        rc = sqlite3_step(stmt);
+        if (rc == SQLITE_BUSY) {
+            continue;
+        } else if (rc == SQLITE_CONSTRAINT) {
+            break;
+        } else if (rc == SQLITE_DONE) {
+            result = true;
+            break;
+        } else if (rc == SQLITE_FULL) {
+            if (db_full_counter % DB_FULL_FREQUENCY == 0) {
+                OXEN_LOG(error, "Failed to store message: database is full");
+                ++db_full_counter;
+            }
+            break;
+        } else {
+            OXEN_LOG(critical, "Could not execute `store` db statement, ec: {}",
+                     rc);
+            break;
+        }
+    }
+
+    rc = sqlite3_reset(stmt);
+    if (rc != SQLITE_OK && rc != SQLITE_CONSTRAINT && rc != SQLITE_FULL) {
+        OXEN_LOG(critical, "sqlite reset error: [{}], {}", rc,
+                 sqlite3_errmsg(db));
+    }
+    return result;
+}
+
+bool Database::bulk_store(const std::vector<Item>& items) {
+
+    std::vector<ItemView> views;
+    views.reserve(items.size());
+    for (const auto& item : items) {
+        views.push_back({item.hash, item.pub_key, item.timestamp, item.ttl,
+                         item.expiration_timestamp, item.nonce, item.data});
+    }
+
+    return bulk_store(views);
+}
+
+bool Database::bulk_store(const std::vector<ItemView>& items) {
+    uint64_t stored;
+    return bulk_store(items, stored);
+}
+
+bool Database::bulk_store(const std::vector<ItemView>& items,
+                          uint64_t& stored) {
+    stored = 0;
+
+    // Outside of the transaction, so that the reservation can't be rolled
+    // back with it
+    if (!reserve_positions(items.size()))
+        return false;
+
+    char* errmsg = 0;
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, &errmsg) !=
+        SQLITE_OK) {
+        return false;
+    }
+
+    // Messages relayed, fetched or bootstrapped from other nodes may have
+    // been deleted by their owner in the meantime, which the statement
+    // checks. Duplicates are ignored, which leaves no changes.
+    for (size_t begin = 0; begin < items.size(); begin += BULK_INSERT_ROWS) {
+        const size_t rows = std::min(BULK_INSERT_ROWS, items.size() - begin);
+        sqlite3_stmt* stmt =
+            rows == BULK_INSERT_ROWS
+                ? bulk_save_stmt
+                : prepare_statement(bulk_insert_query(clustered_, rows));
+        if (!stmt) {
+            break;
+        }
+
+        int param = 1;
+        for (size_t i = begin; i < begin + rows; ++i) {
+            const auto& item = items[i];
+            sqlite3_bind_text(stmt, param++, item.hash.data(),
+                              item.hash.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, param++, item.pub_key.data(),
+                              item.pub_key.size(), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, param++, item.ttl);
+            sqlite3_bind_int64(stmt, param++, item.timestamp);
+            sqlite3_bind_int64(stmt, param++, item.timestamp + item.ttl);
+            sqlite3_bind_blob(stmt, param++, item.nonce.data(),
+                              item.nonce.size(), SQLITE_STATIC);
+            sqlite3_bind_blob(stmt, param++, item.data.data(),
+                              item.data.size(), SQLITE_STATIC);
+            // Gaps left by duplicates are fine, positions only need to
+            // increase
+            sqlite3_bind_int64(stmt, param++, next_seq_++);
+        }
+
+        const bool success = step_write(db, stmt, stored);
+        if (stmt != bulk_save_stmt) {
+            sqlite3_finalize(stmt);
+        }
+        if (!success) {
+            OXEN_LOG(error, "Failed to store {} messages", rows);
         }
-    } catch (...) {
-        fprintf(stderr, "Failed to store items during bulk operation");
     }
 
     if (sqlite3_exec(db, "END TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK)
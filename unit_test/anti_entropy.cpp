@@ -0,0 +1,93 @@
+#include "anti_entropy.h"
+#include "serialization.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace oxen;
+
+BOOST_AUTO_TEST_SUITE(anti_entropy)
+
+BOOST_AUTO_TEST_CASE(it_summarises_messages_by_bucket) {
+
+    const uint64_t t0 = 5 * DIGEST_BUCKET_MS;
+
+    digest_builder_t a;
+    a.add("hash1", t0);
+    a.add("hash2", t0 + 1);
+    a.add("hash3", t0 + DIGEST_BUCKET_MS);
+
+    // Same messages in a different order
+    digest_builder_t b;
+    b.add("hash3", t0 + DIGEST_BUCKET_MS);
+    b.add("hash2", t0 + 1);
+    b.add("hash1", t0);
+
+    const auto digests = a.digests();
+    BOOST_REQUIRE_EQUAL(digests.size(), 2);
+    BOOST_CHECK_EQUAL(digests[0].start, t0);
+    BOOST_CHECK_EQUAL(digests[0].count, 2);
+    BOOST_CHECK_EQUAL(digests[1].start, t0 + DIGEST_BUCKET_MS);
+    BOOST_CHECK(differing_buckets(digests, b.digests()).empty());
+
+    // A missing message, and a bucket only one side has
+    b.add("hash4", t0 + DIGEST_BUCKET_MS + 1);
+    b.add("hash5", t0 + 3 * DIGEST_BUCKET_MS);
+    const std::vector<uint64_t> expected{t0 + DIGEST_BUCKET_MS,
+                                         t0 + 3 * DIGEST_BUCKET_MS};
+    BOOST_CHECK(differing_buckets(digests, b.digests()) == expected);
+    BOOST_CHECK(differing_buckets(b.digests(), digests) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(it_collects_hashes_of_differing_buckets) {
+
+    const uint64_t t0 = 5 * DIGEST_BUCKET_MS;
+    const std::vector<uint64_t> buckets{t0, t0 + 2 * DIGEST_BUCKET_MS,
+                                        t0 + 3 * DIGEST_BUCKET_MS};
+
+    bucket_hashes_t all(buckets, 100);
+    all.add("hash1", t0);
+    all.add("hash2", t0 + DIGEST_BUCKET_MS);
+    all.add("hash3", t0 + 2 * DIGEST_BUCKET_MS);
+    BOOST_CHECK(all.buckets() == buckets);
+    // Only those in the buckets
+    BOOST_REQUIRE_EQUAL(all.hashes().size(), 2);
+    BOOST_CHECK_EQUAL(all.hashes()[hash_fingerprint("hash3")], "hash3");
+
+    // Stops at the limit, and drops the buckets it didn't get to
+    bucket_hashes_t limited(buckets, 2);
+    limited.add("hash1", t0);
+    limited.add("hash3", t0 + 2 * DIGEST_BUCKET_MS);
+    limited.add("hash4", t0 + 2 * DIGEST_BUCKET_MS + 1);
+    limited.add("hash5", t0 + 3 * DIGEST_BUCKET_MS);
+    BOOST_CHECK_EQUAL(limited.hashes().size(), 2);
+    const std::vector<uint64_t> expected{t0, t0 + 2 * DIGEST_BUCKET_MS};
+    BOOST_CHECK(limited.buckets() == expected);
+}
+
+BOOST_AUTO_TEST_CASE(it_serializes_digests) {
+
+    digest_builder_t builder;
+    builder.add("hash1", 1000);
+    builder.add("hash2", 2 * DIGEST_BUCKET_MS);
+    const auto digests = builder.digests();
+
+    std::vector<bucket_digest_t> res;
+    BOOST_REQUIRE(deserialize_digests(serialize_digests(digests), res));
+    BOOST_REQUIRE_EQUAL(res.size(), digests.size());
+    BOOST_CHECK(differing_buckets(res, digests).empty());
+
+    const std::vector<uint64_t> values{1, hash_fingerprint("hash1"), 0};
+    std::vector<uint64_t> values_res;
+    BOOST_REQUIRE(deserialize_integers(serialize_integers(values), values_res));
+    BOOST_CHECK(values_res == values);
+
+    // Truncated
+    const auto blob = serialize_integers(values);
+    BOOST_CHECK(!deserialize_integers(blob.substr(1), values_res));
+    BOOST_CHECK(!deserialize_digests(blob.substr(1), res));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,310 @@
+#include "channel_encryption.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <sispopmq/hex.h>
+#include <sodium.h>
+
+#include <string>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(channel_encryption)
+
+struct key_pair_t {
+    std::vector<uint8_t> private_key;
+    /// In hex, as clients send it
+    std::string public_key;
+};
+
+static key_pair_t make_key_pair() {
+    key_pair_t keys;
+    keys.private_key.resize(crypto_scalarmult_SCALARBYTES);
+    randombytes_buf(keys.private_key.data(), keys.private_key.size());
+
+    std::vector<uint8_t> public_key(crypto_scalarmult_BYTES);
+    crypto_scalarmult_base(public_key.data(), keys.private_key.data());
+    keys.public_key = sispopmq::to_hex(public_key.begin(), public_key.end());
+    return keys;
+}
+
+BOOST_AUTO_TEST_CASE(it_round_trips_between_peers) {
+
+    const auto server_keys = make_key_pair();
+    const auto client_keys = make_key_pair();
+    const ChannelEncryption<std::string> server(server_keys.private_key);
+    const ChannelEncryption<std::string> client(client_keys.private_key);
+
+    const std::string plaintext = "{\"method\":\"retrieve\"}";
+
+    // Repeated, so that later ones use the cached keys
+    for (int i = 0; i < 3; ++i) {
+        const auto gcm = client.encrypt_gcm(plaintext, server_keys.public_key);
+        BOOST_CHECK_EQUAL(server.decrypt_gcm(gcm, client_keys.public_key),
+                          plaintext);
+
+        const auto cbc = server.encrypt_cbc(plaintext, client_keys.public_key);
+        BOOST_CHECK_EQUAL(client.decrypt_cbc(cbc, server_keys.public_key),
+                          plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_caches_keys_of_recent_peers) {
+
+    const auto server_keys = make_key_pair();
+    const auto client_keys = make_key_pair();
+    const ChannelEncryption<std::string> server(server_keys.private_key);
+    const ChannelEncryption<std::string> client(client_keys.private_key);
+
+    const auto ciphertext = client.encrypt_gcm("hello", server_keys.public_key);
+    server.decrypt_gcm(ciphertext, client_keys.public_key);
+    // The reply to the same client
+    server.encrypt_gcm("world", client_keys.public_key);
+
+    const auto stats = server.key_cache_stats();
+    BOOST_CHECK_EQUAL(stats.size, 1);
+    BOOST_CHECK_EQUAL(stats.misses, 1);
+    BOOST_CHECK_EQUAL(stats.hits, 1);
+}
+
+BOOST_AUTO_TEST_CASE(it_evicts_least_recently_used_peers) {
+
+    using channel_t = ChannelEncryption<std::string>;
+    constexpr size_t cache_size = channel_t::KEY_CACHE_SIZE;
+
+    const auto server_keys = make_key_pair();
+    const ChannelEncryption<std::string> server(server_keys.private_key);
+
+    std::vector<key_pair_t> clients;
+    for (size_t i = 0; i < cache_size + 10; ++i) {
+        clients.push_back(make_key_pair());
+    }
+
+    const std::string plaintext = "hello";
+    const auto exchange = [&](const key_pair_t& keys) {
+        const ChannelEncryption<std::string> client(keys.private_key);
+        const auto ciphertext =
+            client.encrypt_gcm(plaintext, server_keys.public_key);
+        BOOST_CHECK_EQUAL(server.decrypt_gcm(ciphertext, keys.public_key),
+                          plaintext);
+    };
+
+    for (const auto& keys : clients) {
+        exchange(keys);
+    }
+
+    auto stats = server.key_cache_stats();
+    BOOST_CHECK_EQUAL(stats.size, cache_size);
+    BOOST_CHECK_EQUAL(stats.misses, clients.size());
+    BOOST_CHECK_EQUAL(stats.hits, 0);
+
+    // The most recent client is still cached
+    exchange(clients.back());
+    stats = server.key_cache_stats();
+    BOOST_CHECK_EQUAL(stats.hits, 1);
+
+    // The first one has been evicted, and has to be derived again
+    exchange(clients.front());
+    stats = server.key_cache_stats();
+    BOOST_CHECK_EQUAL(stats.hits, 1);
+    BOOST_CHECK_EQUAL(stats.misses, clients.size() + 1);
+    BOOST_CHECK_EQUAL(stats.size, cache_size);
+}
+
+BOOST_AUTO_TEST_CASE(it_encrypts_into_caller_buffers) {
+
+    using channel_t = ChannelEncryption<std::string>;
+
+    const auto server_keys = make_key_pair();
+    const auto client_keys = make_key_pair();
+    const channel_t server(server_keys.private_key);
+    const channel_t client(client_keys.private_key);
+    const auto server_pubkey = x25519_key_from_hex(server_keys.public_key);
+    const auto client_pubkey = x25519_key_from_hex(client_keys.public_key);
+
+    // Around the CBC block size, where padding changes
+    for (const size_t size : {0, 1, 15, 16, 17, 1000}) {
+        const std::string plaintext(size, 'x');
+
+        std::string gcm(channel_t::gcm_encrypted_size(size), '\0');
+        client.encrypt_gcm(plaintext, server_pubkey, gcm.data());
+        // Readable by the functions that return strings
+        BOOST_CHECK_EQUAL(server.decrypt_gcm(gcm, client_keys.public_key),
+                          plaintext);
+
+        std::string decrypted(channel_t::gcm_decrypted_size(gcm.size()), '\0');
+        BOOST_CHECK_EQUAL(
+            server.decrypt_gcm(gcm, client_pubkey, decrypted.data()), size);
+        BOOST_CHECK_EQUAL(decrypted, plaintext);
+
+        std::string cbc(channel_t::cbc_encrypted_size(size), '\0');
+        client.encrypt_cbc(plaintext, server_pubkey, cbc.data());
+        BOOST_CHECK_EQUAL(server.decrypt_cbc(cbc, client_keys.public_key),
+                          plaintext);
+
+        decrypted.assign(channel_t::cbc_decrypted_max_size(cbc.size()), '\0');
+        decrypted.resize(
+            server.decrypt_cbc(cbc, client_pubkey, decrypted.data()));
+        BOOST_CHECK_EQUAL(decrypted, plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_decrypts_in_place) {
+
+    const auto server_keys = make_key_pair();
+    const auto client_keys = make_key_pair();
+    const ChannelEncryption<std::string> server(server_keys.private_key);
+    const ChannelEncryption<std::string> client(client_keys.private_key);
+    const auto client_pubkey = x25519_key_from_hex(client_keys.public_key);
+
+    const std::string plaintext = "{\"body\":\"an onion request\"}";
+
+    auto gcm = client.encrypt_gcm(plaintext, server_keys.public_key);
+    BOOST_CHECK_EQUAL(
+        server.decrypt_gcm_in_place(gcm.data(), gcm.size(), client_pubkey),
+        plaintext);
+
+    auto cbc = client.encrypt_cbc(plaintext, server_keys.public_key);
+    BOOST_CHECK_EQUAL(
+        server.decrypt_cbc_in_place(cbc.data(), cbc.size(), client_pubkey),
+        plaintext);
+}
+
+/// Key used for AES-GCM between `keys` and the peer with `pubkey`, derived
+/// with libsodium as clients do
+static std::vector<uint8_t> libsodium_gcm_key(const key_pair_t& keys,
+                                              const std::string& pubkey) {
+    const auto pubkey_bin = x25519_key_from_hex(pubkey);
+    std::vector<uint8_t> shared(crypto_scalarmult_BYTES);
+    BOOST_REQUIRE_EQUAL(crypto_scalarmult(shared.data(),
+                                          keys.private_key.data(),
+                                          pubkey_bin.data()),
+                        0);
+
+    const std::string salt = "SISPOP";
+    std::vector<uint8_t> key(crypto_auth_hmacsha256_BYTES);
+    crypto_auth_hmacsha256_state state;
+    crypto_auth_hmacsha256_init(
+        &state, reinterpret_cast<const unsigned char*>(salt.data()),
+        salt.size());
+    crypto_auth_hmacsha256_update(&state, shared.data(), shared.size());
+    crypto_auth_hmacsha256_final(&state, key.data());
+    return key;
+}
+
+BOOST_AUTO_TEST_CASE(it_is_compatible_with_libsodium_aes_gcm) {
+
+    // libsodium only implements AES-GCM with hardware support, which it
+    // detects when initialised
+    BOOST_REQUIRE_GE(sodium_init(), 0);
+    if (!crypto_aead_aes256gcm_is_available()) {
+        BOOST_TEST_MESSAGE("AES-GCM is not available in libsodium, skipping");
+        return;
+    }
+
+    const auto server_keys = make_key_pair();
+    const auto client_keys = make_key_pair();
+    const ChannelEncryption<std::string> server(server_keys.private_key);
+    const auto key = libsodium_gcm_key(client_keys, server_keys.public_key);
+
+    for (const size_t size : {0, 1, 16, 1000}) {
+        const std::string plaintext(size, 'x');
+
+        // Encrypted by libsodium: nonce || ciphertext || tag
+        std::string sealed(crypto_aead_aes256gcm_NPUBBYTES + size +
+                               crypto_aead_aes256gcm_ABYTES,
+                           '\0');
+        auto nonce = reinterpret_cast<unsigned char*>(sealed.data());
+        randombytes_buf(nonce, crypto_aead_aes256gcm_NPUBBYTES);
+        unsigned long long sealed_size;
+        BOOST_REQUIRE_EQUAL(
+            crypto_aead_aes256gcm_encrypt(
+                nonce + crypto_aead_aes256gcm_NPUBBYTES, &sealed_size,
+                reinterpret_cast<const unsigned char*>(plaintext.data()),
+                plaintext.size(), nullptr, 0, nullptr, nonce, key.data()),
+            0);
+        BOOST_CHECK_EQUAL(server.decrypt_gcm(sealed, client_keys.public_key),
+                          plaintext);
+
+        // ...and the other way around
+        const auto ours = server.encrypt_gcm(plaintext, client_keys.public_key);
+        BOOST_REQUIRE_EQUAL(ours.size(), sealed.size());
+        std::string opened(size, '\0');
+        unsigned long long opened_size;
+        const auto ours_bytes =
+            reinterpret_cast<const unsigned char*>(ours.data());
+        BOOST_REQUIRE_EQUAL(
+            crypto_aead_aes256gcm_decrypt(
+                reinterpret_cast<unsigned char*>(opened.data()), &opened_size,
+                nullptr, ours_bytes + crypto_aead_aes256gcm_NPUBBYTES,
+                ours.size() - crypto_aead_aes256gcm_NPUBBYTES, nullptr, 0,
+                ours_bytes, key.data()),
+            0);
+        BOOST_CHECK_EQUAL(opened_size, size);
+        BOOST_CHECK_EQUAL(opened, plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_decrypts_a_known_aes_gcm_message) {
+
+    // Produced by libsodium's crypto_aead_aes256gcm_encrypt, with the key
+    // derived from these keys and a fixed nonce
+    key_pair_t server_keys;
+    key_pair_t client_keys;
+    for (uint8_t i = 0; i < 32; ++i) {
+        server_keys.private_key.push_back(i + 1);
+        client_keys.private_key.push_back(0xa0 + i);
+    }
+    client_keys.public_key =
+        "605a725d2a4adfeeb1a29e17edd621c1b7593ee8cdbc44ac6c4ab6e2f805d23c";
+    const std::string sealed_hex = "101112131415161718191a1b"
+                                   "ef52864ba868b5afa15cdb7a018fd18b0b57a34962"
+                                   "1990f7baf0c1b31b695048034dd338dc";
+
+    const ChannelEncryption<std::string> server(server_keys.private_key);
+    const auto sealed = sispopmq::from_hex(sealed_hex);
+    BOOST_CHECK_EQUAL(server.decrypt_gcm(sealed, client_keys.public_key),
+                      "{\"method\":\"retrieve\"}");
+
+    auto tampered = sealed;
+    tampered[crypto_aead_aes256gcm_NPUBBYTES] ^= 1;
+    BOOST_CHECK_THROW(server.decrypt_gcm(tampered, client_keys.public_key),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_bad_ciphertext) {
+
+    const auto server_keys = make_key_pair();
+    const auto client_keys = make_key_pair();
+    const ChannelEncryption<std::string> server(server_keys.private_key);
+    const ChannelEncryption<std::string> client(client_keys.private_key);
+    const auto client_pubkey = x25519_key_from_hex(client_keys.public_key);
+
+    auto gcm = client.encrypt_gcm("hello", server_keys.public_key);
+    gcm.back() ^= 1;
+    BOOST_CHECK_THROW(server.decrypt_gcm(gcm, client_keys.public_key),
+                      std::runtime_error);
+
+    std::string short_gcm(20, 'x');
+    BOOST_CHECK_THROW(server.decrypt_gcm_in_place(short_gcm.data(),
+                                                  short_gcm.size(),
+                                                  client_pubkey),
+                      std::runtime_error);
+
+    std::string short_cbc(8, 'x');
+    BOOST_CHECK_THROW(server.decrypt_cbc(short_cbc, client_keys.public_key),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_invalid_keys) {
+
+    const ChannelEncryption<std::string> server(make_key_pair().private_key);
+
+    // Failures are not cached, so they fail every time
+    for (int i = 0; i < 2; ++i) {
+        BOOST_CHECK_THROW(server.encrypt_gcm("hello", "not hex"),
+                          std::runtime_error);
+        BOOST_CHECK_THROW(server.encrypt_gcm("hello", "abcdef"),
+                          std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,85 @@
+#include "compression.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+using namespace oxen;
+
+BOOST_AUTO_TEST_SUITE(compression)
+
+static std::string make_payload(size_t size) {
+
+    std::string payload;
+    while (payload.size() < size) {
+        payload += "message number " + std::to_string(payload.size()) + ";";
+    }
+    payload.resize(size);
+    return payload;
+}
+
+BOOST_AUTO_TEST_CASE(it_compresses_and_decompresses) {
+
+    const auto payload = make_payload(100000);
+
+    std::string compressed;
+    BOOST_REQUIRE(compress(compression_t::zlib, payload, compressed));
+    BOOST_CHECK_LT(compressed.size(), payload.size() / 2);
+
+    std::string decompressed;
+    BOOST_REQUIRE(decompress(compression_t::zlib, compressed, decompressed));
+    BOOST_CHECK(decompressed == payload);
+}
+
+BOOST_AUTO_TEST_CASE(it_only_compresses_when_worth_it) {
+
+    std::string out;
+    BOOST_CHECK(!compress(compression_t::zlib,
+                          make_payload(COMPRESSION_MIN_SIZE - 1), out));
+    BOOST_CHECK(!compress(compression_t::none, make_payload(100000), out));
+
+    // Random data doesn't get any smaller
+    std::string random(10000, '\0');
+    uint32_t x = 12345;
+    for (auto& c : random) {
+        x = x * 1103515245 + 12345;
+        c = static_cast<char>(x >> 24);
+    }
+    BOOST_CHECK(!compress(compression_t::zlib, random, out));
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_corrupted_payloads) {
+
+    std::string compressed;
+    BOOST_REQUIRE(
+        compress(compression_t::zlib, make_payload(100000), compressed));
+
+    std::string out;
+    BOOST_CHECK(!decompress(compression_t::zlib, "", out));
+    BOOST_CHECK(!decompress(compression_t::none, compressed, out));
+
+    auto truncated = compressed.substr(0, compressed.size() / 2);
+    BOOST_CHECK(!decompress(compression_t::zlib, truncated, out));
+
+    // Claims to decompress to more than we are willing to allocate
+    auto oversized = compressed;
+    oversized[3] = '\x7f';
+    BOOST_CHECK(!decompress(compression_t::zlib, oversized, out));
+
+    // Claims a different size than it decompresses to
+    auto wrong_size = compressed;
+    wrong_size[0] = static_cast<char>(wrong_size[0] + 1);
+    BOOST_CHECK(!decompress(compression_t::zlib, wrong_size, out));
+}
+
+BOOST_AUTO_TEST_CASE(it_parses_codecs) {
+
+    compression_t codec;
+    BOOST_REQUIRE(parse_compression(
+        compression_to_string(PREFERRED_COMPRESSION), codec));
+    BOOST_CHECK(codec == PREFERRED_COMPRESSION);
+    BOOST_CHECK(!parse_compression("zstd", codec));
+    BOOST_CHECK(!parse_compression("", codec));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,10 @@
 #include "pow.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <boost/test/unit_test.hpp>
 #include <chrono>
+#include <random>
 
 using namespace std::chrono_literals;
 
@@ -135,4 +137,107 @@ BOOST_AUTO_TEST_CASE(it_checks_correct_difficulty) {
     BOOST_CHECK_EQUAL(get_valid_difficulty(timestamp, history3), 10);
 }
 
+BOOST_AUTO_TEST_CASE(it_verifies_the_same_as_check_pow) {
+    using namespace valid_pow;
+
+    std::string messageHash;
+    BOOST_REQUIRE(
+        checkPoW(nonce, timestamp, ttl, pubkey, data, messageHash, 10));
+
+    message_hash_t hash;
+    BOOST_CHECK(verify_pow({nonce, timestamp, ttl, pubkey, data, 10}, hash));
+    BOOST_CHECK_EQUAL(std::string(hash.data(), hash.size()), messageHash);
+
+    // Each field of the message (and the difficulty) is covered
+    BOOST_CHECK(!verify_pow({"AAAAAAABBCF=", timestamp, ttl, pubkey, data, 10},
+                            hash));
+    BOOST_CHECK(
+        !verify_pow({nonce, "1549252653", ttl, pubkey, data, 10}, hash));
+    BOOST_CHECK(
+        !verify_pow({nonce, timestamp, "345601", pubkey, data, 10}, hash));
+    BOOST_CHECK(!verify_pow({nonce, timestamp, ttl, pubkey, "", 10}, hash));
+    BOOST_CHECK(
+        !verify_pow({nonce, timestamp, ttl, pubkey, data, 100000}, hash));
+
+    // Malformed nonce and ttl
+    BOOST_CHECK(!verify_pow({"AAA*AAAaFio=", timestamp, ttl, pubkey, data, 10},
+                            hash));
+    BOOST_CHECK(!verify_pow({nonce, timestamp, "abc", pubkey, data, 10}, hash));
+    BOOST_CHECK(!verify_pow({nonce, timestamp, "0", pubkey, data, 10}, hash));
+}
+
+BOOST_AUTO_TEST_CASE(it_produces_the_same_hashes_as_check_pow) {
+
+    // Nonces of different lengths (and alphabets), valid or not
+    const std::vector<std::string> nonces{
+        "AAAAAAAaFio=", "AAAAAAAaFi", "-_-_-_-_", "",
+        std::string(200, 'z'), "YWJj", "YWJjZA==", "YWJjZGU="};
+    const std::string ttl = "86400000";
+
+    std::vector<pow_message_t> msgs;
+    std::vector<std::string> expected;
+    std::vector<char> expected_valid;
+    for (const auto& nonce : nonces) {
+        for (const int difficulty : {1, 10}) {
+            std::string messageHash;
+            expected_valid.push_back(checkPoW(nonce, valid_pow::timestamp, ttl,
+                                              valid_pow::pubkey,
+                                              valid_pow::data, messageHash,
+                                              difficulty));
+            expected.push_back(messageHash);
+            msgs.push_back({nonce, valid_pow::timestamp, ttl,
+                            valid_pow::pubkey, valid_pow::data, difficulty});
+        }
+    }
+
+    std::vector<message_hash_t> hashes;
+    std::vector<char> valid;
+    const size_t count = verify_batch(msgs, hashes, valid);
+
+    BOOST_REQUIRE_EQUAL(hashes.size(), msgs.size());
+    BOOST_CHECK_EQUAL(count, std::count(valid.begin(), valid.end(), 1));
+    for (size_t i = 0; i < msgs.size(); ++i) {
+        BOOST_CHECK_EQUAL(valid[i], expected_valid[i]);
+        BOOST_CHECK_EQUAL(std::string(hashes[i].data(), hashes[i].size()),
+                          expected[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_looks_up_the_same_difficulty_in_the_timeline) {
+
+    std::mt19937_64 rng(7);
+    const int64_t base = 1554859211000;
+    // Messages are checked against difficulties set this close to them
+    const std::chrono::milliseconds window = 15min;
+
+    for (int round = 0; round < 50; ++round) {
+
+        // Close enough together for their windows to overlap, sometimes
+        // with the same timestamp
+        std::vector<pow_difficulty_t> history(rng() % 8);
+        for (auto& entry : history) {
+            entry.timestamp =
+                std::chrono::milliseconds(base + (rng() % 20) * 5min / 1ms);
+            entry.difficulty = 1 + rng() % 100;
+        }
+        const pow_difficulty_timeline_t timeline(history);
+
+        std::vector<int64_t> timestamps{0, base};
+        for (const auto& entry : history) {
+            for (const auto offset : {0ms, 1ms, window, -window}) {
+                const int64_t t = (entry.timestamp + offset).count();
+                timestamps.insert(timestamps.end(), {t - 1, t, t + 1});
+            }
+        }
+        for (int i = 0; i < 100; ++i) {
+            timestamps.push_back(base - 20min / 1ms + rng() % (2 * 60 * 60000));
+        }
+
+        for (const auto t : timestamps) {
+            BOOST_CHECK_EQUAL(timeline.difficulty_at(t),
+                              get_valid_difficulty(std::to_string(t), history));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
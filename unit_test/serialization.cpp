@@ -3,6 +3,7 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
 #include <string>
 
 using namespace oxen;
@@ -53,4 +54,196 @@ BOOST_AUTO_TEST_CASE(it_serialises_in_batches) {
     const std::vector<std::string> batches = serialize_messages(inputs);
     BOOST_CHECK_EQUAL(batches.size(), 2);
 }
+
+BOOST_AUTO_TEST_CASE(it_deserializes_into_views_of_the_batch) {
+    const auto pub_key =
+        "054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e";
+    message_t msg{pub_key, "data", "hash", 3456000, 12345678, "nonce"};
+    const std::vector<std::string> batches = serialize_messages(
+        std::vector<message_t>{msg, msg});
+    BOOST_REQUIRE_EQUAL(batches.size(), 1);
+    const std::string& blob = batches[0];
+
+    message_batch_t batch;
+    BOOST_REQUIRE(deserialize_messages(blob, batch));
+    BOOST_REQUIRE_EQUAL(batch.messages.size(), 2);
+    for (const auto& m : batch.messages) {
+        BOOST_CHECK_EQUAL(m.pub_key, pub_key);
+        BOOST_CHECK_EQUAL(m.data, "data");
+        BOOST_CHECK_EQUAL(m.hash, "hash");
+        BOOST_CHECK_EQUAL(m.ttl, 3456000);
+        BOOST_CHECK_EQUAL(m.timestamp, 12345678);
+        BOOST_CHECK_EQUAL(m.nonce, "nonce");
+        // Nothing is copied out of the batch
+        BOOST_CHECK(m.data.data() >= blob.data() &&
+                    m.data.data() < blob.data() + blob.size());
+    }
+
+    message_batch_t truncated;
+    BOOST_CHECK(!deserialize_messages(
+        std::string_view(blob).substr(0, blob.size() - 1), truncated));
+}
+
+BOOST_AUTO_TEST_CASE(it_serializes_in_the_v2_format) {
+    const auto pub_key =
+        "054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e";
+    const std::string hash(128, 'a');
+    message_t msg{pub_key, "data", hash, 3456000, 12345678, "nonce"};
+    const std::vector<message_t> inputs{msg, msg};
+
+    const auto v1 = serialize_messages(inputs);
+    const auto v2 = serialize_messages(inputs, batch_format_t::v2);
+    BOOST_REQUIRE_EQUAL(v2.size(), 1);
+    BOOST_CHECK_LT(v2[0].size(), v1[0].size());
+
+    message_batch_t batch;
+    BOOST_REQUIRE(deserialize_messages(v2[0], batch));
+    BOOST_CHECK_EQUAL(batch.skipped, 0);
+    BOOST_REQUIRE_EQUAL(batch.messages.size(), 2);
+    for (const auto& m : batch.messages) {
+        BOOST_CHECK_EQUAL(m.pub_key, pub_key);
+        BOOST_CHECK_EQUAL(m.data, "data");
+        BOOST_CHECK_EQUAL(m.hash, hash);
+        BOOST_CHECK_EQUAL(m.ttl, 3456000);
+        BOOST_CHECK_EQUAL(m.timestamp, 12345678);
+        BOOST_CHECK_EQUAL(m.nonce, "nonce");
+    }
+
+    // Any corruption is caught by the checksum
+    std::string corrupted = v2[0];
+    corrupted[corrupted.size() / 2] ^= 1;
+    message_batch_t dropped;
+    BOOST_CHECK(!deserialize_messages(corrupted, dropped));
+}
+
+BOOST_AUTO_TEST_CASE(it_skips_bad_v2_records) {
+    const auto pub_key =
+        "054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e";
+    // The pubkey has to be of the right size
+    message_t bad{"05abcd", "data", "hash", 3456000, 12345678, "nonce"};
+    message_t good{pub_key, "data", "hash", 3456000, 12345678, "nonce"};
+
+    const auto batches = serialize_messages(std::vector<message_t>{bad, good},
+                                            batch_format_t::v2);
+    BOOST_REQUIRE_EQUAL(batches.size(), 1);
+
+    message_batch_t batch;
+    BOOST_REQUIRE(deserialize_messages(batches[0], batch));
+    BOOST_CHECK_EQUAL(batch.skipped, 1);
+    BOOST_REQUIRE_EQUAL(batch.messages.size(), 1);
+    BOOST_CHECK_EQUAL(batch.messages[0].pub_key, pub_key);
+}
+
+BOOST_AUTO_TEST_CASE(it_reuses_encoder_buffers) {
+    const auto pub_key =
+        "054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e";
+    message_t msg{pub_key, std::string(1000, 'x'), std::string(128, 'a'),
+                  3456000, 12345678, "nonce"};
+    const std::vector<message_t> inputs(1000, msg);
+
+    for (auto format : {batch_format_t::v1, batch_format_t::v2}) {
+        const auto expected = serialize_messages(inputs, format);
+        BOOST_REQUIRE_EQUAL(expected.size(), 3);
+
+        batch_buffer_pool_t pool;
+        std::vector<const char*> buffers;
+        {
+            batch_encoder_t encoder(format, pool);
+            encoder.encode(inputs);
+            BOOST_CHECK(encoder.batches() == expected);
+            const auto& counts = encoder.message_counts();
+            BOOST_REQUIRE_EQUAL(counts.size(), 3);
+            BOOST_CHECK_EQUAL(counts[0] + counts[1] + counts[2], 1000);
+            for (const auto& batch : encoder.batches()) {
+                // Each batch is written into a buffer of the right size
+                BOOST_CHECK_EQUAL(batch.capacity(), batch.size());
+                buffers.push_back(batch.data());
+            }
+        }
+        BOOST_REQUIRE_EQUAL(pool.size(), 3);
+
+        batch_encoder_t encoder(format, pool);
+        encoder.encode(inputs);
+        BOOST_CHECK(encoder.batches() == expected);
+        BOOST_CHECK_EQUAL(pool.size(), 0);
+        // The same buffers are used again
+        for (const auto& batch : encoder.batches()) {
+            BOOST_CHECK(std::find(buffers.begin(), buffers.end(),
+                                  batch.data()) != buffers.end());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_serializes_snapshot_chunks) {
+    const auto pub_key =
+        "054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e";
+    const uint64_t timestamp = 12345678;
+    const uint64_t ttl = 3456000;
+    const storage::Item item{"hash", pub_key, timestamp, ttl,
+                             timestamp + ttl, "nonce", "data"};
+    const std::vector<storage::Item> inputs{item, item};
+
+    const std::string blob = serialize_snapshot_chunk(inputs);
+
+    std::vector<storage::Item> items;
+    BOOST_REQUIRE(deserialize_snapshot_chunk(blob, items));
+    BOOST_REQUIRE_EQUAL(items.size(), 2);
+    for (const auto& res : items) {
+        BOOST_CHECK_EQUAL(res.hash, item.hash);
+        BOOST_CHECK_EQUAL(res.pub_key, item.pub_key);
+        BOOST_CHECK_EQUAL(res.timestamp, item.timestamp);
+        BOOST_CHECK_EQUAL(res.ttl, item.ttl);
+        BOOST_CHECK_EQUAL(res.expiration_timestamp, item.expiration_timestamp);
+        BOOST_CHECK_EQUAL(res.nonce, item.nonce);
+        BOOST_CHECK_EQUAL(res.data, item.data);
+    }
+
+    // Truncated chunks must be rejected
+    std::vector<storage::Item> truncated;
+    BOOST_CHECK(!deserialize_snapshot_chunk(blob.substr(0, blob.size() - 1),
+                                            truncated));
+}
+
+BOOST_AUTO_TEST_CASE(it_serializes_tombstones) {
+    const std::vector<tombstone_t> inputs{
+        {"owner_a", true, 12345678, {}, "key_a", "sig_a"},
+        {"owner_b", false, 0, {"h1", "h2"}, "key_b", "sig_b"}};
+
+    const std::string blob = serialize_tombstones(inputs);
+
+    std::vector<tombstone_t> tombstones;
+    BOOST_REQUIRE(deserialize_tombstones(blob, tombstones));
+    BOOST_REQUIRE_EQUAL(tombstones.size(), 2);
+    BOOST_CHECK_EQUAL(tombstones[0].pub_key, "owner_a");
+    BOOST_CHECK(tombstones[0].all);
+    BOOST_CHECK_EQUAL(tombstones[0].timestamp, 12345678);
+    BOOST_CHECK(tombstones[0].hashes.empty());
+    BOOST_CHECK_EQUAL(tombstones[0].pubkey_ed25519, "key_a");
+    BOOST_CHECK_EQUAL(tombstones[0].signature, "sig_a");
+    BOOST_CHECK_EQUAL(tombstones[1].pub_key, "owner_b");
+    BOOST_CHECK(!tombstones[1].all);
+    BOOST_REQUIRE_EQUAL(tombstones[1].hashes.size(), 2);
+    BOOST_CHECK_EQUAL(tombstones[1].hashes[1], "h2");
+    BOOST_CHECK_EQUAL(tombstones[1].signature, "sig_b");
+
+    // What the owners signed
+    BOOST_CHECK_EQUAL(tombstone_signed_data(inputs[0]), "delete_all12345678");
+    BOOST_CHECK_EQUAL(tombstone_signed_data(inputs[1]), "delete0h1h2");
+
+    std::vector<tombstone_t> truncated;
+    BOOST_CHECK(!deserialize_tombstones(blob.substr(0, blob.size() - 1),
+                                        truncated));
+}
+BOOST_AUTO_TEST_CASE(it_serializes_hashes) {
+    const std::vector<std::string> hashes{"hash1", "", std::string(128, 'a')};
+
+    std::vector<std::string> res;
+    BOOST_REQUIRE(deserialize_hashes(serialize_hashes(hashes), res));
+    BOOST_CHECK(res == hashes);
+
+    res.clear();
+    const auto blob = serialize_hashes(hashes);
+    BOOST_CHECK(!deserialize_hashes(blob.substr(0, blob.size() - 1), res));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+#include "sha512_multi.hpp"
+
+#include <openssl/sha.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(sha512_multi_test)
+
+static const sha512_impl_t ALL_IMPLS[] = {
+    sha512_impl_t::scalar, sha512_impl_t::avx2, sha512_impl_t::avx512};
+
+static sha512_digest_t openssl_sha512(const std::string& data) {
+    sha512_digest_t digest;
+    SHA512(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+           digest.data());
+    return digest;
+}
+
+static std::string random_string(std::mt19937_64& rng, size_t size) {
+    std::string str(size, '\0');
+    for (auto& c : str)
+        c = static_cast<char>(rng());
+    return str;
+}
+
+BOOST_AUTO_TEST_CASE(it_hashes_the_same_as_openssl) {
+
+    std::mt19937_64 rng(3);
+
+    // Sizes around the block and padding boundaries, and a few random ones
+    std::vector<size_t> sizes;
+    for (size_t size = 0; size <= 300; ++size)
+        sizes.push_back(size);
+    for (int i = 0; i < 50; ++i)
+        sizes.push_back(rng() % 5000);
+
+    std::vector<std::string> data;
+    for (const auto size : sizes)
+        data.push_back(random_string(rng, size));
+
+    // Split into parts at random points (leaving some of them empty)
+    std::vector<sha512_message_t> msgs(data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        const std::string_view str = data[i];
+        size_t cuts[SHA512_MAX_PARTS - 1];
+        for (auto& cut : cuts)
+            cut = str.empty() ? 0 : rng() % (str.size() + 1);
+        std::sort(std::begin(cuts), std::end(cuts));
+        size_t start = 0;
+        for (size_t p = 0; p + 1 < SHA512_MAX_PARTS; ++p) {
+            msgs[i].parts[p] = str.substr(start, cuts[p] - start);
+            start = cuts[p];
+        }
+        msgs[i].parts[SHA512_MAX_PARTS - 1] = str.substr(start);
+    }
+
+    for (const auto impl : ALL_IMPLS) {
+        if (!sha512_impl_supported(impl)) {
+            BOOST_TEST_MESSAGE("Skipping an implementation unsupported here");
+            continue;
+        }
+
+        // All at once, and with fewer messages than there are lanes
+        for (const size_t count : {msgs.size(), size_t{3}, size_t{0}}) {
+            const std::vector<sha512_message_t> subset(msgs.begin(),
+                                                       msgs.begin() + count);
+            std::vector<sha512_digest_t> digests;
+            sha512_multi(subset, digests, impl);
+
+            BOOST_REQUIRE_EQUAL(digests.size(), count);
+            for (size_t i = 0; i < count; ++i) {
+                BOOST_CHECK(digests[i] == openssl_sha512(data[i]));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_picks_a_supported_implementation) {
+    BOOST_CHECK(sha512_impl_supported(sha512_best_impl()));
+    BOOST_CHECK(sha512_impl_supported(sha512_impl_t::scalar));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,7 +2,9 @@
 
 #include <sispopmq/base32z.h>
 #include <sispopmq/base64.h>
+#include <sispopmq/hex.h>
 #include <boost/test/unit_test.hpp>
+#include <sodium.h>
 
 #include <vector>
 
@@ -97,4 +99,86 @@ BOOST_AUTO_TEST_CASE(it_rejects_wrong_signature) {
     BOOST_CHECK(!verified);
 }
 
+/// Keys of a client, which stores its messages under `owner`
+struct client_keys_t {
+    std::array<uint8_t, crypto_sign_SECRETKEYBYTES> secret_key;
+    std::string pubkey_ed25519;
+    std::string owner;
+};
+
+static client_keys_t make_client_keys() {
+    client_keys_t keys;
+    oxen::public_key_t ed25519;
+    crypto_sign_keypair(ed25519.data(), keys.secret_key.data());
+    keys.pubkey_ed25519 = sispopmq::to_hex(ed25519.begin(), ed25519.end());
+
+    oxen::public_key_t x25519;
+    crypto_sign_ed25519_pk_to_curve25519(x25519.data(), ed25519.data());
+    keys.owner = "05" + sispopmq::to_hex(x25519.begin(), x25519.end());
+    return keys;
+}
+
+static std::string sign(const client_keys_t& keys, const std::string& data) {
+    std::string sig(crypto_sign_BYTES, '\0');
+    crypto_sign_detached(reinterpret_cast<unsigned char*>(sig.data()),
+                         nullptr,
+                         reinterpret_cast<const unsigned char*>(data.data()),
+                         data.size(), keys.secret_key.data());
+    return sispopmq::to_base64(sig);
+}
+
+BOOST_AUTO_TEST_CASE(it_accepts_requests_signed_by_the_owner) {
+    using namespace oxen;
+
+    const auto keys = make_client_keys();
+    const std::string data = "delete1600000000000hash1hash2";
+
+    BOOST_CHECK(check_owner_signature(keys.owner, keys.pubkey_ed25519,
+                                      sign(keys, data),
+                                      data) == owner_signature_t::OK);
+    // Without the network prefix
+    BOOST_CHECK(check_owner_signature(keys.owner.substr(2),
+                                      keys.pubkey_ed25519, sign(keys, data),
+                                      data) == owner_signature_t::OK);
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_bad_owner_signatures) {
+    using namespace oxen;
+
+    const auto keys = make_client_keys();
+    const std::string data = "delete1600000000000hash1hash2";
+
+    // Signature of something else
+    BOOST_CHECK(check_owner_signature(keys.owner, keys.pubkey_ed25519,
+                                      sign(keys, "delete1600000000000hash1"),
+                                      data) ==
+                owner_signature_t::INVALID_SIGNATURE);
+
+    // Not a signature at all
+    BOOST_CHECK(check_owner_signature(keys.owner, keys.pubkey_ed25519,
+                                      "bm90IGEgc2lnbmF0dXJl", data) ==
+                owner_signature_t::INVALID_SIGNATURE);
+
+    BOOST_CHECK(check_owner_signature(keys.owner, "abcd", sign(keys, data),
+                                      data) == owner_signature_t::INVALID_KEY);
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_keys_that_dont_own_the_messages) {
+    using namespace oxen;
+
+    const auto owner = make_client_keys();
+    const auto other = make_client_keys();
+    const std::string data = "delete_all1600000000000";
+
+    // Validly signed, but by someone else
+    BOOST_CHECK(check_owner_signature(owner.owner, other.pubkey_ed25519,
+                                      sign(other, data),
+                                      data) == owner_signature_t::NOT_OWNER);
+
+    // The owner's key with someone else's signature
+    BOOST_CHECK(check_owner_signature(owner.owner, owner.pubkey_ed25519,
+                                      sign(other, data), data) ==
+                owner_signature_t::INVALID_SIGNATURE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,8 @@
 #include "Database.hpp"
 #include "utils.hpp"
 
+#include "sqlite3.h"
+
 #include <chrono>
 #include <filesystem>
 #include <iostream>
@@ -10,6 +12,11 @@
 #include <boost/test/unit_test.hpp>
 
 using oxen::storage::Item;
+using oxen::storage::ItemView;
+using oxen::storage::OutboxItem;
+using oxen::storage::OutboxKind;
+using oxen::storage::OutboxLag;
+using oxen::storage::OutboxResult;
 
 using namespace oxen;
 
@@ -212,6 +219,44 @@ BOOST_AUTO_TEST_CASE(it_removes_expired_entries) {
     t.join();
 }
 
+BOOST_AUTO_TEST_CASE(it_removes_expired_backlog_without_blocking) {
+    StorageRAIIFixture fixture;
+
+    const auto pubkey = "mypubkey";
+    const uint64_t timestamp = util::get_time_ms() - 100000;
+
+    const size_t num_expired = 12000;
+    {
+        // Left behind by a previous run of the node, whose io context never
+        // got to clean them up
+        boost::asio::io_context ioc;
+        Database storage(ioc, ".");
+
+        std::vector<Item> items;
+        for (size_t i = 0; i < num_expired; ++i) {
+            items.push_back({std::to_string(i), pubkey, timestamp, 1000,
+                             timestamp + 1000, "nonce", "bytesasstring"});
+        }
+        items.push_back({"live", pubkey, timestamp, 1000000,
+                         timestamp + 1000000, "nonce", "bytesasstring"});
+        BOOST_REQUIRE(storage.bulk_store(items));
+    }
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    // Opening the database with a backlog must not clean it up synchronously
+    uint64_t count;
+    BOOST_CHECK(storage.get_message_count(count));
+    BOOST_CHECK_EQUAL(count, num_expired + 1);
+
+    // The backlog is removed in several batches from the io context
+    ioc.run_for(1s);
+
+    BOOST_CHECK(storage.get_message_count(count));
+    BOOST_CHECK_EQUAL(count, 1);
+}
+
 BOOST_AUTO_TEST_CASE(it_stores_data_in_bulk) {
     StorageRAIIFixture fixture;
 
@@ -283,6 +328,62 @@ BOOST_AUTO_TEST_CASE(it_stores_data_in_bulk_even_when_overlaps) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(it_counts_new_items_in_bulk) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    const uint64_t now = util::get_time_ms();
+    BOOST_REQUIRE(storage.store("0", "owner", "data", 100000, now, "nonce"));
+
+    std::vector<ItemView> items;
+    for (const auto hash : {"0", "1", "2"}) {
+        items.push_back(
+            {hash, "owner", now, 100000, now + 100000, "nonce", "data"});
+    }
+
+    uint64_t stored;
+    BOOST_REQUIRE(storage.bulk_store(items, stored));
+    BOOST_CHECK_EQUAL(stored, 2);
+
+    BOOST_REQUIRE(storage.bulk_store(items, stored));
+    BOOST_CHECK_EQUAL(stored, 0);
+}
+
+BOOST_AUTO_TEST_CASE(it_stores_large_batches_in_order) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    const uint64_t now = util::get_time_ms();
+    BOOST_REQUIRE(storage.store("hash100", "owner", "data", 100000, now,
+                                "nonce"));
+
+    // More than a single insert statement takes
+    std::vector<std::string> hashes;
+    for (int i = 0; i < 250; i++) {
+        hashes.push_back("hash" + std::to_string(i));
+    }
+    std::vector<ItemView> items;
+    for (const auto& hash : hashes) {
+        items.push_back(
+            {hash, "owner", now, 100000, now + 100000, "nonce", "data"});
+    }
+
+    uint64_t stored;
+    BOOST_REQUIRE(storage.bulk_store(items, stored));
+    BOOST_CHECK_EQUAL(stored, 249);
+
+    std::vector<Item> retrieved;
+    BOOST_REQUIRE(storage.retrieve("owner", retrieved, ""));
+    BOOST_REQUIRE_EQUAL(retrieved.size(), 250);
+    BOOST_CHECK_EQUAL(retrieved[0].hash, "hash100");
+    BOOST_CHECK_EQUAL(retrieved[1].hash, "hash0");
+    BOOST_CHECK_EQUAL(retrieved[249].hash, "hash249");
+}
+
 BOOST_AUTO_TEST_CASE(bulk_performance_check) {
     const auto pubkey = "mypubkey";
     const auto bytes = "bytesasstring";
@@ -379,4 +480,699 @@ BOOST_AUTO_TEST_CASE(it_checks_the_retrieve_limit_works) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(it_retrieves_ranges_in_storage_order) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    uint64_t position;
+    BOOST_REQUIRE(storage.get_last_position(position));
+    BOOST_CHECK_EQUAL(position, 0);
+
+    const size_t num_entries = 50;
+    for (size_t i = 0; i < num_entries; i++) {
+        const auto hash = std::string("hash") + std::to_string(i);
+        storage.store(hash, "mypubkey", "0123456789", 100000,
+                      util::get_time_ms(), "nonce");
+    }
+
+    uint64_t up_to;
+    BOOST_REQUIRE(storage.get_last_position(up_to));
+
+    // Stored after the upper bound was taken, must not be returned
+    storage.store("late", "mypubkey", "0123456789", 100000,
+                  util::get_time_ms(), "nonce");
+
+    std::vector<Item> items;
+    uint64_t last = 0;
+    size_t pages = 0;
+    while (last < up_to) {
+        std::vector<Item> page;
+        // 10 bytes per message, so each page holds 20 messages
+        BOOST_REQUIRE(storage.retrieve_range(last, up_to, 200, page, last));
+        BOOST_REQUIRE(!page.empty());
+        items.insert(items.end(), page.begin(), page.end());
+        pages++;
+    }
+
+    BOOST_CHECK_EQUAL(pages, 3);
+    BOOST_REQUIRE_EQUAL(items.size(), num_entries);
+    for (size_t i = 0; i < num_entries; i++) {
+        BOOST_CHECK_EQUAL(items[i].hash, std::string("hash") + std::to_string(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_converts_between_table_layouts) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    db_options_t clustered;
+    clustered.clustered_by_owner = true;
+    clustered.convert_layout = true;
+    db_options_t unclustered;
+    unclustered.convert_layout = true;
+
+    const auto check_order = [](Database& storage) {
+        for (const auto owner : {"owner0", "owner1"}) {
+            std::vector<Item> items;
+            BOOST_REQUIRE(storage.retrieve(owner, items, ""));
+            BOOST_REQUIRE_EQUAL(items.size(), 10);
+            for (size_t i = 0; i < items.size(); i++) {
+                BOOST_CHECK_EQUAL(items[i].hash, owner + std::to_string(i));
+            }
+
+            std::vector<Item> after;
+            BOOST_REQUIRE(storage.retrieve(owner, after, items[6].hash));
+            BOOST_REQUIRE_EQUAL(after.size(), 3);
+            BOOST_CHECK_EQUAL(after[0].hash, items[7].hash);
+        }
+    };
+
+    uint64_t last_position;
+    {
+        Database storage(ioc, ".");
+        // Interleave the owners so that their messages are not adjacent
+        for (size_t i = 0; i < 10; i++) {
+            for (const std::string owner : {"owner0", "owner1"}) {
+                storage.store(owner + std::to_string(i), owner, "data", 100000,
+                              util::get_time_ms(), "nonce");
+            }
+        }
+        BOOST_REQUIRE(storage.get_last_position(last_position));
+    }
+
+    {
+        Database storage(ioc, ".", clustered);
+        check_order(storage);
+
+        uint64_t position;
+        BOOST_REQUIRE(storage.get_last_position(position));
+        BOOST_CHECK_GE(position, last_position);
+
+        // New messages continue after the converted ones
+        BOOST_REQUIRE(storage.store("late", "owner0", "data", 100000,
+                                    util::get_time_ms(), "nonce"));
+        BOOST_REQUIRE(storage.get_last_position(position));
+        BOOST_CHECK_GT(position, last_position);
+
+        std::vector<Item> items;
+        uint64_t last;
+        BOOST_REQUIRE(storage.retrieve_range(last_position, position, 1000,
+                                             items, last));
+        BOOST_REQUIRE_EQUAL(items.size(), 1);
+        BOOST_CHECK_EQUAL(items[0].hash, "late");
+    }
+
+    {
+        // ...and back
+        Database storage(ioc, ".", unclustered);
+        uint64_t count;
+        BOOST_REQUIRE(storage.get_message_count(count));
+        BOOST_CHECK_EQUAL(count, 21);
+
+        Item item;
+        BOOST_REQUIRE(storage.retrieve_by_hash("late", item));
+        BOOST_CHECK_EQUAL(item.pub_key, "owner0");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_keeps_the_existing_layout_unless_asked_to_convert) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    db_options_t clustered;
+    clustered.clustered_by_owner = true;
+    clustered.convert_layout = true;
+
+    const auto is_clustered = []() {
+        sqlite3* db;
+        BOOST_REQUIRE_EQUAL(sqlite3_open("storage.db", &db), SQLITE_OK);
+        sqlite3_stmt* stmt;
+        BOOST_REQUIRE_EQUAL(
+            sqlite3_prepare_v2(db,
+                               "SELECT sql FROM sqlite_master WHERE type = "
+                               "'table' AND name = 'Data';",
+                               -1, &stmt, nullptr),
+            SQLITE_OK);
+        BOOST_REQUIRE_EQUAL(sqlite3_step(stmt), SQLITE_ROW);
+        const std::string sql(
+            reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return sql.find("WITHOUT ROWID") != std::string::npos;
+    };
+
+    {
+        Database storage(ioc, ".", clustered);
+        BOOST_REQUIRE(storage.store("hash", "owner", "data", 100000,
+                                    util::get_time_ms(), "nonce"));
+    }
+    BOOST_REQUIRE(is_clustered());
+
+    // Opened without asking for the conversion: still clustered, and usable
+    {
+        Database storage(ioc, ".");
+        BOOST_REQUIRE(storage.store("hash2", "owner", "data", 100000,
+                                    util::get_time_ms(), "nonce"));
+        std::vector<Item> items;
+        BOOST_REQUIRE(storage.retrieve("owner", items, ""));
+        BOOST_CHECK_EQUAL(items.size(), 2);
+    }
+    BOOST_CHECK(is_clustered());
+}
+
+BOOST_AUTO_TEST_CASE(it_warms_up_and_counts_cache_hits) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+
+    {
+        Database storage(ioc, ".");
+        for (size_t i = 0; i < 3000; i++) {
+            storage.store("hash" + std::to_string(i),
+                          "owner" + std::to_string(i % 7), "data", 100000,
+                          util::get_time_ms(), "nonce");
+        }
+    }
+
+    db_options_t options;
+    options.mmap_size = 16 * 1024 * 1024;
+    options.cache_size_kb = 4096;
+    options.warmup = true;
+    Database storage(ioc, ".", options);
+
+    bool done = false;
+    uint64_t entries = 0;
+    for (int i = 0; i < 1000 && !done; i++) {
+        std::this_thread::sleep_for(10ms);
+        entries = storage.get_warmup_progress(done);
+    }
+    BOOST_REQUIRE(done);
+    // Every entry of both the owner and the hash index has been read
+    BOOST_CHECK_EQUAL(entries, 2 * 3000);
+
+    uint64_t hits, misses;
+    BOOST_REQUIRE(storage.get_cache_stats(hits, misses));
+
+    std::vector<Item> items;
+    BOOST_REQUIRE(storage.retrieve("owner3", items, ""));
+    BOOST_CHECK(!items.empty());
+
+    uint64_t new_hits, new_misses;
+    BOOST_REQUIRE(storage.get_cache_stats(new_hits, new_misses));
+    BOOST_CHECK_GT(new_hits + new_misses, hits + misses);
+
+    // The pages of that owner are now cached, so the same lookup only hits
+    items.clear();
+    BOOST_REQUIRE(storage.retrieve("owner3", items, ""));
+    BOOST_REQUIRE(storage.get_cache_stats(hits, misses));
+    BOOST_CHECK_GT(hits, new_hits);
+    BOOST_CHECK_EQUAL(misses, new_misses);
+}
+
+BOOST_AUTO_TEST_CASE(it_reports_its_memory_use) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    // The schema and prepared statements, at least
+    uint64_t initial;
+    BOOST_REQUIRE(storage.get_memory_used(initial));
+    BOOST_CHECK_GT(initial, 0);
+
+    const uint64_t now = util::get_time_ms();
+    for (size_t i = 0; i < 1000; i++) {
+        storage.store("hash" + std::to_string(i), "owner",
+                      std::string(500, 'x'), 100000, now, "nonce");
+    }
+    std::vector<Item> items;
+    BOOST_REQUIRE(storage.retrieve("owner", items, ""));
+
+    // The pages that were written and read are cached
+    uint64_t used;
+    BOOST_REQUIRE(storage.get_memory_used(used));
+    BOOST_CHECK_GT(used, initial);
+}
+
+BOOST_AUTO_TEST_CASE(it_deletes_messages_of_an_owner) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    const uint64_t now = util::get_time_ms();
+    for (size_t i = 0; i < 10; i++) {
+        storage.store("a" + std::to_string(i), "owner_a", "data", 100000,
+                      now - 1000 + i * 100, "nonce");
+        storage.store("b" + std::to_string(i), "owner_b", "data", 100000,
+                      now - 1000 + i * 100, "nonce");
+    }
+
+    uint64_t deleted;
+    // Messages of other owners are not affected
+    BOOST_REQUIRE(storage.delete_by_hash("owner_a", {"a0", "a1", "b0"},
+                                         "request", deleted));
+    BOOST_CHECK_EQUAL(deleted, 2);
+
+    // Messages stored after the deletion was requested are kept
+    BOOST_REQUIRE(storage.delete_all("owner_a", now - 500, "request", deleted));
+    BOOST_CHECK_EQUAL(deleted, 4);
+
+    std::vector<Item> items;
+    BOOST_REQUIRE(storage.retrieve("owner_a", items, ""));
+    BOOST_REQUIRE_EQUAL(items.size(), 4);
+    BOOST_CHECK_EQUAL(items[0].hash, "a6");
+
+    items.clear();
+    BOOST_REQUIRE(storage.retrieve("owner_b", items, ""));
+    BOOST_CHECK_EQUAL(items.size(), 10);
+}
+
+BOOST_AUTO_TEST_CASE(it_does_not_store_deleted_messages_again) {
+    StorageRAIIFixture fixture;
+
+    const uint64_t now = util::get_time_ms();
+    std::vector<Item> copies;
+    for (size_t i = 0; i < 10; i++) {
+        copies.push_back({"a" + std::to_string(i), "owner_a",
+                          now - 1000 + i * 100, 100000,
+                          now - 1000 + i * 100 + 100000, "nonce", "data"});
+    }
+    // Owned by someone else, with the hash of a deleted message
+    copies.push_back({"b0", "owner_b", now, 100000, now + 100000, "nonce",
+                      "data"});
+
+    {
+        boost::asio::io_context ioc;
+        Database storage(ioc, ".");
+
+        uint64_t deleted;
+        // Including one we don't have yet
+        BOOST_REQUIRE(storage.delete_by_hash("owner_a", {"a8", "a9"},
+                                             "request", deleted));
+        BOOST_CHECK_EQUAL(deleted, 0);
+        BOOST_REQUIRE(
+            storage.delete_all("owner_a", now - 500, "request", deleted));
+        BOOST_REQUIRE(
+            storage.delete_by_hash("owner_b", {"a0"}, "request", deleted));
+    }
+
+    // Tombstones are kept across restarts
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    bool deleted;
+    std::string request;
+    BOOST_REQUIRE(
+        storage.is_deleted("owner_a", "a0", now - 1000, deleted, &request));
+    BOOST_CHECK(deleted);
+    // Kept to prove the deletion to other nodes
+    BOOST_CHECK_EQUAL(request, "request");
+    BOOST_REQUIRE(storage.is_deleted("owner_a", "a7", now - 300, deleted));
+    BOOST_CHECK(!deleted);
+
+    // As relayed (or fetched) by a node that missed the deletions
+    BOOST_REQUIRE(storage.bulk_store(copies));
+
+    std::vector<Item> items;
+    BOOST_REQUIRE(storage.retrieve("owner_a", items, ""));
+    BOOST_REQUIRE_EQUAL(items.size(), 2);
+    BOOST_CHECK_EQUAL(items[0].hash, "a6");
+    BOOST_CHECK_EQUAL(items[1].hash, "a7");
+
+    items.clear();
+    BOOST_REQUIRE(storage.retrieve("owner_b", items, ""));
+    BOOST_CHECK_EQUAL(items.size(), 1);
+
+    // An earlier deletion of everything doesn't undo a later one
+    uint64_t count;
+    BOOST_REQUIRE(storage.delete_all("owner_a", now - 2000, "request", count));
+    BOOST_REQUIRE(storage.is_deleted("owner_a", "a5", now - 500, deleted));
+    BOOST_CHECK(deleted);
+}
+
+BOOST_AUTO_TEST_CASE(it_reads_from_a_wal_database_in_read_only_mode) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+
+    {
+        // Read only mode requires the writer to use WAL
+        Database storage(ioc, ".");
+    }
+    db_options_t read_only;
+    read_only.read_only = true;
+    BOOST_CHECK_THROW(Database(ioc, ".", read_only), std::runtime_error);
+
+    db_options_t wal;
+    wal.wal = true;
+    Database storage(ioc, ".", wal);
+    Database reader(ioc, ".", read_only);
+
+    storage.store("hash", "owner", "data", 100000, util::get_time_ms(),
+                  "nonce");
+
+    // Messages stored by the writer are visible to the reader
+    std::vector<Item> items;
+    BOOST_REQUIRE(reader.retrieve("owner", items, ""));
+    BOOST_REQUIRE_EQUAL(items.size(), 1);
+    BOOST_CHECK_EQUAL(items[0].data, "data");
+
+    BOOST_CHECK(!reader.store("hash2", "owner", "data", 100000,
+                              util::get_time_ms(), "nonce"));
+}
+
+BOOST_AUTO_TEST_CASE(it_keeps_outbox_batches_until_acknowledged) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    const uint64_t now = util::get_time_ms();
+
+    uint64_t id;
+    {
+        Database storage(ioc, ".");
+        BOOST_REQUIRE(storage.outbox_add("batch", 3, now + 100000,
+                                         {"peer_a", "peer_b"}, id));
+
+        // Being sent, so not due
+        std::vector<OutboxItem> items;
+        BOOST_REQUIRE(storage.outbox_take_due(now, 10, items));
+        BOOST_CHECK(items.empty());
+
+        BOOST_REQUIRE(storage.outbox_defer(id, "peer_a", 1, now + 1000));
+        BOOST_REQUIRE(storage.outbox_take_due(now, 10, items));
+        BOOST_CHECK(items.empty());
+
+        BOOST_REQUIRE(storage.outbox_take_due(now + 1000, 10, items));
+        BOOST_REQUIRE_EQUAL(items.size(), 1);
+        BOOST_CHECK_EQUAL(items[0].batch_id, id);
+        BOOST_CHECK_EQUAL(items[0].peer, "peer_a");
+        BOOST_CHECK_EQUAL(items[0].attempts, 1);
+        BOOST_CHECK_EQUAL(items[0].messages, 3);
+        BOOST_CHECK_EQUAL(items[0].data, "batch");
+
+        // Taken entries are not returned again
+        items.clear();
+        BOOST_REQUIRE(storage.outbox_take_due(now + 1000, 10, items));
+        BOOST_CHECK(items.empty());
+
+        BOOST_REQUIRE(storage.outbox_ack(id, "peer_a"));
+
+        std::vector<OutboxLag> lag;
+        BOOST_REQUIRE(storage.outbox_get_lag(lag));
+        BOOST_REQUIRE_EQUAL(lag.size(), 1);
+        BOOST_CHECK_EQUAL(lag[0].peer, "peer_b");
+        BOOST_CHECK_EQUAL(lag[0].batches, 1);
+        BOOST_CHECK_EQUAL(lag[0].messages, 3);
+        BOOST_CHECK_GE(lag[0].oldest, now);
+    }
+
+    // Whatever was being sent is due after a restart
+    Database storage(ioc, ".");
+    std::vector<OutboxItem> items;
+    BOOST_REQUIRE(storage.outbox_take_due(now, 10, items));
+    BOOST_REQUIRE_EQUAL(items.size(), 1);
+    BOOST_CHECK_EQUAL(items[0].peer, "peer_b");
+    BOOST_CHECK_EQUAL(items[0].data, "batch");
+
+    BOOST_CHECK(items[0].kind == OutboxKind::MESSAGES);
+
+    // Expired batches are forgotten
+    BOOST_REQUIRE(storage.outbox_defer(id, "peer_b", 1, now));
+    BOOST_REQUIRE(storage.outbox_prune(now + 100000));
+    items.clear();
+    BOOST_REQUIRE(storage.outbox_take_due(now, 10, items));
+    BOOST_CHECK(items.empty());
+
+    // Deletions are relayed through the outbox too
+    BOOST_REQUIRE(storage.outbox_add("deletions", 0, now + 100000, {"peer_a"},
+                                     id, OutboxKind::TOMBSTONES));
+    BOOST_REQUIRE(storage.outbox_defer(id, "peer_a", 1, now));
+    BOOST_REQUIRE(storage.outbox_take_due(now, 10, items));
+    BOOST_REQUIRE_EQUAL(items.size(), 1);
+    BOOST_CHECK(items[0].kind == OutboxKind::TOMBSTONES);
+    BOOST_CHECK_EQUAL(items[0].data, "deletions");
+}
+
+BOOST_AUTO_TEST_CASE(it_trims_the_outbox_of_peers_that_fall_behind) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+    const uint64_t now = util::get_time_ms();
+
+    // peer_a has acknowledged all but the last one
+    std::vector<uint64_t> ids(4);
+    for (auto& id : ids) {
+        BOOST_REQUIRE(storage.outbox_add(std::string(100, 'x'), 1,
+                                         now + 100000, {"peer_a", "peer_b"},
+                                         id));
+    }
+    std::vector<OutboxResult> results;
+    for (size_t i = 0; i + 1 < ids.size(); ++i) {
+        results.push_back({ids[i], "peer_a", true});
+    }
+    results.push_back({ids.back(), "peer_b", false, 1, now});
+    BOOST_REQUIRE(storage.outbox_record(results));
+
+    std::vector<OutboxItem> items;
+    BOOST_REQUIRE(storage.outbox_take_due(now, 10, items));
+    BOOST_REQUIRE_EQUAL(items.size(), 1);
+    BOOST_CHECK_EQUAL(items[0].peer, "peer_b");
+    BOOST_CHECK_EQUAL(items[0].attempts, 1);
+
+    // Only the most recent batches that fit are kept
+    uint64_t dropped;
+    BOOST_REQUIRE(storage.outbox_trim(0, 250, dropped));
+    BOOST_CHECK_EQUAL(dropped, 2);
+
+    std::vector<OutboxLag> lag;
+    BOOST_REQUIRE(storage.outbox_get_lag(lag));
+    BOOST_REQUIRE_EQUAL(lag.size(), 2);
+    for (const auto& entry : lag) {
+        BOOST_CHECK_EQUAL(entry.batches, entry.peer == "peer_a" ? 1 : 2);
+    }
+
+    // ...and none that are too old
+    BOOST_REQUIRE(
+        storage.outbox_trim(util::get_time_ms() + 1, 1000, dropped));
+    BOOST_CHECK_EQUAL(dropped, 3);
+    lag.clear();
+    BOOST_REQUIRE(storage.outbox_get_lag(lag));
+    BOOST_CHECK(lag.empty());
+}
+
+BOOST_AUTO_TEST_CASE(it_upgrades_an_outbox_from_an_older_version) {
+    StorageRAIIFixture fixture;
+
+    {
+        // As created before batches recorded their message count and age
+        sqlite3* db;
+        BOOST_REQUIRE_EQUAL(sqlite3_open("storage.db", &db), SQLITE_OK);
+        BOOST_REQUIRE_EQUAL(
+            sqlite3_exec(db,
+                         "CREATE TABLE `OutboxBatch` ("
+                         "    `Id` INTEGER PRIMARY KEY,"
+                         "    `Data` BLOB NOT NULL,"
+                         "    `TimeExpires` INTEGER NOT NULL"
+                         ");"
+                         "INSERT INTO `OutboxBatch` VALUES (1, 'old', "
+                         "9999999999999);",
+                         nullptr, nullptr, nullptr),
+            SQLITE_OK);
+        sqlite3_close(db);
+    }
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    const uint64_t now = util::get_time_ms();
+    uint64_t id;
+    BOOST_REQUIRE(storage.outbox_add("new", 3, now + 100000, {"peer"}, id));
+    BOOST_CHECK_NE(id, 1);
+
+    std::vector<OutboxLag> lag;
+    BOOST_REQUIRE(storage.outbox_get_lag(lag));
+    BOOST_REQUIRE_EQUAL(lag.size(), 1);
+    BOOST_CHECK_EQUAL(lag[0].messages, 3);
+    BOOST_CHECK_GE(lag[0].oldest, now);
+}
+
+BOOST_AUTO_TEST_CASE(it_lists_hashes_in_a_time_range) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    const uint64_t now = util::get_time_ms();
+    BOOST_REQUIRE(storage.store("hash3", "owner", "data", 100000, now - 1000,
+                                "nonce"));
+    BOOST_REQUIRE(storage.store("hash1", "owner", "data", 100000, now - 3000,
+                                "nonce"));
+    BOOST_REQUIRE(storage.store("hash2", "owner", "data", 100000, now - 2000,
+                                "nonce"));
+
+    std::vector<std::pair<std::string, uint64_t>> hashes;
+    const auto collect = [&](std::string_view hash, uint64_t timestamp) {
+        hashes.emplace_back(hash, timestamp);
+    };
+
+    BOOST_REQUIRE(storage.for_each_hash(now - 2500, now, now, collect));
+    BOOST_REQUIRE_EQUAL(hashes.size(), 2);
+    // In timestamp order, rather than the order they were stored in
+    BOOST_CHECK_EQUAL(hashes[0].first, "hash2");
+    BOOST_CHECK_EQUAL(hashes[0].second, now - 2000);
+    BOOST_CHECK_EQUAL(hashes[1].first, "hash3");
+
+    // Expired messages are left out
+    hashes.clear();
+    BOOST_REQUIRE(
+        storage.for_each_hash(0, now, now - 3000 + 100000, collect));
+    BOOST_REQUIRE_EQUAL(hashes.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(it_lists_hashes_spanning_hours_from_another_thread) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    Database storage(ioc, ".");
+
+    const uint64_t hour = 60 * 60 * 1000;
+    const uint64_t now = util::get_time_ms();
+    const uint64_t ttl = 24 * hour;
+    for (uint64_t i = 0; i < 5; ++i) {
+        BOOST_REQUIRE(storage.store("hash" + std::to_string(i), "owner",
+                                    "data", ttl, now - (5 - i) * hour,
+                                    "nonce"));
+    }
+
+    std::vector<std::string> hashes;
+    bool success = false;
+    std::thread scanner([&]() {
+        success = storage.for_each_hash(now - 10 * hour, now, now,
+                                        [&](std::string_view hash, uint64_t) {
+                                            hashes.emplace_back(hash);
+                                        });
+    });
+    scanner.join();
+
+    BOOST_REQUIRE(success);
+    BOOST_REQUIRE_EQUAL(hashes.size(), 5);
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        BOOST_CHECK_EQUAL(hashes[i], "hash" + std::to_string(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_reads_the_replication_log) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    const uint64_t now = util::get_time_ms();
+
+    {
+        Database storage(ioc, ".");
+
+        for (int i = 0; i < 3; ++i) {
+            BOOST_REQUIRE(storage.store("hash" + std::to_string(i), "owner",
+                                        "data", 100000, now, "nonce"));
+        }
+
+        std::vector<std::pair<std::string, std::string>> entries;
+        uint64_t last;
+        BOOST_REQUIRE(storage.get_hashes_after(0, 2, entries, last));
+        BOOST_REQUIRE_EQUAL(entries.size(), 2);
+        BOOST_CHECK_EQUAL(entries[0].first, "hash0");
+        BOOST_CHECK_EQUAL(entries[0].second, "owner");
+        BOOST_CHECK_EQUAL(entries[1].first, "hash1");
+
+        // Resumes after the last entry returned
+        entries.clear();
+        BOOST_REQUIRE(storage.get_hashes_after(last, 2, entries, last));
+        BOOST_REQUIRE_EQUAL(entries.size(), 1);
+        BOOST_CHECK_EQUAL(entries[0].first, "hash2");
+
+        uint64_t head;
+        BOOST_REQUIRE(storage.get_last_position(head));
+        BOOST_CHECK_EQUAL(last, head);
+
+        std::vector<std::string> missing;
+        BOOST_REQUIRE(
+            storage.get_missing_hashes({"hash0", "hash7", "hash2"}, missing));
+        BOOST_CHECK(missing == std::vector<std::string>{"hash7"});
+
+        // More hashes than fit in a single query
+        std::vector<std::string> many;
+        for (int i = 0; i < 1000; i++)
+            many.push_back("other" + std::to_string(i));
+        many.push_back("hash1");
+        missing.clear();
+        BOOST_REQUIRE(storage.get_missing_hashes(many, missing));
+        many.pop_back();
+        BOOST_CHECK(missing == many);
+
+        std::optional<uint64_t> cursor;
+        BOOST_REQUIRE(storage.get_log_cursor("peer", cursor));
+        BOOST_CHECK(!cursor);
+        BOOST_REQUIRE(storage.set_log_cursor("peer", last));
+    }
+
+    // Cursors are kept across restarts
+    Database storage(ioc, ".");
+    std::optional<uint64_t> cursor;
+    BOOST_REQUIRE(storage.get_log_cursor("peer", cursor));
+    BOOST_REQUIRE(cursor);
+    uint64_t head;
+    BOOST_REQUIRE(storage.get_last_position(head));
+    BOOST_CHECK_GE(head, *cursor);
+
+    std::vector<std::pair<std::string, std::string>> entries;
+    uint64_t last;
+    BOOST_REQUIRE(storage.get_hashes_after(*cursor, 10, entries, last));
+    BOOST_CHECK(entries.empty());
+}
+
+BOOST_AUTO_TEST_CASE(it_never_reuses_positions) {
+    StorageRAIIFixture fixture;
+
+    boost::asio::io_context ioc;
+    const uint64_t now = util::get_time_ms();
+
+    uint64_t head;
+    {
+        Database storage(ioc, ".");
+        for (int i = 0; i < 3; ++i) {
+            BOOST_REQUIRE(storage.store("hash" + std::to_string(i), "owner",
+                                        "data", 100000, now, "nonce"));
+        }
+        BOOST_REQUIRE(storage.get_last_position(head));
+
+        // Deleting the most recent message doesn't move the head back
+        uint64_t deleted;
+        BOOST_REQUIRE(
+            storage.delete_by_hash("owner", {"hash2"}, "request", deleted));
+        BOOST_REQUIRE_EQUAL(deleted, 1);
+        uint64_t position;
+        BOOST_REQUIRE(storage.get_last_position(position));
+        BOOST_CHECK_EQUAL(position, head);
+    }
+
+    // ...and neither does a restart
+    Database storage(ioc, ".");
+    uint64_t position;
+    BOOST_REQUIRE(storage.get_last_position(position));
+    BOOST_CHECK_GE(position, head);
+
+    BOOST_REQUIRE(
+        storage.bulk_store(std::vector<Item>{{"hash3", "owner", now, 100000,
+                                              now + 100000, "nonce", "data"}}));
+    std::vector<std::pair<std::string, std::string>> entries;
+    uint64_t last;
+    BOOST_REQUIRE(storage.get_hashes_after(head, 10, entries, last));
+    BOOST_REQUIRE_EQUAL(entries.size(), 1);
+    BOOST_CHECK_EQUAL(entries[0].first, "hash3");
+    BOOST_CHECK_GT(last, position);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
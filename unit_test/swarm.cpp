@@ -0,0 +1,96 @@
+#include "swarm.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace oxen;
+
+BOOST_AUTO_TEST_SUITE(swarm)
+
+/// Pubkey that maps to `value` in the swarm id space
+static user_pubkey_t pubkey_at(uint64_t value) {
+
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx",
+             static_cast<unsigned long long>(value));
+
+    bool success;
+    auto pk = user_pubkey_t::create("05" + std::string(buf) +
+                                        std::string(48, '0'),
+                                    success);
+    BOOST_REQUIRE(success);
+    return pk;
+}
+
+static std::vector<SwarmInfo> make_swarms(const std::vector<swarm_id_t>& ids) {
+
+    std::vector<SwarmInfo> swarms;
+    for (const auto id : ids) {
+        swarms.push_back(SwarmInfo{id, {}});
+    }
+    return swarms;
+}
+
+static void check_same_swarm(const std::vector<SwarmInfo>& swarms,
+                             const user_pubkey_t& pk) {
+
+    const swarm_lookup_t lookup(swarms);
+    const auto idx = lookup.find(pk);
+    BOOST_REQUIRE(idx);
+    BOOST_CHECK_EQUAL(swarms[*idx].swarm_id, get_swarm_by_pk(swarms, pk));
+}
+
+BOOST_AUTO_TEST_CASE(it_finds_the_same_swarms_as_a_scan) {
+
+    std::mt19937_64 rng(42);
+
+    for (int round = 0; round < 20; ++round) {
+
+        // Unsorted, as get_swarm_by_pk doesn't require them to be
+        std::vector<swarm_id_t> ids(1 + rng() % 50);
+        for (auto& id : ids) {
+            id = rng() % INVALID_SWARM_ID;
+        }
+        ids.push_back(INVALID_SWARM_ID);
+        const auto swarms = make_swarms(ids);
+
+        for (int i = 0; i < 1000; ++i) {
+            check_same_swarm(swarms, pubkey_at(rng()));
+        }
+        for (const auto id : ids) {
+            check_same_swarm(swarms, pubkey_at(id));
+            check_same_swarm(swarms, pubkey_at(id + 1));
+            check_same_swarm(swarms, pubkey_at(id - 1));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_breaks_ties_and_wraps_around_like_a_scan) {
+
+    // Equally close to both swarms
+    check_same_swarm(make_swarms({100, 200}), pubkey_at(150));
+    check_same_swarm(make_swarms({200, 100}), pubkey_at(150));
+
+    // Closer to a swarm at the other end of the id space
+    const swarm_id_t max_id = INVALID_SWARM_ID - 1;
+    const auto swarms = make_swarms({1000, max_id / 2, max_id - 1000});
+    check_same_swarm(swarms, pubkey_at(0));
+    check_same_swarm(swarms, pubkey_at(10));
+    check_same_swarm(swarms, pubkey_at(max_id - 10));
+    check_same_swarm(swarms, pubkey_at(INVALID_SWARM_ID));
+
+    const auto single = make_swarms({max_id / 3});
+    check_same_swarm(single, pubkey_at(0));
+    check_same_swarm(single, pubkey_at(max_id));
+}
+
+BOOST_AUTO_TEST_CASE(it_finds_no_swarm_without_valid_swarms) {
+
+    const swarm_lookup_t lookup(make_swarms({INVALID_SWARM_ID}));
+    BOOST_CHECK(!lookup.find(pubkey_at(0)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()